@@ -8,10 +8,102 @@
  * 3. 실행: ./basic_fs /tmp/fuse_mnt
  * 4. 테스트: echo "hello" > /tmp/fuse_mnt/test.txt
  * 5. 언마운트: fusermount3 -u /tmp/fuse_mnt
+ *
+ * 옵션:
+ *   -o slow_us=N   N 마이크로초 이상 걸린 요청을 slow log에 기록 (0이면 끔)
+ *   -o metrics_sock=PATH   OpenMetrics 텍스트를 unix socket으로 제공
+ *   -o heat_sample=N,heat_block=B,heat_halflife=S
+ *                  read/write N건 중 1건을 B바이트 구간 단위로 heat map에 기록,
+ *                  S초마다 절반으로 감쇠 (heat_sample=0이면 끔)
+ *   -o inline_max=B,inline_budget=B,inline_ttl_ms=MS
+ *                  B바이트 이하 파일의 속성+내용을 메모리에 보관해 open/read/release를
+ *                  백엔드 없이 처리 (budget=0이면 끔), MS마다 백엔드와 대조
+ *   -o prefetch_bw=MB,prefetch_max=KB
+ *                  순차 읽기와 "같이 열리는 파일"을 감지해 백엔드 데이터를
+ *                  미리 page cache로 읽어 둠 (초당 MB MiB 이내, prefetch_bw=0이면 끔)
+ *   -o max_write=B,read_ahead_kb=KB
+ *                  WRITE 요청 최대 크기(기본 1 MiB, max_pages 협상)와 마운트의 커널
+ *                  readahead 크기. READ 요청 크기는 readahead가 결정하므로 1 MiB READ를
+ *                  받으려면 read_ahead_kb=1024 (bdi 설정에는 root 권한 필요)
+ *   -o numa[,numa_node=N]
+ *                  워커 스레드와 메모리 할당을 백엔드 장치가 붙은(또는 N번)
+ *                  NUMA 노드에 고정
+ *   -o integrity=blake3,integrity_key=FILE[,integrity_block=B,integrity_threads=N]
+ *                  B바이트 블록마다 keyed BLAKE3 태그를 숨김 sidecar(.bft.이름)에
+ *                  두고 read마다 검증 (키: head -c 32 /dev/urandom > FILE)
+ *   -o integrity=crc32c[,integrity_paths=/logs=crc32c:/secure=blake3]
+ *                  변조가 아닌 bit-rot만 잡으면 되는 곳은 CRC32C (키 불필요),
+ *                  경로 접두어마다 방식을 다르게 지정 가능 (태그 방식이 경로와
+ *                  다른 파일은 열지 않음)
+ *   -o integrity_layout=interleaved[,integrity_group=N]
+ *                  태그를 sidecar 대신 데이터 파일 안, 블록 N개마다 뒤에 둠
+ *                  (이 마운트에서 만든 파일만, 검증 read가 pread 한 번)
+ *   -o integrity_adopt
+ *                  태그 없는 기존 파일을 처음 열 때 현재 내용으로 태그를 만듦
+ *   -o integrity_verify=MODE[,integrity_sample=N,integrity_scrub_bw=M]
+ *                  read 검증 방식: strict(매번), first-touch(열려 있는 동안 블록당
+ *                  한 번), sampled(블록 N개 중 1개), background(read에서는 안 하고
+ *                  백그라운드 scrubber가 M MiB/s로 훑음). 경로별로는
+ *                  integrity_paths=/logs=crc32c@sampled
+ *   -o integrity_key=NEW,integrity_key_version=V,integrity_old_key=OLD
+ *                  키 교체: 버전 V-1(OLD)의 태그도 받아들이며, 백그라운드에서
+ *                  integrity_scrub_bw 안에서 조금씩 새 키로 다시 계산 (재시작해도 이어감)
+ *   -o mirror=/b:/c
+ *                  DIR_PATH와 함께 /b, /c에도 같은 트리를 유지 (변경은 병렬로 모두에,
+ *                  read는 덜 바쁜 복제본에서). integrity와 함께 쓰면 검증에 실패한
+ *                  구간을 다른 복제본에서 고침. 처음에는 모든 루트의 내용이 같아야 함.
+ *                  실패한 복제본은 재시작해도 쓰지 않음 (루트마다 .bfmirror의 세대 번호)
+ *   -o mirror_hedge=P
+ *                  최근 read 지연의 P 백분위수(예: 95) 안에 끝나지 않은 read는 다른
+ *                  복제본에도 보내 먼저 끝난 쪽을 씀
+ *   -o mirror=/b:/c:/d:/e,mirror_ec=K[,mirror_ec_cell=B]
+ *                  복제 대신 erasure coding: 루트 n개에 데이터 조각 K개와 Reed-Solomon
+ *                  parity n-K개를 B바이트 cell 단위 stripe로 나눠 둠 (아무 K개로 복원,
+ *                  부분 stripe write는 log에 모았다가 반영)
+ *   -o s3=http://host:port/bucket[,s3_key=FILE,s3_threads=N,s3_part=B,s3_readahead=B]
+ *                  DIR_PATH 대신 S3 호환 bucket: stat은 HEAD(s3_attr_ttl_ms 동안 캐시),
+ *                  목록은 LIST, read는 N개 병렬 ranged GET + readahead, write는 B바이트
+ *                  part의 multipart upload (close 때 완료). 키 파일은 "ID:SECRET"
+ *   -o remote_serve=unix:/path (또는 tcp:host:port)
+ *                  마운트하지 않고 그 주소에서 DIR_PATH를 제공하는 백엔드 데몬으로 동작
+ *   -o remote=unix:/path[,remote_conns=N]
+ *                  DIR_PATH 대신 그런 데몬: 백엔드 연산마다 메시지 하나, 연결마다 여러
+ *                  요청을 응답을 기다리지 않고 이어 보내며 몰린 요청은 한 번에 씀
+ *   -o coherence=unix:/a,coherence_peers=unix:/b+unix:/c[,coherence_ttl_ms=MS]
+ *                  같은 백엔드를 쓰는 다른 데몬(각자 자기 주소를 coherence로)과 변경을
+ *                  서로 알려 캐시를 비움. 모두 연결된 동안은 캐시를 MS 동안 믿음
+ *   -o peer_cache=unix:/a,peer_cache_peers=unix:/a+unix:/b[,peer_cache_budget=B]
+ *                  같은 백엔드를 읽는 데몬끼리 읽은 블록을 나눠 씀: 블록마다 주인이
+ *                  정해져 있어 주인에게 먼저 묻고, 백엔드에서는 주인만 읽음
+ *   -o write_behind=/fast/dir[,write_behind_sync=backend]
+ *                  write는 로컬 journal에 sync되면 응답하고 백엔드에는 나중에 큰
+ *                  순차 쓰기로 올림. fsync는 journal까지(local) 또는 백엔드까지(backend)
+ *   -o offline=/local/dir[,offline_file_max=B]
+ *                  연 파일의 사본을 로컬에 두고, 백엔드가 응답하지 않는 동안 사본으로
+ *                  읽고 쓰며 변경을 기록해 두었다가 돌아오면 재생 (다른 곳에서 바뀐
+ *                  파일은 덮지 않고 .conflict 이름으로)
+ *   -o breaker_ms=MS[,breaker_open_ms=O,breaker_inflight=N]
+ *                  백엔드(와 mirror 복제본마다) 호출을 N개까지만 들이고, MS를 넘기거나
+ *                  멈춘 호출이 잦으면 O ms 동안 바로 실패시킴 (offline/캐시가 있으면
+ *                  그쪽으로, mirror read는 다른 복제본으로). 멈춘 디스크에도 워커가 남음
+ *
+ * 빌드: -DWITH_CACHE=0 / -DWITH_HEAT=0 / -DWITH_PREFETCH=0 / -DWITH_INTEGRITY=0 /
+ *       -DWITH_MIRROR=0 / -DWITH_S3=0 / -DWITH_REMOTE=0 /
+ *       -DWITH_COHERENCE=0 / -DWITH_PEER_CACHE=0 / -DWITH_WRITE_BEHIND=0 /
+ *       -DWITH_OFFLINE=0 / -DWITH_BREAKER=0 으로 기능을 빼고
+ *       컴파일할 수 있음 (해당 옵션도 사라짐). 모두 빼면 순수 passthrough 빌드.
+ *
+ * 계층: 켜진 기능은 고정된 순서(cache → peer → integrity → write-behind → offline →
+ *       breaker → mirror|s3|remote → passthrough)로 쌓이며,
+ *       아무 기능도 켜지 않으면 백엔드 passthrough를 직접 호출한다.
+ *
+ * 통계: cat /tmp/fuse_mnt/.basic_fuse_stats
+ *       curl --unix-socket PATH http://localhost/metrics
  */
 
  /*코드를 수정함*/
 
+#define _GNU_SOURCE
 #define FUSE_USE_VERSION 31
 
 #include <fuse.h>
@@ -29,10 +121,31 @@
 #include <time.h>
 #include <stdlib.h>
 #include <sys/time.h>
+#include <sys/mman.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/sysmacros.h>
+#include <sys/syscall.h>
+#include <sys/random.h>
+#include <sched.h>
+#include <linux/mempolicy.h>
+#include <sys/uio.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
 
 /* 백엔드 데이터 디렉토리 (추후 인자화 가능) */
 static const char *DIR_PATH = "/tmp/fuse_data";
 
+/* 통계 파일: 마운트 루트의 가상 파일, open 시점의 스냅샷을 보여줌 */
+#define STATS_PATH "/.basic_fuse_stats"
+
 /* 안전한 전체 경로 생성: fpath_out 크기를 인자로 받아 overflow 방지 */
 static void get_full_path(const char *path, char *fpath_out, size_t out_size)
 {
@@ -41,273 +154,3673 @@ static void get_full_path(const char *path, char *fpath_out, size_t out_size)
     snprintf(fpath_out, out_size, "%s%s", DIR_PATH, path);
 }
 
-/* 1. getattr */
-static int basic_getattr(const char *path, struct stat *stbuf,
-                         struct fuse_file_info *fi)
-{
-    (void) fi;
-    char fpath[PATH_MAX];
-    get_full_path(path, fpath, sizeof(fpath));
+/* open/create가 fi->fh에 넣어 두는 파일 핸들 */
+struct inline_ent;
+struct integ_file;
+struct ec_file;
 
-    if (lstat(fpath, stbuf) == -1)
-        return -errno;
+struct basic_fh {
+    int fd;                     /* 백엔드 fd (인라인 캐시로 열린 경우 -1) */
+    struct inline_ent *ent;     /* 인라인 캐시 hit으로 열린 경우의 내용 */
+    struct integ_file *ig;      /* integrity layer가 붙인 파일 상태 */
+    off_t next_off;             /* 순차 읽기라면 다음 read가 시작할 위치 */
+    unsigned int seq_run;       /* 연속된 순차 read 수 */
+    off_t pf_until;             /* 여기까지는 이미 prefetch 요청함 */
+    size_t pf_window;           /* 현재 prefetch 크기 (순차가 이어지면 두 배씩) */
+    int mfd[8];                 /* mirror layer: 복제본별 fd ([0]은 쓰지 않음, MIRROR_MAX) */
+    struct ec_file *ec;         /* erasure coding: 파일의 조각 상태 */
+    unsigned int hedged;        /* 이 핸들의 fd로 진행 중이거나 대기 중인 hedge read */
+    struct s3_file *s3;         /* s3 layer: 열린 객체의 버퍼 */
+    unsigned int rconn, rgen;   /* remote layer: fd를 연 연결과 그 세대 (0이면 로컬) */
+    int coh_pinned;             /* coherence: 피어에 쓰는 중이라고 알림 (release 때 풂) */
+    int pc_ok;                  /* peer cache: 읽기 전용 일반 파일이라 블록을 나눠 씀 */
+    off_t pc_size;              /* 그때 연 파일의 크기와 mtime (블록 검증값) */
+    struct timespec pc_mtime;
+    int ofd;                    /* offline: 사본 fd (-1이면 백엔드 핸들) */
+    int off_wr;                 /* offline: 쓰기로 열림 */
+    int off_local;              /* offline: 사본으로 열려 아래 layer에는 없는 핸들 */
+};
 
-    return 0;
+static struct basic_fh *fh_new(int fd)
+{
+    struct basic_fh *fh = calloc(1, sizeof(*fh));
+    if (fh) {
+        fh->fd = fd;
+        fh->ofd = -1;
+        for (size_t r = 0; r < sizeof(fh->mfd) / sizeof(fh->mfd[0]); r++)
+            fh->mfd[r] = -1;
+    }
+    return fh;
 }
 
-/* 2. readdir */
-static int basic_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
-                         off_t offset, struct fuse_file_info *fi,
-                         enum fuse_readdir_flags flags)
+static inline struct basic_fh *get_fh(const struct fuse_file_info *fi)
 {
-    (void) offset;
-    (void) fi;
-    (void) flags;
+    return (struct basic_fh *) (uintptr_t) fi->fh;
+}
 
-    char fpath[PATH_MAX];
-    get_full_path(path, fpath, sizeof(fpath));
+/*
+ * 계층(layer) 스택: 각 layer는 필요한 연산만 구현하고 나머지는 다음 layer로
+ * 넘긴다 (NULL = 그대로 통과). 맨 아래는 항상 basic_* (백엔드 passthrough).
+ * 각 연산의 첫 인자 next는 이 layer 아래에서 호출을 이어 갈 위치로,
+ * next_<op>(next, ...) 로 전달하면 된다.
+ */
+struct basic_layer {
+    const char *name;
+    int (*getattr)(int next, const char *, struct stat *, struct fuse_file_info *);
+    int (*readdir)(int next, const char *, void *, fuse_fill_dir_t, off_t,
+                   struct fuse_file_info *, enum fuse_readdir_flags);
+    int (*create)(int next, const char *, mode_t, struct fuse_file_info *);
+    int (*open)(int next, const char *, struct fuse_file_info *);
+    int (*read)(int next, const char *, char *, size_t, off_t, struct fuse_file_info *);
+    int (*write)(int next, const char *, const char *, size_t, off_t,
+                 struct fuse_file_info *);
+    int (*unlink)(int next, const char *);
+    int (*rename)(int next, const char *, const char *, unsigned int);
+    int (*release)(int next, const char *, struct fuse_file_info *);
+    int (*mkdir)(int next, const char *, mode_t);
+    int (*rmdir)(int next, const char *);
+    int (*chmod)(int next, const char *, mode_t, struct fuse_file_info *);
+    int (*truncate)(int next, const char *, off_t, struct fuse_file_info *);
+    int (*utimens)(int next, const char *, const struct timespec[2],
+                   struct fuse_file_info *);
+    int (*opendir)(int next, const char *, struct fuse_file_info *);
+    int (*fsync)(int next, const char *, int, struct fuse_file_info *);
+};
 
-    DIR *dp = opendir(fpath);
-    if (dp == NULL)
-        return -errno;
+#define MAX_LAYERS 8
 
-    struct dirent *de;
-    while ((de = readdir(dp)) != NULL) {
-        /* 얻은 이름에 대해 실제 lstat 호출하여 정확한 stat 정보 얻기 */
-        struct stat st;
-        memset(&st, 0, sizeof(st));
+static const struct basic_layer *layers[MAX_LAYERS];
+static int nlayers;
+static int plain_io;    /* passthrough read/write가 기록 분기 없는 특수화인지 */
 
-        /* build child path */
-        char child[PATH_MAX];
-        /* handle root "/" path special case to avoid double slashes, snprintf handles it */
-        snprintf(child, sizeof(child), "%s/%s", fpath, de->d_name);
+static int next_getattr(int next, const char *path, struct stat *stbuf,
+                        struct fuse_file_info *fi);
+static int next_read(int next, const char *path, char *buf, size_t size,
+                     off_t offset, struct fuse_file_info *fi);
 
-        if (lstat(child, &st) == -1) {
-            /* skip entries we can't stat, but continue */
-            continue;
+/*
+ * 컴파일 시 기능 선택: -DWITH_CACHE=0 처럼 끄고 빌드하면 그 기능의 마운트 옵션이
+ * 사라지고, hot path의 관련 분기와 코드도 상수 조건으로 컴파일러가 제거한다.
+ */
+#ifndef WITH_CACHE
+#define WITH_CACHE 1        /* 작은 파일 인라인 캐시 (cache layer) */
+#endif
+#ifndef WITH_HEAT
+#define WITH_HEAT 1         /* read/write heat map */
+#endif
+#ifndef WITH_PREFETCH
+#define WITH_PREFETCH 1     /* 순차/연관 파일 prefetch */
+#endif
+#ifndef WITH_INTEGRITY
+#define WITH_INTEGRITY 1    /* 블록 단위 무결성 태그 (integrity layer) */
+#endif
+#ifndef WITH_MIRROR
+#define WITH_MIRROR 1       /* 여러 백엔드 루트에 복제 (mirror layer) */
+#endif
+#ifndef WITH_S3
+#define WITH_S3 1           /* S3 호환 object store를 백엔드로 (s3 layer) */
+#endif
+#ifndef WITH_REMOTE
+#define WITH_REMOTE 1       /* 다른 데몬의 DIR_PATH를 메시지로 (remote layer) */
+#endif
+#ifndef WITH_COHERENCE
+#define WITH_COHERENCE 1    /* 같은 백엔드를 쓰는 데몬끼리 캐시 무효화 통보 */
+#endif
+#ifndef WITH_PEER_CACHE
+#define WITH_PEER_CACHE 1   /* 같은 백엔드를 읽는 데몬끼리 블록 공유 (peer layer) */
+#endif
+#ifndef WITH_WRITE_BEHIND
+#define WITH_WRITE_BEHIND 1 /* write를 로컬 journal에 받고 백엔드에는 나중에 */
+#endif
+#ifndef WITH_OFFLINE
+#define WITH_OFFLINE 1      /* 백엔드가 내려가도 로컬 사본으로 계속 (offline layer) */
+#endif
+#ifndef WITH_BREAKER
+#define WITH_BREAKER 1      /* 느려지거나 멈춘 백엔드를 끊음 (breaker layer) */
+#endif
+
+/* 커널 FUSE_MAX_PAGES 기본 상한(256 페이지)이자 libfuse 요청 버퍼 크기 */
+#define FUSE_MAX_REQ_SIZE (256 * 4096)
+
+/* 마운트 옵션: fuse_opt_parse로 -o key=value 형태를 채움 */
+static struct options {
+    unsigned int slow_us;   /* slow log 기준 지연 시간(us), 0이면 기록 안 함 */
+    const char *metrics_sock;   /* OpenMetrics를 내보낼 unix socket 경로 */
+    const char *mirror;         /* DIR_PATH와 같은 내용을 둘 다른 루트들 "/b:/c" */
+    const char *mirror_hedge;   /* 이 백분위수 지연을 넘긴 read는 다른 복제본에도 보냄 */
+    unsigned int mirror_ec;     /* 0이 아니면 복제 대신 데이터 조각 K개 + parity */
+    unsigned int mirror_ec_cell;    /* stripe에서 조각 하나가 갖는 크기 */
+    const char *s3;             /* DIR_PATH 대신 쓸 bucket "http://host:port/bucket" */
+    const char *s3_key;         /* "ACCESS_KEY_ID:SECRET" 한 줄, 없으면 서명하지 않음 */
+    const char *s3_region;      /* SigV4 region (기본 us-east-1) */
+    unsigned int s3_threads;    /* 병렬 ranged GET / part upload 수 */
+    unsigned int s3_part;       /* multipart upload의 part 크기 */
+    unsigned int s3_readahead;  /* 순차 read의 최대 readahead 창 */
+    unsigned int s3_attr_ttl_ms;    /* HEAD/LIST 결과를 다시 묻지 않고 쓰는 시간 */
+    const char *remote;         /* 백엔드 데몬 주소 "unix:/path" 또는 "tcp:host:port" */
+    unsigned int remote_conns;  /* 그 데몬과 맺는 연결 수 */
+    const char *remote_serve;   /* 마운트 대신 이 주소에서 DIR_PATH를 제공 */
+    unsigned int remote_threads;    /* remote_serve: 요청을 처리하는 스레드 수 */
+    const char *coherence;      /* 이 데몬이 무효화를 받는 주소 */
+    const char *coherence_peers;    /* 같은 백엔드를 쓰는 다른 데몬들 "ADDR+ADDR" */
+    unsigned int coherence_ttl_ms;  /* 통보를 받는 동안 캐시 항목을 다시 확인하지 않는 시간 */
+    unsigned int coherence_lease_ms;    /* 피어가 응답하지 않을 때 기다리는 최대 시간 */
+    const char *peer_cache;     /* 이 데몬이 블록 요청을 받는 주소 (ring에서의 이름) */
+    const char *peer_cache_peers;   /* 블록을 나눠 쓰는 데몬들 "ADDR+ADDR" */
+    unsigned long peer_cache_budget;    /* 공유 블록 캐시의 바이트 상한 */
+    unsigned int peer_cache_block;  /* 블록 크기 (주인을 정하는 단위) */
+    unsigned int peer_cache_retry_ms;   /* 응답 없는 주인을 건너뛰는 시간 */
+    const char *write_behind;   /* write를 먼저 받는 journal 디렉터리 (빠른 로컬 장치) */
+    const char *write_behind_sync;  /* fsync가 기다리는 곳: "local"(기본) 또는 "backend" */
+    unsigned long write_behind_max;     /* journal 디스크 사용 상한 */
+    unsigned int write_behind_batch;    /* 백엔드에 한 번에 쓰는 최대 크기 */
+    unsigned int write_behind_delay_ms; /* 올리기 전에 write를 모으는 시간 */
+    const char *offline;        /* 백엔드가 안 될 때 쓰는 사본과 변경 기록 디렉터리 */
+    unsigned long offline_file_max;     /* 이보다 큰 파일은 사본을 두지 않음 */
+    unsigned int offline_retry_ms;      /* 내려간 백엔드를 처음 다시 확인하기까지 */
+    unsigned int offline_retry_max_ms;  /* 확인 간격은 두 배씩 이 값까지 */
+    unsigned int breaker_ms;    /* 이보다 오래 걸리는 백엔드 호출은 실패로 셈, 0이면 끔 */
+    unsigned int breaker_open_ms;   /* 열린 breaker가 시험 호출을 받기까지 */
+    unsigned int breaker_inflight;  /* 백엔드 안에 동시에 들어가는 호출 상한 */
+    unsigned int heat_sample;   /* read/write N건 중 1건을 heat map에 기록, 0이면 끔 */
+    unsigned int heat_block;    /* heat map 구간 크기(bytes) */
+    unsigned int heat_halflife; /* 이 주기(초)마다 heat 카운터를 절반으로 */
+    unsigned int inline_max;    /* 이 크기 이하 파일은 내용을 메모리에 보관 */
+    unsigned long inline_budget;    /* 인라인 캐시 전체 바이트 상한, 0이면 끔 */
+    unsigned int inline_ttl_ms; /* 캐시된 속성을 백엔드와 다시 대조하는 주기 */
+    unsigned int prefetch_bw;   /* prefetch 대역폭 상한(MiB/s), 0이면 끔 */
+    unsigned int prefetch_max;  /* 한 번에 미리 읽을 최대 크기(KiB) */
+    unsigned int max_write;     /* WRITE 요청 최대 크기 (max_pages 협상에 사용) */
+    unsigned int read_ahead_kb; /* 마운트의 커널 readahead 크기, 0이면 그대로 */
+    const char *mountpoint;     /* 옵션 파싱 중 기록 (libfuse에도 그대로 전달) */
+    int numa;                   /* 워커/메모리를 한 NUMA 노드에 고정 */
+    int numa_node;              /* 고정할 노드, -1이면 백엔드 장치의 노드 */
+    const char *integrity;      /* 기본 무결성 방식 ("blake3", "crc32c"), NULL이면 끔 */
+    const char *integrity_paths;    /* 경로별 방식 "/prefix=alg:..." */
+    const char *integrity_layout;   /* "sidecar"(기본) 또는 "interleaved" */
+    unsigned int integrity_group;   /* interleaved: 태그 묶음 하나당 데이터 블록 수 */
+    const char *integrity_key;  /* 32바이트 키 파일 */
+    unsigned int integrity_block;   /* 태그 하나가 덮는 크기 (2의 거듭제곱, >= 1 KiB) */
+    unsigned int integrity_threads; /* 해시 스레드 수, 0이면 CPU 수에 맞춤 */
+    int integrity_adopt;        /* 태그 없는 기존 파일을 현재 내용으로 받아들임 */
+    const char *integrity_verify;   /* 기본 read 검증 방식, NULL이면 strict */
+    unsigned int integrity_sample;  /* sampled: 블록 N개 중 1개를 검증 */
+    unsigned int integrity_scrub_bw;        /* scrubber 읽기 한도 (MiB/s) */
+    unsigned int integrity_scrub_interval;  /* scrubber 한 바퀴 사이 간격 (초) */
+    unsigned int integrity_key_version;     /* integrity_key의 버전 */
+    const char *integrity_old_key;  /* 교체 중: 버전 integrity_key_version - 1의 키 */
+    int show_help;
+} options = {
+    .slow_us = 20000,
+    .heat_sample = WITH_HEAT ? 64 : 0,
+    .heat_block = 1024 * 1024,
+    .heat_halflife = 60,
+    .inline_max = 16 * 1024,
+    .inline_budget = WITH_CACHE ? 16 * 1024 * 1024 : 0,
+    .inline_ttl_ms = 1000,
+    .prefetch_max = 8 * 1024,
+    .max_write = FUSE_MAX_REQ_SIZE,
+    .numa_node = -1,
+    .mirror_ec_cell = 64 * 1024,
+    .s3_threads = 8,
+    .s3_part = 8 * 1024 * 1024,
+    .s3_readahead = 16 * 1024 * 1024,
+    .s3_attr_ttl_ms = 1000,
+    .remote_conns = 1,
+    .remote_threads = 8,
+    .coherence_ttl_ms = 60000,
+    .coherence_lease_ms = 2000,
+    .peer_cache_budget = 256UL * 1024 * 1024,
+    .peer_cache_block = 1024 * 1024,
+    .peer_cache_retry_ms = 1000,
+    .write_behind_max = 1024UL * 1024 * 1024,
+    .write_behind_batch = 8 * 1024 * 1024,
+    .write_behind_delay_ms = 200,
+    .offline_file_max = 64UL * 1024 * 1024,
+    .offline_retry_ms = 1000,
+    .offline_retry_max_ms = 60000,
+    .breaker_open_ms = 5000,
+    .breaker_inflight = 8,
+    .integrity_block = 64 * 1024,
+    .integrity_group = 1,
+    .integrity_sample = 16,
+    .integrity_scrub_bw = 8,
+    .integrity_scrub_interval = 24 * 3600,
+    .integrity_key_version = 1,
+};
+
+#define OPTION(t, p) { t, offsetof(struct options, p), 1 }
+static const struct fuse_opt option_spec[] = {
+    OPTION("slow_us=%u", slow_us),
+    OPTION("metrics_sock=%s", metrics_sock),
+#if WITH_HEAT
+    OPTION("heat_sample=%u", heat_sample),
+    OPTION("heat_block=%u", heat_block),
+    OPTION("heat_halflife=%u", heat_halflife),
+#endif
+#if WITH_CACHE
+    OPTION("inline_max=%u", inline_max),
+    OPTION("inline_budget=%lu", inline_budget),
+    OPTION("inline_ttl_ms=%u", inline_ttl_ms),
+#endif
+#if WITH_PREFETCH
+    OPTION("prefetch_bw=%u", prefetch_bw),
+    OPTION("prefetch_max=%u", prefetch_max),
+#endif
+    OPTION("max_write=%u", max_write),
+    OPTION("read_ahead_kb=%u", read_ahead_kb),
+    OPTION("numa", numa),
+    OPTION("numa_node=%d", numa_node),
+#if WITH_MIRROR
+    OPTION("mirror=%s", mirror),
+    OPTION("mirror_hedge=%s", mirror_hedge),
+    OPTION("mirror_ec=%u", mirror_ec),
+    OPTION("mirror_ec_cell=%u", mirror_ec_cell),
+#endif
+#if WITH_S3
+    OPTION("s3=%s", s3),
+    OPTION("s3_key=%s", s3_key),
+    OPTION("s3_region=%s", s3_region),
+    OPTION("s3_threads=%u", s3_threads),
+    OPTION("s3_part=%u", s3_part),
+    OPTION("s3_readahead=%u", s3_readahead),
+    OPTION("s3_attr_ttl_ms=%u", s3_attr_ttl_ms),
+#endif
+#if WITH_REMOTE
+    OPTION("remote=%s", remote),
+    OPTION("remote_conns=%u", remote_conns),
+    OPTION("remote_serve=%s", remote_serve),
+    OPTION("remote_threads=%u", remote_threads),
+#endif
+#if WITH_COHERENCE
+    OPTION("coherence=%s", coherence),
+    OPTION("coherence_peers=%s", coherence_peers),
+    OPTION("coherence_ttl_ms=%u", coherence_ttl_ms),
+    OPTION("coherence_lease_ms=%u", coherence_lease_ms),
+#endif
+#if WITH_PEER_CACHE
+    OPTION("peer_cache=%s", peer_cache),
+    OPTION("peer_cache_peers=%s", peer_cache_peers),
+    OPTION("peer_cache_budget=%lu", peer_cache_budget),
+    OPTION("peer_cache_block=%u", peer_cache_block),
+    OPTION("peer_cache_retry_ms=%u", peer_cache_retry_ms),
+#endif
+#if WITH_WRITE_BEHIND
+    OPTION("write_behind=%s", write_behind),
+    OPTION("write_behind_sync=%s", write_behind_sync),
+    OPTION("write_behind_max=%lu", write_behind_max),
+    OPTION("write_behind_batch=%u", write_behind_batch),
+    OPTION("write_behind_delay_ms=%u", write_behind_delay_ms),
+#endif
+#if WITH_OFFLINE
+    OPTION("offline=%s", offline),
+    OPTION("offline_file_max=%lu", offline_file_max),
+    OPTION("offline_retry_ms=%u", offline_retry_ms),
+    OPTION("offline_retry_max_ms=%u", offline_retry_max_ms),
+#endif
+#if WITH_BREAKER
+    OPTION("breaker_ms=%u", breaker_ms),
+    OPTION("breaker_open_ms=%u", breaker_open_ms),
+    OPTION("breaker_inflight=%u", breaker_inflight),
+#endif
+#if WITH_INTEGRITY
+    OPTION("integrity=%s", integrity),
+    OPTION("integrity_key=%s", integrity_key),
+    OPTION("integrity_key_version=%u", integrity_key_version),
+    OPTION("integrity_old_key=%s", integrity_old_key),
+    OPTION("integrity_paths=%s", integrity_paths),
+    OPTION("integrity_layout=%s", integrity_layout),
+    OPTION("integrity_group=%u", integrity_group),
+    OPTION("integrity_block=%u", integrity_block),
+    OPTION("integrity_threads=%u", integrity_threads),
+    OPTION("integrity_adopt", integrity_adopt),
+    OPTION("integrity_verify=%s", integrity_verify),
+    OPTION("integrity_sample=%u", integrity_sample),
+    OPTION("integrity_scrub_bw=%u", integrity_scrub_bw),
+    OPTION("integrity_scrub_interval=%u", integrity_scrub_interval),
+#endif
+    OPTION("-h", show_help),
+    OPTION("--help", show_help),
+    FUSE_OPT_END
+};
+
+/*
+ * NUMA 배치: 워커 스레드를 한 노드의 CPU에 고정하고 메모리 정책을
+ * 그 노드 우선(MPOL_PREFERRED)으로 바꾼다. libfuse 워커는 기존 워커가
+ * 만들기 때문에 새 워커는 affinity/mempolicy를 물려받고, 워커가 잡는
+ * 요청 버퍼와 통계 shard 등도 해당 노드에 할당된다.
+ */
+static struct {
+    int node;               /* -1이면 비활성 */
+    cpu_set_t cpus;
+    unsigned long pinned;   /* 고정된 스레드 수 */
+} numa = { .node = -1 };
+
+static __thread int numa_bound;
+
+/* 백엔드 디렉토리가 있는 블록 장치에서 시작해 상위(PCI 등)로 올라가며 numa_node를 찾음 */
+static int numa_backend_node(void)
+{
+    struct stat st;
+    char link[64];
+    char dir[PATH_MAX];
+
+    if (stat(DIR_PATH, &st) == -1)
+        return -1;
+
+    snprintf(link, sizeof(link), "/sys/dev/block/%u:%u",
+             major(st.st_dev), minor(st.st_dev));
+    if (realpath(link, dir) == NULL)
+        return -1;
+
+    while (strncmp(dir, "/sys/devices/", 13) == 0) {
+        char f[PATH_MAX + 16];
+        int node = -1;
+
+        snprintf(f, sizeof(f), "%s/numa_node", dir);
+        FILE *fp = fopen(f, "r");
+        if (fp) {
+            int ok = fscanf(fp, "%d", &node) == 1;
+            fclose(fp);
+            if (ok && node >= 0)
+                return node;
         }
+        char *slash = strrchr(dir, '/');
+        if (slash == NULL)
+            break;
+        *slash = '\0';
+    }
+    return -1;
+}
 
-        /* filler: (buf, name, statbuf, off, flags) -- older fuse versions use different sig,
-           but passing 0 for off and 0 for flags is OK for many cases */
-        if (filler(buf, de->d_name, &st, 0, 0))
+/* "0-7,16-23" 형식의 cpulist 파싱 */
+static int numa_node_cpus(int node, cpu_set_t *set)
+{
+    char f[64];
+    unsigned int a, b;
+    int c;
+
+    snprintf(f, sizeof(f), "/sys/devices/system/node/node%d/cpulist", node);
+    FILE *fp = fopen(f, "r");
+    if (fp == NULL)
+        return -errno;
+
+    CPU_ZERO(set);
+    while (fscanf(fp, "%u", &a) == 1) {
+        b = a;
+        c = fgetc(fp);
+        if (c == '-') {
+            if (fscanf(fp, "%u", &b) != 1)
+                break;
+            c = fgetc(fp);
+        }
+        for (unsigned int i = a; i <= b && i < CPU_SETSIZE; i++)
+            CPU_SET(i, set);
+        if (c != ',')
             break;
     }
+    fclose(fp);
 
-    closedir(dp);
-    return 0;
+    return CPU_COUNT(set) ? 0 : -ENOENT;
 }
 
-/* 3. create: 파일 생성 (적절한 플래그 사용) */
-static int basic_create(const char *path, mode_t mode, struct fuse_file_info *fi)
+/* 현재 스레드를 선택된 노드에 고정 (스레드당 한 번) */
+static void numa_bind_thread(void)
 {
-    char fpath[PATH_MAX];
-    get_full_path(path, fpath, sizeof(fpath));
+    if (numa.node < 0 || numa_bound)
+        return;
+    numa_bound = 1;
 
-    /* create은 O_CREAT + 주로 쓰기 전용. 기존 예제들처럼 명시적으로 설정 */
-    int flags = O_CREAT | O_WRONLY;
-    /* 만약 사용자가 쓰기 이외 플래그를 원하면 fi->flags를 참고하여 추가 가능 */
-    if (fi && (fi->flags & O_APPEND))
-        flags |= O_APPEND;
+    unsigned long mask[16] = { 0 };
+    const int bits = 8 * sizeof(mask[0]);
 
-    int fd = open(fpath, flags, mode);
-    if (fd == -1)
-        return -errno;
+    if (numa.node < (int) (sizeof(mask) * 8)) {
+        mask[numa.node / bits] = 1ul << (numa.node % bits);
+        syscall(SYS_set_mempolicy, MPOL_PREFERRED, mask, sizeof(mask) * 8);
+    }
+    if (pthread_setaffinity_np(pthread_self(), sizeof(numa.cpus), &numa.cpus) == 0)
+        __atomic_fetch_add(&numa.pinned, 1, __ATOMIC_RELAXED);
+}
 
-    fi->fh = (uint64_t) fd;
+static void numa_setup(void)
+{
+    int node = options.numa_node >= 0 ? options.numa_node : numa_backend_node();
 
-    /* 향후 초기 HMAC 생성 여기에 추가 */
+    if (node < 0) {
+        fprintf(stderr, "[WARN] numa: cannot find NUMA node of %s, not binding\n",
+                DIR_PATH);
+        return;
+    }
+    if (numa_node_cpus(node, &numa.cpus) < 0) {
+        fprintf(stderr, "[WARN] numa: node %d has no CPUs, not binding\n", node);
+        return;
+    }
 
-    return 0;
+    numa.node = node;
+    printf("[INFO] NUMA: binding workers to node %d (%d cpus)\n",
+           node, CPU_COUNT(&numa.cpus));
 }
 
-/* 4. open */
-static int basic_open(const char *path, struct fuse_file_info *fi)
-{
-    char fpath[PATH_MAX];
-    get_full_path(path, fpath, sizeof(fpath));
+/*
+ * 요청 추적 (slow log / 통계용)
+ * 각 핸들러는 req_begin/req_end 사이에서 실행되고, 백엔드 시스템콜은
+ * BACKEND()로 감싸 소요 시간을 현재 요청에 누적한다.
+ */
+enum basic_op {
+    OP_GETATTR, OP_READDIR, OP_CREATE, OP_OPEN, OP_READ, OP_WRITE,
+    OP_UNLINK, OP_RENAME, OP_RELEASE, OP_MKDIR, OP_RMDIR, OP_CHMOD,
+    OP_TRUNCATE, OP_UTIMENS, OP_OPENDIR, OP_FSYNC,
+    OP_COUNT
+};
 
-    /* fi->flags를 그대로 사용 (FUSE가 전달한 플래그) */
-    int fd = open(fpath, fi->flags);
-    if (fd == -1)
-        return -errno;
+static const char *op_names[OP_COUNT] = {
+    "getattr", "readdir", "create", "open", "read", "write",
+    "unlink", "rename", "release", "mkdir", "rmdir", "chmod",
+    "truncate", "utimens", "opendir", "fsync",
+};
 
-    fi->fh = (uint64_t) fd;
+struct req_trace {
+    enum basic_op op;
+    const char *path;
+    off_t offset;
+    size_t size;
+    uint64_t start_ns;
+    uint64_t backend_ns;    /* 백엔드 시스템콜에서 보낸 시간 */
+    uint64_t hash_ns;       /* 해시(무결성) 계산에 보낸 시간 */
+    struct op_stat *stat;   /* 이 요청을 집계할 shard 슬롯 */
+};
 
-    /* 향후 HMAC 검증 준비 로직 */
+/*
+ * op별 통계: 각 스레드는 자기 shard에만 쓰고 (lock, RMW 없음)
+ * 통계 파일/metrics 쪽에서 모든 shard를 합산한다.
+ * 지연 히스토그램 버킷 i의 상한은 2^i us, 마지막 칸은 +Inf.
+ */
+#define LAT_BUCKETS 24
 
-    return 0;
-}
+struct op_stat {
+    uint64_t started;
+    uint64_t count;
+    uint64_t errors;
+    uint64_t total_ns;
+    uint64_t backend_ns;
+    uint64_t max_ns;
+    uint64_t hist[LAT_BUCKETS + 1];
+};
 
-/* 5. read */
-static int basic_read(const char *path, char *buf, size_t size, off_t offset,
-                      struct fuse_file_info *fi)
+struct stat_shard {
+    struct op_stat ops[OP_COUNT];
+    struct stat_shard *next;        /* 전체 목록 (추가만 함) */
+    struct stat_shard *next_free;   /* 종료된 스레드가 남긴 shard */
+};
+
+/* 할당 실패 시 모든 스레드가 함께 쓰는 shard (이 경우 일부 카운트 유실 가능) */
+static struct stat_shard shard_fallback;
+static struct stat_shard *shard_list = &shard_fallback;
+static struct stat_shard *shard_free;
+static pthread_mutex_t shard_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t shard_once = PTHREAD_ONCE_INIT;
+static pthread_key_t shard_key;
+static __thread struct stat_shard *my_shard;
+
+static __thread struct req_trace cur_req;
+
+/* libfuse 워커 스레드가 끝나면 shard를 다음 스레드가 이어 쓰도록 반납 */
+static void shard_release(void *p)
 {
-    (void) path; /* path는 fi->fh가 있으면 필요 없음 */
-    ssize_t res = pread((int)fi->fh, buf, size, offset);
-    if (res == -1)
-        return -errno;
+    struct stat_shard *s = p;
 
-    /* 향후 읽은 데이터에 대한 HMAC 검증 로직 */
+    pthread_mutex_lock(&shard_lock);
+    s->next_free = shard_free;
+    shard_free = s;
+    pthread_mutex_unlock(&shard_lock);
+}
 
-    return (int)res;
+static void shard_key_init(void)
+{
+    pthread_key_create(&shard_key, shard_release);
 }
 
-/* 6. write (partial write 처리) */
-static int basic_write(const char *path, const char *buf, size_t size,
-                       off_t offset, struct fuse_file_info *fi)
+static struct stat_shard *shard_get(void)
 {
-    (void) path;
+    if (my_shard)
+        return my_shard;
 
-    size_t to_write = size;
-    off_t off = offset;
-    const char *p = buf;
+    /* 워커 스레드의 첫 요청: shard를 잡기 전에 노드 고정부터 */
+    numa_bind_thread();
+    pthread_once(&shard_once, shard_key_init);
 
-    while (to_write > 0) {
-        ssize_t written = pwrite((int)fi->fh, p, to_write, off);
-        if (written == -1) {
-            if (errno == EINTR)
-                continue;
-            return -errno;
-        }
-        to_write -= written;
-        p += written;
-        off += written;
+    pthread_mutex_lock(&shard_lock);
+    struct stat_shard *s = shard_free;
+    if (s) {
+        shard_free = s->next_free;
+    } else if ((s = calloc(1, sizeof(*s))) != NULL) {
+        s->next = shard_list;
+        __atomic_store_n(&shard_list, s, __ATOMIC_RELEASE);
     }
+    pthread_mutex_unlock(&shard_lock);
 
-    /* 향후 쓰기 후 HMAC 재계산 및 원자적 갱신 로직 */
+    if (s == NULL)
+        return my_shard = &shard_fallback;
 
-    return (int)size;
+    pthread_setspecific(shard_key, s);
+    return my_shard = s;
 }
 
-/* 7. unlink */
-static int basic_unlink(const char *path)
+/* 소유 스레드만 쓰므로 relaxed load/store면 충분 (읽는 쪽이 찢어진 값을 보지 않게) */
+static inline void stat_add(uint64_t *c, uint64_t v)
 {
-    char fpath[PATH_MAX];
-    get_full_path(path, fpath, sizeof(fpath));
-
-    if (unlink(fpath) == -1)
-        return -errno;
+    __atomic_store_n(c, __atomic_load_n(c, __ATOMIC_RELAXED) + v, __ATOMIC_RELAXED);
+}
 
-    /* 향후 xattr 등 HMAC 메타데이터 삭제 로직 추가 */
+static inline uint64_t stat_load(const uint64_t *c)
+{
+    return __atomic_load_n(c, __ATOMIC_RELAXED);
+}
 
-    return 0;
+static int lat_bucket(uint64_t ns)
+{
+    uint64_t us = ns / 1000;
+    if (us <= 1)
+        return 0;
+    int b = 64 - __builtin_clzll(us - 1);
+    return b < LAT_BUCKETS ? b : LAT_BUCKETS;
 }
 
-/* 8. rename */
-static int basic_rename(const char *from, const char *to, unsigned int flags)
+/* 모든 shard 합산 */
+static void stats_collect(struct op_stat out[OP_COUNT])
 {
-    /* 이 구현은 flags를 지원하지 않음 (간단 구현). flags가 주어지면 에러 반환 */
-    if (flags)
-        return -EINVAL;
+    memset(out, 0, sizeof(struct op_stat) * OP_COUNT);
 
-    char ffrom[PATH_MAX];
-    char fto[PATH_MAX];
-    get_full_path(from, ffrom, sizeof(ffrom));
-    get_full_path(to, fto, sizeof(fto));
+    for (struct stat_shard *s = __atomic_load_n(&shard_list, __ATOMIC_ACQUIRE);
+         s != NULL; s = s->next) {
+        for (int i = 0; i < OP_COUNT; i++) {
+            const struct op_stat *o = &s->ops[i];
+            /* count를 started보다 먼저 읽어야 in-flight가 음수로 보이지 않음 */
+            out[i].count += __atomic_load_n(&o->count, __ATOMIC_ACQUIRE);
+            out[i].started += stat_load(&o->started);
+            out[i].errors += stat_load(&o->errors);
+            out[i].total_ns += stat_load(&o->total_ns);
+            out[i].backend_ns += stat_load(&o->backend_ns);
+            uint64_t max = stat_load(&o->max_ns);
+            if (max > out[i].max_ns)
+                out[i].max_ns = max;
+            for (int b = 0; b <= LAT_BUCKETS; b++)
+                out[i].hist[b] += stat_load(&o->hist[b]);
+        }
+    }
+}
 
-    if (rename(ffrom, fto) == -1)
-        return -errno;
+/*
+ * slow log: 기준 시간을 넘긴 요청을 고정 크기 ring에 보관 (오래된 것부터 덮어씀)
+ * high-level API에서는 커널 큐 대기 시간을 알 수 없으므로
+ * 백엔드/해시 이외의 시간은 other(데몬 내부 + 디스패치)로 기록한다.
+ */
+#define SLOW_RING_SIZE 128
+#define SLOW_PATH_MAX  256
 
-    /* 향후 sidecar DB 동기화 등 처리 */
+struct slow_entry {
+    struct timespec when;
+    enum basic_op op;
+    char path[SLOW_PATH_MAX];
+    off_t offset;
+    size_t size;
+    uid_t uid;
+    pid_t pid;
+    int result;
+    uint64_t total_ns;
+    uint64_t backend_ns;
+    uint64_t hash_ns;
+};
 
-    return 0;
-}
+static struct slow_entry slow_ring[SLOW_RING_SIZE];
+static uint64_t slow_total;     /* 지금까지 기록된 수 (ring 위치 = slow_total % 크기) */
+static pthread_mutex_t slow_lock = PTHREAD_MUTEX_INITIALIZER;
 
-/* 9. release (필수) - open/create에서 할당한 fd를 닫음 */
-static int basic_release(const char *path, struct fuse_file_info *fi)
+static uint64_t now_ns(void)
 {
-    (void) path;
-    int fd = (int) fi->fh;
-    if (fd >= 0) {
-        close(fd);
-        fi->fh = 0;
-    }
-    return 0;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
 }
 
-/* 10. mkdir */
-static int basic_mkdir(const char *path, mode_t mode)
+/* 백엔드 호출 시간 누적 (clock_gettime은 성공 시 errno를 건드리지 않음) */
+#define BACKEND(call) ({                                \
+        uint64_t bk_t0_ = now_ns();                     \
+        __typeof__(call) bk_r_ = (call);                \
+        cur_req.backend_ns += now_ns() - bk_t0_;        \
+        bk_r_;                                          \
+    })
+
+static void req_begin(enum basic_op op, const char *path, off_t offset, size_t size)
 {
-    char fpath[PATH_MAX];
-    get_full_path(path, fpath, sizeof(fpath));
+    cur_req.op = op;
+    cur_req.path = path;
+    cur_req.offset = offset;
+    cur_req.size = size;
+    cur_req.backend_ns = 0;
+    cur_req.hash_ns = 0;
+    cur_req.stat = &shard_get()->ops[op];
+    stat_add(&cur_req.stat->started, 1);
+    cur_req.start_ns = now_ns();
+}
 
-    if (mkdir(fpath, mode) == -1)
-        return -errno;
+static void slow_record(const struct req_trace *r, int result, uint64_t total)
+{
+    struct fuse_context *ctx = fuse_get_context();
 
-    return 0;
+    pthread_mutex_lock(&slow_lock);
+    struct slow_entry *e = &slow_ring[slow_total % SLOW_RING_SIZE];
+    clock_gettime(CLOCK_REALTIME, &e->when);
+    e->op = r->op;
+    snprintf(e->path, sizeof(e->path), "%s", r->path ? r->path : "");
+    e->offset = r->offset;
+    e->size = r->size;
+    e->uid = ctx ? ctx->uid : 0;
+    e->pid = ctx ? ctx->pid : 0;
+    e->result = result;
+    e->total_ns = total;
+    e->backend_ns = r->backend_ns;
+    e->hash_ns = r->hash_ns;
+    __atomic_store_n(&slow_total, slow_total + 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&slow_lock);
 }
 
-/* 11. rmdir */
-static int basic_rmdir(const char *path)
+static int req_end(int result)
 {
-    char fpath[PATH_MAX];
-    get_full_path(path, fpath, sizeof(fpath));
+    uint64_t total = now_ns() - cur_req.start_ns;
+    struct op_stat *s = cur_req.stat;
 
-    if (rmdir(fpath) == -1)
-        return -errno;
+    if (result < 0)
+        stat_add(&s->errors, 1);
+    stat_add(&s->total_ns, total);
+    stat_add(&s->backend_ns, cur_req.backend_ns);
+    stat_add(&s->hist[lat_bucket(total)], 1);
+    if (total > stat_load(&s->max_ns))
+        __atomic_store_n(&s->max_ns, total, __ATOMIC_RELAXED);
+    /* count는 마지막에: started - count = 처리 중인 요청 수 */
+    __atomic_store_n(&s->count, stat_load(&s->count) + 1, __ATOMIC_RELEASE);
+
+    if (options.slow_us && total >= (uint64_t) options.slow_us * 1000)
+        slow_record(&cur_req, result, total);
 
+    return result;
+}
+
+/*
+ * 백엔드에 닿지 못한 오류 (파일 자체의 오류와 구분): 연결과 시간 초과만.
+ * EIO는 디스크나 파일의 오류일 수 있어 넣지 않는다 (remote의 끊긴 연결은 ECONNRESET)
+ */
+static int backend_down(int err)
+{
+    switch (-err) {
+    case ENOTCONN: case ECONNREFUSED: case ECONNRESET: case ECONNABORTED:
+    case ETIMEDOUT: case EHOSTUNREACH: case EHOSTDOWN: case ENETDOWN: case ENETUNREACH:
+    case EPIPE: case ESHUTDOWN: case EPROTO:
+        return 1;
+    }
     return 0;
 }
 
-/* 12. chmod */
-static int basic_chmod(const char *path, mode_t mode, struct fuse_file_info *fi)
+/*
+ * circuit breaker (-o breaker_ms=MS): 백엔드(와 mirror 복제본마다) 호출의 지연과
+ * 결과를 본다. 백엔드 안에는 breaker_inflight개까지만 들어가고, 자리가 없으면 MS까지
+ * 기다린다. MS보다 오래 걸렸거나 아직 안 끝난 호출, 백엔드에 닿지 못한 오류가 최근
+ * BRK_WINDOW개 중 절반 이상이면 (또는 모든 자리가 멈춘 호출이면) 열려서
+ * breaker_open_ms 동안 호출을 바로 -EHOSTDOWN으로 돌려보낸다. 그 뒤 한 호출만 시험으로
+ * 보내 성공하면 닫고 실패하면 다시 연다. 멈춘 디스크에 묶이는 워커는 자리 수까지라
+ * 나머지 워커는 캐시된 것을 계속 처리하고, 위의 offline layer는 빠른 실패를
+ * 백엔드가 내려간 것으로 보고 사본으로 넘어간다.
+ */
+#define BRK_SLOTS 64
+#define BRK_WINDOW 20
+#define BRK_MIN_CALLS 5
+#define BRK_NONE BRK_SLOTS      /* 자리 없이 통과 (기록하지 않음) */
+
+enum { BRK_CLOSED, BRK_OPEN, BRK_HALF };
+enum { BRK_NOWAIT, BRK_WAIT, BRK_FORCE };   /* 자리가 없을 때: 바로 -EAGAIN / 기다림 / 그냥 통과 */
+
+struct breaker {
+    const char *name;
+    pthread_mutex_t lock;
+    pthread_cond_t freed;       /* 자리가 빔 */
+    int state;
+    uint64_t until_ns;          /* BRK_OPEN: 이때까지 바로 실패 */
+    uint64_t since_ns;          /* 마지막으로 닫힌 상태를 떠난 시각 */
+    uint32_t hist;              /* 최근 결과 (1 = 실패), 새것이 bit 0 */
+    unsigned int nhist;
+    int trial;                  /* BRK_HALF: 시험 호출의 자리, -1이면 없음 */
+    unsigned int inflight;
+    uint64_t start[BRK_SLOTS];  /* 0이면 빈 자리 */
+    unsigned char stuck[BRK_SLOTS];
+    /* 여기부터와 state, inflight, since_ns는 __atomic으로 씀: stats/metrics가 lock 없이 읽음 */
+    uint64_t ewma_ns;           /* 끝난 호출의 지연 (1/8 지수 평균) */
+    unsigned long long calls;
+    unsigned long long failures;    /* 백엔드에 닿지 못한 오류 */
+    unsigned long long slow;        /* breaker_ms를 넘겨 끝난 호출 */
+    unsigned long long stuck_calls; /* breaker_ms가 지나도록 안 끝난 호출 */
+    unsigned long long rejected;    /* 열려 있거나 자리가 없어 돌려보낸 호출 */
+    unsigned long long opened;
+};
+
+static int brk_on;
+static struct breaker backend_brk;
+
+/* mirror/ec면 복제본마다 (mirror.brk), 아니면 backend_brk 하나 */
+static int brk_per_replica(void)
 {
-    (void) fi;
-    char fpath[PATH_MAX];
-    get_full_path(path, fpath, sizeof(fpath));
+    return WITH_MIRROR && options.mirror;
+}
 
-    if (chmod(fpath, mode) == -1)
-        return -errno;
+static void brk_init(struct breaker *b, const char *name)
+{
+    b->name = name;
+    pthread_mutex_init(&b->lock, NULL);
+    pthread_cond_init(&b->freed, NULL);
+    b->trial = -1;
+}
 
-    return 0;
+/* 열려 있고 아직 시험할 때가 아님: 이 백엔드로 보내지 않음 */
+static int brk_tripped(struct breaker *b)
+{
+    if (!WITH_BREAKER || !brk_on)
+        return 0;
+    int state = __atomic_load_n(&b->state, __ATOMIC_ACQUIRE);
+    if (state == BRK_HALF)
+        return __atomic_load_n(&b->trial, __ATOMIC_RELAXED) >= 0;
+    return state == BRK_OPEN && now_ns() < __atomic_load_n(&b->until_ns, __ATOMIC_RELAXED);
 }
 
-/* 13. truncate */
-static int basic_truncate(const char *path, off_t size, struct fuse_file_info *fi)
+static void brk_trip_locked(struct breaker *b, uint64_t now, const char *why)
 {
-    (void) fi;
-    char fpath[PATH_MAX];
-    get_full_path(path, fpath, sizeof(fpath));
+    if (b->state == BRK_CLOSED) {
+        __atomic_store_n(&b->since_ns, now, __ATOMIC_RELAXED);
+        fprintf(stderr, "[WARN] breaker: %s %s, failing fast for %u ms\n",
+                b->name, why, options.breaker_open_ms);
+    }
+    __atomic_store_n(&b->until_ns, now + (uint64_t) options.breaker_open_ms * 1000000,
+                     __ATOMIC_RELAXED);
+    __atomic_store_n(&b->state, BRK_OPEN, __ATOMIC_RELEASE);
+    b->trial = -1;
+    __atomic_fetch_add(&b->opened, 1, __ATOMIC_RELAXED);
+}
 
-    if (truncate(fpath, size) == -1)
-        return -errno;
+/* 자리 slot의 호출 결과 하나 (시험 호출이면 닫거나 다시 엶) */
+static void brk_result_locked(struct breaker *b, int slot, int failed, uint64_t now)
+{
+    if (b->state == BRK_HALF && slot == b->trial) {
+        if (failed) {
+            brk_trip_locked(b, now, "trial call failed");
+            return;
+        }
+        fprintf(stderr, "[INFO] breaker: %s closed after %.1f s\n",
+                b->name, (now - b->since_ns) / 1e9);
+        b->trial = -1;
+        b->hist = 0;
+        b->nhist = 0;
+        __atomic_store_n(&b->state, BRK_CLOSED, __ATOMIC_RELEASE);
+        return;
+    }
+    if (b->state != BRK_CLOSED)
+        return;
+    b->hist = b->hist << 1 | (failed != 0);
+    if (b->nhist < BRK_WINDOW)
+        b->nhist++;
+    unsigned int bad = __builtin_popcount(b->hist & ((1u << BRK_WINDOW) - 1));
+    if (b->nhist >= BRK_MIN_CALLS && bad * 2 >= b->nhist) {
+        char why[64];
+        snprintf(why, sizeof(why), "opened (%u of the last %u calls failed or were slow)",
+                 bad, b->nhist);
+        brk_trip_locked(b, now, why);
+    }
+}
 
-    return 0;
+/* breaker_ms가 지나도록 안 끝난 호출을 실패로 셈 (한 번씩) */
+static void brk_scan_locked(struct breaker *b, uint64_t now)
+{
+    uint64_t limit = (uint64_t) options.breaker_ms * 1000000;
+    unsigned int stuck = 0;
+
+    if (b->inflight == 0)
+        return;
+    for (unsigned int s = 0; s < options.breaker_inflight; s++) {
+        if (b->start[s] == 0 || now - b->start[s] < limit)
+            continue;
+        stuck++;
+        if (b->stuck[s])
+            continue;
+        b->stuck[s] = 1;
+        __atomic_fetch_add(&b->stuck_calls, 1, __ATOMIC_RELAXED);
+        brk_result_locked(b, s, 1, now);
+    }
+    if (stuck == options.breaker_inflight && b->state == BRK_CLOSED)
+        brk_trip_locked(b, now, "opened (every slot is held by a stuck call)");
 }
 
-/* 14. utimens */
-static int basic_utimens(const char *path, const struct timespec ts[2],
-                         struct fuse_file_info *fi)
+/*
+ * 호출 전: 자리 번호(>= 0, BRK_NONE이면 기록 안 함) 또는 돌려보낼 오류.
+ * 열려 있으면 -EHOSTDOWN, 자리를 MS 동안 얻지 못하면 -ETIMEDOUT (둘 다
+ * backend_down이라 위의 offline이 사본으로 넘어감). 시험할 때가 되었으면 이 호출이
+ * 시험 호출이 된다.
+ */
+static int brk_enter(struct breaker *b, int mode)
 {
-    (void) fi;
-    char fpath[PATH_MAX];
-    get_full_path(path, fpath, sizeof(fpath));
+    if (!WITH_BREAKER || !brk_on)
+        return BRK_NONE;
 
-    /* utimensat 시 path가 절대/상대 경로 문제 없도록 AT_FDCWD 사용 */
-    if (utimensat(AT_FDCWD, fpath, ts, 0) == -1)
-        return -errno;
+    uint64_t now = now_ns();
+    uint64_t deadline = now + (uint64_t) options.breaker_ms * 1000000;
+    int slot = -1;
 
-    return 0;
+    pthread_mutex_lock(&b->lock);
+    for (;;) {
+        brk_scan_locked(b, now);
+        if (mode != BRK_FORCE && b->state == BRK_OPEN && now >= b->until_ns)
+            __atomic_store_n(&b->state, BRK_HALF, __ATOMIC_RELEASE);
+        if (mode != BRK_FORCE && (b->state == BRK_OPEN || (b->state == BRK_HALF && b->trial >= 0))) {
+            __atomic_fetch_add(&b->rejected, 1, __ATOMIC_RELAXED);
+            pthread_mutex_unlock(&b->lock);
+            return -EHOSTDOWN;
+        }
+        if (b->inflight < options.breaker_inflight)
+            break;
+        if (mode == BRK_FORCE || mode == BRK_NOWAIT) {
+            pthread_mutex_unlock(&b->lock);
+            return mode == BRK_FORCE ? BRK_NONE : -EAGAIN;
+        }
+        if (now >= deadline) {
+            __atomic_fetch_add(&b->rejected, 1, __ATOMIC_RELAXED);
+            pthread_mutex_unlock(&b->lock);
+            return -ETIMEDOUT;
+        }
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        uint64_t wait = deadline - now + ts.tv_nsec;
+        ts.tv_sec += wait / 1000000000ull;
+        ts.tv_nsec = wait % 1000000000ull;
+        pthread_cond_timedwait(&b->freed, &b->lock, &ts);
+        now = now_ns();
+    }
+    while (b->start[++slot])
+        ;
+    b->start[slot] = now;
+    b->stuck[slot] = 0;
+    __atomic_fetch_add(&b->inflight, 1, __ATOMIC_RELAXED);
+    if (b->state == BRK_HALF && mode != BRK_FORCE)
+        b->trial = slot;
+    pthread_mutex_unlock(&b->lock);
+    return slot;
 }
 
-/* init */
-static void *basic_init(struct fuse_conn_info *conn, struct fuse_config *cfg)
+/* 호출 후: 지연과 결과를 기록하고 res를 그대로 돌려줌 */
+static int brk_leave(struct breaker *b, int slot, int res)
 {
-    (void) conn;
-    (void) cfg;
+    if (slot == BRK_NONE)
+        return res;
 
-    /* 기본 키로드 등 초기화시 필요한 데이터 구조를 여기에 할당 가능 */
-    printf("[INFO] Basic FS Initialized. Backend: %s\n", DIR_PATH);
+    uint64_t now = now_ns();
+    pthread_mutex_lock(&b->lock);
+    uint64_t ns = now - b->start[slot];
+    int down = backend_down(res);
+    int slow = ns >= (uint64_t) options.breaker_ms * 1000000;
 
-    return NULL;
+    __atomic_fetch_add(&b->calls, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&b->ewma_ns, b->ewma_ns ? b->ewma_ns - b->ewma_ns / 8 + ns / 8 : ns,
+                     __ATOMIC_RELAXED);
+    __atomic_fetch_add(&b->failures, down, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&b->slow, slow, __ATOMIC_RELAXED);
+    if (!b->stuck[slot])
+        brk_result_locked(b, slot, down || slow, now);
+    else if (b->trial == slot)
+        b->trial = -1;
+    b->start[slot] = 0;
+    __atomic_fetch_sub(&b->inflight, 1, __ATOMIC_RELAXED);
+    pthread_cond_signal(&b->freed);
+    pthread_mutex_unlock(&b->lock);
+    return res;
 }
 
-/* FUSE operations 매핑 */
-static struct fuse_operations basic_oper = {
-    .init       = basic_init,
-    .getattr    = basic_getattr,
-    .readdir    = basic_readdir,
-    .create     = basic_create,
+/*
+ * 인라인 캐시: 작은 파일(설정, lock 파일, 메타데이터 JSON 등)의 속성과 내용을
+ * 경로 기준으로 보관한다. hit이면 getattr/open/read/release가 백엔드를 건드리지 않음.
+ * 우리가 수정하는 경로는 즉시 무효화하고, 외부 변경은 inline_ttl_ms마다
+ * 아래 layer의 getattr 한 번으로 확인한다. 전체 크기는 inline_budget 안에서 LRU로 유지.
+ * coherence로 다른 데몬의 변경을 통보받는 동안(trust_until 전)은 같은 epoch에
+ * 확인한 항목을 coherence_ttl_ms 동안 다시 확인하지 않는다.
+ */
+#define INLINE_BUCKETS 1024
+
+struct inline_ent {
+    char *path;
+    struct stat st;
+    char *data;
+    size_t cost;                /* budget 계산용 크기 */
+    uint64_t checked_ns;        /* 마지막으로 백엔드와 대조한 시각 */
+    unsigned int epoch;         /* 대조할 때의 icache.epoch */
+    unsigned int refs;          /* 캐시 표 1 + 이 내용으로 열린 핸들 수 */
+    int linked;                 /* 아직 표에 들어 있는지 */
+    struct inline_ent *hnext;
+    struct inline_ent *prev, *next;     /* LRU (head가 최근) */
+};
+
+static struct {
+    pthread_mutex_t lock;
+    struct inline_ent *table[INLINE_BUCKETS];
+    struct inline_ent *head, *tail;
+    size_t bytes;
+    size_t entries;
+    uint64_t hits, misses, attr_hits, evictions, invalidations;
+    uint64_t trust_until;       /* 이때까지는 다른 데몬의 변경이 모두 통보됨 (coherence) */
+    unsigned int epoch;         /* 통보가 끊겼다 이어질 때마다 늘어남 */
+    unsigned long gen;          /* 무효화마다 늘어남 (채우는 중 경합 확인) */
+    struct inline_pin *pins;    /* 다른 데몬이 쓰는 중이라 캐시하지 않는 경로 */
+    unsigned int npins;
+} icache = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+struct inline_pin {
+    struct inline_pin *next;
+    unsigned int n;
+    char path[];
+};
+
+static unsigned int path_hash(const char *path)
+{
+    uint32_t h = 2166136261u;   /* FNV-1a */
+    for (const unsigned char *p = (const unsigned char *) path; *p; p++)
+        h = (h ^ *p) * 16777619u;
+    return h;
+}
+
+static void inline_free(struct inline_ent *e)
+{
+    free(e->path);
+    free(e->data);
+    free(e);
+}
+
+static void inline_put(struct inline_ent *e)
+{
+    pthread_mutex_lock(&icache.lock);
+    int last = --e->refs == 0;
+    pthread_mutex_unlock(&icache.lock);
+    if (last)
+        inline_free(e);
+}
+
+/* icache.lock 보유 상태에서 호출 */
+static void inline_unlink_locked(struct inline_ent *e)
+{
+    struct inline_ent **pp = &icache.table[path_hash(e->path) % INLINE_BUCKETS];
+    while (*pp != e)
+        pp = &(*pp)->hnext;
+    *pp = e->hnext;
+
+    if (e->prev)
+        e->prev->next = e->next;
+    else
+        icache.head = e->next;
+    if (e->next)
+        e->next->prev = e->prev;
+    else
+        icache.tail = e->prev;
+
+    __atomic_fetch_sub(&icache.bytes, e->cost, __ATOMIC_RELAXED);
+    __atomic_fetch_sub(&icache.entries, 1, __ATOMIC_RELAXED);
+    e->linked = 0;
+    if (--e->refs == 0)
+        inline_free(e);
+}
+
+static struct inline_ent *inline_find_locked(const char *path)
+{
+    struct inline_ent *e = icache.table[path_hash(path) % INLINE_BUCKETS];
+    while (e && strcmp(e->path, path) != 0)
+        e = e->hnext;
+    return e;
+}
+
+static void inline_touch_locked(struct inline_ent *e)
+{
+    if (icache.head == e)
+        return;
+    e->prev->next = e->next;
+    if (e->next)
+        e->next->prev = e->prev;
+    else
+        icache.tail = e->prev;
+    e->prev = NULL;
+    e->next = icache.head;
+    icache.head->prev = e;
+    icache.head = e;
+}
+
+static int inline_same(const struct stat *a, const struct stat *b)
+{
+    return a->st_ino == b->st_ino && a->st_dev == b->st_dev &&
+           a->st_size == b->st_size && a->st_mode == b->st_mode &&
+           a->st_mtim.tv_sec == b->st_mtim.tv_sec &&
+           a->st_mtim.tv_nsec == b->st_mtim.tv_nsec &&
+           a->st_ctim.tv_sec == b->st_ctim.tv_sec &&
+           a->st_ctim.tv_nsec == b->st_ctim.tv_nsec;
+}
+
+/*
+ * 경로의 캐시 항목을 참조를 잡아 반환. TTL이 지났으면 lstat으로 대조하고
+ * 달라졌으면 버린다. 없으면 NULL.
+ */
+static struct inline_ent *inline_get(int next, const char *path)
+{
+    if (options.inline_budget == 0)
+        return NULL;
+
+    pthread_mutex_lock(&icache.lock);
+    struct inline_ent *e = inline_find_locked(path);
+    if (e == NULL) {
+        pthread_mutex_unlock(&icache.lock);
+        return NULL;
+    }
+    e->refs++;
+    uint64_t checked = e->checked_ns;
+    unsigned int epoch = icache.epoch;
+    int trusted = e->epoch == epoch;
+    pthread_mutex_unlock(&icache.lock);
+
+    uint64_t now = now_ns();
+    uint64_t ttl = (uint64_t) options.inline_ttl_ms * 1000000;
+    if (trusted && now < __atomic_load_n(&icache.trust_until, __ATOMIC_ACQUIRE))
+        ttl = (uint64_t) options.coherence_ttl_ms * 1000000;
+    /* 백엔드 breaker가 열려 있으면 대조하지 않고 그대로 씀 (닫히면 다시 대조) */
+    if (now - checked >= ttl && !brk_tripped(&backend_brk)) {
+        struct stat st;
+        int res = next_getattr(next, path, &st, NULL);
+        int same = res == 0 && inline_same(&st, &e->st);
+
+        pthread_mutex_lock(&icache.lock);
+        /* 이 호출로 breaker가 열렸으면 바뀐 것이 아님: 그대로 씀 */
+        if (!same && !(res < 0 && brk_tripped(&backend_brk))) {
+            if (e->linked) {
+                inline_unlink_locked(e);
+                __atomic_fetch_add(&icache.invalidations, 1, __ATOMIC_RELAXED);
+            }
+            int last = --e->refs == 0;
+            pthread_mutex_unlock(&icache.lock);
+            if (last)
+                inline_free(e);
+            return NULL;
+        }
+        if (same) {
+            e->checked_ns = now;
+            e->epoch = epoch;
+        }
+        pthread_mutex_unlock(&icache.lock);
+    }
+
+    pthread_mutex_lock(&icache.lock);
+    if (e->linked)
+        inline_touch_locked(e);
+    pthread_mutex_unlock(&icache.lock);
+    return e;
+}
+
+/* 다른 데몬이 path를 쓰는 중인지 */
+static int inline_pinned_locked(const char *path)
+{
+    for (struct inline_pin *p = icache.pins; p; p = p->next)
+        if (strcmp(p->path, path) == 0)
+            return 1;
+    return 0;
+}
+
+/* 다른 데몬이 path를 쓰기 시작(+1)/끝냄(-1): 그동안은 캐시하지 않음 */
+static void inline_pin(const char *path, int delta)
+{
+    struct inline_pin **pp, *p;
+
+    pthread_mutex_lock(&icache.lock);
+    for (pp = &icache.pins; (p = *pp) != NULL; pp = &p->next)
+        if (strcmp(p->path, path) == 0)
+            break;
+    if (delta > 0 && p == NULL && (p = calloc(1, sizeof(*p) + strlen(path) + 1)) != NULL) {
+        strcpy(p->path, path);
+        p->next = icache.pins;
+        icache.pins = p;
+        icache.npins++;
+        pp = &icache.pins;
+    }
+    if (p && (p->n += delta) == 0) {
+        *pp = p->next;
+        icache.npins--;
+        free(p);
+    }
+    pthread_mutex_unlock(&icache.lock);
+}
+
+/* 방금 연 핸들로 내용을 읽어 캐시에 넣음 (작은 일반 파일만) */
+static void inline_fill(int next, const char *path, struct fuse_file_info *fi)
+{
+    struct stat st;
+    unsigned long gen = __atomic_load_n(&icache.gen, __ATOMIC_ACQUIRE);
+    unsigned int epoch = __atomic_load_n(&icache.epoch, __ATOMIC_ACQUIRE);
+
+    /* 통계 파일은 크기가 0이고 열 때마다 새로 만들어짐 */
+    if (options.inline_budget == 0 || strcmp(path, STATS_PATH) == 0 ||
+        next_getattr(next, path, &st, fi) != 0 ||
+        !S_ISREG(st.st_mode) || (uint64_t) st.st_size > options.inline_max)
+        return;
+
+    struct inline_ent *e = calloc(1, sizeof(*e));
+    if (e == NULL)
+        return;
+    e->path = strdup(path);
+    e->data = malloc(st.st_size ? st.st_size : 1);
+    if (e->path == NULL || e->data == NULL) {
+        inline_free(e);
+        return;
+    }
+
+    int n = next_read(next, path, e->data, st.st_size, 0, fi);
+    struct stat after;
+    /* 읽는 도중 바뀌었으면 넣지 않음 */
+    if (n != st.st_size || next_getattr(next, path, &after, fi) != 0 ||
+        !inline_same(&st, &after)) {
+        inline_free(e);
+        return;
+    }
+
+    e->st = st;
+    e->cost = sizeof(*e) + strlen(path) + 1 + st.st_size;
+    e->checked_ns = now_ns();
+    e->epoch = epoch;
+    e->refs = 1;
+    e->linked = 1;
+
+    pthread_mutex_lock(&icache.lock);
+    /* 읽는 동안 (이 데몬이나 다른 데몬에서) 무효화됐거나 쓰는 중이면 넣지 않음 */
+    if (icache.gen != gen || inline_pinned_locked(path)) {
+        pthread_mutex_unlock(&icache.lock);
+        inline_free(e);
+        return;
+    }
+    struct inline_ent *old = inline_find_locked(path);
+    if (old)
+        inline_unlink_locked(old);
+
+    unsigned int b = path_hash(path) % INLINE_BUCKETS;
+    e->hnext = icache.table[b];
+    icache.table[b] = e;
+    e->next = icache.head;
+    if (icache.head)
+        icache.head->prev = e;
+    icache.head = e;
+    if (icache.tail == NULL)
+        icache.tail = e;
+    __atomic_fetch_add(&icache.bytes, e->cost, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&icache.entries, 1, __ATOMIC_RELAXED);
+
+    while (icache.bytes > options.inline_budget && icache.tail) {
+        inline_unlink_locked(icache.tail);
+        __atomic_fetch_add(&icache.evictions, 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&icache.lock);
+}
+
+/* path 자체와 (디렉토리 rename 대비) 그 아래 경로를 모두 무효화 */
+static void inline_invalidate(const char *path, int subtree)
+{
+    if (options.inline_budget == 0)
+        return;
+
+    size_t len = strlen(path);
+
+    pthread_mutex_lock(&icache.lock);
+    /* 이 변경 전에 읽기 시작한 inline_fill이 옛 내용을 넣지 못하게 */
+    __atomic_fetch_add(&icache.gen, 1, __ATOMIC_ACQ_REL);
+    if (!subtree) {
+        struct inline_ent *e = inline_find_locked(path);
+        if (e) {
+            inline_unlink_locked(e);
+            __atomic_fetch_add(&icache.invalidations, 1, __ATOMIC_RELAXED);
+        }
+    } else {
+        struct inline_ent *e = icache.head;
+        while (e) {
+            struct inline_ent *next = e->next;
+            if (strncmp(e->path, path, len) == 0 &&
+                (e->path[len] == '\0' || e->path[len] == '/')) {
+                inline_unlink_locked(e);
+                __atomic_fetch_add(&icache.invalidations, 1, __ATOMIC_RELAXED);
+            }
+            e = next;
+        }
+    }
+    pthread_mutex_unlock(&icache.lock);
+}
+
+/*
+ * 커널 readdir 캐시: 목록을 만든 시점의 디렉토리 mtime/ctime을 기억해 두고
+ * opendir 때 그대로면 keep_cache를 줘서 커널이 캐시된 목록을 재사용하게 한다.
+ * 우리가 디렉토리를 바꾸면 기록을 지우고 커널 쪽도 무효화(notify)한다.
+ * 표는 경로 해시로 직접 매핑 (충돌 시 덮어씀 = 캐시 이점만 잃음).
+ */
+#define DIRCACHE_SLOTS 1024
+
+struct dircache_slot {
+    char *path;
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    struct timespec ctime;
+};
+
+static struct {
+    pthread_mutex_t lock;
+    struct dircache_slot slot[DIRCACHE_SLOTS];
+    uint64_t kept, refilled;
+} dircache = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static int ts_equal(const struct timespec *a, const struct timespec *b)
+{
+    return a->tv_sec == b->tv_sec && a->tv_nsec == b->tv_nsec;
+}
+
+/* 마지막 목록 이후 디렉토리가 그대로인지 */
+static int dircache_unchanged(const char *path, const struct stat *st)
+{
+    struct dircache_slot *sl = &dircache.slot[path_hash(path) % DIRCACHE_SLOTS];
+
+    pthread_mutex_lock(&dircache.lock);
+    int same = sl->path && strcmp(sl->path, path) == 0 &&
+               sl->dev == st->st_dev && sl->ino == st->st_ino &&
+               ts_equal(&sl->mtime, &st->st_mtim) &&
+               ts_equal(&sl->ctime, &st->st_ctim);
+    if (same)
+        __atomic_fetch_add(&dircache.kept, 1, __ATOMIC_RELAXED);
+    else
+        __atomic_fetch_add(&dircache.refilled, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&dircache.lock);
+    return same;
+}
+
+/* st는 목록을 읽기 시작하기 전에 얻은 값 (도중에 바뀌면 다음 opendir에서 어긋남) */
+static void dircache_record(const char *path, const struct stat *st)
+{
+    struct dircache_slot *sl = &dircache.slot[path_hash(path) % DIRCACHE_SLOTS];
+    char *copy = NULL;
+
+    pthread_mutex_lock(&dircache.lock);
+    if (sl->path == NULL || strcmp(sl->path, path) != 0) {
+        copy = strdup(path);
+        if (copy == NULL) {
+            pthread_mutex_unlock(&dircache.lock);
+            return;
+        }
+        free(sl->path);
+        sl->path = copy;
+    }
+    sl->dev = st->st_dev;
+    sl->ino = st->st_ino;
+    sl->mtime = st->st_mtim;
+    sl->ctime = st->st_ctim;
+    pthread_mutex_unlock(&dircache.lock);
+}
+
+static void dircache_forget(const char *path)
+{
+    struct dircache_slot *sl = &dircache.slot[path_hash(path) % DIRCACHE_SLOTS];
+
+    pthread_mutex_lock(&dircache.lock);
+    if (sl->path && strcmp(sl->path, path) == 0) {
+        free(sl->path);
+        sl->path = NULL;
+    }
+    pthread_mutex_unlock(&dircache.lock);
+}
+
+/*
+ * 커널 캐시 무효화는 요청 처리 경로에서 부르면 교착 위험이 있으므로
+ * (libfuse 문서 참고) 큐에 넣고 별도 스레드에서 fuse_invalidate_path를 호출.
+ */
+#define INVAL_QUEUE 256
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    char *q[INVAL_QUEUE];
+    unsigned int head, tail;
+    int running;
+    int stop;
+    pthread_t thread;
+    struct fuse *fuse;
+    uint64_t sent, dropped;
+} inval = { .lock = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER };
+
+static void inval_queue(const char *path)
+{
+    if (!inval.running)
+        return;
+
+    char *copy = strdup(path);
+
+    pthread_mutex_lock(&inval.lock);
+    if (copy == NULL || inval.tail - inval.head == INVAL_QUEUE) {
+        /* 가득 차면 버림: 커널도 mtime 비교로 결국 다시 읽음 */
+        inval.dropped++;
+        free(copy);
+    } else {
+        inval.q[inval.tail++ % INVAL_QUEUE] = copy;
+        pthread_cond_signal(&inval.cond);
+    }
+    pthread_mutex_unlock(&inval.lock);
+}
+
+static void *inval_main(void *arg)
+{
+    (void) arg;
+
+    pthread_mutex_lock(&inval.lock);
+    for (;;) {
+        while (inval.head == inval.tail && !inval.stop)
+            pthread_cond_wait(&inval.cond, &inval.lock);
+        if (inval.head == inval.tail)
+            break;
+        char *path = inval.q[inval.head++ % INVAL_QUEUE];
+        pthread_mutex_unlock(&inval.lock);
+
+        /* 커널이 모르는 경로면 -ENOENT: 무효화할 것이 없다는 뜻 */
+        fuse_invalidate_path(inval.fuse, path);
+        free(path);
+
+        pthread_mutex_lock(&inval.lock);
+        inval.sent++;
+    }
+    pthread_mutex_unlock(&inval.lock);
+    return NULL;
+}
+
+static void inval_start(struct fuse *fuse)
+{
+    inval.fuse = fuse;
+    if (pthread_create(&inval.thread, NULL, inval_main, NULL) == 0)
+        inval.running = 1;
+}
+
+static void inval_stop(void)
+{
+    if (!inval.running)
+        return;
+    pthread_mutex_lock(&inval.lock);
+    inval.stop = 1;
+    pthread_cond_signal(&inval.cond);
+    pthread_mutex_unlock(&inval.lock);
+    pthread_join(inval.thread, NULL);
+    inval.running = 0;
+}
+
+/* path 항목이 생기거나 없어졌음: 부모 디렉토리의 목록 캐시를 버림 */
+static void dir_changed(const char *path)
+{
+    char parent[PATH_MAX];
+
+    snprintf(parent, sizeof(parent), "%s", path);
+    char *slash = strrchr(parent, '/');
+    if (slash == NULL)
+        return;
+    if (slash == parent)
+        slash[1] = '\0';
+    else
+        *slash = '\0';
+
+    dircache_forget(parent);
+    inval_queue(parent);
+}
+
+/*
+ * prefetch: 순차 읽기가 이어지는 핸들은 앞쪽 구간을, 어떤 파일을 연 직후
+ * 같은 프로세스가 늘 열던 파일("같이 열리는 파일")은 첫 구간을 별도 스레드가
+ * readahead(2)로 백엔드 page cache에 올려 둔다. 토큰 버킷으로 prefetch_bw를 넘지 않음.
+ * layer 스택을 거치지 않고 DIR_PATH를 직접 읽으므로 백엔드가 s3/remote이거나
+ * 파일 offset이 데이터 offset과 다르면 (erasure coding, interleaved 태그) 끈다.
+ *
+ * high-level API에서는 커널 nodeid를 알 수 없어 fuse_lowlevel_notify_store로
+ * FUSE 쪽 page cache를 직접 채울 수는 없다. 대신 READ가 오면 백엔드 I/O 없이
+ * 메모리에서 바로 응답하게 된다.
+ */
+#define PF_QUEUE   64
+#define PF_ASSOC   1024     /* "A 다음에 B를 연다" 기록 수 */
+#define PF_PIDS    64       /* 최근 연 파일을 기억하는 프로세스 수 */
+#define PF_MIN_WINDOW (128 * 1024)
+
+struct pf_job {
+    char *path;
+    off_t off;
+    size_t len;
+};
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct pf_job q[PF_QUEUE];
+    unsigned int head, tail;
+    int running;
+    int stop;
+    pthread_t thread;
+    /* 같이 열리는 파일 모델 */
+    struct { uint32_t hash; char *next; } assoc[PF_ASSOC];
+    struct { pid_t pid; char *path; uint64_t when_ns; } last[PF_PIDS];
+    uint64_t seq_jobs, assoc_jobs, dropped, bytes;
+} pf = { .lock = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER };
+
+static void pf_enqueue(const char *path, off_t off, size_t len, int assoc)
+{
+    char *copy = strdup(path);
+
+    pthread_mutex_lock(&pf.lock);
+    if (copy == NULL || pf.tail - pf.head == PF_QUEUE) {
+        __atomic_fetch_add(&pf.dropped, 1, __ATOMIC_RELAXED);
+        free(copy);
+    } else {
+        pf.q[pf.tail++ % PF_QUEUE] = (struct pf_job) { copy, off, len };
+        if (assoc)
+            __atomic_fetch_add(&pf.assoc_jobs, 1, __ATOMIC_RELAXED);
+        else
+            __atomic_fetch_add(&pf.seq_jobs, 1, __ATOMIC_RELAXED);
+        pthread_cond_signal(&pf.cond);
+    }
+    pthread_mutex_unlock(&pf.lock);
+}
+
+static void *pf_main(void *arg)
+{
+    (void) arg;
+    const double rate = (double) options.prefetch_bw * 1024 * 1024;   /* bytes/s */
+    double tokens = rate;
+    uint64_t last = now_ns();
+
+    pthread_mutex_lock(&pf.lock);
+    for (;;) {
+        while (pf.head == pf.tail && !pf.stop)
+            pthread_cond_wait(&pf.cond, &pf.lock);
+        if (pf.stop)
+            break;
+        struct pf_job job = pf.q[pf.head++ % PF_QUEUE];
+        pthread_mutex_unlock(&pf.lock);
+
+        /* 토큰 버킷: 최대 1초치까지 쌓이고, 모자라면 채워질 때까지 대기 */
+        for (;;) {
+            uint64_t now = now_ns();
+            tokens += rate * (now - last) / 1e9;
+            last = now;
+            if (tokens > rate)
+                tokens = rate;
+            if (tokens >= (double) job.len || tokens >= rate ||
+                __atomic_load_n(&pf.stop, __ATOMIC_RELAXED))
+                break;
+            double wait_us = (job.len - tokens) / rate * 1e6 + 1;
+            usleep(wait_us < 100000 ? (useconds_t) wait_us : 100000);
+        }
+        tokens -= job.len;
+
+        char fpath[PATH_MAX];
+        get_full_path(job.path, fpath, sizeof(fpath));
+        int fd = open(fpath, O_RDONLY | O_CLOEXEC);
+        if (fd != -1) {
+            readahead(fd, job.off, job.len);
+            close(fd);
+        }
+        free(job.path);
+
+        pthread_mutex_lock(&pf.lock);
+        __atomic_fetch_add(&pf.bytes, job.len, __ATOMIC_RELAXED);
+    }
+    /* 남은 작업 정리 */
+    while (pf.head != pf.tail)
+        free(pf.q[pf.head++ % PF_QUEUE].path);
+    pthread_mutex_unlock(&pf.lock);
+    return NULL;
+}
+
+static void pf_start(void)
+{
+    if (!WITH_PREFETCH || options.prefetch_bw == 0)
+        return;
+    if (pthread_create(&pf.thread, NULL, pf_main, NULL) == 0)
+        pf.running = 1;
+}
+
+static void pf_stop(void)
+{
+    if (!pf.running)
+        return;
+    pthread_mutex_lock(&pf.lock);
+    pf.stop = 1;
+    pthread_cond_signal(&pf.cond);
+    pthread_mutex_unlock(&pf.lock);
+    pthread_join(pf.thread, NULL);
+    pf.running = 0;
+}
+
+/* open 시: 같은 프로세스가 직전에 연 파일 -> 이 파일 관계를 기록하고, 이 파일 다음 것을 prefetch */
+static void pf_note_open(const char *path)
+{
+    if (!WITH_PREFETCH || !pf.running)
+        return;
+
+    struct fuse_context *ctx = fuse_get_context();
+    pid_t pid = ctx ? ctx->pid : 0;
+    uint32_t h = path_hash(path);
+    uint64_t now = now_ns();
+    char *next = NULL;
+    char *mine = strdup(path);
+
+    pthread_mutex_lock(&pf.lock);
+    unsigned int ps = (unsigned int) pid % PF_PIDS;
+    if (pf.last[ps].pid == pid && pf.last[ps].path &&
+        now - pf.last[ps].when_ns < 2000000000ull &&
+        strcmp(pf.last[ps].path, path) != 0) {
+        unsigned int as = path_hash(pf.last[ps].path) % PF_ASSOC;
+        pf.assoc[as].hash = path_hash(pf.last[ps].path);
+        free(pf.assoc[as].next);
+        pf.assoc[as].next = strdup(path);
+    }
+    if (mine) {
+        free(pf.last[ps].path);
+        pf.last[ps].pid = pid;
+        pf.last[ps].path = mine;
+        pf.last[ps].when_ns = now;
+    }
+    unsigned int as = h % PF_ASSOC;
+    if (pf.assoc[as].next && pf.assoc[as].hash == h)
+        next = strdup(pf.assoc[as].next);
+    pthread_mutex_unlock(&pf.lock);
+
+    if (next) {
+        pf_enqueue(next, 0, PF_MIN_WINDOW, 1);
+        free(next);
+    }
+}
+
+/* read 시: 순차 패턴이면 prefetch 창을 키워 가며 앞쪽을 요청 */
+static void pf_note_read(const char *path, struct basic_fh *fh, off_t offset, size_t got)
+{
+    if (!WITH_PREFETCH || !pf.running)
+        return;
+
+    if (offset == fh->next_off) {
+        fh->seq_run++;
+    } else {
+        fh->seq_run = 0;
+        fh->pf_until = 0;
+        fh->pf_window = 0;
+    }
+    fh->next_off = offset + got;
+
+    if (fh->seq_run < 2 || got == 0)
+        return;
+
+    /* 미리 읽어 둔 구간의 절반을 소비했으면 다음 창을 요청 */
+    if (fh->pf_until - fh->next_off > (off_t) fh->pf_window / 2)
+        return;
+
+    /* 요청이 크면 (max_pages 협상으로 최대 1 MiB) 창도 요청 두 개 이상부터 시작 */
+    size_t max = (size_t) options.prefetch_max * 1024;
+    size_t first = got * 2 > PF_MIN_WINDOW ? got * 2 : PF_MIN_WINDOW;
+    fh->pf_window = fh->pf_window ? fh->pf_window * 2 : first;
+    if (fh->pf_window > max)
+        fh->pf_window = max;
+
+    off_t start = fh->pf_until > fh->next_off ? fh->pf_until : fh->next_off;
+    pf_enqueue(path, start, fh->pf_window, 0);
+    fh->pf_until = start + fh->pf_window;
+}
+
+/*
+ * heat map: 샘플링된 read/write를 (inode) 및 (inode, 구간) 단위로 집계.
+ * count-min sketch로 빈도를 추정하고, 추정치가 큰 키만 top-k 표에 남긴다.
+ * 파일 수와 무관하게 메모리는 sketch + top-k 표 크기로 고정.
+ */
+#define HEAT_DEPTH 4
+#define HEAT_WIDTH 4096
+#define HEAT_TOPK  32
+#define HEAT_FILE_BLOCK UINT64_MAX  /* 파일 단위 키의 block 값 */
+
+struct heat_entry {
+    dev_t dev;
+    ino_t ino;
+    uint64_t block;
+    uint32_t est;           /* sketch 추정치 (샘플 단위) */
+    uint32_t reads;
+    uint32_t writes;
+    char path[SLOW_PATH_MAX];
+};
+
+static struct {
+    pthread_mutex_t lock;
+    uint32_t cms[HEAT_DEPTH][HEAT_WIDTH];
+    struct heat_entry files[HEAT_TOPK];
+    struct heat_entry ranges[HEAT_TOPK];
+    int nfiles;
+    int nranges;
+    uint64_t samples;
+    time_t next_decay;
+} heat = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static __thread unsigned int heat_tick;
+
+static uint64_t mix64(uint64_t x)
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdull;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ull;
+    x ^= x >> 33;
+    return x;
+}
+
+static void heat_decay(void)
+{
+    for (int d = 0; d < HEAT_DEPTH; d++)
+        for (int w = 0; w < HEAT_WIDTH; w++)
+            heat.cms[d][w] >>= 1;
+    for (int i = 0; i < heat.nfiles; i++)
+        heat.files[i].est >>= 1;
+    for (int i = 0; i < heat.nranges; i++)
+        heat.ranges[i].est >>= 1;
+}
+
+/* sketch 갱신 후 추정치(행별 최소값) 반환 */
+static uint32_t heat_cms_add(dev_t dev, ino_t ino, uint64_t block)
+{
+    uint64_t h = mix64(mix64((uint64_t) dev ^ ((uint64_t) ino << 1)) ^ block);
+    uint32_t est = UINT32_MAX;
+
+    for (int d = 0; d < HEAT_DEPTH; d++) {
+        uint32_t *c = &heat.cms[d][mix64(h + d) % HEAT_WIDTH];
+        if (*c < UINT32_MAX)
+            (*c)++;
+        if (*c < est)
+            est = *c;
+    }
+    return est;
+}
+
+static void heat_topk_update(struct heat_entry *tab, int *n, dev_t dev, ino_t ino,
+                             uint64_t block, uint32_t est, int is_write,
+                             const char *path)
+{
+    struct heat_entry *e = NULL;
+    int min = 0;
+
+    for (int i = 0; i < *n; i++) {
+        if (tab[i].ino == ino && tab[i].dev == dev && tab[i].block == block) {
+            e = &tab[i];
+            break;
+        }
+        if (tab[i].est < tab[min].est)
+            min = i;
+    }
+
+    if (e == NULL) {
+        if (*n < HEAT_TOPK)
+            e = &tab[(*n)++];
+        else if (est > tab[min].est)
+            e = &tab[min];
+        else
+            return;
+        e->dev = dev;
+        e->ino = ino;
+        e->block = block;
+        e->reads = e->writes = 0;
+        snprintf(e->path, sizeof(e->path), "%s", path);
+    }
+
+    e->est = est;
+    if (is_write)
+        e->writes++;
+    else
+        e->reads++;
+}
+
+static void heat_note(const char *path, int fd, off_t offset, size_t size, int is_write)
+{
+    if (!WITH_HEAT || options.heat_sample == 0 || ++heat_tick % options.heat_sample)
+        return;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1)
+        return;
+
+    uint64_t bsz = options.heat_block ? options.heat_block : 1;
+    uint64_t first = (uint64_t) offset / bsz;
+    uint64_t last = size ? ((uint64_t) offset + size - 1) / bsz : first;
+    time_t now = time(NULL);
+
+    pthread_mutex_lock(&heat.lock);
+    if (options.heat_halflife && now >= heat.next_decay) {
+        if (heat.next_decay)
+            heat_decay();
+        heat.next_decay = now + options.heat_halflife;
+    }
+    heat.samples++;
+
+    uint32_t est = heat_cms_add(st.st_dev, st.st_ino, HEAT_FILE_BLOCK);
+    heat_topk_update(heat.files, &heat.nfiles, st.st_dev, st.st_ino,
+                     HEAT_FILE_BLOCK, est, is_write, path);
+
+    /* 큰 요청이 sketch를 독점하지 않도록 구간은 최대 8개까지만 */
+    for (uint64_t b = first; b <= last && b < first + 8; b++) {
+        est = heat_cms_add(st.st_dev, st.st_ino, b);
+        heat_topk_update(heat.ranges, &heat.nranges, st.st_dev, st.st_ino,
+                         b, est, is_write, path);
+    }
+    pthread_mutex_unlock(&heat.lock);
+}
+
+static int heat_cmp(const void *a, const void *b)
+{
+    const struct heat_entry *x = a, *y = b;
+    return x->est < y->est ? 1 : x->est > y->est ? -1 : 0;
+}
+
+static void heat_render(FILE *out)
+{
+    struct heat_entry files[HEAT_TOPK], ranges[HEAT_TOPK];
+    int nfiles, nranges;
+    uint64_t samples;
+
+    pthread_mutex_lock(&heat.lock);
+    nfiles = heat.nfiles;
+    nranges = heat.nranges;
+    samples = heat.samples;
+    memcpy(files, heat.files, sizeof(files[0]) * nfiles);
+    memcpy(ranges, heat.ranges, sizeof(ranges[0]) * nranges);
+    pthread_mutex_unlock(&heat.lock);
+
+    qsort(files, nfiles, sizeof(files[0]), heat_cmp);
+    qsort(ranges, nranges, sizeof(ranges[0]), heat_cmp);
+
+    fprintf(out, "\n# hot files (1/%u sampled, %llu samples, halflife %us)\n"
+                 "# est reads writes ino path\n",
+            options.heat_sample, (unsigned long long) samples, options.heat_halflife);
+    for (int i = 0; i < nfiles; i++)
+        fprintf(out, "%u %u %u %llu %s\n", files[i].est, files[i].reads,
+                files[i].writes, (unsigned long long) files[i].ino, files[i].path);
+
+    fprintf(out, "\n# hot ranges (%u bytes)\n# est reads writes ino offset path\n",
+            options.heat_block);
+    for (int i = 0; i < nranges; i++)
+        fprintf(out, "%u %u %u %llu %llu %s\n", ranges[i].est, ranges[i].reads,
+                ranges[i].writes, (unsigned long long) ranges[i].ino,
+                (unsigned long long) ranges[i].block * options.heat_block,
+                ranges[i].path);
+}
+
+/*
+ * BLAKE3 (keyed): 무결성 태그 계산용.
+ * 1 KiB chunk들이 서로 독립이라 B3_LANES개 chunk를 벡터 레인에 나눠 동시에
+ * 압축하고(GCC vector extension, -mavx2 등으로 빌드하면 더 넓은 레지스터 사용),
+ * 여러 블록에 걸친 요청은 hash pool 스레드들이 블록 단위로 나눠 계산한다.
+ */
+#define B3_CHUNK 1024
+#define B3_LANES 8
+
+enum {
+    B3_CHUNK_START = 1 << 0,
+    B3_CHUNK_END = 1 << 1,
+    B3_PARENT = 1 << 2,
+    B3_ROOT = 1 << 3,
+    B3_KEYED = 1 << 4,
+};
+
+static const uint32_t b3_iv[8] = {
+    0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+    0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19,
+};
+
+/* 라운드마다 메시지 워드 순서 (permutation을 미리 적용한 표) */
+static const uint8_t b3_sched[7][16] = {
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+    {2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8},
+    {3, 4, 10, 12, 13, 2, 7, 14, 6, 5, 9, 0, 11, 15, 8, 1},
+    {10, 7, 12, 9, 14, 3, 13, 15, 4, 0, 11, 2, 5, 8, 1, 6},
+    {12, 13, 9, 11, 15, 10, 14, 8, 7, 2, 5, 3, 0, 1, 6, 4},
+    {9, 14, 11, 5, 8, 12, 15, 1, 13, 3, 0, 10, 2, 6, 4, 7},
+    {11, 15, 5, 0, 1, 9, 8, 6, 14, 10, 2, 12, 3, 4, 7, 13},
+};
+
+/* 키(또는 IV)와 모드 플래그: 키 없는 해시는 words = IV, flags = 0 */
+struct b3_key {
+    uint32_t words[8];
+    uint32_t flags;
+};
+
+/* 스칼라와 벡터(레인) 버전이 같이 쓰는 라운드 함수 */
+#define B3_ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+#define B3_G(v, a, b, c, d, x, y) do {                                 \
+        v[a] = v[a] + v[b] + (x); v[d] = B3_ROTR(v[d] ^ v[a], 16);      \
+        v[c] = v[c] + v[d];       v[b] = B3_ROTR(v[b] ^ v[c], 12);      \
+        v[a] = v[a] + v[b] + (y); v[d] = B3_ROTR(v[d] ^ v[a], 8);       \
+        v[c] = v[c] + v[d];       v[b] = B3_ROTR(v[b] ^ v[c], 7);       \
+    } while (0)
+#define B3_ROUNDS(v, m) do {                                            \
+        for (int r_ = 0; r_ < 7; r_++) {                                \
+            const uint8_t *s_ = b3_sched[r_];                           \
+            B3_G(v, 0, 4, 8, 12, m[s_[0]], m[s_[1]]);                   \
+            B3_G(v, 1, 5, 9, 13, m[s_[2]], m[s_[3]]);                   \
+            B3_G(v, 2, 6, 10, 14, m[s_[4]], m[s_[5]]);                  \
+            B3_G(v, 3, 7, 11, 15, m[s_[6]], m[s_[7]]);                  \
+            B3_G(v, 0, 5, 10, 15, m[s_[8]], m[s_[9]]);                  \
+            B3_G(v, 1, 6, 11, 12, m[s_[10]], m[s_[11]]);                \
+            B3_G(v, 2, 7, 8, 13, m[s_[12]], m[s_[13]]);                 \
+            B3_G(v, 3, 4, 9, 14, m[s_[14]], m[s_[15]]);                 \
+        }                                                               \
+    } while (0)
+
+static inline uint32_t load32(const uint8_t *p)
+{
+    return (uint32_t) p[0] | (uint32_t) p[1] << 8 |
+           (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+static inline void store32(uint8_t *p, uint32_t w)
+{
+    p[0] = w;
+    p[1] = w >> 8;
+    p[2] = w >> 16;
+    p[3] = w >> 24;
+}
+
+/* 64바이트 블록 하나 압축, cv를 제자리에서 갱신 */
+static void b3_compress(uint32_t cv[8], const uint8_t block[64], uint32_t len,
+                        uint64_t counter, uint32_t flags)
+{
+    uint32_t m[16], v[16];
+
+    for (int i = 0; i < 16; i++)
+        m[i] = load32(block + 4 * i);
+    memcpy(v, cv, 8 * sizeof(uint32_t));
+    memcpy(v + 8, b3_iv, 4 * sizeof(uint32_t));
+    v[12] = (uint32_t) counter;
+    v[13] = (uint32_t) (counter >> 32);
+    v[14] = len;
+    v[15] = flags;
+    B3_ROUNDS(v, m);
+    for (int i = 0; i < 8; i++)
+        cv[i] = v[i] ^ v[i + 8];
+}
+
+/* chunk 하나(<= 1 KiB)의 chaining value */
+static void b3_chunk(const struct b3_key *k, const uint8_t *in, size_t len,
+                     uint64_t counter, int root, uint32_t cv[8])
+{
+    size_t off = 0;
+
+    memcpy(cv, k->words, sizeof(k->words));
+    do {
+        uint8_t block[64] = {0};
+        size_t n = len - off < 64 ? len - off : 64;
+        uint32_t flags = k->flags;
+
+        memcpy(block, in + off, n);
+        if (off == 0)
+            flags |= B3_CHUNK_START;
+        if (off + n == len)
+            flags |= B3_CHUNK_END | (root ? B3_ROOT : 0);
+        b3_compress(cv, block, n, counter, flags);
+        off += n;
+    } while (off < len);
+}
+
+static void b3_parent(const struct b3_key *k, const uint32_t l[8], const uint32_t r[8],
+                      int root, uint32_t cv[8])
+{
+    uint8_t block[64];
+
+    for (int i = 0; i < 8; i++) {
+        store32(block + 4 * i, l[i]);
+        store32(block + 32 + 4 * i, r[i]);
+    }
+    memcpy(cv, k->words, sizeof(k->words));
+    b3_compress(cv, block, 64, 0, k->flags | B3_PARENT | (root ? B3_ROOT : 0));
+}
+
+typedef uint32_t b3_vec __attribute__((vector_size(4 * B3_LANES)));
+
+/* 연속된 꽉 찬 chunk B3_LANES개를 레인별로 동시에 압축 */
+static void b3_chunks_lanes(const struct b3_key *k, const uint8_t *in,
+                            uint64_t counter, uint32_t cvs[B3_LANES][8])
+{
+    b3_vec h[8], v[16], m[16];
+
+    for (int i = 0; i < 8; i++)
+        h[i] = (b3_vec) {0} + k->words[i];
+
+    for (int b = 0; b < B3_CHUNK / 64; b++) {
+        for (int w = 0; w < 16; w++)
+            for (int l = 0; l < B3_LANES; l++)
+                m[w][l] = load32(in + (size_t) l * B3_CHUNK + b * 64 + 4 * w);
+
+        uint32_t flags = k->flags | (b == 0 ? B3_CHUNK_START : 0) |
+                         (b == B3_CHUNK / 64 - 1 ? B3_CHUNK_END : 0);
+        for (int i = 0; i < 8; i++)
+            v[i] = h[i];
+        for (int i = 0; i < 4; i++)
+            v[8 + i] = (b3_vec) {0} + b3_iv[i];
+        for (int l = 0; l < B3_LANES; l++) {
+            v[12][l] = (uint32_t) (counter + l);
+            v[13][l] = (uint32_t) ((counter + l) >> 32);
+        }
+        v[14] = (b3_vec) {0} + 64;
+        v[15] = (b3_vec) {0} + flags;
+        B3_ROUNDS(v, m);
+        for (int i = 0; i < 8; i++)
+            h[i] = v[i] ^ v[i + 8];
+    }
+
+    for (int l = 0; l < B3_LANES; l++)
+        for (int i = 0; i < 8; i++)
+            cvs[l][i] = h[i][l];
+}
+
+/*
+ * chunk 번호 chunk에서 시작하는 len바이트 부분 트리의 chaining value.
+ * 왼쪽 부분 트리는 len보다 작은 가장 큰 2의 거듭제곱 chunk 수를 가진다.
+ */
+static void b3_tree(const struct b3_key *k, const uint8_t *in, size_t len,
+                    uint64_t chunk, int root, uint32_t cv[8])
+{
+    if (len <= B3_CHUNK) {
+        b3_chunk(k, in, len, chunk, root, cv);
+        return;
+    }
+
+    if (!root && len == B3_LANES * B3_CHUNK) {
+        uint32_t cvs[B3_LANES][8];
+        b3_chunks_lanes(k, in, chunk, cvs);
+        for (int n = B3_LANES; n > 1; n /= 2)
+            for (int i = 0; i < n / 2; i++)
+                b3_parent(k, cvs[2 * i], cvs[2 * i + 1], 0, cvs[i]);
+        memcpy(cv, cvs[0], sizeof(cvs[0]));
+        return;
+    }
+
+    size_t left = B3_CHUNK;
+    while (2 * left < len)
+        left *= 2;
+
+    uint32_t l[8], r[8];
+    b3_tree(k, in, left, chunk, 0, l);
+    b3_tree(k, in + left, len - left, chunk + left / B3_CHUNK, 0, r);
+    b3_parent(k, l, r, root, cv);
+}
+
+/* 입력 전체의 32바이트 해시 (keyed 모드면 MAC) */
+static void b3_hash(const struct b3_key *k, const void *in, size_t len, uint8_t out[32])
+{
+    uint32_t cv[8];
+
+    b3_tree(k, in, len, 0, 1, cv);
+    for (int i = 0; i < 8; i++)
+        store32(out + 4 * i, cv[i]);
+}
+
+/*
+ * CRC32C: 변조 방지가 아닌 bit-rot 검출용 체크섬. SSE4.2가 있으면 crc32
+ * 명령으로 8바이트씩, 없으면 표 기반으로 계산한다.
+ */
+static uint32_t crc32c_table[256];
+
+static void crc32c_init(void)
+{
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++)
+            c = c & 1 ? (c >> 1) ^ 0x82F63B78 : c >> 1;
+        crc32c_table[i] = c;
+    }
+}
+
+static uint32_t crc32c_sw(uint32_t crc, const uint8_t *p, size_t n)
+{
+    crc = ~crc;
+    while (n--)
+        crc = crc32c_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw(uint32_t crc, const uint8_t *p, size_t n)
+{
+    uint64_t c = ~crc;
+    for (; n >= 8; n -= 8, p += 8) {
+        uint64_t w;
+        memcpy(&w, p, sizeof(w));
+        c = __builtin_ia32_crc32di(c, w);
+    }
+    while (n--)
+        c = __builtin_ia32_crc32qi(c, *p++);
+    return ~(uint32_t) c;
+}
+#endif
+
+static uint32_t crc32c(uint32_t crc, const void *p, size_t n)
+{
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("sse4.2"))
+        return crc32c_hw(crc, p, n);
+#endif
+    return crc32c_sw(crc, p, n);
+}
+
+/*
+ * hash pool: 여러 블록짜리 요청의 태그 계산을 나눠 맡는 스레드들.
+ * 요청한 스레드도 같이 블록을 가져가 계산하므로 pool이 바빠도 멈추지 않는다.
+ */
+struct hash_job {
+    void (*fn)(void *arg, unsigned int i);
+    void *arg;
+    unsigned int n;         /* 전체 작업 수 */
+    unsigned int next;      /* 다음에 가져갈 번호 (hpool.lock) */
+    unsigned int done;
+    struct hash_job *qnext;
+};
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;        /* 새 작업 */
+    pthread_cond_t done;        /* 작업 완료 */
+    struct hash_job *head, *tail;
+    pthread_t *threads;
+    unsigned int nthreads;
+    int stop;
+} hpool = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+    .done = PTHREAD_COND_INITIALIZER,
+};
+
+/* lock을 쥔 상태에서 job의 다음 번호를 가져감, 다 나갔으면 큐에서 뺌
+ * (큐에는 아직 나눠 줄 번호가 남은 job만 있음) */
+static int hpool_take_locked(struct hash_job *job, unsigned int *i)
+{
+    if (job->next >= job->n)
+        return 0;
+    *i = job->next++;
+    if (job->next == job->n) {
+        struct hash_job **pp = &hpool.head, *prev = NULL;
+        while (*pp != job) {
+            prev = *pp;
+            pp = &prev->qnext;
+        }
+        *pp = job->qnext;
+        if (hpool.tail == job)
+            hpool.tail = prev;
+    }
+    return 1;
+}
+
+static void hpool_finish_locked(struct hash_job *job)
+{
+    if (++job->done == job->n)
+        pthread_cond_broadcast(&hpool.done);
+}
+
+static void *hpool_main(void *arg)
+{
+    (void) arg;
+
+    pthread_mutex_lock(&hpool.lock);
+    while (!hpool.stop) {
+        struct hash_job *job = hpool.head;
+        unsigned int i;
+
+        if (job == NULL) {
+            pthread_cond_wait(&hpool.cond, &hpool.lock);
+            continue;
+        }
+        if (!hpool_take_locked(job, &i))
+            continue;       /* 큐에는 남은 번호가 있는 job만 있으므로 오지 않음 */
+        pthread_mutex_unlock(&hpool.lock);
+        job->fn(job->arg, i);
+        pthread_mutex_lock(&hpool.lock);
+        hpool_finish_locked(job);
+    }
+    pthread_mutex_unlock(&hpool.lock);
+    return NULL;
+}
+
+/* fn(arg, 0..n-1)을 pool과 나눠 실행하고 모두 끝날 때까지 기다림 */
+static void hpool_run(void (*fn)(void *, unsigned int), void *arg, unsigned int n)
+{
+    if (n <= 1 || hpool.nthreads == 0) {
+        for (unsigned int i = 0; i < n; i++)
+            fn(arg, i);
+        return;
+    }
+
+    struct hash_job job = { .fn = fn, .arg = arg, .n = n };
+    unsigned int i;
+
+    pthread_mutex_lock(&hpool.lock);
+    if (hpool.tail)
+        hpool.tail->qnext = &job;
+    else
+        hpool.head = &job;
+    hpool.tail = &job;
+    pthread_cond_broadcast(&hpool.cond);
+
+    while (hpool_take_locked(&job, &i)) {
+        pthread_mutex_unlock(&hpool.lock);
+        fn(arg, i);
+        pthread_mutex_lock(&hpool.lock);
+        hpool_finish_locked(&job);
+    }
+    while (job.done < job.n)
+        pthread_cond_wait(&hpool.done, &hpool.lock);
+    pthread_mutex_unlock(&hpool.lock);
+}
+
+static void hpool_start(unsigned int n)
+{
+    hpool.threads = calloc(n, sizeof(*hpool.threads));
+    if (hpool.threads == NULL)
+        return;
+    for (unsigned int i = 0; i < n; i++) {
+        if (pthread_create(&hpool.threads[hpool.nthreads], NULL, hpool_main, NULL) != 0)
+            break;
+        hpool.nthreads++;
+    }
+}
+
+static void hpool_stop(void)
+{
+    pthread_mutex_lock(&hpool.lock);
+    hpool.stop = 1;
+    pthread_cond_broadcast(&hpool.cond);
+    pthread_mutex_unlock(&hpool.lock);
+    for (unsigned int i = 0; i < hpool.nthreads; i++)
+        pthread_join(hpool.threads[i], NULL);
+    free(hpool.threads);
+    hpool.threads = NULL;
+    hpool.nthreads = 0;
+}
+
+/* read 검증 방식 (integrity_verify, 경로별 "@방식") */
+enum { VERIFY_STRICT, VERIFY_FIRST, VERIFY_SAMPLED, VERIFY_BACKGROUND, VERIFY_MODES };
+
+static const char *const verify_names[VERIFY_MODES] = {
+    "strict", "first-touch", "sampled", "background",
+};
+
+/* integrity layer 통계 (layer는 아래 스택 부분에 있음) */
+static struct {
+    unsigned long long hashed;      /* 태그를 계산한 블록 수 */
+    unsigned long long hashed_bytes;
+    unsigned long long verified;    /* 검증에 성공한 블록 수 */
+    unsigned long long failures;    /* 태그 불일치 (블록 또는 root) */
+    unsigned long long adopted;     /* sidecar 없이 열려 현재 내용으로 태그를 만든 파일 */
+    unsigned long long unclean;     /* dirty로 남아 root 대신 블록을 모두 검증한 파일 */
+    unsigned long long checked[VERIFY_MODES];   /* 방식별 검증한 블록 */
+    unsigned long long skipped[VERIFY_MODES];   /* 방식별 검증 없이 읽은 블록 */
+    unsigned long long scrub_passes;
+    unsigned long long scrub_files;
+    unsigned long long rekeyed;     /* 새 키로 다시 계산을 마친 파일 */
+} istat;
+
+/* mirror layer 상태 (layer는 아래 스택 부분에 있음) */
+#define MIRROR_MAX 8        /* DIR_PATH 포함 */
+_Static_assert(sizeof(((struct basic_fh *) 0)->mfd) / sizeof(int) == MIRROR_MAX, "basic_fh.mfd");
+
+static struct {
+    int n;                          /* 복제본 수 (DIR_PATH 포함) */
+    char *root[MIRROR_MAX];         /* [0]은 DIR_PATH */
+    int failed[MIRROR_MAX];
+    unsigned int inflight[MIRROR_MAX];      /* 진행 중인 read (queue depth) */
+    struct breaker brk[MIRROR_MAX];         /* breaker_ms: 복제본별 read 건강 */
+    unsigned long long reads[MIRROR_MAX];
+    unsigned long long repairs;     /* 다른 복제본에서 고친 구간 */
+    unsigned long long repair_failures;
+    unsigned long long gen;         /* 세대: 복제본이 실패로 표시될 때마다 올라감 */
+    pthread_mutex_t gen_lock;
+} mirror = { .n = 1, .gen_lock = PTHREAD_MUTEX_INITIALIZER };
+
+/* erasure coding (mirror_ec=K) 상태: 루트 n개 = 데이터 조각 K개 + parity n-K개 */
+static struct {
+    int k;                          /* 0이면 복제 (mirror) */
+    unsigned int cell;              /* stripe 하나에서 조각 하나가 갖는 크기 */
+    uint8_t gen[MIRROR_MAX][MIRROR_MAX];    /* parity p = sum gen[p][j] * 데이터 j */
+    unsigned long long full;        /* log 없이 바로 쓴 stripe */
+    unsigned long long logged;      /* log로 간 부분 stripe write */
+    unsigned long long logged_bytes;
+    unsigned long long flushes;     /* log를 stripe에 반영한 횟수 */
+    unsigned long long degraded;    /* 빠진 데이터 조각을 parity로 복원한 read */
+} ec;
+
+/* mirror layer의 hedged read 상태 */
+#define HEDGE_THREADS 16
+#define HEDGE_QUEUE 256
+#define HEDGE_BUCKETS 256       /* 2의 거듭제곱 구간마다 4칸 */
+#define HEDGE_WINDOW 4096       /* 이만큼 기록할 때마다 기준을 다시 계산하고 절반으로 감쇠 */
+
+struct hedge_req {
+    struct basic_fh *fh;
+    off_t off;
+    size_t size;
+    int replica[2];
+    char *buf[2];
+    int res[2];
+    int issued;
+    int done;
+    int winner;                 /* -1이면 아직 */
+    unsigned int refs;          /* 요청한 워커 + 큐/진행 중인 작업 */
+};
+
+struct hedge_job {
+    struct hedge_req *req;
+    int slot;
+};
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;        /* 작업이 들어옴 */
+    pthread_cond_t done;        /* 작업이 끝남 (워커, release가 기다림) */
+    pthread_t threads[HEDGE_THREADS];
+    int nthreads;
+    int stop;
+    struct hedge_job q[HEDGE_QUEUE];
+    unsigned int head, tail;
+    double pct;                 /* mirror_hedge, 0이면 끔 */
+    unsigned int hist[HEDGE_BUCKETS];
+    unsigned int samples;
+    uint64_t threshold_ns;      /* 0이면 아직 표본이 모자람 */
+    unsigned long long hedged;  /* 두 번째 read를 보낸 수 */
+    unsigned long long wins;    /* 두 번째 read가 이긴 수 */
+    unsigned long long cancelled;   /* 시작 전에 버린 read */
+} hedge = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+    .done = PTHREAD_COND_INITIALIZER,
+};
+
+/* object store backend (s3=URL) 상태 (layer는 아래 스택 부분에 있음) */
+enum { S3_HEAD, S3_GET, S3_PUT, S3_LIST, S3_DELETE, S3_COPY, S3_PART, S3_REQ_KINDS };
+
+static const char *const s3_req_names[S3_REQ_KINDS] = {
+    "head", "get", "put", "list", "delete", "copy", "multipart",
+};
+
+static struct {
+    int on;
+    char host[256];             /* Host 헤더 ("host" 또는 "host:port") */
+    char bucket[256];
+    struct sockaddr_storage addr;
+    socklen_t addrlen;
+    char key_id[128];           /* 비어 있으면 서명하지 않음 */
+    char secret[128];
+    char region[64];
+    pthread_mutex_t lock;       /* idle 연결 목록 */
+    struct s3_conn *idle;
+    unsigned int nidle;
+    unsigned long long reqs[S3_REQ_KINDS];
+    unsigned long long errors;
+    unsigned long long connects;
+    unsigned long long rx_bytes, tx_bytes;
+    unsigned long long attr_hits, attr_misses;
+    unsigned long long ra_hits; /* readahead 버퍼에서 바로 답한 read */
+    unsigned long long uploads; /* 완료한 multipart upload */
+} s3 = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+/* remote backend (remote=ADDR) 상태, 메시지 종류는 wire 형식이라 순서를 바꾸지 않음 */
+enum {
+    RPC_HELLO, RPC_LSTAT, RPC_OPEN, RPC_CLOSE, RPC_PREAD, RPC_PWRITE, RPC_READDIR,
+    RPC_UNLINK, RPC_RENAME, RPC_MKDIR, RPC_RMDIR, RPC_CHMOD, RPC_TRUNCATE,
+    RPC_FTRUNCATE, RPC_UTIMENS, RPC_FSYNC, RPC_OPS
+};
+
+static const char *const rpc_op_names[RPC_OPS] = {
+    "hello", "lstat", "open", "close", "pread", "pwrite", "readdir", "unlink", "rename",
+    "mkdir", "rmdir", "chmod", "truncate", "ftruncate", "utimens", "fsync",
+};
+
+static struct {
+    unsigned int n;             /* 연결 수, 0이면 꺼짐 */
+    struct remote_conn *conns;
+    unsigned int rr;            /* open을 연결에 돌아가며 나눔 */
+    unsigned long long calls[RPC_OPS];
+    unsigned long long errors;  /* -errno로 끝난 요청 (ENOENT 등 포함) */
+    unsigned long long reconnects;
+    unsigned long long frames, writes;  /* 보낸 프레임 / 그에 든 sendmsg (서버도 셈) */
+} remote;
+
+/* cache coherence (coherence=ADDR) 상태, 피어별 상태는 아래 coh_peer */
+#define COH_SUBTREE 1               /* 무효화 flags: 아래 경로 모두 (rename) */
+#define COH_PIN 2                   /* 보낸 쪽이 쓰기 시작함: close까지 캐시하지 않음 */
+#define COH_UNPIN 4                 /* 그 쓰기가 끝남 */
+
+static struct {
+    unsigned int n;             /* 피어 수, 0이면 꺼짐 */
+    struct coh_peer *peer;
+    int lfd;
+    int stop;
+    pthread_t listener;
+    unsigned int up;            /* 우리가 맺은 연결이 살아 있는 피어 */
+    unsigned long long published;   /* 보낸 무효화 (피어 수와 무관하게 1번) */
+    unsigned long long received;
+    unsigned long long timeouts;    /* 응답 없이 lease가 끝나 진행한 피어 */
+    unsigned long long lapses;  /* 피어의 lease가 끊겼다 이어진 수 */
+    unsigned long long wait_ns; /* 무효화 응답을 기다린 총 시간 */
+} coh = { .lfd = -1 };
+
+/* peer cache (peer_cache=ADDR) 상태, 블록은 아래 struct pblock */
+#define PCACHE_BUCKETS 4096
+#define PCACHE_PEERS_MAX 16
+
+static struct {
+    int on;
+    int next;                   /* peer layer 아래 layer 번호 (주인으로서 읽을 때) */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;        /* 채우는 중인 블록이 끝남 */
+    struct pblock *table[PCACHE_BUCKETS];
+    struct pblock *head, *tail; /* LRU */
+    unsigned long bytes;
+    unsigned long blocks;
+    unsigned int npeers;
+    struct pcache_peer *peer;
+    struct pcache_ring *ring;   /* 가상 노드들, point 순 */
+    unsigned int nring;
+    unsigned long long hits;    /* 내 캐시에 있던 블록 (주인으로서 답한 것 포함) */
+    unsigned long long peer_hits;   /* 주인에게 받은 블록 */
+    unsigned long long loads;   /* 아래 layer에서 읽은 블록 */
+    unsigned long long served;  /* 다른 노드에 답한 요청 */
+    unsigned long long stale;   /* 주인의 파일이 요청과 달라 직접 읽음 */
+    unsigned long long peer_errors;
+    unsigned long long evictions;
+    unsigned long long reconnects;
+} pcache = { .lock = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER };
+
+/* write-behind (write_behind=DIR) 상태, journal 형식은 아래 struct wb_rec */
+#define WB_BUCKETS 1024
+
+static struct {
+    int on;
+    int next;                   /* write-behind layer 아래 layer 번호 (uploader가 씀) */
+    int backend_sync;           /* fsync가 백엔드까지 기다림 */
+    pthread_mutex_t lock;
+    pthread_cond_t work;        /* uploader를 깨움 */
+    pthread_cond_t done;        /* upload가 끝났거나 journal 공간이 생김 */
+    pthread_cond_t synced;      /* segment fdatasync가 끝남 */
+    struct wb_file *table[WB_BUCKETS];
+    struct wb_file *qhead, *qtail;  /* 올릴 write가 있는 파일, 오래된 것부터 */
+    struct wb_seg *segs, *cur;  /* journal segment, 새 기록은 cur에 */
+    uint64_t seq, seg_id;
+    unsigned long disk;         /* segment 파일 크기 합 */
+    unsigned long pending;      /* 아직 올리지 않은 write 바이트 */
+    unsigned int nfiles;
+    unsigned int waiting;       /* journal이 차서 기다리는 writer */
+    int failing;                /* 마지막 upload가 실패함 */
+    int stop, running;
+    pthread_t thread;
+    unsigned long long writes;  /* journal에 받은 write */
+    unsigned long long syncs;   /* journal fdatasync (여러 write가 하나를 같이 씀) */
+    unsigned long long batches, uploaded;   /* 백엔드에 쓴 묶음 / 바이트 */
+    unsigned long long flushes; /* fsync, truncate 등이 upload를 기다린 수 */
+    unsigned long long errors;
+    unsigned long long recovered;   /* 시작할 때 journal에서 되살린 write */
+} wb = {
+    .lock = PTHREAD_MUTEX_INITIALIZER, .work = PTHREAD_COND_INITIALIZER,
+    .done = PTHREAD_COND_INITIALIZER, .synced = PTHREAD_COND_INITIALIZER,
+};
+
+/* offline (offline=DIR) 상태: 사본은 DIR/data 아래 같은 경로, 변경 기록은 DIR/log */
+#define OFF_BUCKETS 1024
+#define OFF_FETCH_MAX 1024          /* 사본을 받을 경로 대기열 상한 */
+
+enum { OFF_ONLINE, OFF_OFFLINE, OFF_REPLAY };
+
+static struct {
+    int on;
+    int next;                   /* offline layer 아래 layer 번호 */
+    int state;                  /* OFF_*: ONLINE이 아니면 요청은 사본으로 */
+    pthread_mutex_t lock;
+    pthread_cond_t work;        /* 백그라운드 스레드를 깨움 */
+    pthread_cond_t replayed;    /* 재생이 끝남 (변경이 기다림) */
+    int logfd;
+    off_t logend;
+    struct off_rec **log;       /* 아직 재생하지 않은 변경, 기록 순서 */
+    unsigned int nlog, logcap;
+    struct off_node *table[OFF_BUCKETS];    /* 백엔드에 올릴 내용이 있는 파일 */
+    unsigned int ndirty;
+    struct {
+        char *path;
+        unsigned int hash;
+    } fetch[OFF_FETCH_MAX];     /* 사본이 최신인지 확인할 경로, 오래된 것부터 */
+    unsigned int nfetch;
+    unsigned int busy;          /* 사본에 쓰는 중인 write */
+    unsigned int writers;       /* 사본으로 열린 쓰기 핸들 (사본을 새로 받지 않음) */
+    int down_err;               /* 마지막으로 백엔드를 내려놓게 한 오류 */
+    uint64_t since;             /* 내려간 시각 */
+    uint64_t next_probe;
+    unsigned int backoff_ms;
+    int stop, running;
+    pthread_t thread;
+    unsigned long long downs;   /* 온라인에서 오프라인으로 바뀐 수 */
+    unsigned long long probes;  /* 백그라운드 확인 (요청은 백엔드에 가지 않음) */
+    unsigned long long local_ops;   /* 사본으로 처리한 open/변경 */
+    unsigned long long replayed_ops, uploads, upload_bytes;
+    unsigned long long conflicts;
+    unsigned long long fetched, fetch_bytes;
+} off = {
+    .lock = PTHREAD_MUTEX_INITIALIZER, .work = PTHREAD_COND_INITIALIZER,
+    .replayed = PTHREAD_COND_INITIALIZER, .logfd = -1,
+};
+
+static void stats_render(FILE *out)
+{
+    struct op_stat st[OP_COUNT];
+
+    stats_collect(st);
+    fprintf(out, "# layers:");
+    for (int l = 0; l < nlayers; l++)
+        fprintf(out, " %s", layers[l]->name);
+    fprintf(out, " passthrough%s\n", plain_io ? " (plain)" : "");
+    if (numa.node >= 0)
+        fprintf(out, "# numa node %d, %lu threads bound\n", numa.node,
+                __atomic_load_n(&numa.pinned, __ATOMIC_RELAXED));
+    fprintf(out, "# inline cache: %zu files, %zu/%lu bytes, open hits %llu misses %llu,"
+                 " attr hits %llu, evictions %llu, invalidations %llu\n",
+            __atomic_load_n(&icache.entries, __ATOMIC_RELAXED),
+            __atomic_load_n(&icache.bytes, __ATOMIC_RELAXED), options.inline_budget,
+            (unsigned long long) __atomic_load_n(&icache.hits, __ATOMIC_RELAXED),
+            (unsigned long long) __atomic_load_n(&icache.misses, __ATOMIC_RELAXED),
+            (unsigned long long) __atomic_load_n(&icache.attr_hits, __ATOMIC_RELAXED),
+            (unsigned long long) __atomic_load_n(&icache.evictions, __ATOMIC_RELAXED),
+            (unsigned long long) __atomic_load_n(&icache.invalidations, __ATOMIC_RELAXED));
+    fprintf(out, "# readdir cache: opendir kept %llu, refilled %llu\n",
+            (unsigned long long) __atomic_load_n(&dircache.kept, __ATOMIC_RELAXED),
+            (unsigned long long) __atomic_load_n(&dircache.refilled, __ATOMIC_RELAXED));
+    pthread_mutex_lock(&inval.lock);
+    fprintf(out, "# kernel invalidations: sent %llu, dropped %llu\n",
+            (unsigned long long) inval.sent, (unsigned long long) inval.dropped);
+    pthread_mutex_unlock(&inval.lock);
+    if (pf.running)
+        fprintf(out, "# prefetch (%u MiB/s): sequential %llu, opened-together %llu,"
+                     " dropped %llu, %llu bytes\n", options.prefetch_bw,
+                (unsigned long long) __atomic_load_n(&pf.seq_jobs, __ATOMIC_RELAXED),
+                (unsigned long long) __atomic_load_n(&pf.assoc_jobs, __ATOMIC_RELAXED),
+                (unsigned long long) __atomic_load_n(&pf.dropped, __ATOMIC_RELAXED),
+                (unsigned long long) __atomic_load_n(&pf.bytes, __ATOMIC_RELAXED));
+    if (options.integrity)
+        fprintf(out, "# integrity (%s, %s, %u KiB blocks, %u hash threads): hashed %llu blocks"
+                     " %llu bytes, verified %llu, failures %llu, adopted %llu, unclean %llu\n",
+                options.integrity, options.integrity_layout ? options.integrity_layout : "sidecar",
+                options.integrity_block / 1024, hpool.nthreads,
+                __atomic_load_n(&istat.hashed, __ATOMIC_RELAXED),
+                __atomic_load_n(&istat.hashed_bytes, __ATOMIC_RELAXED),
+                __atomic_load_n(&istat.verified, __ATOMIC_RELAXED),
+                __atomic_load_n(&istat.failures, __ATOMIC_RELAXED),
+                __atomic_load_n(&istat.adopted, __ATOMIC_RELAXED),
+                __atomic_load_n(&istat.unclean, __ATOMIC_RELAXED));
+    if (mirror.n > 1) {
+        fprintf(out, "# mirror: reads");
+        for (int r = 0; r < mirror.n; r++)
+            fprintf(out, " %s %llu%s", mirror.root[r],
+                    __atomic_load_n(&mirror.reads[r], __ATOMIC_RELAXED),
+                    mirror.failed[r] ? " (failed)" : "");
+        fprintf(out, ", repairs %llu, unrepairable %llu, generation %llu\n",
+                __atomic_load_n(&mirror.repairs, __ATOMIC_RELAXED),
+                __atomic_load_n(&mirror.repair_failures, __ATOMIC_RELAXED),
+                __atomic_load_n(&mirror.gen, __ATOMIC_RELAXED));
+    }
+    if (ec.k)
+        fprintf(out, "# erasure coding %d+%d, cell %u KiB: full stripes %llu, logged writes %llu"
+                     " (%llu bytes), log flushes %llu, degraded reads %llu\n",
+                ec.k, mirror.n - ec.k, ec.cell / 1024,
+                __atomic_load_n(&ec.full, __ATOMIC_RELAXED),
+                __atomic_load_n(&ec.logged, __ATOMIC_RELAXED),
+                __atomic_load_n(&ec.logged_bytes, __ATOMIC_RELAXED),
+                __atomic_load_n(&ec.flushes, __ATOMIC_RELAXED),
+                __atomic_load_n(&ec.degraded, __ATOMIC_RELAXED));
+    if (hedge.nthreads)
+        fprintf(out, "# mirror hedge: p%g threshold %llu us, hedged %llu, won %llu,"
+                     " cancelled %llu\n", hedge.pct,
+                (unsigned long long) (__atomic_load_n(&hedge.threshold_ns, __ATOMIC_RELAXED) / 1000),
+                __atomic_load_n(&hedge.hedged, __ATOMIC_RELAXED),
+                __atomic_load_n(&hedge.wins, __ATOMIC_RELAXED),
+                __atomic_load_n(&hedge.cancelled, __ATOMIC_RELAXED));
+    if (s3.on) {
+        fprintf(out, "# s3: http://%s/%s requests", s3.host, s3.bucket);
+        for (int k = 0; k < S3_REQ_KINDS; k++)
+            fprintf(out, " %s %llu", s3_req_names[k],
+                    __atomic_load_n(&s3.reqs[k], __ATOMIC_RELAXED));
+        fprintf(out, ", errors %llu, connects %llu, rx %llu tx %llu bytes\n",
+                __atomic_load_n(&s3.errors, __ATOMIC_RELAXED),
+                __atomic_load_n(&s3.connects, __ATOMIC_RELAXED),
+                __atomic_load_n(&s3.rx_bytes, __ATOMIC_RELAXED),
+                __atomic_load_n(&s3.tx_bytes, __ATOMIC_RELAXED));
+        fprintf(out, "# s3 attr cache hits %llu misses %llu, readahead hits %llu,"
+                     " multipart uploads %llu\n",
+                __atomic_load_n(&s3.attr_hits, __ATOMIC_RELAXED),
+                __atomic_load_n(&s3.attr_misses, __ATOMIC_RELAXED),
+                __atomic_load_n(&s3.ra_hits, __ATOMIC_RELAXED),
+                __atomic_load_n(&s3.uploads, __ATOMIC_RELAXED));
+    }
+    if (coh.n) {
+        uint64_t now = now_ns();
+        fprintf(out, "# coherence: %s, %u/%u peers connected, %s (epoch %u), pinned %u\n",
+                options.coherence, __atomic_load_n(&coh.up, __ATOMIC_RELAXED), coh.n,
+                now < __atomic_load_n(&icache.trust_until, __ATOMIC_RELAXED) ?
+                "trusted" : "not trusted",
+                __atomic_load_n(&icache.epoch, __ATOMIC_RELAXED), icache.npins);
+        fprintf(out, "# coherence invalidations sent %llu (waited %.3f ms, %llu lease timeouts),"
+                     " received %llu, lapses %llu\n",
+                __atomic_load_n(&coh.published, __ATOMIC_RELAXED),
+                __atomic_load_n(&coh.wait_ns, __ATOMIC_RELAXED) / 1e6,
+                __atomic_load_n(&coh.timeouts, __ATOMIC_RELAXED),
+                __atomic_load_n(&coh.received, __ATOMIC_RELAXED),
+                __atomic_load_n(&coh.lapses, __ATOMIC_RELAXED));
+    }
+    if (pcache.on) {
+        pthread_mutex_lock(&pcache.lock);
+        fprintf(out, "# peer cache: %s, %u peers, %lu blocks %lu/%lu bytes, evictions %llu\n",
+                options.peer_cache, pcache.npeers, pcache.blocks, pcache.bytes,
+                options.peer_cache_budget, pcache.evictions);
+        pthread_mutex_unlock(&pcache.lock);
+        fprintf(out, "# peer cache blocks: local hits %llu, from peers %llu, backend reads %llu,"
+                     " served %llu, stale %llu, peer errors %llu, reconnects %llu\n",
+                __atomic_load_n(&pcache.hits, __ATOMIC_RELAXED),
+                __atomic_load_n(&pcache.peer_hits, __ATOMIC_RELAXED),
+                __atomic_load_n(&pcache.loads, __ATOMIC_RELAXED),
+                __atomic_load_n(&pcache.served, __ATOMIC_RELAXED),
+                __atomic_load_n(&pcache.stale, __ATOMIC_RELAXED),
+                __atomic_load_n(&pcache.peer_errors, __ATOMIC_RELAXED),
+                __atomic_load_n(&pcache.reconnects, __ATOMIC_RELAXED));
+    }
+    if (wb.on) {
+        pthread_mutex_lock(&wb.lock);
+        fprintf(out, "# write-behind: %s (fsync to %s), pending %lu bytes in %u files,"
+                     " journal %lu/%lu bytes%s\n",
+                options.write_behind, wb.backend_sync ? "backend" : "journal", wb.pending,
+                wb.nfiles, wb.disk, options.write_behind_max,
+                wb.failing ? ", backend failing" : "");
+        pthread_mutex_unlock(&wb.lock);
+        fprintf(out, "# write-behind writes %llu (%llu journal syncs), uploaded %llu bytes in"
+                     " %llu batches, flush waits %llu, errors %llu, recovered %llu\n",
+                __atomic_load_n(&wb.writes, __ATOMIC_RELAXED),
+                __atomic_load_n(&wb.syncs, __ATOMIC_RELAXED),
+                __atomic_load_n(&wb.uploaded, __ATOMIC_RELAXED),
+                __atomic_load_n(&wb.batches, __ATOMIC_RELAXED),
+                __atomic_load_n(&wb.flushes, __ATOMIC_RELAXED),
+                __atomic_load_n(&wb.errors, __ATOMIC_RELAXED),
+                __atomic_load_n(&wb.recovered, __ATOMIC_RELAXED));
+    }
+    if (off.on) {
+        static const char *const names[] = { "online", "OFFLINE", "replaying" };
+        pthread_mutex_lock(&off.lock);
+        fprintf(out, "# offline: %s, backend %s", options.offline, names[off.state]);
+        if (off.state == OFF_OFFLINE) {
+            uint64_t now = now_ns();
+            fprintf(out, " for %.1f s (%s), next check in %llu ms",
+                    (now - off.since) / 1e9, strerror(off.down_err ? -off.down_err : EIO),
+                    off.next_probe > now ? (unsigned long long) (off.next_probe - now) / 1000000 : 0ULL);
+        }
+        fprintf(out, ", %u changes and %u files to replay\n", off.nlog, off.ndirty);
+        pthread_mutex_unlock(&off.lock);
+        fprintf(out, "# offline went down %llu times, checks %llu, local ops %llu, replayed %llu"
+                     " changes, uploaded %llu files (%llu bytes), conflicts %llu, copies fetched"
+                     " %llu (%llu bytes)\n",
+                __atomic_load_n(&off.downs, __ATOMIC_RELAXED),
+                __atomic_load_n(&off.probes, __ATOMIC_RELAXED),
+                __atomic_load_n(&off.local_ops, __ATOMIC_RELAXED),
+                __atomic_load_n(&off.replayed_ops, __ATOMIC_RELAXED),
+                __atomic_load_n(&off.uploads, __ATOMIC_RELAXED),
+                __atomic_load_n(&off.upload_bytes, __ATOMIC_RELAXED),
+                __atomic_load_n(&off.conflicts, __ATOMIC_RELAXED),
+                __atomic_load_n(&off.fetched, __ATOMIC_RELAXED),
+                __atomic_load_n(&off.fetch_bytes, __ATOMIC_RELAXED));
+    }
+    if (brk_on) {
+        static const char *const names[] = { "closed", "OPEN", "half-open" };
+        int per = brk_per_replica();
+        for (int r = per ? 0 : -1; r < (per ? mirror.n : 0); r++) {
+            struct breaker *b = r < 0 ? &backend_brk : &mirror.brk[r];
+            uint64_t now = now_ns(), until = __atomic_load_n(&b->until_ns, __ATOMIC_RELAXED);
+            int state = __atomic_load_n(&b->state, __ATOMIC_RELAXED);
+            fprintf(out, "# breaker %s %s: %s", r < 0 ? "backend" : "replica", b->name,
+                    names[state]);
+            if (state != BRK_CLOSED)
+                fprintf(out, " for %.1f s, trial in %llu ms", (now - __atomic_load_n(&b->since_ns, __ATOMIC_RELAXED)) / 1e9,
+                        until > now ? (unsigned long long) (until - now) / 1000000 : 0ULL);
+            fprintf(out, ", %llu calls (avg %.3f ms), in flight %u/%u, failed %llu, slow %llu,"
+                         " stuck %llu, rejected %llu, opened %llu times\n",
+                    __atomic_load_n(&b->calls, __ATOMIC_RELAXED), __atomic_load_n(&b->ewma_ns, __ATOMIC_RELAXED) / 1e6,
+                    __atomic_load_n(&b->inflight, __ATOMIC_RELAXED), options.breaker_inflight,
+                    __atomic_load_n(&b->failures, __ATOMIC_RELAXED), __atomic_load_n(&b->slow, __ATOMIC_RELAXED),
+                    __atomic_load_n(&b->stuck_calls, __ATOMIC_RELAXED), __atomic_load_n(&b->rejected, __ATOMIC_RELAXED),
+                    __atomic_load_n(&b->opened, __ATOMIC_RELAXED));
+        }
+    }
+    if (remote.n) {
+        fprintf(out, "# remote: %s x%u calls", options.remote, remote.n);
+        for (int k = 1; k < RPC_OPS; k++)
+            fprintf(out, " %s %llu", rpc_op_names[k],
+                    __atomic_load_n(&remote.calls[k], __ATOMIC_RELAXED));
+        fprintf(out, ", errors %llu, %llu frames in %llu writes, reconnects %llu\n",
+                __atomic_load_n(&remote.errors, __ATOMIC_RELAXED),
+                __atomic_load_n(&remote.frames, __ATOMIC_RELAXED),
+                __atomic_load_n(&remote.writes, __ATOMIC_RELAXED),
+                __atomic_load_n(&remote.reconnects, __ATOMIC_RELAXED));
+    }
+    if (options.integrity) {
+        fprintf(out, "# integrity verify (checked/skipped blocks):");
+        for (int m = 0; m < VERIFY_MODES; m++)
+            fprintf(out, " %s %llu/%llu", verify_names[m],
+                    __atomic_load_n(&istat.checked[m], __ATOMIC_RELAXED),
+                    __atomic_load_n(&istat.skipped[m], __ATOMIC_RELAXED));
+        fprintf(out, ", scrub passes %llu files %llu\n",
+                __atomic_load_n(&istat.scrub_passes, __ATOMIC_RELAXED),
+                __atomic_load_n(&istat.scrub_files, __ATOMIC_RELAXED));
+        fprintf(out, "# integrity key version %u%s, re-tagged files %llu\n",
+                options.integrity_key_version,
+                options.integrity_old_key ? " (rotating from the previous key)" : "",
+                __atomic_load_n(&istat.rekeyed, __ATOMIC_RELAXED));
+    }
+    fprintf(out, "# op count errors inflight avg_us max_us\n");
+    for (int i = 0; i < OP_COUNT; i++) {
+        uint64_t n = st[i].count;
+        fprintf(out, "%-9s %10llu %8llu %8lld %10.1f %10.1f\n", op_names[i],
+                (unsigned long long) n, (unsigned long long) st[i].errors,
+                (long long) (st[i].started - n),
+                n ? st[i].total_ns / 1000.0 / n : 0.0, st[i].max_ns / 1000.0);
+    }
+
+    pthread_mutex_lock(&slow_lock);
+    uint64_t total = slow_total;
+    uint64_t first = total > SLOW_RING_SIZE ? total - SLOW_RING_SIZE : 0;
+
+    fprintf(out, "\n# slow requests (>= %u us): %llu recorded, newest last\n",
+            options.slow_us, (unsigned long long) total);
+    fprintf(out, "# time op path offset size uid pid result total_us backend_us hash_us other_us\n");
+    for (uint64_t i = first; i < total; i++) {
+        const struct slow_entry *e = &slow_ring[i % SLOW_RING_SIZE];
+        uint64_t other = e->total_ns - e->backend_ns - e->hash_ns;
+        struct tm tm;
+        char tbuf[32];
+
+        localtime_r(&e->when.tv_sec, &tm);
+        strftime(tbuf, sizeof(tbuf), "%Y-%m-%dT%H:%M:%S", &tm);
+        fprintf(out, "%s.%06ld %s %s %lld %zu %u %d %d %.1f %.1f %.1f %.1f\n",
+                tbuf, e->when.tv_nsec / 1000, op_names[e->op], e->path,
+                (long long) e->offset, e->size, (unsigned) e->uid, (int) e->pid,
+                e->result, e->total_ns / 1000.0, e->backend_ns / 1000.0,
+                e->hash_ns / 1000.0, other / 1000.0);
+    }
+    pthread_mutex_unlock(&slow_lock);
+
+    if (options.heat_sample)
+        heat_render(out);
+}
+
+static int stats_getattr(struct stat *stbuf)
+{
+    memset(stbuf, 0, sizeof(*stbuf));
+    stbuf->st_mode = S_IFREG | 0444;
+    stbuf->st_nlink = 1;
+    stbuf->st_uid = getuid();
+    stbuf->st_gid = getgid();
+    /* 크기는 읽을 때마다 다르므로 0으로 두고 direct_io로 끝까지 읽게 함 */
+    return 0;
+}
+
+static int stats_open(struct fuse_file_info *fi)
+{
+    if ((fi->flags & O_ACCMODE) != O_RDONLY)
+        return -EACCES;
+
+    /* 스냅샷을 memfd에 기록해 두면 read/release는 일반 fd와 동일하게 처리됨 */
+    int fd = memfd_create("basic_fuse_stats", MFD_CLOEXEC);
+    if (fd == -1)
+        return -errno;
+
+    int wfd = dup(fd);
+    FILE *out = wfd == -1 ? NULL : fdopen(wfd, "w");
+    if (out == NULL) {
+        int err = errno;
+        if (wfd != -1)
+            close(wfd);
+        close(fd);
+        return -err;
+    }
+    stats_render(out);
+    fclose(out);
+
+    struct basic_fh *fh = fh_new(fd);
+    if (fh == NULL) {
+        close(fd);
+        return -ENOMEM;
+    }
+    fi->fh = (uint64_t) (uintptr_t) fh;
+    fi->direct_io = 1;
+    return 0;
+}
+
+/*
+ * OpenMetrics exporter: metrics_sock 에 연결하면 현재 값을 텍스트로 돌려줌.
+ * HTTP GET이 오면 (curl --unix-socket, 프록시 등) 응답 헤더를 붙이고,
+ * 아무것도 보내지 않는 클라이언트(nc -U 등)에는 본문만 보낸다.
+ * 값은 shard와 __atomic으로 쓰는 카운터에서 읽기만 하므로 요청 경로와 lock을
+ * 공유하지 않음 (새 카운터를 lock 안에서 읽게 만들지 말 것).
+ */
+static int metrics_fd = -1;
+static pthread_t metrics_thread;
+
+static void metrics_render(FILE *out)
+{
+    struct op_stat st[OP_COUNT];
+
+    stats_collect(st);
+
+    fprintf(out, "# TYPE basic_fuse_requests counter\n"
+                 "# HELP basic_fuse_requests Completed requests per operation.\n");
+    for (int i = 0; i < OP_COUNT; i++)
+        fprintf(out, "basic_fuse_requests_total{op=\"%s\"} %llu\n",
+                op_names[i], (unsigned long long) st[i].count);
+
+    fprintf(out, "# TYPE basic_fuse_request_errors counter\n"
+                 "# HELP basic_fuse_request_errors Requests that returned an error.\n");
+    for (int i = 0; i < OP_COUNT; i++)
+        fprintf(out, "basic_fuse_request_errors_total{op=\"%s\"} %llu\n",
+                op_names[i], (unsigned long long) st[i].errors);
+
+    fprintf(out, "# TYPE basic_fuse_requests_in_flight gauge\n"
+                 "# HELP basic_fuse_requests_in_flight Requests currently being handled.\n");
+    for (int i = 0; i < OP_COUNT; i++)
+        fprintf(out, "basic_fuse_requests_in_flight{op=\"%s\"} %lld\n",
+                op_names[i], (long long) (st[i].started - st[i].count));
+
+    fprintf(out, "# TYPE basic_fuse_backend_seconds counter\n"
+                 "# HELP basic_fuse_backend_seconds Time spent in backend syscalls.\n");
+    for (int i = 0; i < OP_COUNT; i++)
+        fprintf(out, "basic_fuse_backend_seconds_total{op=\"%s\"} %.9f\n",
+                op_names[i], st[i].backend_ns / 1e9);
+
+    fprintf(out, "# TYPE basic_fuse_request_duration_seconds histogram\n"
+                 "# HELP basic_fuse_request_duration_seconds Request latency.\n");
+    for (int i = 0; i < OP_COUNT; i++) {
+        uint64_t cum = 0;
+        for (int b = 0; b < LAT_BUCKETS; b++) {
+            cum += st[i].hist[b];
+            fprintf(out, "basic_fuse_request_duration_seconds_bucket{op=\"%s\",le=\"%g\"} %llu\n",
+                    op_names[i], (double) (1ull << b) / 1e6, (unsigned long long) cum);
+        }
+        cum += st[i].hist[LAT_BUCKETS];
+        fprintf(out, "basic_fuse_request_duration_seconds_bucket{op=\"%s\",le=\"+Inf\"} %llu\n",
+                op_names[i], (unsigned long long) cum);
+        fprintf(out, "basic_fuse_request_duration_seconds_count{op=\"%s\"} %llu\n",
+                op_names[i], (unsigned long long) cum);
+        fprintf(out, "basic_fuse_request_duration_seconds_sum{op=\"%s\"} %.9f\n",
+                op_names[i], st[i].total_ns / 1e9);
+    }
+
+    fprintf(out, "# TYPE basic_fuse_inline_cache_lookups counter\n"
+                 "# HELP basic_fuse_inline_cache_lookups Small-file cache lookups on open.\n"
+                 "basic_fuse_inline_cache_lookups_total{result=\"hit\"} %llu\n"
+                 "basic_fuse_inline_cache_lookups_total{result=\"miss\"} %llu\n"
+                 "basic_fuse_inline_cache_lookups_total{result=\"attr_hit\"} %llu\n",
+            (unsigned long long) __atomic_load_n(&icache.hits, __ATOMIC_RELAXED),
+            (unsigned long long) __atomic_load_n(&icache.misses, __ATOMIC_RELAXED),
+            (unsigned long long) __atomic_load_n(&icache.attr_hits, __ATOMIC_RELAXED));
+    fprintf(out, "# TYPE basic_fuse_inline_cache_evictions counter\n"
+                 "basic_fuse_inline_cache_evictions_total{reason=\"budget\"} %llu\n"
+                 "basic_fuse_inline_cache_evictions_total{reason=\"invalidate\"} %llu\n",
+            (unsigned long long) __atomic_load_n(&icache.evictions, __ATOMIC_RELAXED),
+            (unsigned long long) __atomic_load_n(&icache.invalidations, __ATOMIC_RELAXED));
+    fprintf(out, "# TYPE basic_fuse_inline_cache_bytes gauge\n"
+                 "basic_fuse_inline_cache_bytes %zu\n"
+                 "# TYPE basic_fuse_inline_cache_files gauge\n"
+                 "basic_fuse_inline_cache_files %zu\n",
+            __atomic_load_n(&icache.bytes, __ATOMIC_RELAXED),
+            __atomic_load_n(&icache.entries, __ATOMIC_RELAXED));
+
+    fprintf(out, "# TYPE basic_fuse_readdir_cache counter\n"
+                 "# HELP basic_fuse_readdir_cache opendir calls that kept or refilled the kernel listing.\n"
+                 "basic_fuse_readdir_cache_total{result=\"kept\"} %llu\n"
+                 "basic_fuse_readdir_cache_total{result=\"refilled\"} %llu\n",
+            (unsigned long long) __atomic_load_n(&dircache.kept, __ATOMIC_RELAXED),
+            (unsigned long long) __atomic_load_n(&dircache.refilled, __ATOMIC_RELAXED));
+
+    fprintf(out, "# TYPE basic_fuse_prefetch_jobs counter\n"
+                 "# HELP basic_fuse_prefetch_jobs Prefetch requests by trigger.\n"
+                 "basic_fuse_prefetch_jobs_total{trigger=\"sequential\"} %llu\n"
+                 "basic_fuse_prefetch_jobs_total{trigger=\"opened_together\"} %llu\n"
+                 "basic_fuse_prefetch_jobs_total{trigger=\"dropped\"} %llu\n"
+                 "# TYPE basic_fuse_prefetch_bytes counter\n"
+                 "basic_fuse_prefetch_bytes_total %llu\n",
+            (unsigned long long) __atomic_load_n(&pf.seq_jobs, __ATOMIC_RELAXED),
+            (unsigned long long) __atomic_load_n(&pf.assoc_jobs, __ATOMIC_RELAXED),
+            (unsigned long long) __atomic_load_n(&pf.dropped, __ATOMIC_RELAXED),
+            (unsigned long long) __atomic_load_n(&pf.bytes, __ATOMIC_RELAXED));
+
+    fprintf(out, "# TYPE basic_fuse_integrity_blocks counter\n"
+                 "# HELP basic_fuse_integrity_blocks Integrity tag work by outcome.\n"
+                 "basic_fuse_integrity_blocks_total{result=\"hashed\"} %llu\n"
+                 "basic_fuse_integrity_blocks_total{result=\"verified\"} %llu\n"
+                 "# TYPE basic_fuse_integrity_hashed_bytes counter\n"
+                 "basic_fuse_integrity_hashed_bytes_total %llu\n"
+                 "# TYPE basic_fuse_integrity_failures counter\n"
+                 "basic_fuse_integrity_failures_total %llu\n"
+                 "# TYPE basic_fuse_integrity_files counter\n"
+                 "# HELP basic_fuse_integrity_files Files opened without a verifiable root.\n"
+                 "basic_fuse_integrity_files_total{state=\"adopted\"} %llu\n"
+                 "basic_fuse_integrity_files_total{state=\"unclean\"} %llu\n",
+            __atomic_load_n(&istat.hashed, __ATOMIC_RELAXED),
+            __atomic_load_n(&istat.verified, __ATOMIC_RELAXED),
+            __atomic_load_n(&istat.hashed_bytes, __ATOMIC_RELAXED),
+            __atomic_load_n(&istat.failures, __ATOMIC_RELAXED),
+            __atomic_load_n(&istat.adopted, __ATOMIC_RELAXED),
+            __atomic_load_n(&istat.unclean, __ATOMIC_RELAXED));
+    fprintf(out, "# TYPE basic_fuse_integrity_verify_blocks counter\n"
+                 "# HELP basic_fuse_integrity_verify_blocks Blocks read, by verification mode.\n");
+    for (int m = 0; m < VERIFY_MODES; m++)
+        fprintf(out, "basic_fuse_integrity_verify_blocks_total{mode=\"%s\",result=\"checked\"} %llu\n"
+                     "basic_fuse_integrity_verify_blocks_total{mode=\"%s\",result=\"skipped\"} %llu\n",
+                verify_names[m], __atomic_load_n(&istat.checked[m], __ATOMIC_RELAXED),
+                verify_names[m], __atomic_load_n(&istat.skipped[m], __ATOMIC_RELAXED));
+    fprintf(out, "# TYPE basic_fuse_integrity_scrub_files counter\n"
+                 "basic_fuse_integrity_scrub_files_total %llu\n"
+                 "# TYPE basic_fuse_integrity_scrub_passes counter\n"
+                 "basic_fuse_integrity_scrub_passes_total %llu\n"
+                 "# TYPE basic_fuse_integrity_rekeyed_files counter\n"
+                 "basic_fuse_integrity_rekeyed_files_total %llu\n",
+            __atomic_load_n(&istat.scrub_files, __ATOMIC_RELAXED),
+            __atomic_load_n(&istat.scrub_passes, __ATOMIC_RELAXED),
+            __atomic_load_n(&istat.rekeyed, __ATOMIC_RELAXED));
+
+    if (mirror.n > 1) {
+        fprintf(out, "# TYPE basic_fuse_mirror_reads counter\n"
+                     "# HELP basic_fuse_mirror_reads Reads served by each replica root.\n");
+        for (int r = 0; r < mirror.n; r++)
+            fprintf(out, "basic_fuse_mirror_reads_total{root=\"%s\"} %llu\n", mirror.root[r],
+                    __atomic_load_n(&mirror.reads[r], __ATOMIC_RELAXED));
+        fprintf(out, "# TYPE basic_fuse_mirror_failed gauge\n");
+        for (int r = 0; r < mirror.n; r++)
+            fprintf(out, "basic_fuse_mirror_failed{root=\"%s\"} %d\n", mirror.root[r],
+                    mirror.failed[r]);
+        fprintf(out, "# TYPE basic_fuse_mirror_repairs counter\n"
+                     "basic_fuse_mirror_repairs_total{result=\"repaired\"} %llu\n"
+                     "basic_fuse_mirror_repairs_total{result=\"unrepairable\"} %llu\n"
+                     "# TYPE basic_fuse_mirror_generation gauge\n"
+                     "# HELP basic_fuse_mirror_generation Bumped each time a replica is marked failed.\n"
+                     "basic_fuse_mirror_generation %llu\n",
+                __atomic_load_n(&mirror.repairs, __ATOMIC_RELAXED),
+                __atomic_load_n(&mirror.repair_failures, __ATOMIC_RELAXED),
+                __atomic_load_n(&mirror.gen, __ATOMIC_RELAXED));
+    }
+    if (ec.k)
+        fprintf(out, "# TYPE basic_fuse_ec_full_stripes counter\n"
+                     "# HELP basic_fuse_ec_full_stripes Stripes written whole, without the log.\n"
+                     "basic_fuse_ec_full_stripes_total %llu\n"
+                     "# TYPE basic_fuse_ec_logged_writes counter\n"
+                     "basic_fuse_ec_logged_writes_total %llu\n"
+                     "# TYPE basic_fuse_ec_logged_bytes counter\n"
+                     "basic_fuse_ec_logged_bytes_total %llu\n"
+                     "# TYPE basic_fuse_ec_log_flushes counter\n"
+                     "basic_fuse_ec_log_flushes_total %llu\n"
+                     "# TYPE basic_fuse_ec_degraded_reads counter\n"
+                     "# HELP basic_fuse_ec_degraded_reads Reads rebuilt from parity.\n"
+                     "basic_fuse_ec_degraded_reads_total %llu\n",
+                __atomic_load_n(&ec.full, __ATOMIC_RELAXED),
+                __atomic_load_n(&ec.logged, __ATOMIC_RELAXED),
+                __atomic_load_n(&ec.logged_bytes, __ATOMIC_RELAXED),
+                __atomic_load_n(&ec.flushes, __ATOMIC_RELAXED),
+                __atomic_load_n(&ec.degraded, __ATOMIC_RELAXED));
+    if (hedge.nthreads) {
+        unsigned long long hedged = __atomic_load_n(&hedge.hedged, __ATOMIC_RELAXED);
+        unsigned long long wins = __atomic_load_n(&hedge.wins, __ATOMIC_RELAXED);
+
+        fprintf(out, "# TYPE basic_fuse_mirror_hedge_threshold_seconds gauge\n"
+                     "# HELP basic_fuse_mirror_hedge_threshold_seconds Read latency after which"
+                     " a read is also sent to another replica.\n"
+                     "basic_fuse_mirror_hedge_threshold_seconds %.9f\n"
+                     "# TYPE basic_fuse_mirror_hedged_reads counter\n"
+                     "basic_fuse_mirror_hedged_reads_total{result=\"primary_won\"} %llu\n"
+                     "basic_fuse_mirror_hedged_reads_total{result=\"hedge_won\"} %llu\n"
+                     "# TYPE basic_fuse_mirror_hedge_cancelled counter\n"
+                     "basic_fuse_mirror_hedge_cancelled_total %llu\n",
+                __atomic_load_n(&hedge.threshold_ns, __ATOMIC_RELAXED) / 1e9,
+                hedged - wins, wins, __atomic_load_n(&hedge.cancelled, __ATOMIC_RELAXED));
+    }
+    if (s3.on) {
+        fprintf(out, "# TYPE basic_fuse_s3_requests counter\n"
+                     "# HELP basic_fuse_s3_requests Requests sent to the object store, by kind.\n");
+        for (int k = 0; k < S3_REQ_KINDS; k++)
+            fprintf(out, "basic_fuse_s3_requests_total{kind=\"%s\"} %llu\n", s3_req_names[k],
+                    __atomic_load_n(&s3.reqs[k], __ATOMIC_RELAXED));
+        fprintf(out, "# TYPE basic_fuse_s3_errors counter\n"
+                     "basic_fuse_s3_errors_total %llu\n"
+                     "# TYPE basic_fuse_s3_connects counter\n"
+                     "basic_fuse_s3_connects_total %llu\n"
+                     "# TYPE basic_fuse_s3_bytes counter\n"
+                     "basic_fuse_s3_bytes_total{dir=\"rx\"} %llu\n"
+                     "basic_fuse_s3_bytes_total{dir=\"tx\"} %llu\n"
+                     "# TYPE basic_fuse_s3_attr_cache counter\n"
+                     "basic_fuse_s3_attr_cache_total{result=\"hit\"} %llu\n"
+                     "basic_fuse_s3_attr_cache_total{result=\"miss\"} %llu\n"
+                     "# TYPE basic_fuse_s3_readahead_hits counter\n"
+                     "basic_fuse_s3_readahead_hits_total %llu\n"
+                     "# TYPE basic_fuse_s3_multipart_uploads counter\n"
+                     "basic_fuse_s3_multipart_uploads_total %llu\n",
+                __atomic_load_n(&s3.errors, __ATOMIC_RELAXED),
+                __atomic_load_n(&s3.connects, __ATOMIC_RELAXED),
+                __atomic_load_n(&s3.rx_bytes, __ATOMIC_RELAXED),
+                __atomic_load_n(&s3.tx_bytes, __ATOMIC_RELAXED),
+                __atomic_load_n(&s3.attr_hits, __ATOMIC_RELAXED),
+                __atomic_load_n(&s3.attr_misses, __ATOMIC_RELAXED),
+                __atomic_load_n(&s3.ra_hits, __ATOMIC_RELAXED),
+                __atomic_load_n(&s3.uploads, __ATOMIC_RELAXED));
+    }
+    if (coh.n) {
+        fprintf(out, "# TYPE basic_fuse_coherence_peers_connected gauge\n"
+                     "basic_fuse_coherence_peers_connected %u\n"
+                     "# TYPE basic_fuse_coherence_trusted gauge\n"
+                     "# HELP basic_fuse_coherence_trusted 1 while every peer's lease is valid.\n"
+                     "basic_fuse_coherence_trusted %d\n"
+                     "# TYPE basic_fuse_coherence_invalidations counter\n"
+                     "basic_fuse_coherence_invalidations_total{dir=\"sent\"} %llu\n"
+                     "basic_fuse_coherence_invalidations_total{dir=\"received\"} %llu\n"
+                     "# TYPE basic_fuse_coherence_wait_seconds counter\n"
+                     "basic_fuse_coherence_wait_seconds_total %.9f\n"
+                     "# TYPE basic_fuse_coherence_lease_timeouts counter\n"
+                     "basic_fuse_coherence_lease_timeouts_total %llu\n"
+                     "# TYPE basic_fuse_coherence_lapses counter\n"
+                     "basic_fuse_coherence_lapses_total %llu\n",
+                __atomic_load_n(&coh.up, __ATOMIC_RELAXED),
+                now_ns() < __atomic_load_n(&icache.trust_until, __ATOMIC_RELAXED),
+                __atomic_load_n(&coh.published, __ATOMIC_RELAXED),
+                __atomic_load_n(&coh.received, __ATOMIC_RELAXED),
+                __atomic_load_n(&coh.wait_ns, __ATOMIC_RELAXED) / 1e9,
+                __atomic_load_n(&coh.timeouts, __ATOMIC_RELAXED),
+                __atomic_load_n(&coh.lapses, __ATOMIC_RELAXED));
+    }
+    if (pcache.on) {
+        fprintf(out, "# TYPE basic_fuse_peer_cache_bytes gauge\n"
+                     "basic_fuse_peer_cache_bytes %lu\n"
+                     "# TYPE basic_fuse_peer_cache_blocks counter\n"
+                     "# HELP basic_fuse_peer_cache_blocks Blocks read through the peer cache, by source.\n"
+                     "basic_fuse_peer_cache_blocks_total{source=\"local\"} %llu\n"
+                     "basic_fuse_peer_cache_blocks_total{source=\"peer\"} %llu\n"
+                     "basic_fuse_peer_cache_blocks_total{source=\"backend\"} %llu\n"
+                     "# TYPE basic_fuse_peer_cache_served counter\n"
+                     "basic_fuse_peer_cache_served_total %llu\n"
+                     "# TYPE basic_fuse_peer_cache_stale counter\n"
+                     "basic_fuse_peer_cache_stale_total %llu\n"
+                     "# TYPE basic_fuse_peer_cache_peer_errors counter\n"
+                     "basic_fuse_peer_cache_peer_errors_total %llu\n"
+                     "# TYPE basic_fuse_peer_cache_evictions counter\n"
+                     "basic_fuse_peer_cache_evictions_total %llu\n",
+                __atomic_load_n(&pcache.bytes, __ATOMIC_RELAXED),
+                __atomic_load_n(&pcache.hits, __ATOMIC_RELAXED),
+                __atomic_load_n(&pcache.peer_hits, __ATOMIC_RELAXED),
+                __atomic_load_n(&pcache.loads, __ATOMIC_RELAXED),
+                __atomic_load_n(&pcache.served, __ATOMIC_RELAXED),
+                __atomic_load_n(&pcache.stale, __ATOMIC_RELAXED),
+                __atomic_load_n(&pcache.peer_errors, __ATOMIC_RELAXED),
+                __atomic_load_n(&pcache.evictions, __ATOMIC_RELAXED));
+    }
+    if (wb.on) {
+        fprintf(out, "# TYPE basic_fuse_write_behind_pending_bytes gauge\n"
+                     "# HELP basic_fuse_write_behind_pending_bytes Written data not yet on the backend.\n"
+                     "basic_fuse_write_behind_pending_bytes %lu\n"
+                     "# TYPE basic_fuse_write_behind_journal_bytes gauge\n"
+                     "basic_fuse_write_behind_journal_bytes %lu\n"
+                     "# TYPE basic_fuse_write_behind_failing gauge\n"
+                     "basic_fuse_write_behind_failing %d\n"
+                     "# TYPE basic_fuse_write_behind_writes counter\n"
+                     "basic_fuse_write_behind_writes_total %llu\n"
+                     "# TYPE basic_fuse_write_behind_journal_syncs counter\n"
+                     "basic_fuse_write_behind_journal_syncs_total %llu\n"
+                     "# TYPE basic_fuse_write_behind_uploaded_bytes counter\n"
+                     "basic_fuse_write_behind_uploaded_bytes_total %llu\n"
+                     "# TYPE basic_fuse_write_behind_batches counter\n"
+                     "basic_fuse_write_behind_batches_total %llu\n"
+                     "# TYPE basic_fuse_write_behind_flush_waits counter\n"
+                     "basic_fuse_write_behind_flush_waits_total %llu\n"
+                     "# TYPE basic_fuse_write_behind_errors counter\n"
+                     "basic_fuse_write_behind_errors_total %llu\n",
+                __atomic_load_n(&wb.pending, __ATOMIC_RELAXED),
+                __atomic_load_n(&wb.disk, __ATOMIC_RELAXED),
+                __atomic_load_n(&wb.failing, __ATOMIC_RELAXED),
+                __atomic_load_n(&wb.writes, __ATOMIC_RELAXED),
+                __atomic_load_n(&wb.syncs, __ATOMIC_RELAXED),
+                __atomic_load_n(&wb.uploaded, __ATOMIC_RELAXED),
+                __atomic_load_n(&wb.batches, __ATOMIC_RELAXED),
+                __atomic_load_n(&wb.flushes, __ATOMIC_RELAXED),
+                __atomic_load_n(&wb.errors, __ATOMIC_RELAXED));
+    }
+    if (off.on) {
+        fprintf(out, "# TYPE basic_fuse_offline_backend_up gauge\n"
+                     "# HELP basic_fuse_offline_backend_up 1 while requests go to the backend.\n"
+                     "basic_fuse_offline_backend_up %d\n"
+                     "# TYPE basic_fuse_offline_pending_changes gauge\n"
+                     "basic_fuse_offline_pending_changes %u\n"
+                     "# TYPE basic_fuse_offline_pending_files gauge\n"
+                     "basic_fuse_offline_pending_files %u\n"
+                     "# TYPE basic_fuse_offline_downs counter\n"
+                     "basic_fuse_offline_downs_total %llu\n"
+                     "# TYPE basic_fuse_offline_probes counter\n"
+                     "basic_fuse_offline_probes_total %llu\n"
+                     "# TYPE basic_fuse_offline_local_ops counter\n"
+                     "basic_fuse_offline_local_ops_total %llu\n"
+                     "# TYPE basic_fuse_offline_replayed counter\n"
+                     "basic_fuse_offline_replayed_total %llu\n"
+                     "# TYPE basic_fuse_offline_uploaded_bytes counter\n"
+                     "basic_fuse_offline_uploaded_bytes_total %llu\n"
+                     "# TYPE basic_fuse_offline_conflicts counter\n"
+                     "basic_fuse_offline_conflicts_total %llu\n"
+                     "# TYPE basic_fuse_offline_fetched_bytes counter\n"
+                     "basic_fuse_offline_fetched_bytes_total %llu\n",
+                __atomic_load_n(&off.state, __ATOMIC_RELAXED) == OFF_ONLINE,
+                __atomic_load_n(&off.nlog, __ATOMIC_RELAXED),
+                __atomic_load_n(&off.ndirty, __ATOMIC_RELAXED),
+                __atomic_load_n(&off.downs, __ATOMIC_RELAXED),
+                __atomic_load_n(&off.probes, __ATOMIC_RELAXED),
+                __atomic_load_n(&off.local_ops, __ATOMIC_RELAXED),
+                __atomic_load_n(&off.replayed_ops, __ATOMIC_RELAXED),
+                __atomic_load_n(&off.upload_bytes, __ATOMIC_RELAXED),
+                __atomic_load_n(&off.conflicts, __ATOMIC_RELAXED),
+                __atomic_load_n(&off.fetch_bytes, __ATOMIC_RELAXED));
+    }
+    if (brk_on) {
+        static const char *const metrics[] = {
+            "# TYPE basic_fuse_breaker_state gauge\n"
+            "# HELP basic_fuse_breaker_state 0 closed, 1 open (failing fast), 2 half-open.\n",
+            "# TYPE basic_fuse_breaker_latency_seconds gauge\n"
+            "# HELP basic_fuse_breaker_latency_seconds Moving average of backend call latency.\n",
+            "# TYPE basic_fuse_breaker_in_flight gauge\n",
+            "# TYPE basic_fuse_breaker_calls counter\n",
+            "# TYPE basic_fuse_breaker_bad_calls counter\n"
+            "# HELP basic_fuse_breaker_bad_calls Calls that counted against the backend or were turned away.\n",
+            "# TYPE basic_fuse_breaker_opened counter\n",
+        };
+        int per = brk_per_replica();
+
+        for (size_t m = 0; m < sizeof(metrics) / sizeof(metrics[0]); m++) {
+            fputs(metrics[m], out);
+            for (int r = per ? 0 : -1; r < (per ? mirror.n : 0); r++) {
+                struct breaker *b = r < 0 ? &backend_brk : &mirror.brk[r];
+                char lbl[PATH_MAX + 32];
+                snprintf(lbl, sizeof(lbl), "kind=\"%s\",backend=\"%s\"",
+                         r < 0 ? "backend" : "replica", b->name);
+                if (m == 0)
+                    fprintf(out, "basic_fuse_breaker_state{%s} %d\n", lbl, __atomic_load_n(&b->state, __ATOMIC_RELAXED));
+                else if (m == 1)
+                    fprintf(out, "basic_fuse_breaker_latency_seconds{%s} %.9f\n", lbl,
+                            __atomic_load_n(&b->ewma_ns, __ATOMIC_RELAXED) / 1e9);
+                else if (m == 2)
+                    fprintf(out, "basic_fuse_breaker_in_flight{%s} %u\n", lbl,
+                            __atomic_load_n(&b->inflight, __ATOMIC_RELAXED));
+                else if (m == 3)
+                    fprintf(out, "basic_fuse_breaker_calls_total{%s} %llu\n", lbl,
+                            __atomic_load_n(&b->calls, __ATOMIC_RELAXED));
+                else if (m == 4)
+                    fprintf(out, "basic_fuse_breaker_bad_calls_total{%s,reason=\"failed\"} %llu\n"
+                                 "basic_fuse_breaker_bad_calls_total{%s,reason=\"slow\"} %llu\n"
+                                 "basic_fuse_breaker_bad_calls_total{%s,reason=\"stuck\"} %llu\n"
+                                 "basic_fuse_breaker_bad_calls_total{%s,reason=\"rejected\"} %llu\n",
+                            lbl, __atomic_load_n(&b->failures, __ATOMIC_RELAXED),
+                            lbl, __atomic_load_n(&b->slow, __ATOMIC_RELAXED),
+                            lbl, __atomic_load_n(&b->stuck_calls, __ATOMIC_RELAXED),
+                            lbl, __atomic_load_n(&b->rejected, __ATOMIC_RELAXED));
+                else
+                    fprintf(out, "basic_fuse_breaker_opened_total{%s} %llu\n", lbl,
+                            __atomic_load_n(&b->opened, __ATOMIC_RELAXED));
+            }
+        }
+    }
+    if (remote.n) {
+        fprintf(out, "# TYPE basic_fuse_remote_calls counter\n"
+                     "# HELP basic_fuse_remote_calls Messages sent to the remote backend, by op.\n");
+        for (int k = 1; k < RPC_OPS; k++)
+            fprintf(out, "basic_fuse_remote_calls_total{op=\"%s\"} %llu\n", rpc_op_names[k],
+                    __atomic_load_n(&remote.calls[k], __ATOMIC_RELAXED));
+        fprintf(out, "# TYPE basic_fuse_remote_errors counter\n"
+                     "basic_fuse_remote_errors_total %llu\n"
+                     "# TYPE basic_fuse_remote_frames counter\n"
+                     "basic_fuse_remote_frames_total %llu\n"
+                     "# TYPE basic_fuse_remote_writes counter\n"
+                     "# HELP basic_fuse_remote_writes Socket writes; frames per write shows batching.\n"
+                     "basic_fuse_remote_writes_total %llu\n"
+                     "# TYPE basic_fuse_remote_reconnects counter\n"
+                     "basic_fuse_remote_reconnects_total %llu\n",
+                __atomic_load_n(&remote.errors, __ATOMIC_RELAXED),
+                __atomic_load_n(&remote.frames, __ATOMIC_RELAXED),
+                __atomic_load_n(&remote.writes, __ATOMIC_RELAXED),
+                __atomic_load_n(&remote.reconnects, __ATOMIC_RELAXED));
+    }
+
+    fprintf(out, "# TYPE basic_fuse_slow_requests counter\n"
+                 "# HELP basic_fuse_slow_requests Requests recorded in the slow log.\n");
+    fprintf(out, "basic_fuse_slow_requests_total %llu\n",
+            (unsigned long long) __atomic_load_n(&slow_total, __ATOMIC_RELAXED));
+
+    fprintf(out, "# EOF\n");
+}
+
+static void metrics_serve_client(int cfd)
+{
+    struct pollfd pfd = { .fd = cfd, .events = POLLIN };
+    char req[512];
+    ssize_t n = 0;
+
+    if (poll(&pfd, 1, 200) > 0)
+        n = recv(cfd, req, sizeof(req), 0);
+
+    char *body = NULL;
+    size_t len = 0;
+    FILE *out = open_memstream(&body, &len);
+    if (out == NULL)
+        return;
+    if (n >= 4 && memcmp(req, "GET ", 4) == 0)
+        fputs("HTTP/1.0 200 OK\r\n"
+              "Content-Type: application/openmetrics-text; version=1.0.0; charset=utf-8\r\n"
+              "Connection: close\r\n\r\n", out);
+    metrics_render(out);
+    fclose(out);
+
+    /* MSG_NOSIGNAL: 스크레이퍼가 먼저 끊어도 SIGPIPE로 데몬이 죽지 않게 */
+    for (size_t off = 0; off < len; ) {
+        ssize_t w = send(cfd, body + off, len - off, MSG_NOSIGNAL);
+        if (w == -1) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        off += w;
+    }
+    free(body);
+}
+
+static void *metrics_main(void *arg)
+{
+    (void) arg;
+
+    for (;;) {
+        int cfd = accept4(metrics_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (cfd == -1) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            break;  /* metrics_stop()이 shutdown하면 여기서 끝남 */
+        }
+        metrics_serve_client(cfd);
+        close(cfd);
+    }
+    return NULL;
+}
+
+static int metrics_start(const char *path)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+        return -ENAMETOOLONG;
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+        return -errno;
+
+    /* 이전 실행이 남긴 소켓 파일 정리 */
+    unlink(path);
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1 ||
+        listen(fd, 16) == -1) {
+        int err = errno;
+        close(fd);
+        return -err;
+    }
+
+    metrics_fd = fd;
+    int err = pthread_create(&metrics_thread, NULL, metrics_main, NULL);
+    if (err) {
+        close(fd);
+        unlink(path);
+        metrics_fd = -1;
+        return -err;
+    }
+    return 0;
+}
+
+static void metrics_stop(void)
+{
+    if (metrics_fd == -1)
+        return;
+    shutdown(metrics_fd, SHUT_RDWR);
+    pthread_join(metrics_thread, NULL);
+    close(metrics_fd);
+    unlink(options.metrics_sock);
+    metrics_fd = -1;
+}
+
+/* 1. getattr */
+static int basic_getattr(const char *path, struct stat *stbuf,
+                         struct fuse_file_info *fi)
+{
+    (void) fi;
+    char fpath[PATH_MAX];
+    if (strcmp(path, STATS_PATH) == 0)
+        return stats_getattr(stbuf);
+
+    get_full_path(path, fpath, sizeof(fpath));
+
+    if (BACKEND(lstat(fpath, stbuf)) == -1)
+        return -errno;
+
+    return 0;
+}
+
+/* 2. readdir */
+static int basic_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
+                         off_t offset, struct fuse_file_info *fi,
+                         enum fuse_readdir_flags flags)
+{
+    (void) offset;
+    (void) fi;
+    (void) flags;
+
+    char fpath[PATH_MAX];
+    get_full_path(path, fpath, sizeof(fpath));
+
+    DIR *dp = BACKEND(opendir(fpath));
+    if (dp == NULL)
+        return -errno;
+
+    /* 목록을 읽기 전의 상태를 기록해야 도중의 변경을 놓치지 않음 */
+    struct stat dst;
+    int have_dst = BACKEND(fstat(dirfd(dp), &dst)) == 0;
+
+    struct dirent *de;
+    while ((de = BACKEND(readdir(dp))) != NULL) {
+        /* 얻은 이름에 대해 실제 lstat 호출하여 정확한 stat 정보 얻기 */
+        struct stat st;
+        memset(&st, 0, sizeof(st));
+
+        /* build child path */
+        char child[PATH_MAX];
+        /* handle root "/" path special case to avoid double slashes, snprintf handles it */
+        snprintf(child, sizeof(child), "%s/%s", fpath, de->d_name);
+
+        if (BACKEND(lstat(child, &st)) == -1) {
+            /* skip entries we can't stat, but continue */
+            continue;
+        }
+
+        /* filler: (buf, name, statbuf, off, flags) -- older fuse versions use different sig,
+           but passing 0 for off and 0 for flags is OK for many cases */
+        if (filler(buf, de->d_name, &st, 0, 0))
+            break;
+    }
+
+    BACKEND(closedir(dp));
+
+    if (have_dst)
+        dircache_record(path, &dst);
+    return 0;
+}
+
+/* 3. create: 파일 생성 (적절한 플래그 사용) */
+static int basic_create(const char *path, mode_t mode, struct fuse_file_info *fi)
+{
+    char fpath[PATH_MAX];
+    if (strcmp(path, STATS_PATH) == 0)
+        return -EEXIST;
+    get_full_path(path, fpath, sizeof(fpath));
+
+    /* create은 O_CREAT + 주로 쓰기 전용. 기존 예제들처럼 명시적으로 설정 */
+    int flags = O_CREAT | O_WRONLY;
+    /* 만약 사용자가 쓰기 이외 플래그를 원하면 fi->flags를 참고하여 추가 가능 */
+    if (fi && (fi->flags & O_APPEND))
+        flags |= O_APPEND;
+
+    int fd = BACKEND(open(fpath, flags, mode));
+    if (fd == -1)
+        return -errno;
+
+    struct basic_fh *fh = fh_new(fd);
+    if (fh == NULL) {
+        BACKEND(close(fd));
+        return -ENOMEM;
+    }
+    fi->fh = (uint64_t) (uintptr_t) fh;
+    dir_changed(path);
+
+    /* 향후 초기 HMAC 생성 여기에 추가 */
+
+    return 0;
+}
+
+/* 4. open */
+static int basic_open(const char *path, struct fuse_file_info *fi)
+{
+    char fpath[PATH_MAX];
+    if (strcmp(path, STATS_PATH) == 0)
+        return stats_open(fi);
+    get_full_path(path, fpath, sizeof(fpath));
+
+    /* fi->flags를 그대로 사용 (FUSE가 전달한 플래그) */
+    int fd = BACKEND(open(fpath, fi->flags));
+    if (fd == -1)
+        return -errno;
+
+    struct basic_fh *fh = fh_new(fd);
+    if (fh == NULL) {
+        BACKEND(close(fd));
+        return -ENOMEM;
+    }
+    fi->fh = (uint64_t) (uintptr_t) fh;
+
+    pf_note_open(path);
+
+    /* 향후 HMAC 검증 준비 로직 */
+
+    return 0;
+}
+
+/* 5. read */
+/*
+ * track이 0인 특수화(basic_read_plain)는 heat/prefetch 기록이 빠진 순수 pread로,
+ * 두 기능이 모두 꺼졌을 때 layers_setup이 고른다.
+ */
+static inline __attribute__((always_inline))
+int read_common(const char *path, char *buf, size_t size, off_t offset,
+                struct fuse_file_info *fi, const int track)
+{
+    struct basic_fh *fh = get_fh(fi);
+    ssize_t res = BACKEND(pread(fh->fd, buf, size, offset));
+    if (res == -1)
+        return -errno;
+
+    if (track) {
+        heat_note(path, fh->fd, offset, (size_t)res, 0);
+        pf_note_read(path, fh, offset, (size_t)res);
+    }
+
+    /* 향후 읽은 데이터에 대한 HMAC 검증 로직 */
+
+    return (int)res;
+}
+
+static int basic_read(const char *path, char *buf, size_t size, off_t offset,
+                      struct fuse_file_info *fi)
+{
+    return read_common(path, buf, size, offset, fi, 1);
+}
+
+static int basic_read_plain(const char *path, char *buf, size_t size, off_t offset,
+                            struct fuse_file_info *fi)
+{
+    return read_common(path, buf, size, offset, fi, 0);
+}
+
+/* 6. write (partial write 처리) */
+static inline __attribute__((always_inline))
+int write_common(const char *path, const char *buf, size_t size,
+                 off_t offset, struct fuse_file_info *fi, const int track)
+{
+    size_t to_write = size;
+    off_t off = offset;
+    const char *p = buf;
+
+    while (to_write > 0) {
+        ssize_t written = BACKEND(pwrite(get_fh(fi)->fd, p, to_write, off));
+        if (written == -1) {
+            if (errno == EINTR)
+                continue;
+            return -errno;
+        }
+        to_write -= written;
+        p += written;
+        off += written;
+    }
+
+    if (track)
+        heat_note(path, get_fh(fi)->fd, offset, size, 1);
+
+    /* 향후 쓰기 후 HMAC 재계산 및 원자적 갱신 로직 */
+
+    return (int)size;
+}
+
+static int basic_write(const char *path, const char *buf, size_t size,
+                       off_t offset, struct fuse_file_info *fi)
+{
+    return write_common(path, buf, size, offset, fi, 1);
+}
+
+static int basic_write_plain(const char *path, const char *buf, size_t size,
+                             off_t offset, struct fuse_file_info *fi)
+{
+    return write_common(path, buf, size, offset, fi, 0);
+}
+
+/* 7. unlink */
+static int basic_unlink(const char *path)
+{
+    char fpath[PATH_MAX];
+    get_full_path(path, fpath, sizeof(fpath));
+
+    if (BACKEND(unlink(fpath)) == -1)
+        return -errno;
+
+    dir_changed(path);
+
+    /* 향후 xattr 등 HMAC 메타데이터 삭제 로직 추가 */
+
+    return 0;
+}
+
+/* 8. rename */
+static int basic_rename(const char *from, const char *to, unsigned int flags)
+{
+    /* 이 구현은 flags를 지원하지 않음 (간단 구현). flags가 주어지면 에러 반환 */
+    if (flags)
+        return -EINVAL;
+
+    char ffrom[PATH_MAX];
+    char fto[PATH_MAX];
+    get_full_path(from, ffrom, sizeof(ffrom));
+    get_full_path(to, fto, sizeof(fto));
+
+    if (BACKEND(rename(ffrom, fto)) == -1)
+        return -errno;
+
+    dircache_forget(from);
+    dir_changed(from);
+    dir_changed(to);
+
+    /* 향후 sidecar DB 동기화 등 처리 */
+
+    return 0;
+}
+
+/* 9. release (필수) - open/create에서 할당한 fd를 닫음 */
+static int basic_release(const char *path, struct fuse_file_info *fi)
+{
+    (void) path;
+    struct basic_fh *fh = get_fh(fi);
+    if (fh == NULL)
+        return 0;
+
+    if (fh->fd >= 0)
+        BACKEND(close(fh->fd));
+    free(fh);
+    fi->fh = 0;
+    return 0;
+}
+
+/* 10. mkdir */
+static int basic_mkdir(const char *path, mode_t mode)
+{
+    char fpath[PATH_MAX];
+    get_full_path(path, fpath, sizeof(fpath));
+
+    if (BACKEND(mkdir(fpath, mode)) == -1)
+        return -errno;
+
+    dir_changed(path);
+
+    return 0;
+}
+
+/* 11. rmdir */
+static int basic_rmdir(const char *path)
+{
+    char fpath[PATH_MAX];
+    get_full_path(path, fpath, sizeof(fpath));
+
+    if (BACKEND(rmdir(fpath)) == -1)
+        return -errno;
+
+    dircache_forget(path);
+    dir_changed(path);
+
+    return 0;
+}
+
+/* 12. chmod */
+static int basic_chmod(const char *path, mode_t mode, struct fuse_file_info *fi)
+{
+    (void) fi;
+    char fpath[PATH_MAX];
+    get_full_path(path, fpath, sizeof(fpath));
+
+    if (BACKEND(chmod(fpath, mode)) == -1)
+        return -errno;
+
+    return 0;
+}
+
+/* 13. truncate */
+static int basic_truncate(const char *path, off_t size, struct fuse_file_info *fi)
+{
+    (void) fi;
+    char fpath[PATH_MAX];
+    get_full_path(path, fpath, sizeof(fpath));
+
+    if (BACKEND(truncate(fpath, size)) == -1)
+        return -errno;
+
+    return 0;
+}
+
+/* 14. utimens */
+static int basic_utimens(const char *path, const struct timespec ts[2],
+                         struct fuse_file_info *fi)
+{
+    (void) fi;
+    char fpath[PATH_MAX];
+    get_full_path(path, fpath, sizeof(fpath));
+
+    /* utimensat 시 path가 절대/상대 경로 문제 없도록 AT_FDCWD 사용 */
+    if (BACKEND(utimensat(AT_FDCWD, fpath, ts, 0)) == -1)
+        return -errno;
+
+    return 0;
+}
+
+/* 15. opendir: 목록이 그대로면 커널 readdir 캐시 유지 */
+static int basic_opendir(const char *path, struct fuse_file_info *fi)
+{
+    char fpath[PATH_MAX];
+    get_full_path(path, fpath, sizeof(fpath));
+
+    struct stat st;
+    if (BACKEND(lstat(fpath, &st)) == -1)
+        return -errno;
+    if (!S_ISDIR(st.st_mode))
+        return -ENOTDIR;
+
+    /* 이번 목록은 항상 캐시 가능, 지난 목록을 재사용해도 되는지는 mtime으로 판단 */
+    fi->cache_readdir = 1;
+    if (dircache_unchanged(path, &st))
+        fi->keep_cache = 1;
+
+    return 0;
+}
+
+/* 16. fsync: 이 핸들의 fd (인라인 캐시 핸들은 백엔드에 쓴 것이 없음) */
+static int basic_fsync(const char *path, int datasync, struct fuse_file_info *fi)
+{
+    (void) path;
+    struct basic_fh *fh = get_fh(fi);
+    if (fh == NULL || fh->fd < 0)
+        return 0;
+
+    if (BACKEND(datasync ? fdatasync(fh->fd) : fsync(fh->fd)) == -1)
+        return -errno;
+
+    return 0;
+}
+
+/*
+ * 요청 크기: WRITE는 max_write로 정해지고 libfuse가 이를 max_pages로 커널과 협상함
+ * (커널 기본 상한 256 페이지 = 1 MiB). READ 크기는 커널 readahead를 따르는데,
+ * 마운트 bdi의 readahead는 INIT 이후에만 바꿀 수 있으므로 init이 끝난 뒤
+ * 별도 스레드가 마운트 지점을 stat해 /sys/class/bdi/<dev>/read_ahead_kb를 쓴다.
+ */
+static void *bdi_tune_main(void *arg)
+{
+    (void) arg;
+    struct stat st;
+    char f[64];
+
+    /* init 응답 전에는 이 stat이 커널에서 대기하다가 워커가 처리함 */
+    if (stat(options.mountpoint, &st) == -1) {
+        fprintf(stderr, "[WARN] read_ahead_kb: stat %s: %s\n",
+                options.mountpoint, strerror(errno));
+        return NULL;
+    }
+
+    snprintf(f, sizeof(f), "/sys/class/bdi/%u:%u/read_ahead_kb",
+             major(st.st_dev), minor(st.st_dev));
+    FILE *fp = fopen(f, "w");
+    if (fp == NULL || fprintf(fp, "%u\n", options.read_ahead_kb) < 0 || fclose(fp) != 0) {
+        fprintf(stderr, "[WARN] read_ahead_kb: %s: %s\n", f, strerror(errno));
+        return NULL;
+    }
+    printf("[INFO] kernel readahead for %s set to %u KiB\n",
+           options.mountpoint, options.read_ahead_kb);
+    return NULL;
+}
+
+static void io_size_setup(struct fuse_conn_info *conn)
+{
+    if (conn == NULL)
+        return;
+
+    if (options.max_write > FUSE_MAX_REQ_SIZE) {
+        fprintf(stderr, "[WARN] max_write %u exceeds %u, clamping\n",
+                options.max_write, FUSE_MAX_REQ_SIZE);
+        options.max_write = FUSE_MAX_REQ_SIZE;
+    }
+    if (options.max_write)
+        conn->max_write = options.max_write;
+
+    /* 커널이 제시한 값보다 크게 요청할 수는 없음: bdi를 키운 뒤 실제로 적용됨 */
+    printf("[INFO] max_write %u, max_readahead %u, max_read %u\n",
+           conn->max_write, conn->max_readahead, conn->max_read);
+
+    if (options.read_ahead_kb && options.mountpoint) {
+        pthread_t t;
+        if (pthread_create(&t, NULL, bdi_tune_main, NULL) == 0)
+            pthread_detach(t);
+    }
+}
+
+/*
+ * 스택 맨 아래의 백엔드 passthrough. read/write는 켜진 기능에 따라
+ * layers_setup이 특수화된 버전으로 바꿔 끼운다.
+ */
+static struct fuse_operations passthrough = {
+    .getattr    = basic_getattr,
+    .readdir    = basic_readdir,
+    .create     = basic_create,
     .open       = basic_open,
     .read       = basic_read,
     .write      = basic_write,
@@ -319,15 +3832,10759 @@ static struct fuse_operations basic_oper = {
     .chmod      = basic_chmod,
     .truncate   = basic_truncate,
     .utimens    = basic_utimens,
+    .opendir    = basic_opendir,
+    .fsync      = basic_fsync,
+};
+
+/*
+ * 실제 처리 함수 표: layer가 없으면 passthrough 그대로라 스택을 거치는
+ * 비용이 전혀 없고, 있으면 스택 맨 위에서 시작한다.
+ */
+static struct fuse_operations impl;
+
+/*
+ * layer 연결: next부터 아래로 내려가며 해당 연산을 구현한 첫 layer를 호출하고,
+ * 없으면 passthrough(basic_*)로 끝난다.
+ */
+#define LAYER_CALL(op, next, ...)                                      \
+    do {                                                                \
+        for (int l_ = (next); l_ < nlayers; l_++)                       \
+            if (layers[l_]->op)                                         \
+                return layers[l_]->op(l_ + 1, __VA_ARGS__);             \
+        return passthrough.op(__VA_ARGS__);                             \
+    } while (0)
+
+static int next_getattr(int next, const char *path, struct stat *stbuf,
+                        struct fuse_file_info *fi)
+{
+    LAYER_CALL(getattr, next, path, stbuf, fi);
+}
+
+static int next_readdir(int next, const char *path, void *buf, fuse_fill_dir_t filler,
+                        off_t offset, struct fuse_file_info *fi,
+                        enum fuse_readdir_flags flags)
+{
+    LAYER_CALL(readdir, next, path, buf, filler, offset, fi, flags);
+}
+
+static int next_create(int next, const char *path, mode_t mode, struct fuse_file_info *fi)
+{
+    LAYER_CALL(create, next, path, mode, fi);
+}
+
+static int next_open(int next, const char *path, struct fuse_file_info *fi)
+{
+    LAYER_CALL(open, next, path, fi);
+}
+
+static int next_read(int next, const char *path, char *buf, size_t size,
+                     off_t offset, struct fuse_file_info *fi)
+{
+    LAYER_CALL(read, next, path, buf, size, offset, fi);
+}
+
+static int next_write(int next, const char *path, const char *buf, size_t size,
+                      off_t offset, struct fuse_file_info *fi)
+{
+    LAYER_CALL(write, next, path, buf, size, offset, fi);
+}
+
+static int next_unlink(int next, const char *path)
+{
+    LAYER_CALL(unlink, next, path);
+}
+
+static int next_rename(int next, const char *from, const char *to, unsigned int flags)
+{
+    LAYER_CALL(rename, next, from, to, flags);
+}
+
+static int next_release(int next, const char *path, struct fuse_file_info *fi)
+{
+    LAYER_CALL(release, next, path, fi);
+}
+
+static int next_mkdir(int next, const char *path, mode_t mode)
+{
+    LAYER_CALL(mkdir, next, path, mode);
+}
+
+static int next_rmdir(int next, const char *path)
+{
+    LAYER_CALL(rmdir, next, path);
+}
+
+static int next_chmod(int next, const char *path, mode_t mode, struct fuse_file_info *fi)
+{
+    LAYER_CALL(chmod, next, path, mode, fi);
+}
+
+static int next_truncate(int next, const char *path, off_t size, struct fuse_file_info *fi)
+{
+    LAYER_CALL(truncate, next, path, size, fi);
+}
+
+static int next_utimens(int next, const char *path, const struct timespec ts[2],
+                        struct fuse_file_info *fi)
+{
+    LAYER_CALL(utimens, next, path, ts, fi);
+}
+
+static int next_opendir(int next, const char *path, struct fuse_file_info *fi)
+{
+    LAYER_CALL(opendir, next, path, fi);
+}
+
+static int next_fsync(int next, const char *path, int datasync, struct fuse_file_info *fi)
+{
+    LAYER_CALL(fsync, next, path, datasync, fi);
+}
+
+/* 스택 맨 위에서 시작하는 진입점 (layer가 하나라도 있을 때 사용) */
+static int stack_getattr(const char *path, struct stat *stbuf, struct fuse_file_info *fi)
+{
+    return next_getattr(0, path, stbuf, fi);
+}
+
+static int stack_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
+                         off_t offset, struct fuse_file_info *fi,
+                         enum fuse_readdir_flags flags)
+{
+    return next_readdir(0, path, buf, filler, offset, fi, flags);
+}
+
+static int stack_create(const char *path, mode_t mode, struct fuse_file_info *fi)
+{
+    return next_create(0, path, mode, fi);
+}
+
+static int stack_open(const char *path, struct fuse_file_info *fi)
+{
+    return next_open(0, path, fi);
+}
+
+static int stack_read(const char *path, char *buf, size_t size, off_t offset,
+                      struct fuse_file_info *fi)
+{
+    return next_read(0, path, buf, size, offset, fi);
+}
+
+static int stack_write(const char *path, const char *buf, size_t size,
+                       off_t offset, struct fuse_file_info *fi)
+{
+    return next_write(0, path, buf, size, offset, fi);
+}
+
+static int stack_unlink(const char *path)
+{
+    return next_unlink(0, path);
+}
+
+static int stack_rename(const char *from, const char *to, unsigned int flags)
+{
+    return next_rename(0, from, to, flags);
+}
+
+static int stack_release(const char *path, struct fuse_file_info *fi)
+{
+    return next_release(0, path, fi);
+}
+
+static int stack_mkdir(const char *path, mode_t mode)
+{
+    return next_mkdir(0, path, mode);
+}
+
+static int stack_rmdir(const char *path)
+{
+    return next_rmdir(0, path);
+}
+
+static int stack_chmod(const char *path, mode_t mode, struct fuse_file_info *fi)
+{
+    return next_chmod(0, path, mode, fi);
+}
+
+static int stack_truncate(const char *path, off_t size, struct fuse_file_info *fi)
+{
+    return next_truncate(0, path, size, fi);
+}
+
+static int stack_utimens(const char *path, const struct timespec ts[2],
+                         struct fuse_file_info *fi)
+{
+    return next_utimens(0, path, ts, fi);
+}
+
+static int stack_opendir(const char *path, struct fuse_file_info *fi)
+{
+    return next_opendir(0, path, fi);
+}
+
+static int stack_fsync(const char *path, int datasync, struct fuse_file_info *fi)
+{
+    return next_fsync(0, path, datasync, fi);
+}
+
+/*
+ * cache layer: 작은 파일 인라인 캐시 (위의 inline_* 참고).
+ * hit이면 open/read/release/getattr를 아래 layer로 넘기지 않고,
+ * 내용/속성을 바꾸는 연산은 아래로 넘긴 뒤 캐시를 무효화한다.
+ * coherence가 켜져 있으면 같은 변경을 다른 데몬들에도 알린다 (coh_publish).
+ */
+static void coh_publish(const char *path, unsigned int flags);
+
+static int cache_getattr(int next, const char *path, struct stat *stbuf,
+                         struct fuse_file_info *fi)
+{
+    struct inline_ent *e = inline_get(next, path);
+    if (e) {
+        *stbuf = e->st;
+        inline_put(e);
+        __atomic_fetch_add(&icache.attr_hits, 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+    return next_getattr(next, path, stbuf, fi);
+}
+
+static int cache_create(int next, const char *path, mode_t mode, struct fuse_file_info *fi)
+{
+    int res = next_create(next, path, mode, fi);
+    if (res == 0) {
+        inline_invalidate(path, 0);
+        coh_publish(path, 0);
+    }
+    return res;
+}
+
+static int cache_open(int next, const char *path, struct fuse_file_info *fi)
+{
+    int rdonly = (fi->flags & O_ACCMODE) == O_RDONLY;
+
+    /* 작은 파일이 캐시에 있으면 아래로 내려가지 않음 (백엔드를 열지 않음) */
+    if (rdonly) {
+        struct inline_ent *e = inline_get(next, path);
+        if (e) {
+            __atomic_fetch_add(&icache.hits, 1, __ATOMIC_RELAXED);
+            struct basic_fh *fh = fh_new(-1);
+            if (fh == NULL) {
+                inline_put(e);
+                return -ENOMEM;
+            }
+            fh->ent = e;
+            fi->fh = (uint64_t) (uintptr_t) fh;
+            return 0;
+        }
+        __atomic_fetch_add(&icache.misses, 1, __ATOMIC_RELAXED);
+    } else {
+        inline_invalidate(path, 0);
+    }
+
+    int res = next_open(next, path, fi);
+    if (res == 0 && rdonly)
+        inline_fill(next, path, fi);
+    return res;
+}
+
+static int cache_read(int next, const char *path, char *buf, size_t size,
+                      off_t offset, struct fuse_file_info *fi)
+{
+    const struct inline_ent *e = get_fh(fi)->ent;
+
+    if (e == NULL)
+        return next_read(next, path, buf, size, offset, fi);
+
+    if (offset >= e->st.st_size)
+        return 0;
+    if (size > (size_t) (e->st.st_size - offset))
+        size = e->st.st_size - offset;
+    memcpy(buf, e->data + offset, size);
+    return (int)size;
+}
+
+static int cache_write(int next, const char *path, const char *buf, size_t size,
+                       off_t offset, struct fuse_file_info *fi)
+{
+    struct basic_fh *fh = get_fh(fi);
+
+    /* 첫 write 전에 피어들이 이 파일을 버리고 close까지 캐시하지 않게 */
+    if (coh.n && fh && !fh->coh_pinned) {
+        coh_publish(path, COH_PIN);
+        fh->coh_pinned = 1;
+    }
+    int res = next_write(next, path, buf, size, offset, fi);
+    inline_invalidate(path, 0);
+    return res;
+}
+
+static int cache_unlink(int next, const char *path)
+{
+    int res = next_unlink(next, path);
+    if (res == 0) {
+        inline_invalidate(path, 0);
+        coh_publish(path, 0);
+    }
+    return res;
+}
+
+static int cache_rename(int next, const char *from, const char *to, unsigned int flags)
+{
+    int res = next_rename(next, from, to, flags);
+    if (res == 0) {
+        inline_invalidate(from, 1);
+        inline_invalidate(to, 1);
+        coh_publish(from, COH_SUBTREE);
+        coh_publish(to, COH_SUBTREE);
+    }
+    return res;
+}
+
+static int cache_release(int next, const char *path, struct fuse_file_info *fi)
+{
+    struct basic_fh *fh = get_fh(fi);
+
+    if (fh && fh->ent) {
+        inline_put(fh->ent);
+        fh->ent = NULL;
+        if (fh->fd < 0) {
+            free(fh);
+            fi->fh = 0;
+            return 0;
+        }
+    }
+    int pinned = fh && fh->coh_pinned;
+    int res = next_release(next, path, fi);
+    if (pinned)
+        coh_publish(path, COH_UNPIN);
+    return res;
+}
+
+static int cache_chmod(int next, const char *path, mode_t mode, struct fuse_file_info *fi)
+{
+    int res = next_chmod(next, path, mode, fi);
+    inline_invalidate(path, 0);
+    if (res == 0)
+        coh_publish(path, 0);
+    return res;
+}
+
+static int cache_truncate(int next, const char *path, off_t size, struct fuse_file_info *fi)
+{
+    int res = next_truncate(next, path, size, fi);
+    inline_invalidate(path, 0);
+    if (res == 0)
+        coh_publish(path, 0);
+    return res;
+}
+
+static int cache_utimens(int next, const char *path, const struct timespec ts[2],
+                         struct fuse_file_info *fi)
+{
+    int res = next_utimens(next, path, ts, fi);
+    inline_invalidate(path, 0);
+    if (res == 0)
+        coh_publish(path, 0);
+    return res;
+}
+
+/* 디렉토리는 캐시하지 않지만 피어의 커널 캐시와 목록 캐시를 위해 알림 */
+static int cache_mkdir(int next, const char *path, mode_t mode)
+{
+    int res = next_mkdir(next, path, mode);
+    if (res == 0)
+        coh_publish(path, 0);
+    return res;
+}
+
+static int cache_rmdir(int next, const char *path)
+{
+    int res = next_rmdir(next, path);
+    if (res == 0)
+        coh_publish(path, 0);
+    return res;
+}
+
+static const struct basic_layer cache_layer = {
+    .name       = "cache",
+    .getattr    = cache_getattr,
+    .create     = cache_create,
+    .open       = cache_open,
+    .read       = cache_read,
+    .write      = cache_write,
+    .unlink     = cache_unlink,
+    .rename     = cache_rename,
+    .release    = cache_release,
+    .mkdir      = cache_mkdir,
+    .rmdir      = cache_rmdir,
+    .chmod      = cache_chmod,
+    .truncate   = cache_truncate,
+    .utimens    = cache_utimens,
+};
+
+/*
+ * mirror layer (-o mirror=/b:/c): DIR_PATH와 같은 트리를 다른 루트들에도 두고
+ * 바꾸는 연산은 모든 복제본에 병렬로(hash pool) 적용한다. 복제본 0(DIR_PATH)은
+ * 아래 passthrough가, 나머지는 여기서 직접 시스템 호출로 처리한다.
+ * getattr/readdir는 복제본 0만 보고, read는 진행 중인 read가 가장 적은 복제본이
+ * 맡는다 (breaker_ms가 켜져 있으면 복제본마다 breaker를 두고 열린 것은 건너뜀).
+ * 결과가 복제본 0과 다른 복제본은 실패로 표시해 더는 읽지도 쓰지도 않는다.
+ *
+ * 실패는 재시작 뒤에도 남아야 하므로 루트마다 MIRROR_STATE 파일에 세대 번호를
+ * 두고, 복제본을 실패로 표시할 때 남은 복제본들의 세대를 올린다. 마운트할 때
+ * 가장 큰 세대보다 뒤처진 루트는 놓친 변경이 있는 것이라 실패로 두고 (DIR_PATH가
+ * 뒤처졌으면 마운트하지 않음), 세대 파일이 없는 새 루트도 같다. 다시 맞추는 것은
+ * 이 layer 밖의 일로, 맞춘 뒤 최신 루트의 MIRROR_STATE를 복사해 두면 다시 쓴다.
+ * MIRROR_STATE로 시작하는 이름은 어느 디렉토리에서든 보이지 않고 만들 수 없다.
+ */
+#define MIRROR_STATE ".bfmirror"
+
+static __thread int mirror_pin = -1;    /* read-repair: 이 복제본에서만 읽음 */
+static __thread unsigned int mirror_tick;
+
+static void mirror_path(int r, const char *path, char *out, size_t len)
+{
+    snprintf(out, len, "%s%s", mirror.root[r], path);
+}
+
+static int is_mirror_state(const char *path)
+{
+    const char *base = strrchr(path, '/');
+    return strncmp(base ? base + 1 : path, MIRROR_STATE, strlen(MIRROR_STATE)) == 0;
+}
+
+/* 루트 r의 세대, 파일이 없거나 읽을 수 없으면 0 */
+static unsigned long long mirror_gen_read(int r)
+{
+    char p[PATH_MAX], buf[64];
+    unsigned long long gen = 0;
+    mirror_path(r, "/" MIRROR_STATE, p, sizeof(p));
+    int fd = BACKEND(open(p, O_RDONLY | O_CLOEXEC));
+    if (fd == -1)
+        return 0;
+    ssize_t n = BACKEND(pread(fd, buf, sizeof(buf) - 1, 0));
+    close(fd);
+    buf[n > 0 ? n : 0] = '\0';
+    if (sscanf(buf, "generation %llu", &gen) != 1)
+        gen = 0;
+    return gen;
+}
+
+/* 임시 파일에 써서 fsync한 뒤 rename: 중간에 죽어도 이전 세대나 새 세대 둘 중 하나 */
+static int mirror_gen_write(int r, unsigned long long gen)
+{
+    char p[PATH_MAX], tmp[PATH_MAX], buf[64];
+    int len = snprintf(buf, sizeof(buf), "generation %llu\n", gen);
+    mirror_path(r, "/" MIRROR_STATE, p, sizeof(p));
+    mirror_path(r, "/" MIRROR_STATE ".tmp", tmp, sizeof(tmp));
+
+    int fd = BACKEND(open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644));
+    if (fd == -1)
+        return -errno;
+    ssize_t n = BACKEND(write(fd, buf, len));
+    int err = n == -1 ? -errno : n != len ? -EIO : BACKEND(fsync(fd)) == -1 ? -errno : 0;
+    close(fd);
+    if (err == 0 && BACKEND(rename(tmp, p)) == -1)
+        err = -errno;
+    if (err)
+        BACKEND(unlink(tmp));
+    return err;
+}
+
+static void mirror_fail(int r, const char *path, int err)
+{
+    if (__atomic_exchange_n(&mirror.failed[r], 1, __ATOMIC_RELAXED) != 0)
+        return;
+    fprintf(stderr, "[WARN] mirror: %s failed on %s (%s), no longer used\n",
+            mirror.root[r], path, strerror(err < 0 ? -err : EIO));
+
+    /* 남은 복제본의 세대를 올려 r이 재시작 뒤에도 뒤처진 것으로 보이게 */
+    pthread_mutex_lock(&mirror.gen_lock);
+    unsigned long long gen = ++mirror.gen;
+    for (int q = 0; q < mirror.n; q++) {
+        if (__atomic_load_n(&mirror.failed[q], __ATOMIC_RELAXED))
+            continue;
+        int werr = mirror_gen_write(q, gen);
+        if (werr)
+            fprintf(stderr, "[WARN] mirror: %s: cannot record generation %llu (%s)\n",
+                    mirror.root[q], gen, strerror(-werr));
+    }
+    pthread_mutex_unlock(&mirror.gen_lock);
+}
+
+/*
+ * 마운트 때: 가장 큰 세대보다 뒤처진 루트를 실패로 표시. DIR_PATH가 뒤처졌거나
+ * (erasure coding이면) 남은 조각으로 복원할 수 없으면 -ESTALE
+ */
+static int mirror_gen_check(void)
+{
+    unsigned long long gen[MIRROR_MAX], max = 0;
+    int stale = 0;
+    for (int r = 0; r < mirror.n; r++)
+        if ((gen[r] = mirror_gen_read(r)) > max)
+            max = gen[r];
+    if (gen[0] < max) {
+        fprintf(stderr, "mirror: %s is at generation %llu but other roots are at %llu;"
+                        " resync it from a current root first\n", mirror.root[0], gen[0], max);
+        return -ESTALE;
+    }
+    for (int r = 1; r < mirror.n; r++)
+        if (gen[r] < max) {
+            mirror.failed[r] = 1;
+            stale++;
+            fprintf(stderr, "[WARN] mirror: %s is stale (generation %llu < %llu), not used"
+                            " until resynced\n", mirror.root[r], gen[r], max);
+        }
+    if (ec.k && stale > mirror.n - ec.k) {
+        fprintf(stderr, "mirror_ec: only %d of %d roots are current, need %d\n",
+                mirror.n - stale, mirror.n, ec.k);
+        return -ESTALE;
+    }
+
+    /* 처음이면 세대 1로 시작해, 나중에 더한 빈 루트(세대 0)도 뒤처진 것으로 보임 */
+    mirror.gen = max ? max : 1;
+    for (int r = 0; r < mirror.n && max == 0; r++) {
+        int err = mirror_gen_write(r, mirror.gen);
+        if (err) {
+            fprintf(stderr, "mirror: %s: cannot write %s: %s\n", mirror.root[r],
+                    MIRROR_STATE, strerror(-err));
+            return err;
+        }
+    }
+    return 0;
+}
+
+/* 복제본 from의 [off, off+len)을 to에 그대로 복사 (read-repair), from의 끝에서 멈춤 */
+static int mirror_copy(const char *path, off_t off, size_t len, int from, int to)
+{
+    char src[PATH_MAX], dst[PATH_MAX], buf[64 * 1024];
+    mirror_path(from, path, src, sizeof(src));
+    mirror_path(to, path, dst, sizeof(dst));
+
+    int in = BACKEND(open(src, O_RDONLY | O_CLOEXEC));
+    int out = BACKEND(open(dst, O_WRONLY | O_CLOEXEC));
+    int err = in == -1 || out == -1 ? -errno : 0;
+    while (err == 0 && len > 0) {
+        ssize_t n = BACKEND(pread(in, buf, len < sizeof(buf) ? len : sizeof(buf), off));
+        if (n <= 0) {
+            err = n == 0 ? 0 : -errno;
+            break;
+        }
+        for (ssize_t done = 0, w; err == 0 && done < n; done += w)
+            if ((w = BACKEND(pwrite(out, buf + done, n - done, off + done))) == -1)
+                err = -errno;
+        off += n;
+        len -= n;
+    }
+    if (in != -1)
+        close(in);
+    if (out != -1)
+        close(out);
+    return err;
+}
+
+enum { M_CREATE, M_OPEN, M_WRITE, M_TRUNCATE, M_UNLINK, M_RENAME, M_MKDIR, M_RMDIR,
+       M_CHMOD, M_UTIMENS };
+
+/* 모든 복제본에 같은 연산: 복제본마다 hpool 작업 하나 */
+struct mirror_op {
+    int kind;
+    int next;
+    int first;                      /* open/create는 0을 먼저 따로 처리 */
+    const char *path, *to;
+    struct fuse_file_info *fi;
+    const char *buf;
+    size_t size;
+    off_t off;
+    mode_t mode;
+    unsigned int flags;
+    const struct timespec *ts;
+    int res[MIRROR_MAX];
+};
+
+/* 복제본 r(>0)에서 직접 처리 */
+static int mirror_apply(struct mirror_op *op, int r)
+{
+    char p[PATH_MAX], q[PATH_MAX];
+    struct basic_fh *fh = op->fi ? get_fh(op->fi) : NULL;
+    int res = 0;
+
+    mirror_path(r, op->path, p, sizeof(p));
+    switch (op->kind) {
+    case M_CREATE:
+    case M_OPEN: {
+        /* create는 복제본 0에 없던 파일이므로 다른 복제본에 남은 것은 비움 */
+        int flags = op->kind == M_CREATE
+                    ? O_CREAT | O_WRONLY | O_TRUNC | (op->fi->flags & O_APPEND) : op->fi->flags;
+        int fd = BACKEND(open(p, flags | O_CLOEXEC, op->mode));
+        if (fd == -1)
+            return -errno;
+        fh->mfd[r] = fd;
+        return 0;
+    }
+    case M_WRITE:
+        if (fh->mfd[r] < 0)
+            return -EBADF;
+        for (size_t done = 0; done < op->size;) {
+            ssize_t w = BACKEND(pwrite(fh->mfd[r], op->buf + done, op->size - done,
+                                       op->off + done));
+            if (w == -1 && errno != EINTR)
+                return -errno;
+            if (w > 0)
+                done += w;
+        }
+        return op->size;
+    case M_TRUNCATE:
+        res = BACKEND(truncate(p, op->off));
+        break;
+    case M_UNLINK:
+        res = BACKEND(unlink(p));
+        break;
+    case M_RENAME:
+        if (op->flags)
+            return -EINVAL;
+        mirror_path(r, op->to, q, sizeof(q));
+        res = BACKEND(rename(p, q));
+        break;
+    case M_MKDIR:
+        res = BACKEND(mkdir(p, op->mode));
+        break;
+    case M_RMDIR:
+        res = BACKEND(rmdir(p));
+        break;
+    case M_CHMOD:
+        res = BACKEND(chmod(p, op->mode));
+        break;
+    case M_UTIMENS:
+        res = BACKEND(utimensat(AT_FDCWD, p, op->ts, 0));
+        break;
+    }
+    return res == -1 ? -errno : 0;
+}
+
+static void mirror_job(void *arg, unsigned int i)
+{
+    struct mirror_op *op = arg;
+    int r = op->first + i;
+
+    if (r > 0) {
+        op->res[r] = mirror.failed[r] ? 0 : mirror_apply(op, r);
+        return;
+    }
+    switch (op->kind) {
+    case M_WRITE:
+        op->res[0] = next_write(op->next, op->path, op->buf, op->size, op->off, op->fi);
+        break;
+    case M_TRUNCATE:
+        op->res[0] = next_truncate(op->next, op->path, op->off, op->fi);
+        break;
+    case M_UNLINK:
+        op->res[0] = next_unlink(op->next, op->path);
+        break;
+    case M_RENAME:
+        op->res[0] = next_rename(op->next, op->path, op->to, op->flags);
+        break;
+    case M_MKDIR:
+        op->res[0] = next_mkdir(op->next, op->path, op->mode);
+        break;
+    case M_RMDIR:
+        op->res[0] = next_rmdir(op->next, op->path);
+        break;
+    case M_CHMOD:
+        op->res[0] = next_chmod(op->next, op->path, op->mode, op->fi);
+        break;
+    case M_UTIMENS:
+        op->res[0] = next_utimens(op->next, op->path, op->ts, op->fi);
+        break;
+    }
+}
+
+/* op를 복제본 first..n-1에 병렬로 적용, 결과는 복제본 0의 것 */
+static int mirror_run(struct mirror_op *op)
+{
+    /* 통계 파일은 복제본 0(passthrough)에만 있음 */
+    if (strcmp(op->path, STATS_PATH) == 0) {
+        if (op->first == 0)
+            mirror_job(op, 0);
+        return op->res[0];
+    }
+    hpool_run(mirror_job, op, mirror.n - op->first);
+    for (int r = 1; r < mirror.n; r++)
+        if (!mirror.failed[r] && op->res[r] != op->res[0])
+            mirror_fail(r, op->path, op->res[r]);
+    return op->res[0];
+}
+
+static int mirror_getattr(int next, const char *path, struct stat *stbuf,
+                          struct fuse_file_info *fi)
+{
+    if (is_mirror_state(path))
+        return -ENOENT;
+    return next_getattr(next, path, stbuf, fi);
+}
+
+struct mirror_dir {
+    void *buf;
+    fuse_fill_dir_t filler;
+};
+
+static int mirror_filler(void *buf, const char *name, const struct stat *stbuf,
+                         off_t off, enum fuse_fill_dir_flags flags)
+{
+    const struct mirror_dir *d = buf;
+    if (is_mirror_state(name))
+        return 0;
+    return d->filler(d->buf, name, stbuf, off, flags);
+}
+
+static int mirror_readdir(int next, const char *path, void *buf, fuse_fill_dir_t filler,
+                          off_t offset, struct fuse_file_info *fi, enum fuse_readdir_flags flags)
+{
+    struct mirror_dir d = { buf, filler };
+    return next_readdir(next, path, &d, mirror_filler, offset, fi, flags);
+}
+
+static int mirror_create(int next, const char *path, mode_t mode, struct fuse_file_info *fi)
+{
+    if (is_mirror_state(path))
+        return -EPERM;
+    int res = next_create(next, path, mode, fi);
+    if (res)
+        return res;
+    struct mirror_op op = { .kind = M_CREATE, .next = next, .first = 1, .path = path,
+                            .fi = fi, .mode = mode };
+    return mirror_run(&op);
+}
+
+static int mirror_open(int next, const char *path, struct fuse_file_info *fi)
+{
+    int res = next_open(next, path, fi);
+    if (res || strcmp(path, STATS_PATH) == 0)
+        return res;
+    struct mirror_op op = { .kind = M_OPEN, .next = next, .first = 1, .path = path, .fi = fi };
+    return mirror_run(&op);
+}
+
+/*
+ * 실패하지 않았고 breaker가 열리지 않았으며 이 핸들로 열린 복제본 중 진행 중인
+ * read가 가장 적은 것. skip을 빼고 고르며 (hedge 대상), 남은 것이 없으면 -1
+ */
+static int mirror_pick(const struct basic_fh *fh, int skip)
+{
+    if (mirror_pin >= 0)
+        return mirror_pin;
+
+    int best = -1;
+    unsigned int depth = UINT_MAX, start = mirror_tick++;
+    for (int k = 0; k < mirror.n; k++) {
+        int r = (start + k) % mirror.n;
+        if (r == skip || (r > 0 && (mirror.failed[r] || fh->mfd[r] < 0)) ||
+            (r == 0 && skip >= 0 && fh->fd < 0) || brk_tripped(&mirror.brk[r]))
+            continue;
+        unsigned int d = __atomic_load_n(&mirror.inflight[r], __ATOMIC_RELAXED);
+        if (d < depth) {
+            depth = d;
+            best = r;
+        }
+    }
+    return best;
+}
+
+/*
+ * hedged read (-o mirror_hedge=P): read를 hedge 스레드에 맡기고 최근 read 지연의
+ * P 백분위수 안에 끝나지 않으면 다른 복제본에도 같은 read를 보내 먼저 끝난 쪽을
+ * 돌려준다. 두 read는 각자의 버퍼에 읽고 이긴 쪽을 복사하며, 진 쪽은 아직 시작 전이면
+ * 버리고 이미 시작했으면 (pread는 중간에 멈출 수 없으므로) 끝난 뒤 버린다.
+ * release는 그 핸들의 남은 hedge read가 끝나기를 기다려 fd를 닫는다.
+ */
+static unsigned int hedge_bucket(uint64_t ns)
+{
+    if (ns < 4)
+        return 0;
+    unsigned int k = 63 - __builtin_clzll(ns);
+    unsigned int b = k * 4 + ((ns >> (k - 2)) & 3);
+    return b < HEDGE_BUCKETS ? b : HEDGE_BUCKETS - 1;
+}
+
+static uint64_t hedge_bucket_top(unsigned int b)
+{
+    unsigned int k = b / 4;
+    return k < 2 ? 4 : (uint64_t) (4 + b % 4 + 1) << (k - 2);
+}
+
+/* read 하나의 지연을 기록 */
+static void hedge_note(uint64_t ns)
+{
+    if (hedge.pct == 0)
+        return;
+    __atomic_fetch_add(&hedge.hist[hedge_bucket(ns)], 1, __ATOMIC_RELAXED);
+    if (__atomic_add_fetch(&hedge.samples, 1, __ATOMIC_RELAXED) % HEDGE_WINDOW)
+        return;
+
+    /* 창마다 한 스레드만 여기로 옴: 기준 계산 후 감쇠 (경합으로 조금 틀려도 무방) */
+    uint64_t total = 0, run = 0;
+    for (int b = 0; b < HEDGE_BUCKETS; b++)
+        total += __atomic_load_n(&hedge.hist[b], __ATOMIC_RELAXED);
+    for (int b = 0; b < HEDGE_BUCKETS; b++) {
+        run += __atomic_load_n(&hedge.hist[b], __ATOMIC_RELAXED);
+        if (run * 100.0 >= total * hedge.pct) {
+            __atomic_store_n(&hedge.threshold_ns, hedge_bucket_top(b), __ATOMIC_RELAXED);
+            break;
+        }
+    }
+    for (int b = 0; b < HEDGE_BUCKETS; b++)
+        __atomic_store_n(&hedge.hist[b], __atomic_load_n(&hedge.hist[b], __ATOMIC_RELAXED) / 2,
+                         __ATOMIC_RELAXED);
+}
+
+static void hedge_put_locked(struct hedge_req *req)
+{
+    if (--req->refs == 0) {
+        free(req->buf[0]);
+        free(req->buf[1]);
+        free(req);
+    }
+}
+
+static int hedge_submit_locked(struct hedge_req *req, int r)
+{
+    if (hedge.tail - hedge.head == HEDGE_QUEUE)
+        return -1;
+    int slot = req->issued++;
+    req->replica[slot] = r;
+    req->refs++;
+    req->fh->hedged++;
+    hedge.q[hedge.tail++ % HEDGE_QUEUE] = (struct hedge_job) { req, slot };
+    pthread_cond_signal(&hedge.cond);
+    return 0;
+}
+
+static void *hedge_main(void *arg)
+{
+    (void) arg;
+
+    pthread_mutex_lock(&hedge.lock);
+    for (;;) {
+        while (hedge.head == hedge.tail && !hedge.stop)
+            pthread_cond_wait(&hedge.cond, &hedge.lock);
+        if (hedge.head == hedge.tail)
+            break;
+        struct hedge_job job = hedge.q[hedge.head++ % HEDGE_QUEUE];
+        struct hedge_req *req = job.req;
+        int r = req->replica[job.slot];
+
+        if (req->winner >= 0) {
+            __atomic_fetch_add(&hedge.cancelled, 1, __ATOMIC_RELAXED);
+        } else {
+            int fd = r == 0 ? req->fh->fd : req->fh->mfd[r];
+            char *buf = req->buf[job.slot];
+            pthread_mutex_unlock(&hedge.lock);
+
+            /* 막 열렸거나 자리가 없는 복제본: 다른 쪽이 이기고, 둘 다면 직접 읽음 */
+            int slot = brk_enter(&mirror.brk[r], BRK_NOWAIT), res = -EAGAIN;
+            if (slot >= 0) {
+                uint64_t t0 = now_ns();
+                __atomic_fetch_add(&mirror.inflight[r], 1, __ATOMIC_RELAXED);
+                ssize_t n = BACKEND(pread(fd, buf, req->size, req->off));
+                res = brk_leave(&mirror.brk[r], slot, n == -1 ? -errno : (int) n);
+                __atomic_fetch_sub(&mirror.inflight[r], 1, __ATOMIC_RELAXED);
+                __atomic_fetch_add(&mirror.reads[r], 1, __ATOMIC_RELAXED);
+                hedge_note(now_ns() - t0);
+            }
+
+            pthread_mutex_lock(&hedge.lock);
+            req->res[job.slot] = res;
+            req->done++;
+            /* 성공한 첫 read가 이김, 모두 실패했으면 마지막 것 */
+            if (req->winner < 0 && (res >= 0 || req->done == req->issued))
+                req->winner = job.slot;
+        }
+        req->fh->hedged--;
+        hedge_put_locked(req);
+        pthread_cond_broadcast(&hedge.done);
+    }
+    pthread_mutex_unlock(&hedge.lock);
+    return NULL;
+}
+
+/* 복제본 r0에 read를 보내고 기준 시간 안에 끝나지 않으면 r1에도 보냄 */
+static int hedge_read(struct basic_fh *fh, char *buf, size_t size, off_t off, int r0, int r1)
+{
+    struct hedge_req *req = calloc(1, sizeof(*req));
+    if (req == NULL || (req->buf[0] = malloc(size)) == NULL) {
+        free(req);
+        return -ENOMEM;
+    }
+    req->fh = fh;
+    req->off = off;
+    req->size = size;
+    req->winner = -1;
+    req->refs = 1;
+
+    uint64_t wait = __atomic_load_n(&hedge.threshold_ns, __ATOMIC_RELAXED);
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    wait += ts.tv_nsec;
+    ts.tv_sec += wait / 1000000000ull;
+    ts.tv_nsec = wait % 1000000000ull;
+
+    int res = -EAGAIN;
+    pthread_mutex_lock(&hedge.lock);
+    if (hedge_submit_locked(req, r0) == 0) {
+        while (req->winner < 0 &&
+               pthread_cond_timedwait(&hedge.done, &hedge.lock, &ts) != ETIMEDOUT)
+            ;
+        /* 두 번째 버퍼는 실제로 hedge할 때만 (잠금 안이지만 드묾) */
+        if (req->winner < 0 && (req->buf[1] = malloc(size)) != NULL &&
+            hedge_submit_locked(req, r1) == 0)
+            __atomic_fetch_add(&hedge.hedged, 1, __ATOMIC_RELAXED);
+        while (req->winner < 0)
+            pthread_cond_wait(&hedge.done, &hedge.lock);
+        res = req->res[req->winner];
+        if (res > 0)
+            memcpy(buf, req->buf[req->winner], res);
+        if (req->winner > 0 && res >= 0)
+            __atomic_fetch_add(&hedge.wins, 1, __ATOMIC_RELAXED);
+    }
+    hedge_put_locked(req);
+    pthread_mutex_unlock(&hedge.lock);
+    return res;
+}
+
+/* release 전에: 이 핸들의 fd를 쓰는 hedge read가 남아 있으면 기다림 */
+static void hedge_drain(struct basic_fh *fh)
+{
+    pthread_mutex_lock(&hedge.lock);
+    while (fh->hedged)
+        pthread_cond_wait(&hedge.done, &hedge.lock);
+    pthread_mutex_unlock(&hedge.lock);
+}
+
+static void hedge_start(void)
+{
+    if (hedge.pct == 0 || mirror.n < 2)
+        return;
+    while (hedge.nthreads < HEDGE_THREADS &&
+           pthread_create(&hedge.threads[hedge.nthreads], NULL, hedge_main, NULL) == 0)
+        hedge.nthreads++;
+}
+
+static void hedge_stop(void)
+{
+    pthread_mutex_lock(&hedge.lock);
+    hedge.stop = 1;
+    pthread_cond_broadcast(&hedge.cond);
+    pthread_mutex_unlock(&hedge.lock);
+    for (int i = 0; i < hedge.nthreads; i++)
+        pthread_join(hedge.threads[i], NULL);
+    hedge.nthreads = 0;
+}
+
+static int mirror_read(int next, const char *path, char *buf, size_t size,
+                       off_t offset, struct fuse_file_info *fi)
+{
+    struct basic_fh *fh = get_fh(fi);
+    int r = mirror_pick(fh, -1), r1, res = -EAGAIN;
+
+    if (r < 0 || (r > 0 && (mirror.failed[r] || fh->mfd[r] < 0)))
+        return -EIO;    /* 고를 수 없는 복제본에 고정됨 */
+
+    /* 기준이 정해졌고 넘겨받을 복제본이 있으면 hedge, 큐가 차 있으면 직접 */
+    if (hedge.nthreads && mirror_pin < 0 && (r > 0 || fh->fd >= 0) &&
+        __atomic_load_n(&hedge.threshold_ns, __ATOMIC_RELAXED) &&
+        (r1 = mirror_pick(fh, r)) >= 0)
+        res = hedge_read(fh, buf, size, offset, r, r1);
+    if (res == -EAGAIN) {
+        /* breaker가 받지 않으면 (막 열렸거나 자리가 없음) 다른 복제본 하나로 */
+        int slot = brk_enter(&mirror.brk[r], BRK_NOWAIT);
+        if (slot < 0 && mirror_pin < 0 && (r1 = mirror_pick(fh, r)) >= 0 &&
+            (slot = brk_enter(&mirror.brk[r1], BRK_NOWAIT)) >= 0)
+            r = r1;
+        if (slot < 0)
+            return -EIO;
+        uint64_t t0 = now_ns();
+        __atomic_fetch_add(&mirror.inflight[r], 1, __ATOMIC_RELAXED);
+        if (r == 0) {
+            res = next_read(next, path, buf, size, offset, fi);
+        } else {
+            ssize_t n = BACKEND(pread(fh->mfd[r], buf, size, offset));
+            res = n == -1 ? -errno : (int) n;
+        }
+        brk_leave(&mirror.brk[r], slot, res);
+        __atomic_fetch_sub(&mirror.inflight[r], 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&mirror.reads[r], 1, __ATOMIC_RELAXED);
+        hedge_note(now_ns() - t0);
+    }
+
+    /* 다른 복제본이 안 되면 복제본 0으로 */
+    if (res < 0 && r > 0 && mirror_pin < 0 && !brk_tripped(&mirror.brk[0])) {
+        mirror_fail(r, path, res);
+        res = next_read(next, path, buf, size, offset, fi);
+    }
+    return res;
+}
+
+static int mirror_write(int next, const char *path, const char *buf, size_t size,
+                        off_t offset, struct fuse_file_info *fi)
+{
+    struct mirror_op op = { .kind = M_WRITE, .next = next, .path = path, .fi = fi,
+                            .buf = buf, .size = size, .off = offset };
+    return mirror_run(&op);
+}
+
+static int mirror_release(int next, const char *path, struct fuse_file_info *fi)
+{
+    struct basic_fh *fh = get_fh(fi);
+    if (fh && hedge.nthreads)
+        hedge_drain(fh);
+    for (int r = 1; fh && r < mirror.n; r++)
+        if (fh->mfd[r] >= 0)
+            BACKEND(close(fh->mfd[r]));
+    return next_release(next, path, fi);
+}
+
+static int mirror_truncate(int next, const char *path, off_t size, struct fuse_file_info *fi)
+{
+    struct mirror_op op = { .kind = M_TRUNCATE, .next = next, .path = path, .fi = fi,
+                            .off = size };
+    return mirror_run(&op);
+}
+
+static int mirror_unlink(int next, const char *path)
+{
+    struct mirror_op op = { .kind = M_UNLINK, .next = next, .path = path };
+    return mirror_run(&op);
+}
+
+static int mirror_rename(int next, const char *from, const char *to, unsigned int flags)
+{
+    if (is_mirror_state(from) || is_mirror_state(to))
+        return -EPERM;
+    struct mirror_op op = { .kind = M_RENAME, .next = next, .path = from, .to = to,
+                            .flags = flags };
+    return mirror_run(&op);
+}
+
+static int mirror_mkdir(int next, const char *path, mode_t mode)
+{
+    if (is_mirror_state(path))
+        return -EPERM;
+    struct mirror_op op = { .kind = M_MKDIR, .next = next, .path = path, .mode = mode };
+    return mirror_run(&op);
+}
+
+static int mirror_rmdir(int next, const char *path)
+{
+    struct mirror_op op = { .kind = M_RMDIR, .next = next, .path = path };
+    return mirror_run(&op);
+}
+
+static int mirror_chmod(int next, const char *path, mode_t mode, struct fuse_file_info *fi)
+{
+    struct mirror_op op = { .kind = M_CHMOD, .next = next, .path = path, .fi = fi,
+                            .mode = mode };
+    return mirror_run(&op);
+}
+
+static int mirror_utimens(int next, const char *path, const struct timespec ts[2],
+                          struct fuse_file_info *fi)
+{
+    struct mirror_op op = { .kind = M_UTIMENS, .next = next, .path = path, .fi = fi,
+                            .ts = ts };
+    return mirror_run(&op);
+}
+
+static int mirror_fsync(int next, const char *path, int datasync, struct fuse_file_info *fi)
+{
+    struct basic_fh *fh = get_fh(fi);
+    int err = 0;
+    for (int r = 1; fh && r < mirror.n; r++)
+        if (fh->mfd[r] >= 0 && BACKEND(datasync ? fdatasync(fh->mfd[r]) : fsync(fh->mfd[r])) == -1)
+            err = -errno;
+    int res = next_fsync(next, path, datasync, fi);
+    return res ? res : err;
+}
+
+static const struct basic_layer mirror_layer = {
+    .name       = "mirror",
+    .getattr    = mirror_getattr,
+    .readdir    = mirror_readdir,
+    .create     = mirror_create,
+    .open       = mirror_open,
+    .read       = mirror_read,
+    .write      = mirror_write,
+    .unlink     = mirror_unlink,
+    .rename     = mirror_rename,
+    .release    = mirror_release,
+    .mkdir      = mirror_mkdir,
+    .rmdir      = mirror_rmdir,
+    .chmod      = mirror_chmod,
+    .truncate   = mirror_truncate,
+    .utimens    = mirror_utimens,
+    .fsync      = mirror_fsync,
+};
+
+/* "/b:/c" -> 복제본 1, 2 */
+static int mirror_parse(const char *spec)
+{
+    char *copy = strdup(spec), *save = NULL;
+    if (copy == NULL)
+        return -ENOMEM;
+
+    int err = 0;
+    mirror.root[0] = (char *) DIR_PATH;
+    for (char *ent = strtok_r(copy, ":", &save); ent && err == 0;
+         ent = strtok_r(NULL, ":", &save)) {
+        struct stat st;
+        if (mirror.n == MIRROR_MAX)
+            err = -E2BIG;
+        else if (stat(ent, &st) == -1)
+            err = -errno;
+        else if (!S_ISDIR(st.st_mode))
+            err = -ENOTDIR;
+        else if ((mirror.root[mirror.n] = strdup(ent)) == NULL)
+            err = -ENOMEM;
+        else
+            mirror.n++;
+    }
+    free(copy);
+    return err == 0 && mirror.n < 2 ? -EINVAL : err;
+}
+
+/*
+ * GF(2^8) (다항식 0x11d): erasure coding의 parity 계산과 복원에 씀.
+ * 구간 곱셈-누적은 곱할 상수마다 하위/상위 nibble 표 두 개로 16(32)바이트씩
+ * pshufb 한 번에 처리하고, SSSE3이 없으면 같은 표로 바이트씩 계산한다.
+ */
+static uint8_t gf_exp[512], gf_log[256];
+static uint8_t gf_nib[256][32];     /* [c][x] = c*x (x < 16), [c][16 + x] = c*(x << 4) */
+
+static uint8_t gf_mul(uint8_t a, uint8_t b)
+{
+    return a && b ? gf_exp[gf_log[a] + gf_log[b]] : 0;
+}
+
+static uint8_t gf_inv(uint8_t a)
+{
+    return gf_exp[255 - gf_log[a]];
+}
+
+static void gf_init(void)
+{
+    unsigned int x = 1;
+    for (int i = 0; i < 255; i++) {
+        gf_exp[i] = gf_exp[i + 255] = x;
+        gf_log[x] = i;
+        x <<= 1;
+        if (x & 0x100)
+            x ^= 0x11d;
+    }
+    for (int c = 0; c < 256; c++)
+        for (int i = 0; i < 16; i++) {
+            gf_nib[c][i] = gf_mul(c, i);
+            gf_nib[c][16 + i] = gf_mul(c, i << 4);
+        }
+}
+
+static void gf_madd_sw(uint8_t *dst, const uint8_t *src, uint8_t c, size_t n)
+{
+    const uint8_t *t = gf_nib[c];
+    for (size_t i = 0; i < n; i++)
+        dst[i] ^= t[src[i] & 15] ^ t[16 + (src[i] >> 4)];
+}
+
+#if defined(__x86_64__)
+__attribute__((target("avx2")))
+static void gf_madd_avx2(uint8_t *dst, const uint8_t *src, uint8_t c, size_t n)
+{
+    __m256i lo = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) gf_nib[c]));
+    __m256i hi = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) (gf_nib[c] + 16)));
+    __m256i mask = _mm256_set1_epi8(0x0f);
+    size_t i = 0;
+
+    for (; i + 32 <= n; i += 32) {
+        __m256i x = _mm256_loadu_si256((const __m256i *) (src + i));
+        __m256i p = _mm256_xor_si256(
+            _mm256_shuffle_epi8(lo, _mm256_and_si256(x, mask)),
+            _mm256_shuffle_epi8(hi, _mm256_and_si256(_mm256_srli_epi64(x, 4), mask)));
+        __m256i d = _mm256_loadu_si256((const __m256i *) (dst + i));
+        _mm256_storeu_si256((__m256i *) (dst + i), _mm256_xor_si256(d, p));
+    }
+    gf_madd_sw(dst + i, src + i, c, n - i);
+}
+
+__attribute__((target("ssse3")))
+static void gf_madd_ssse3(uint8_t *dst, const uint8_t *src, uint8_t c, size_t n)
+{
+    __m128i lo = _mm_loadu_si128((const __m128i *) gf_nib[c]);
+    __m128i hi = _mm_loadu_si128((const __m128i *) (gf_nib[c] + 16));
+    __m128i mask = _mm_set1_epi8(0x0f);
+    size_t i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i *) (src + i));
+        __m128i p = _mm_xor_si128(_mm_shuffle_epi8(lo, _mm_and_si128(x, mask)),
+                                  _mm_shuffle_epi8(hi, _mm_and_si128(_mm_srli_epi64(x, 4), mask)));
+        __m128i d = _mm_loadu_si128((const __m128i *) (dst + i));
+        _mm_storeu_si128((__m128i *) (dst + i), _mm_xor_si128(d, p));
+    }
+    gf_madd_sw(dst + i, src + i, c, n - i);
+}
+#endif
+
+/* dst ^= c * src */
+static void gf_madd(uint8_t *dst, const uint8_t *src, uint8_t c, size_t n)
+{
+    if (c == 0)
+        return;
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("avx2")) {
+        gf_madd_avx2(dst, src, c, n);
+        return;
+    }
+    if (__builtin_cpu_supports("ssse3")) {
+        gf_madd_ssse3(dst, src, c, n);
+        return;
+    }
+#endif
+    gf_madd_sw(dst, src, c, n);
+}
+
+/* k x k 행렬을 역행렬로 (Gauss-Jordan), 특이하면 -1 */
+static int gf_invert(uint8_t a[MIRROR_MAX][MIRROR_MAX], uint8_t out[MIRROR_MAX][MIRROR_MAX], int k)
+{
+    for (int i = 0; i < k; i++)
+        for (int j = 0; j < k; j++)
+            out[i][j] = i == j;
+
+    for (int c = 0; c < k; c++) {
+        int p = c;
+        while (p < k && a[p][c] == 0)
+            p++;
+        if (p == k)
+            return -1;
+        for (int j = 0; j < k; j++) {
+            uint8_t t = a[c][j]; a[c][j] = a[p][j]; a[p][j] = t;
+            t = out[c][j]; out[c][j] = out[p][j]; out[p][j] = t;
+        }
+        uint8_t inv = gf_inv(a[c][c]);
+        for (int j = 0; j < k; j++) {
+            a[c][j] = gf_mul(a[c][j], inv);
+            out[c][j] = gf_mul(out[c][j], inv);
+        }
+        for (int i = 0; i < k; i++) {
+            uint8_t f = a[i][c];
+            if (i == c || f == 0)
+                continue;
+            for (int j = 0; j < k; j++) {
+                a[i][j] ^= gf_mul(f, a[c][j]);
+                out[i][j] ^= gf_mul(f, out[c][j]);
+            }
+        }
+    }
+    return 0;
+}
+
+/*
+ * erasure coding (-o mirror=/b:/c:/d,mirror_ec=K): mirror의 루트 n개에 파일을
+ * 조각 n개로 나눠 둔다. 논리 파일은 stripe(cell * K바이트) 단위로 잘라 stripe마다
+ * cell 하나씩을 데이터 조각 0..K-1에, Reed-Solomon parity(Cauchy 행렬) cell을
+ * 조각 K..n-1에 둔다. 조각 파일은 각 루트에서 원래 이름 그대로이며, 데이터 조각은
+ * 채운 만큼만 길어서 논리 크기는 데이터 조각 길이의 합이다 (parity 조각은 앞
+ * EC_PHDR에 논리 크기를 두어 데이터 조각이 빠졌을 때 씀).
+ *
+ * read는 필요한 데이터 조각을 병렬로 직접 읽고, 조각이 없거나 실패하면 아무
+ * 조각 K개로 복원한다. write는 stripe 전체를 덮는 부분만 바로 parity와 함께 쓰고,
+ * 앞뒤의 부분 stripe는 small-write log(숨김 .bec.이름, 루트 0..n-K에 같은 사본)에
+ * 붙여 두었다가 log가 EC_LOG_MAX를 넘거나 마지막 핸들이 닫힐 때 stripe마다 한 번의
+ * read-modify-write로 반영한다. log의 내용은 메모리에도 두어 read에 덮어 보여 준다.
+ * 비정상 종료로 남은 log는 다음 open(또는 getattr) 때 반영한다.
+ */
+#define EC_LOG_PREFIX ".bec."
+#define EC_LOG_MAGIC 0x4c434542u   /* "BECL" */
+#define EC_LOG_MAX (4 * 1024 * 1024)
+#define EC_PHDR 8
+#define EC_ETAB_SIZE 256
+
+struct ec_rec {
+    uint32_t magic;
+    uint32_t len;
+    uint64_t off;
+    uint32_t crc;               /* off, len과 데이터의 crc32c */
+    uint32_t pad;
+};
+
+struct ec_ext {
+    uint64_t off;
+    size_t len;
+    char *data;
+};
+
+struct ec_file {
+    struct ec_file *next;
+    dev_t dev;
+    ino_t ino;
+    unsigned int refs;
+    pthread_rwlock_t lock;      /* read는 rdlock, 크기나 내용을 바꾸는 쪽은 wrlock */
+    int fd[MIRROR_MAX];         /* 조각 파일, 없거나 실패한 루트는 -1 */
+    int lfd[MIRROR_MAX];        /* log 사본 (루트 0..n-K), 아직 열지 않았으면 -1 */
+    uint64_t size;              /* 논리 크기 (log 포함) */
+    uint64_t dsize;             /* 조각 파일들이 나타내는 크기 */
+    off_t lpos;                 /* log 파일의 끝 */
+    struct ec_ext *ext;         /* log의 write, 기록 순서대로 */
+    size_t next_ext, cap_ext;
+    size_t logged;              /* log 데이터 바이트 */
+};
+
+static struct {
+    pthread_mutex_t lock;
+    struct ec_file *bucket[EC_ETAB_SIZE];
+} etab = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static uint64_t ec_width(void)
+{
+    return (uint64_t) ec.cell * ec.k;
+}
+
+static int ec_up(const struct ec_file *f, int r)
+{
+    return f->fd[r] >= 0 && !mirror.failed[r];
+}
+
+/* 조각 r에서 stripe s의 cell이 시작하는 위치 */
+static off_t ec_cell_pos(int r, uint64_t s)
+{
+    return (r >= ec.k ? EC_PHDR : 0) + s * ec.cell;
+}
+
+/* 논리 크기 size일 때 조각 r의 길이 */
+static off_t ec_frag_len(int r, uint64_t size)
+{
+    uint64_t C = ec.cell, W = ec_width(), s = size / W, rem = size % W;
+    if (r >= ec.k)
+        return EC_PHDR + (s + (rem > 0)) * C;
+    uint64_t part = rem > r * C ? rem - r * C : 0;
+    return s * C + (part < C ? part : C);
+}
+
+static int is_ec_log(const char *path)
+{
+    const char *base = strrchr(path, '/');
+    return strncmp(base ? base + 1 : path, EC_LOG_PREFIX, strlen(EC_LOG_PREFIX)) == 0;
+}
+
+/* 루트 r에서 path의 log 경로 "/root/dir/.bec.name" */
+static int ec_log_path(int r, const char *path, char *out, size_t len)
+{
+    const char *base = strrchr(path, '/') + 1;
+    int n = snprintf(out, len, "%s%.*s%s%s", mirror.root[r], (int) (base - path), path,
+                     EC_LOG_PREFIX, base);
+    return n < 0 || (size_t) n >= len ? -ENAMETOOLONG : 0;
+}
+
+/* 조각 길이에서 논리 크기: 데이터 조각 길이의 합, 빠진 조각이 있으면 parity 헤더.
+ * fd가 NULL이면 경로로 (getattr), len0은 이미 아는 조각 0의 길이 (-1이면 모름) */
+static int ec_size_of(const char *path, const int *fd, off_t len0, uint64_t *size)
+{
+    char p[PATH_MAX];
+    uint64_t sum = 0;
+    int r;
+
+    for (r = 0; r < ec.k; r++) {
+        struct stat st;
+        if (r == 0 && len0 >= 0) {
+            sum += len0;
+            continue;
+        }
+        mirror_path(r, path, p, sizeof(p));
+        if (mirror.failed[r] ||
+            (fd ? fd[r] < 0 || fstat(fd[r], &st) == -1 : BACKEND(stat(p, &st)) == -1))
+            break;
+        sum += st.st_size;
+    }
+    if (r == ec.k) {
+        *size = sum;
+        return 0;
+    }
+
+    for (r = ec.k; r < mirror.n; r++) {
+        uint8_t h[EC_PHDR];
+        if (mirror.failed[r] || (fd && fd[r] < 0))
+            continue;
+        mirror_path(r, path, p, sizeof(p));
+        int pfd = fd ? fd[r] : BACKEND(open(p, O_RDONLY | O_CLOEXEC));
+        ssize_t n = pfd < 0 ? -1 : BACKEND(pread(pfd, h, sizeof(h), 0));
+        if (!fd && pfd >= 0)
+            close(pfd);
+        if (n == (ssize_t) sizeof(h)) {
+            *size = load32(h) | (uint64_t) load32(h + 4) << 32;
+            return 0;
+        }
+    }
+    return -EIO;
+}
+
+/* iov 전체를 읽거나 씀 (짧으면 이어서), read가 끝에서 멈추면 -EIO */
+static int ec_pio(int fd, struct iovec *iov, int cnt, off_t off, int write)
+{
+    while (cnt > 0) {
+        int c = cnt > IOV_MAX ? IOV_MAX : cnt;
+        ssize_t n = write ? BACKEND(pwritev(fd, iov, c, off)) : BACKEND(preadv(fd, iov, c, off));
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return n == 0 ? -EIO : -errno;
+        off += n;
+        while (cnt > 0 && (size_t) n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            cnt--;
+        }
+        if (cnt > 0) {
+            iov->iov_base = (char *) iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+/* 조각마다 병렬로 처리하는 I/O 하나 */
+struct ec_io {
+    struct ec_file *f;
+    int write;
+    int rows[MIRROR_MAX];       /* 작업 i가 맡는 조각 */
+    int res[MIRROR_MAX];
+    /* 조각 단위 cell 배열 (ec_load/ec_store): cells[r] + i * cell = stripe s + i */
+    uint8_t **cells;
+    uint64_t s;
+    size_t cnt;
+    off_t limit[MIRROR_MAX];    /* 쓸 때 조각 길이 상한 */
+    /* 논리 버퍼와 직접 (ec_direct): 조각마다 iov */
+    struct iovec *iov[MIRROR_MAX];
+    int niov[MIRROR_MAX];
+    off_t pos[MIRROR_MAX];
+};
+
+static void ec_io_job(void *arg, unsigned int i)
+{
+    struct ec_io *io = arg;
+    int r = io->rows[i], fd = io->f->fd[r];
+    off_t pos = ec_cell_pos(r, io->s);
+    size_t len = io->cnt * ec.cell;
+
+    __atomic_fetch_add(&mirror.inflight[r], 1, __ATOMIC_RELAXED);
+    if (io->iov[r]) {
+        io->res[i] = ec_pio(fd, io->iov[r], io->niov[r], io->pos[r], io->write);
+    } else if (io->write) {
+        if (pos + (off_t) len > io->limit[r])
+            len = io->limit[r] > pos ? io->limit[r] - pos : 0;
+        struct iovec v = { io->cells[r], len };
+        io->res[i] = len ? ec_pio(fd, &v, 1, pos, 1) : 0;
+    } else {
+        /* 조각 끝 뒤는 0 (마지막 stripe의 채워지지 않은 부분) */
+        size_t done = 0;
+        io->res[i] = 0;
+        while (done < len) {
+            ssize_t n = BACKEND(pread(fd, io->cells[r] + done, len - done, pos + done));
+            if (n == -1 && errno == EINTR)
+                continue;
+            if (n <= 0) {
+                io->res[i] = n == 0 ? 0 : -errno;
+                break;
+            }
+            done += n;
+        }
+        memset(io->cells[r] + done, 0, len - done);
+    }
+    __atomic_fetch_sub(&mirror.inflight[r], 1, __ATOMIC_RELAXED);
+    if (!io->write)
+        __atomic_fetch_add(&mirror.reads[r], 1, __ATOMIC_RELAXED);
+}
+
+/* cells의 데이터 행으로 parity 행을 계산 */
+static void ec_encode(uint8_t **cells, size_t len)
+{
+    for (int p = 0; p < mirror.n - ec.k; p++) {
+        memset(cells[ec.k + p], 0, len);
+        for (int j = 0; j < ec.k; j++)
+            gf_madd(cells[ec.k + p], cells[j], ec.gen[p][j], len);
+    }
+}
+
+/* 성공한 조각 have[] 중 K개로 빠진 데이터 행을 복원 */
+static int ec_decode(uint8_t **cells, const int *have, size_t len)
+{
+    uint8_t a[MIRROR_MAX][MIRROR_MAX], inv[MIRROR_MAX][MIRROR_MAX];
+    int rows[MIRROR_MAX], n = 0;
+
+    for (int r = 0; r < mirror.n && n < ec.k; r++) {
+        if (!have[r])
+            continue;
+        for (int j = 0; j < ec.k; j++)
+            a[n][j] = r < ec.k ? r == j : ec.gen[r - ec.k][j];
+        rows[n++] = r;
+    }
+    if (n < ec.k || gf_invert(a, inv, ec.k))
+        return -EIO;
+    for (int j = 0; j < ec.k; j++) {
+        if (have[j])
+            continue;
+        memset(cells[j], 0, len);
+        for (int i = 0; i < ec.k; i++)
+            gf_madd(cells[j], cells[rows[i]], inv[j][i], len);
+    }
+    return 0;
+}
+
+/* stripe s부터 cnt개의 데이터 cell을 cells[0..K-1]에 (빠진 조각은 parity로 복원) */
+static int ec_load(struct ec_file *f, const char *path, uint64_t s, size_t cnt, uint8_t **cells)
+{
+    int have[MIRROR_MAX] = { 0 }, tried[MIRROR_MAX] = { 0 }, nhave = 0;
+    size_t len = cnt * ec.cell;
+
+    while (nhave < ec.k) {
+        struct ec_io io = { .f = f, .cells = cells, .s = s, .cnt = cnt };
+        int n = 0;
+        for (int r = 0; r < mirror.n; r++) {
+            if (tried[r] || !ec_up(f, r) || (r >= ec.k && nhave + n >= ec.k))
+                continue;
+            tried[r] = 1;
+            io.rows[n++] = r;
+        }
+        if (n == 0)
+            return -EIO;
+        hpool_run(ec_io_job, &io, n);
+        for (int i = 0; i < n; i++) {
+            if (io.res[i] == 0) {
+                have[io.rows[i]] = 1;
+                nhave++;
+            } else {
+                mirror_fail(io.rows[i], path, io.res[i]);
+            }
+        }
+    }
+    for (int j = 0; j < ec.k; j++)
+        if (!have[j]) {
+            __atomic_fetch_add(&ec.degraded, 1, __ATOMIC_RELAXED);
+            return ec_decode(cells, have, len);
+        }
+    return 0;
+}
+
+/* 조각 first..n-1에 stripe s부터 cnt개의 cell을 씀 (조각 길이는 dsize에 맞춤),
+ * K개 미만에 쓰였으면 실패 */
+static int ec_store(struct ec_file *f, const char *path, uint64_t s, size_t cnt,
+                    uint8_t **cells, int first)
+{
+    struct ec_io io = { .f = f, .write = 1, .cells = cells, .s = s, .cnt = cnt };
+    int n = 0, ok = first;
+
+    for (int r = first; r < mirror.n; r++)
+        if (ec_up(f, r)) {
+            io.limit[r] = ec_frag_len(r, f->dsize);
+            io.rows[n++] = r;
+        }
+    hpool_run(ec_io_job, &io, n);
+    for (int i = 0; i < n; i++) {
+        if (io.res[i] == 0)
+            ok++;
+        else
+            mirror_fail(io.rows[i], path, io.res[i]);
+    }
+    return ok >= ec.k ? 0 : -EIO;
+}
+
+/* 조각 파일 길이와 parity 헤더를 논리 크기 size에 맞춤 (늘어난 부분은 0) */
+static int ec_set_size(struct ec_file *f, const char *path, uint64_t size)
+{
+    uint8_t h[EC_PHDR];
+    int ok = 0;
+
+    store32(h, (uint32_t) size);
+    store32(h + 4, (uint32_t) (size >> 32));
+    for (int r = 0; r < mirror.n; r++) {
+        if (!ec_up(f, r))
+            continue;
+        if (BACKEND(ftruncate(f->fd[r], ec_frag_len(r, size))) == -1 ||
+            (r >= ec.k && BACKEND(pwrite(f->fd[r], h, sizeof(h), 0)) != (ssize_t) sizeof(h)))
+            mirror_fail(r, path, -errno);
+        else
+            ok++;
+    }
+    if (ok < ec.k)
+        return -EIO;
+    f->dsize = size;
+    if (f->size < size)
+        f->size = size;
+    return 0;
+}
+
+static uint8_t **ec_cells(size_t len)
+{
+    uint8_t **cells = calloc(mirror.n, sizeof(*cells));
+    for (int r = 0; cells && r < mirror.n; r++)
+        if ((cells[r] = malloc(len ? len : 1)) == NULL) {
+            while (r--)
+                free(cells[r]);
+            free(cells);
+            return NULL;
+        }
+    return cells;
+}
+
+static void ec_cells_free(uint8_t **cells)
+{
+    for (int r = 0; cells && r < mirror.n; r++)
+        free(cells[r]);
+    free(cells);
+}
+
+/* 논리 [off, off+len)을 조각 단위 cells(stripe s부터)로 / 에서 복사 */
+static void ec_scatter(uint8_t **cells, uint64_t s, uint64_t off, const char *src,
+                       size_t len, char *dst)
+{
+    uint64_t C = ec.cell, W = ec_width();
+
+    while (len > 0) {
+        uint64_t st = off / W, j = off % W / C, o = off % C;
+        size_t n = C - o < len ? C - o : len;
+        uint8_t *cell = cells[j] + (st - s) * C + o;
+        if (src) {
+            memcpy(cell, src, n);
+            src += n;
+        } else {
+            memcpy(dst, cell, n);
+            dst += n;
+        }
+        off += n;
+        len -= n;
+    }
+}
+
+/* 반영을 마친 log를 닫고 파일을 지움 */
+static void ec_log_drop(struct ec_file *f, const char *path)
+{
+    char p[PATH_MAX];
+    for (int r = 0; r <= mirror.n - ec.k; r++) {
+        if (f->lfd[r] < 0)
+            continue;
+        close(f->lfd[r]);
+        f->lfd[r] = -1;
+        if (ec_log_path(r, path, p, sizeof(p)) == 0)
+            BACKEND(unlink(p));
+    }
+}
+
+/* log의 write를 stripe에 반영하고 log를 비움 (wrlock) */
+static int ec_flush(struct ec_file *f, const char *path)
+{
+    if (f->next_ext == 0)
+        return 0;
+
+    uint64_t W = ec_width();
+    size_t run = EC_LOG_MAX / W ? EC_LOG_MAX / W : 1;
+    int err = f->size > f->dsize ? ec_set_size(f, path, f->size) : 0;
+    uint8_t **cells = err ? NULL : ec_cells(run * ec.cell);
+    if (err == 0 && cells == NULL)
+        err = -ENOMEM;
+
+    /* 아직 반영하지 않은 가장 낮은 stripe부터 최대 run개씩 (log 순서대로 덮음) */
+    uint64_t from = 0;
+    while (err == 0) {
+        uint64_t s = UINT64_MAX, last = 0;
+        for (size_t i = 0; i < f->next_ext; i++) {
+            struct ec_ext *e = &f->ext[i];
+            uint64_t a = e->off / W, b = (e->off + e->len - 1) / W;
+            if (b < from)
+                continue;
+            s = (a > from ? a : from) < s ? (a > from ? a : from) : s;
+            last = b > last ? b : last;
+        }
+        if (s == UINT64_MAX)
+            break;
+        size_t cnt = last - s + 1 < run ? last - s + 1 : run;
+        uint64_t lo = s * W, hi = (s + cnt) * W;
+        if ((err = ec_load(f, path, s, cnt, cells)) != 0)
+            break;
+        for (size_t i = 0; i < f->next_ext; i++) {
+            struct ec_ext *e = &f->ext[i];
+            uint64_t a = e->off > lo ? e->off : lo, b = e->off + e->len < hi ? e->off + e->len : hi;
+            if (a < b)
+                ec_scatter(cells, s, a, e->data + (a - e->off), b - a, NULL);
+        }
+        ec_encode(cells, cnt * ec.cell);
+        err = ec_store(f, path, s, cnt, cells, 0);
+        from = s + cnt;
+    }
+    ec_cells_free(cells);
+    if (err)
+        return err;
+
+    /* 반영이 끝났으니 log는 처음부터 다시 */
+    for (int r = 0; r <= mirror.n - ec.k; r++)
+        if (f->lfd[r] >= 0)
+            BACKEND(ftruncate(f->lfd[r], 0));
+    for (size_t i = 0; i < f->next_ext; i++)
+        free(f->ext[i].data);
+    f->next_ext = 0;
+    f->logged = 0;
+    f->lpos = 0;
+    __atomic_fetch_add(&ec.flushes, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+static int ec_ext_add(struct ec_file *f, uint64_t off, const char *buf, size_t len)
+{
+    if (f->next_ext == f->cap_ext) {
+        size_t cap = f->cap_ext ? f->cap_ext * 2 : 16;
+        struct ec_ext *ext = realloc(f->ext, cap * sizeof(*ext));
+        if (ext == NULL)
+            return -ENOMEM;
+        f->ext = ext;
+        f->cap_ext = cap;
+    }
+    char *data = malloc(len);
+    if (data == NULL)
+        return -ENOMEM;
+    memcpy(data, buf, len);
+    f->ext[f->next_ext++] = (struct ec_ext) { off, len, data };
+    f->logged += len;
+    if (f->size < off + len)
+        f->size = off + len;
+    return 0;
+}
+
+/* 부분 stripe write를 log 사본 모두에 붙이고 메모리에도 둠 */
+static int ec_log_append(struct ec_file *f, const char *path, uint64_t off,
+                         const char *buf, size_t len)
+{
+    char p[PATH_MAX];
+    struct ec_rec rec = { .magic = EC_LOG_MAGIC, .len = len, .off = off };
+    int ok = 0;
+
+    rec.crc = crc32c(crc32c(0, &rec.off, sizeof(rec.off)), &rec.len, sizeof(rec.len));
+    rec.crc = crc32c(rec.crc, buf, len);
+    for (int r = 0; r <= mirror.n - ec.k; r++) {
+        if (mirror.failed[r])
+            continue;
+        if (f->lfd[r] < 0 && ec_log_path(r, path, p, sizeof(p)) == 0)
+            f->lfd[r] = BACKEND(open(p, O_RDWR | O_CREAT | O_CLOEXEC, 0600));
+        if (f->lfd[r] < 0)
+            continue;
+        struct iovec v[2] = { { &rec, sizeof(rec) }, { (void *) buf, len } };
+        if (ec_pio(f->lfd[r], v, 2, f->lpos, 1) == 0)
+            ok++;
+    }
+    /* 조각을 잃을 수 있는 만큼(n-K개) 루트를 잃어도 log 하나는 남아야 함 */
+    if (ok == 0)
+        return -EIO;
+    f->lpos += sizeof(rec) + len;
+    __atomic_fetch_add(&ec.logged, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&ec.logged_bytes, len, __ATOMIC_RELAXED);
+    return ec_ext_add(f, off, buf, len);
+}
+
+/* 남은 log를 읽어 메모리로 (가장 길게 온전한 사본), 끝이 깨진 기록은 버림 */
+static int ec_log_replay(struct ec_file *f, const char *path)
+{
+    char p[PATH_MAX];
+    int best = -1;
+    off_t best_len = 0;
+
+    for (int r = 0; r <= mirror.n - ec.k; r++) {
+        if (mirror.failed[r] || ec_log_path(r, path, p, sizeof(p)))
+            continue;
+        f->lfd[r] = BACKEND(open(p, O_RDWR | O_CLOEXEC));
+        if (f->lfd[r] < 0)
+            continue;
+        off_t pos = 0;
+        struct ec_rec rec;
+        while (BACKEND(pread(f->lfd[r], &rec, sizeof(rec), pos)) == (ssize_t) sizeof(rec) &&
+               rec.magic == EC_LOG_MAGIC) {
+            char *data = malloc(rec.len ? rec.len : 1);
+            int good = data && BACKEND(pread(f->lfd[r], data, rec.len, pos + sizeof(rec))) ==
+                                   (ssize_t) rec.len;
+            uint32_t crc = crc32c(crc32c(0, &rec.off, sizeof(rec.off)), &rec.len, sizeof(rec.len));
+            good = good && crc32c(crc, data, rec.len) == rec.crc;
+            free(data);
+            if (!good)
+                break;
+            pos += sizeof(rec) + rec.len;
+        }
+        if (pos > best_len) {
+            best = r;
+            best_len = pos;
+        }
+    }
+    if (best < 0)
+        return 0;
+
+    for (off_t pos = 0; pos < best_len;) {
+        struct ec_rec rec;
+        if (BACKEND(pread(f->lfd[best], &rec, sizeof(rec), pos)) != (ssize_t) sizeof(rec))
+            return -EIO;
+        char *data = malloc(rec.len ? rec.len : 1);
+        int err = data == NULL ? -ENOMEM :
+                  BACKEND(pread(f->lfd[best], data, rec.len, pos + sizeof(rec))) !=
+                  (ssize_t) rec.len ? -EIO : ec_ext_add(f, rec.off, data, rec.len);
+        free(data);
+        if (err)
+            return err;
+        pos += sizeof(rec) + rec.len;
+    }
+    fprintf(stderr, "[INFO] ec: replaying %zu logged writes for %s\n", f->next_ext, path);
+    return ec_flush(f, path);
+}
+
+/* 논리 크기를 size로 (wrlock): 줄일 때는 마지막 stripe의 parity를 다시 계산 */
+static int ec_resize(struct ec_file *f, const char *path, uint64_t size)
+{
+    uint64_t W = ec_width();
+    int err = ec_flush(f, path);
+    if (err)
+        return err;
+
+    if (size < f->dsize && size % W) {
+        uint64_t s = size / W, keep = size % W;
+        uint8_t **cells = ec_cells(ec.cell);
+        if (cells == NULL)
+            return -ENOMEM;
+        err = ec_load(f, path, s, 1, cells);
+        if (err == 0) {
+            for (int j = 0; j < ec.k; j++) {
+                uint64_t from = keep > (uint64_t) j * ec.cell ? keep - (uint64_t) j * ec.cell : 0;
+                if (from < ec.cell)
+                    memset(cells[j] + from, 0, ec.cell - from);
+            }
+            ec_encode(cells, ec.cell);
+            err = ec_set_size(f, path, size);
+        }
+        if (err == 0)
+            err = ec_store(f, path, s, 1, cells, ec.k);
+        ec_cells_free(cells);
+    } else {
+        err = ec_set_size(f, path, size);
+    }
+    if (err == 0)
+        f->size = size;
+    return err;
+}
+
+static struct ec_file **etab_find_locked(dev_t dev, ino_t ino)
+{
+    struct ec_file **pp = &etab.bucket[(ino ^ dev) % EC_ETAB_SIZE];
+    while (*pp && ((*pp)->dev != dev || (*pp)->ino != ino))
+        pp = &(*pp)->next;
+    return pp;
+}
+
+/* log 파일은 남겨 둠 (지우는 것은 반영한 뒤 ec_log_drop) */
+static void ec_free(struct ec_file *f)
+{
+    for (int r = 0; r < mirror.n; r++) {
+        if (f->fd[r] >= 0)
+            close(f->fd[r]);
+        if (f->lfd[r] >= 0)
+            close(f->lfd[r]);
+    }
+    for (size_t i = 0; i < f->next_ext; i++)
+        free(f->ext[i].data);
+    free(f->ext);
+    pthread_rwlock_destroy(&f->lock);
+    free(f);
+}
+
+/* path 파일의 조각들을 연 공유 상태 (처음이면 크기를 구하고 남은 log를 반영) */
+static int ec_acquire(const char *path, int create, mode_t mode, struct ec_file **out)
+{
+    char p[PATH_MAX];
+    struct stat st;
+
+    mirror_path(0, path, p, sizeof(p));
+    int fd0 = BACKEND(open(p, O_RDWR | O_CLOEXEC));
+    if (fd0 == -1)
+        return -errno;
+    if (fstat(fd0, &st) == -1 || !S_ISREG(st.st_mode)) {
+        close(fd0);
+        return -EINVAL;
+    }
+
+    int err = 0;
+    pthread_mutex_lock(&etab.lock);
+    struct ec_file **pp = etab_find_locked(st.st_dev, st.st_ino);
+    struct ec_file *f = *pp;
+    if (f) {
+        f->refs++;
+        close(fd0);
+    } else if ((f = calloc(1, sizeof(*f))) == NULL) {
+        close(fd0);
+        err = -ENOMEM;
+    } else {
+        f->dev = st.st_dev;
+        f->ino = st.st_ino;
+        f->refs = 1;
+        pthread_rwlock_init(&f->lock, NULL);
+        for (int r = 0; r < MIRROR_MAX; r++)
+            f->fd[r] = f->lfd[r] = -1;
+        f->fd[0] = fd0;
+        for (int r = 1; r < mirror.n; r++) {
+            if (mirror.failed[r])
+                continue;
+            mirror_path(r, path, p, sizeof(p));
+            f->fd[r] = BACKEND(open(p, O_RDWR | O_CLOEXEC | (create ? O_CREAT : 0), mode));
+            if (f->fd[r] < 0)
+                mirror_fail(r, path, -errno);
+        }
+        /* 새로 만든 파일: 다른 루트에 남아 있던 같은 이름의 조각은 버림 */
+        if (create && st.st_size == 0)
+            err = ec_set_size(f, path, 0);
+        else if ((err = ec_size_of(path, f->fd, st.st_size, &f->dsize)) == 0)
+            f->size = f->dsize;
+        if (err == 0)
+            err = ec_log_replay(f, path);
+        if (err)
+            ec_free(f);
+        else
+            *pp = f;
+    }
+    pthread_mutex_unlock(&etab.lock);
+
+    *out = err ? NULL : f;
+    return err;
+}
+
+static void ec_put(struct ec_file *f, const char *path)
+{
+    pthread_mutex_lock(&etab.lock);
+    if (--f->refs == 0) {
+        *etab_find_locked(f->dev, f->ino) = f->next;
+        /* 반영하지 못한 log는 지우지 않고 다음 open에서 다시 */
+        int err = ec_flush(f, path);
+        if (err)
+            fprintf(stderr, "[WARN] ec: %s: logged writes kept in the log (%s)\n",
+                    path, strerror(-err));
+        else
+            ec_log_drop(f, path);
+        ec_free(f);
+    }
+    pthread_mutex_unlock(&etab.lock);
+}
+
+static int ec_getattr(int next, const char *path, struct stat *stbuf, struct fuse_file_info *fi)
+{
+    if (is_ec_log(path) || is_mirror_state(path))
+        return -ENOENT;
+    int res = next_getattr(next, path, stbuf, fi);
+    if (res || !S_ISREG(stbuf->st_mode) || strcmp(path, STATS_PATH) == 0)
+        return res;
+
+    /* 열려 있으면 log까지 포함한 크기 */
+    pthread_mutex_lock(&etab.lock);
+    struct ec_file *f = *etab_find_locked(stbuf->st_dev, stbuf->st_ino);
+    if (f)
+        stbuf->st_size = __atomic_load_n(&f->size, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&etab.lock);
+    if (f)
+        return 0;
+
+    /* 비정상 종료로 남은 log가 있으면 먼저 반영 */
+    char p[PATH_MAX];
+    struct stat lst;
+    if (ec_log_path(0, path, p, sizeof(p)) == 0 && BACKEND(stat(p, &lst)) == 0 &&
+        ec_acquire(path, 0, 0, &f) == 0) {
+        stbuf->st_size = f->size;
+        ec_put(f, path);
+        return 0;
+    }
+
+    uint64_t size;
+    if (ec_size_of(path, NULL, stbuf->st_size, &size) == 0)
+        stbuf->st_size = size;
+    return 0;
+}
+
+struct ec_dir {
+    void *buf;
+    fuse_fill_dir_t filler;
+};
+
+static int ec_filler(void *buf, const char *name, const struct stat *stbuf,
+                     off_t off, enum fuse_fill_dir_flags flags)
+{
+    const struct ec_dir *d = buf;
+    if (strncmp(name, EC_LOG_PREFIX, strlen(EC_LOG_PREFIX)) == 0 || is_mirror_state(name))
+        return 0;
+    return d->filler(d->buf, name, stbuf, off, flags);
+}
+
+static int ec_readdir(int next, const char *path, void *buf, fuse_fill_dir_t filler,
+                      off_t offset, struct fuse_file_info *fi, enum fuse_readdir_flags flags)
+{
+    struct ec_dir d = { buf, filler };
+    return next_readdir(next, path, &d, ec_filler, offset, fi, flags);
+}
+
+/* 조각을 직접 다루므로 루트 0도 읽기/쓰기로 (O_APPEND면 커널이 끝 위치를 줌) */
+static int ec_attach(int next, const char *path, struct fuse_file_info *fi, int flags,
+                     int create, mode_t mode)
+{
+    struct ec_file *f;
+    int err = ec_acquire(path, create, mode, &f);
+    if (err == 0 && (flags & O_TRUNC)) {
+        pthread_rwlock_wrlock(&f->lock);
+        err = ec_resize(f, path, 0);
+        pthread_rwlock_unlock(&f->lock);
+        if (err)
+            ec_put(f, path);
+    }
+    fi->flags = flags;
+    if (err) {
+        next_release(next, path, fi);
+        return err;
+    }
+    get_fh(fi)->ec = f;
+    return 0;
+}
+
+static int ec_create(int next, const char *path, mode_t mode, struct fuse_file_info *fi)
+{
+    if (is_ec_log(path) || is_mirror_state(path))
+        return -EPERM;
+    int flags = fi->flags;
+    fi->flags = (flags & ~(O_ACCMODE | O_APPEND | O_TRUNC)) | O_RDWR;
+    int res = next_create(next, path, mode, fi);
+    if (res) {
+        fi->flags = flags;
+        return res;
+    }
+    return ec_attach(next, path, fi, flags, 1, mode);
+}
+
+static int ec_open(int next, const char *path, struct fuse_file_info *fi)
+{
+    if (strcmp(path, STATS_PATH) == 0)
+        return next_open(next, path, fi);
+    int flags = fi->flags;
+    fi->flags = (flags & ~(O_ACCMODE | O_APPEND | O_TRUNC)) | O_RDWR;
+    int res = next_open(next, path, fi);
+    if (res) {
+        fi->flags = flags;
+        return res;
+    }
+    return ec_attach(next, path, fi, flags, 0, 0);
+}
+
+/* 데이터 조각에서 논리 [off, off+len)을 buf로 직접 (조각마다 preadv 하나, 병렬) */
+static int ec_direct(struct ec_file *f, const char *path, char *buf, uint64_t off, size_t len)
+{
+    uint64_t C = ec.cell, W = ec_width(), s0 = off / W, s1 = (off + len - 1) / W;
+    size_t per = s1 - s0 + 1;
+    struct ec_io io = { .f = f };
+    struct iovec *iov = calloc(ec.k * per, sizeof(*iov));
+    int n = 0, err = 0;
+
+    if (iov == NULL)
+        return -ENOMEM;
+    for (int j = 0; j < ec.k; j++) {
+        io.iov[j] = iov + j * per;
+        for (uint64_t s = s0; s <= s1; s++) {
+            uint64_t a = s * W + j * C, b = a + C;
+            a = a > off ? a : off;
+            b = b < off + len ? b : off + len;
+            if (a >= b)
+                continue;
+            if (io.niov[j] == 0)
+                io.pos[j] = s * C + (a - (s * W + j * C));
+            io.iov[j][io.niov[j]++] = (struct iovec) { buf + (a - off), b - a };
+        }
+        if (io.niov[j] == 0) {
+            io.iov[j] = NULL;
+            continue;
+        }
+        if (!ec_up(f, j)) {
+            err = -EIO;
+            break;
+        }
+        io.rows[n++] = j;
+    }
+    if (err == 0) {
+        hpool_run(ec_io_job, &io, n);
+        /* 크기 안에서 짧거나 실패한 조각은 더 쓰지 않음 (복원은 parity로) */
+        for (int i = 0; i < n; i++)
+            if (io.res[i]) {
+                mirror_fail(io.rows[i], path, io.res[i]);
+                err = io.res[i];
+            }
+    }
+    free(iov);
+    return err;
+}
+
+static int ec_read(int next, const char *path, char *buf, size_t size, off_t offset,
+                   struct fuse_file_info *fi)
+{
+    struct basic_fh *fh = get_fh(fi);
+    struct ec_file *f = fh ? fh->ec : NULL;
+    if (f == NULL)
+        return next_read(next, path, buf, size, offset, fi);
+
+    pthread_rwlock_rdlock(&f->lock);
+    uint64_t end = (uint64_t) offset + size;
+    if ((uint64_t) offset >= f->size) {
+        pthread_rwlock_unlock(&f->lock);
+        return 0;
+    }
+    if (end > f->size)
+        end = f->size;
+
+    /* 조각에 있는 부분, 그 뒤(log로만 늘어난 부분)는 0 */
+    uint64_t dend = end < f->dsize ? end : f->dsize;
+    int err = 0;
+    if ((uint64_t) offset < dend) {
+        err = ec_direct(f, path, buf, offset, dend - offset);
+        if (err) {
+            uint64_t W = ec_width(), s0 = offset / W, cnt = (dend - 1) / W - s0 + 1;
+            uint8_t **cells = ec_cells(cnt * ec.cell);
+            err = cells ? ec_load(f, path, s0, cnt, cells) : -ENOMEM;
+            if (err == 0)
+                ec_scatter(cells, s0, offset, NULL, dend - offset, buf);
+            ec_cells_free(cells);
+        }
+    }
+    if ((uint64_t) offset > dend)
+        dend = offset;
+    memset(buf + (dend - offset), 0, end - dend);
+
+    for (size_t i = 0; err == 0 && i < f->next_ext; i++) {
+        struct ec_ext *e = &f->ext[i];
+        uint64_t a = e->off > (uint64_t) offset ? e->off : (uint64_t) offset;
+        uint64_t b = e->off + e->len < end ? e->off + e->len : end;
+        if (a < b)
+            memcpy(buf + (a - offset), e->data + (a - e->off), b - a);
+    }
+    pthread_rwlock_unlock(&f->lock);
+    return err ? err : (int) (end - offset);
+}
+
+/* stripe s0부터 cnt개를 buf(논리 순서)로 덮어씀: parity를 계산해 조각마다 한 번에 */
+static int ec_write_full(struct ec_file *f, const char *path, const char *buf,
+                         uint64_t s0, size_t cnt)
+{
+    uint64_t C = ec.cell, W = ec_width();
+    int m = mirror.n - ec.k, n = 0, ok = 0;
+    struct ec_io io = { .f = f, .write = 1, .s = s0, .cnt = cnt };
+    uint8_t **cells = calloc(mirror.n, sizeof(*cells));
+    struct iovec *iov = calloc(ec.k * cnt, sizeof(*iov));
+    int err = cells && iov ? 0 : -ENOMEM;
+
+    for (int p = 0; err == 0 && p < m; p++)
+        if ((cells[ec.k + p] = calloc(cnt, C)) == NULL)
+            err = -ENOMEM;
+    if (err)
+        goto out;
+
+    for (size_t i = 0; i < cnt; i++)
+        for (int j = 0; j < ec.k; j++) {
+            const uint8_t *d = (const uint8_t *) buf + i * W + j * C;
+            for (int p = 0; p < m; p++)
+                gf_madd(cells[ec.k + p] + i * C, d, ec.gen[p][j], C);
+            iov[j * cnt + i] = (struct iovec) { (void *) d, C };
+        }
+    io.cells = cells;
+    for (int r = 0; r < mirror.n; r++) {
+        if (!ec_up(f, r))
+            continue;
+        if (r < ec.k) {
+            io.iov[r] = iov + r * cnt;
+            io.niov[r] = cnt;
+            io.pos[r] = s0 * C;
+        } else {
+            io.limit[r] = ec_frag_len(r, f->dsize);
+        }
+        io.rows[n++] = r;
+    }
+    hpool_run(ec_io_job, &io, n);
+    for (int i = 0; i < n; i++) {
+        if (io.res[i] == 0)
+            ok++;
+        else
+            mirror_fail(io.rows[i], path, io.res[i]);
+    }
+    err = ok >= ec.k ? 0 : -EIO;
+    if (err == 0)
+        __atomic_fetch_add(&ec.full, cnt, __ATOMIC_RELAXED);
+
+out:
+    for (int p = 0; cells && p < m; p++)
+        free(cells[ec.k + p]);
+    free(cells);
+    free(iov);
+    return err;
+}
+
+static int ec_log_overlaps(const struct ec_file *f, uint64_t lo, uint64_t hi)
+{
+    for (size_t i = 0; i < f->next_ext; i++)
+        if (f->ext[i].off < hi && f->ext[i].off + f->ext[i].len > lo)
+            return 1;
+    return 0;
+}
+
+static int ec_write(int next, const char *path, const char *buf, size_t size, off_t offset,
+                    struct fuse_file_info *fi)
+{
+    struct basic_fh *fh = get_fh(fi);
+    struct ec_file *f = fh ? fh->ec : NULL;
+    if (f == NULL)
+        return next_write(next, path, buf, size, offset, fi);
+    if (size == 0)
+        return 0;
+
+    pthread_rwlock_wrlock(&f->lock);
+    uint64_t W = ec_width(), lo = offset, hi = lo + size;
+    uint64_t a = (lo + W - 1) / W * W, b = hi / W * W;
+    int err = 0;
+
+    if (a < b) {
+        /* stripe 전체: log에 겹치는 write가 있으면 먼저 반영해야 나중에 덮이지 않음 */
+        if (ec_log_overlaps(f, a, b))
+            err = ec_flush(f, path);
+        if (err == 0 && b > f->dsize)
+            err = ec_set_size(f, path, b);
+        if (err == 0)
+            err = ec_write_full(f, path, buf + (a - lo), a / W, (b - a) / W);
+        if (err == 0 && lo < a)
+            err = ec_log_append(f, path, lo, buf, a - lo);
+        if (err == 0 && b < hi)
+            err = ec_log_append(f, path, b, buf + (b - lo), hi - b);
+    } else {
+        err = ec_log_append(f, path, lo, buf, size);
+    }
+    if (err == 0 && f->logged > EC_LOG_MAX)
+        err = ec_flush(f, path);
+    pthread_rwlock_unlock(&f->lock);
+    return err ? err : (int) size;
+}
+
+static int ec_release(int next, const char *path, struct fuse_file_info *fi)
+{
+    struct basic_fh *fh = get_fh(fi);
+    if (fh && fh->ec) {
+        ec_put(fh->ec, path);
+        fh->ec = NULL;
+    }
+    return next_release(next, path, fi);
+}
+
+static int ec_truncate(int next, const char *path, off_t size, struct fuse_file_info *fi)
+{
+    struct basic_fh *fh = fi ? get_fh(fi) : NULL;
+    struct ec_file *f = fh ? fh->ec : NULL;
+    int held = f != NULL, err = 0;
+
+    if (strcmp(path, STATS_PATH) == 0)
+        return next_truncate(next, path, size, fi);
+    if (!held && (err = ec_acquire(path, 0, 0, &f)) != 0)
+        return err;
+    pthread_rwlock_wrlock(&f->lock);
+    err = ec_resize(f, path, size);
+    pthread_rwlock_unlock(&f->lock);
+    if (!held)
+        ec_put(f, path);
+    return err;
+}
+
+/* 이름이 바뀌거나 지워질 때 (열려 있는 동안만 있는) log도 같이 */
+static void ec_log_follow(const char *from, const char *to)
+{
+    char p[PATH_MAX], q[PATH_MAX];
+    for (int r = 0; r <= mirror.n - ec.k; r++) {
+        if (mirror.failed[r] || ec_log_path(r, from, p, sizeof(p)))
+            continue;
+        if (to == NULL)
+            BACKEND(unlink(p));
+        else if (ec_log_path(r, to, q, sizeof(q)) == 0)
+            BACKEND(rename(p, q));
+    }
+}
+
+static int ec_unlink(int next, const char *path)
+{
+    int res = mirror_unlink(next, path);
+    if (res == 0)
+        ec_log_follow(path, NULL);
+    return res;
+}
+
+static int ec_rename(int next, const char *from, const char *to, unsigned int flags)
+{
+    if (is_ec_log(from) || is_ec_log(to))
+        return -EPERM;
+    int res = mirror_rename(next, from, to, flags);
+    if (res == 0)
+        ec_log_follow(from, to);
+    return res;
+}
+
+/* log에 있는 write는 log가, 반영된 것은 조각 파일이 보관하므로 둘 다 sync */
+static int ec_fsync(int next, const char *path, int datasync, struct fuse_file_info *fi)
+{
+    struct basic_fh *fh = get_fh(fi);
+    struct ec_file *f = fh ? fh->ec : NULL;
+    int err = 0;
+
+    if (f == NULL)
+        return next_fsync(next, path, datasync, fi);
+    pthread_rwlock_rdlock(&f->lock);
+    for (int r = 0; r < mirror.n; r++) {
+        if (f->fd[r] >= 0 && BACKEND(fdatasync(f->fd[r])) == -1)
+            err = -errno;
+        if (f->lfd[r] >= 0 && BACKEND(fdatasync(f->lfd[r])) == -1)
+            err = -errno;
+    }
+    pthread_rwlock_unlock(&f->lock);
+    return err;
+}
+
+static const struct basic_layer ec_layer = {
+    .name       = "ec",
+    .getattr    = ec_getattr,
+    .readdir    = ec_readdir,
+    .create     = ec_create,
+    .open       = ec_open,
+    .read       = ec_read,
+    .write      = ec_write,
+    .unlink     = ec_unlink,
+    .rename     = ec_rename,
+    .release    = ec_release,
+    .mkdir      = mirror_mkdir,
+    .rmdir      = mirror_rmdir,
+    .chmod      = mirror_chmod,
+    .truncate   = ec_truncate,
+    .utimens    = mirror_utimens,
+    .fsync      = ec_fsync,
+};
+
+/* parity 행: Cauchy 행렬 1 / ((K + p) ^ j), 단위 행렬과 합친 어느 K행도 역행렬이 있음 */
+static void ec_setup(void)
+{
+    gf_init();
+    crc32c_init();
+    for (int p = 0; p < mirror.n - ec.k; p++)
+        for (int j = 0; j < ec.k; j++)
+            ec.gen[p][j] = gf_inv((ec.k + p) ^ j);
+}
+
+/*
+ * object store backend (-o s3=http://host[:port]/bucket): 맨 아래 layer로 DIR_PATH
+ * 대신 S3 호환 bucket을 쓴다. 경로 "/a/b"는 key "a/b", 디렉토리는 key 접두어 "a/"
+ * (mkdir은 빈 "a/" 객체를 둠). 통계 파일만 아래 passthrough로 넘긴다.
+ *
+ * getattr은 HEAD (없는 것까지 s3_attr_ttl_ms 동안 보관), readdir은 delimiter를 준
+ * ListObjectsV2를 continuation token으로 이어 받는다. read는 순차로 이어지면 두 배씩
+ * (s3_readahead까지) 커지는 창을 S3_RANGE 단위 ranged GET으로 나눠 hash pool에서
+ * 병렬로 가져오고, write는 핸들 버퍼에 모아 s3_part 크기 part를 s3_threads개씩
+ * 병렬로 multipart upload한 뒤 release에서 완료한다 (작은 파일은 PUT 한 번).
+ *
+ * 객체는 부분 수정이 안 되므로: 이미 올린 part 앞을 다시 쓰면 -EOPNOTSUPP, 기존
+ * 객체를 쓰기로 열어 고치면 첫 write에서 내용을 (S3_REWRITE_MAX까지) 읽어 와
+ * release에서 통째로 다시 올린다. 새 파일은 release 전까지 다른 곳에서 보이지 않음.
+ * 연결은 HTTP/1.1 keep-alive만 (TLS 없음: 가까운 S3 호환 서버나 프록시 용도).
+ */
+#define S3_RANGE (1024 * 1024)          /* ranged GET 하나의 크기 */
+#define S3_REWRITE_MAX (64 * 1024 * 1024)
+#define S3_PART_MIN (5 * 1024 * 1024)   /* S3의 마지막이 아닌 part 최소 크기 */
+#define S3_PARTS_MAX 10000
+#define S3_IDLE_MAX 64                  /* 보관할 keep-alive 연결 수 */
+#define S3_ATTR_BUCKETS 4096
+#define S3_ATTR_MAX 65536               /* 넘으면 열려 있지 않은 항목을 모두 버림 */
+#define S3_TIMEOUT_S 30
+
+/* SigV4 서명용 SHA-256 / HMAC-SHA256 (FIPS 180-4) */
+struct sha256 {
+    uint32_t h[8];
+    uint64_t len;
+    uint8_t buf[64];
+    size_t n;
+};
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define SHA_ROR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256_block(uint32_t *h, const uint8_t *p)
+{
+    uint32_t w[64], v[8];
+
+    for (int i = 0; i < 16; i++)
+        w[i] = (uint32_t) p[4 * i] << 24 | (uint32_t) p[4 * i + 1] << 16 |
+               (uint32_t) p[4 * i + 2] << 8 | p[4 * i + 3];
+    for (int i = 16; i < 64; i++) {
+        uint32_t s0 = SHA_ROR(w[i - 15], 7) ^ SHA_ROR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = SHA_ROR(w[i - 2], 17) ^ SHA_ROR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    memcpy(v, h, sizeof(v));
+    for (int i = 0; i < 64; i++) {
+        uint32_t t1 = v[7] + (SHA_ROR(v[4], 6) ^ SHA_ROR(v[4], 11) ^ SHA_ROR(v[4], 25)) +
+                      ((v[4] & v[5]) ^ (~v[4] & v[6])) + sha256_k[i] + w[i];
+        uint32_t t2 = (SHA_ROR(v[0], 2) ^ SHA_ROR(v[0], 13) ^ SHA_ROR(v[0], 22)) +
+                      ((v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]));
+        memmove(v + 1, v, 7 * sizeof(v[0]));
+        v[4] += t1;
+        v[0] = t1 + t2;
+    }
+    for (int i = 0; i < 8; i++)
+        h[i] += v[i];
+}
+
+static void sha256_init(struct sha256 *s)
+{
+    static const uint32_t iv[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+    memcpy(s->h, iv, sizeof(iv));
+    s->len = 0;
+    s->n = 0;
+}
+
+static void sha256_update(struct sha256 *s, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+
+    s->len += len;
+    while (len) {
+        size_t m = 64 - s->n < len ? 64 - s->n : len;
+        memcpy(s->buf + s->n, p, m);
+        s->n += m;
+        p += m;
+        len -= m;
+        if (s->n == 64) {
+            sha256_block(s->h, s->buf);
+            s->n = 0;
+        }
+    }
+}
+
+static void sha256_final(struct sha256 *s, uint8_t out[32])
+{
+    uint64_t bits = s->len * 8;
+    uint8_t pad = 0x80, zero = 0, len[8];
+
+    sha256_update(s, &pad, 1);
+    while (s->n != 56)
+        sha256_update(s, &zero, 1);
+    for (int i = 0; i < 8; i++)
+        len[i] = bits >> (56 - 8 * i);
+    sha256_update(s, len, 8);
+    for (int i = 0; i < 8; i++) {
+        out[4 * i] = s->h[i] >> 24;
+        out[4 * i + 1] = s->h[i] >> 16;
+        out[4 * i + 2] = s->h[i] >> 8;
+        out[4 * i + 3] = s->h[i];
+    }
+}
+
+static void hmac_sha256(const uint8_t *key, size_t klen, const void *msg, size_t mlen,
+                        uint8_t out[32])
+{
+    uint8_t k[64] = { 0 }, pad[64];
+    struct sha256 s;
+
+    if (klen > 64) {
+        sha256_init(&s);
+        sha256_update(&s, key, klen);
+        sha256_final(&s, k);
+    } else {
+        memcpy(k, key, klen);
+    }
+    for (int i = 0; i < 64; i++)
+        pad[i] = k[i] ^ 0x36;
+    sha256_init(&s);
+    sha256_update(&s, pad, 64);
+    sha256_update(&s, msg, mlen);
+    sha256_final(&s, out);
+    for (int i = 0; i < 64; i++)
+        pad[i] = k[i] ^ 0x5c;
+    sha256_init(&s);
+    sha256_update(&s, pad, 64);
+    sha256_update(&s, out, 32);
+    sha256_final(&s, out);
+}
+
+static void hex_encode(const uint8_t *in, size_t len, char *out)
+{
+    static const char digits[] = "0123456789abcdef";
+    for (size_t i = 0; i < len; i++) {
+        out[2 * i] = digits[in[i] >> 4];
+        out[2 * i + 1] = digits[in[i] & 15];
+    }
+    out[2 * len] = '\0';
+}
+
+/* RFC 3986 unreserved 외에는 %XX (keep_slash면 '/'는 그대로) */
+static int s3_uri_encode(const char *s, int keep_slash, char *out, size_t len)
+{
+    size_t o = 0;
+    for (const unsigned char *p = (const unsigned char *) s; *p; p++) {
+        if (o + 4 > len)
+            return -ENAMETOOLONG;
+        if ((*p >= 'A' && *p <= 'Z') || (*p >= 'a' && *p <= 'z') || (*p >= '0' && *p <= '9') ||
+            *p == '-' || *p == '.' || *p == '_' || *p == '~' || (keep_slash && *p == '/'))
+            out[o++] = *p;
+        else
+            o += sprintf(out + o, "%%%02X", *p);
+    }
+    out[o] = '\0';
+    return 0;
+}
+
+/* "/a/b" -> "a/b" (dir이면 뒤에 '/'), 루트의 key는 "" */
+static int s3_key(const char *path, int dir, char *out, size_t len)
+{
+    while (*path == '/')
+        path++;
+    int n = snprintf(out, len, "%s%s", path, dir && *path ? "/" : "");
+    return n < 0 || (size_t) n >= len ? -ENAMETOOLONG : 0;
+}
+
+/* keep-alive 연결: 응답을 읽다 남은 바이트는 buf에 (pipelining은 하지 않음) */
+struct s3_conn {
+    int fd;
+    size_t pos, len;
+    struct s3_conn *next;
+    char buf[16384];
+};
+
+static int s3_connect(void)
+{
+    int fd = socket(s3.addr.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+        return -errno;
+
+    struct timeval tv = { .tv_sec = S3_TIMEOUT_S };
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (BACKEND(connect(fd, (struct sockaddr *) &s3.addr, s3.addrlen)) == -1) {
+        int err = errno;
+        close(fd);
+        return -err;
+    }
+    __atomic_fetch_add(&s3.connects, 1, __ATOMIC_RELAXED);
+    return fd;
+}
+
+static struct s3_conn *s3_conn_get(int fresh, int *err)
+{
+    struct s3_conn *c = NULL;
+
+    if (!fresh) {
+        pthread_mutex_lock(&s3.lock);
+        if ((c = s3.idle) != NULL) {
+            s3.idle = c->next;
+            s3.nidle--;
+        }
+        pthread_mutex_unlock(&s3.lock);
+        if (c)
+            return c;
+    }
+    int fd = s3_connect();
+    if (fd < 0 || (c = malloc(sizeof(*c))) == NULL) {
+        *err = fd < 0 ? fd : -ENOMEM;
+        if (fd >= 0)
+            close(fd);
+        return NULL;
+    }
+    c->fd = fd;
+    c->pos = c->len = 0;
+    return c;
+}
+
+static void s3_conn_put(struct s3_conn *c, int reuse)
+{
+    if (reuse && c->pos == c->len) {
+        pthread_mutex_lock(&s3.lock);
+        if (s3.nidle < S3_IDLE_MAX) {
+            c->next = s3.idle;
+            s3.idle = c;
+            s3.nidle++;
+            c = NULL;
+        }
+        pthread_mutex_unlock(&s3.lock);
+        if (c == NULL)
+            return;
+    }
+    close(c->fd);
+    free(c);
+}
+
+static void s3_conn_drain(void)
+{
+    pthread_mutex_lock(&s3.lock);
+    while (s3.idle) {
+        struct s3_conn *c = s3.idle;
+        s3.idle = c->next;
+        close(c->fd);
+        free(c);
+    }
+    s3.nidle = 0;
+    pthread_mutex_unlock(&s3.lock);
+}
+
+/* 응답에서 정확히 n바이트 (dst가 NULL이면 버림) */
+static int s3_recv(struct s3_conn *c, char *dst, size_t n)
+{
+    while (n) {
+        if (c->pos == c->len) {
+            ssize_t r = BACKEND(recv(c->fd, c->buf, sizeof(c->buf), 0));
+            if (r <= 0)
+                return r == 0 ? -ECONNRESET : -errno;
+            c->pos = 0;
+            c->len = r;
+            __atomic_fetch_add(&s3.rx_bytes, r, __ATOMIC_RELAXED);
+        }
+        size_t m = c->len - c->pos < n ? c->len - c->pos : n;
+        if (dst) {
+            memcpy(dst, c->buf + c->pos, m);
+            dst += m;
+        }
+        c->pos += m;
+        n -= m;
+    }
+    return 0;
+}
+
+/* CRLF까지 한 줄 (CRLF는 빼고), 너무 길면 -EPROTO */
+static int s3_line(struct s3_conn *c, char *line, size_t len)
+{
+    size_t n = 0;
+    for (;;) {
+        char ch;
+        int err = s3_recv(c, &ch, 1);
+        if (err)
+            return err;
+        if (ch == '\n')
+            break;
+        if (n + 1 >= len)
+            return -EPROTO;
+        line[n++] = ch;
+    }
+    if (n && line[n - 1] == '\r')
+        n--;
+    line[n] = '\0';
+    return 0;
+}
+
+struct s3_req {
+    int kind;                   /* 통계용 S3_* */
+    const char *method;
+    const char *key;            /* 인코딩 전 key, NULL이면 bucket 자체 */
+    const char *query;          /* 인코딩하고 이름 순으로 정렬한 query */
+    const char *copy_src;       /* x-amz-copy-source가 가리킬 key */
+    uint64_t range_off;
+    size_t range_len;           /* 0이 아니면 Range 요청 */
+    const void *body;
+    size_t blen;
+    char *out;                  /* 2xx 본문을 여기로 (outcap까지, 넘치면 -EPROTO) */
+    size_t outcap;
+    /* 응답 */
+    int status;
+    char *resp;                 /* out에 받지 않은 본문 (malloc, NUL로 끝남) */
+    size_t rlen;
+    uint64_t clen;              /* Content-Length */
+    char etag[80];
+    time_t mtime;
+};
+
+static void s3_req_free(struct s3_req *rq)
+{
+    free(rq->resp);
+    rq->resp = NULL;
+}
+
+/* SigV4: x-amz-date와 Authorization 헤더 (본문은 UNSIGNED-PAYLOAD) */
+static void s3_sign(const struct s3_req *rq, const char *uri, const char *src, char *date,
+                    char *auth, size_t alen)
+{
+    time_t now = time(NULL);
+    struct tm tm;
+    char day[9], scope[160], canon[8192 + 8 * PATH_MAX], sts[512], hex[65];
+    uint8_t k[32], h[32];
+    struct sha256 s;
+
+    gmtime_r(&now, &tm);
+    strftime(date, 17, "%Y%m%dT%H%M%SZ", &tm);
+    memcpy(day, date, 8);
+    day[8] = '\0';
+    snprintf(scope, sizeof(scope), "%s/%s/s3/aws4_request", day, s3.region);
+
+    const char *signed_hdrs = src ? "host;x-amz-content-sha256;x-amz-copy-source;x-amz-date"
+                                  : "host;x-amz-content-sha256;x-amz-date";
+    snprintf(canon, sizeof(canon),
+             "%s\n%s\n%s\nhost:%s\nx-amz-content-sha256:UNSIGNED-PAYLOAD\n%s%s%sx-amz-date:%s\n\n"
+             "%s\nUNSIGNED-PAYLOAD",
+             rq->method, uri, rq->query ? rq->query : "", s3.host,
+             src ? "x-amz-copy-source:" : "", src ? src : "", src ? "\n" : "", date,
+             signed_hdrs);
+    sha256_init(&s);
+    sha256_update(&s, canon, strlen(canon));
+    sha256_final(&s, h);
+    hex_encode(h, 32, hex);
+    snprintf(sts, sizeof(sts), "AWS4-HMAC-SHA256\n%s\n%s\n%s", date, scope, hex);
+
+    char secret[sizeof(s3.secret) + 4];
+    snprintf(secret, sizeof(secret), "AWS4%s", s3.secret);
+    hmac_sha256((uint8_t *) secret, strlen(secret), day, 8, k);
+    hmac_sha256(k, 32, s3.region, strlen(s3.region), k);
+    hmac_sha256(k, 32, "s3", 2, k);
+    hmac_sha256(k, 32, "aws4_request", 12, k);
+    hmac_sha256(k, 32, sts, strlen(sts), h);
+    hex_encode(h, 32, hex);
+    snprintf(auth, alen, "AWS4-HMAC-SHA256 Credential=%s/%s, SignedHeaders=%s, Signature=%s",
+             s3.key_id, scope, signed_hdrs, hex);
+}
+
+static int s3_send(int fd, const char *hdr, size_t hlen, const void *body, size_t blen)
+{
+    struct iovec iov[2] = { { (void *) hdr, hlen }, { (void *) body, blen } };
+    struct msghdr msg = { .msg_iov = iov, .msg_iovlen = blen ? 2 : 1 };
+
+    while (msg.msg_iovlen) {
+        ssize_t w = BACKEND(sendmsg(fd, &msg, MSG_NOSIGNAL));
+        if (w < 0)
+            return -errno;
+        __atomic_fetch_add(&s3.tx_bytes, w, __ATOMIC_RELAXED);
+        while (msg.msg_iovlen && (size_t) w >= msg.msg_iov->iov_len) {
+            w -= msg.msg_iov->iov_len;
+            msg.msg_iov++;
+            msg.msg_iovlen--;
+        }
+        if (msg.msg_iovlen) {
+            msg.msg_iov->iov_base = (char *) msg.msg_iov->iov_base + w;
+            msg.msg_iov->iov_len -= w;
+        }
+    }
+    return 0;
+}
+
+/* 본문 n바이트를 rq->out(2xx) 또는 rq->resp로 */
+static int s3_body(struct s3_conn *c, struct s3_req *rq, int to_out, size_t n)
+{
+    if (to_out) {
+        if (rq->rlen + n > rq->outcap)
+            return -EPROTO;
+        int err = s3_recv(c, rq->out + rq->rlen, n);
+        if (err == 0)
+            rq->rlen += n;
+        return err;
+    }
+    char *p = realloc(rq->resp, rq->rlen + n + 1);
+    if (p == NULL)
+        return -ENOMEM;
+    rq->resp = p;
+    int err = s3_recv(c, p + rq->rlen, n);
+    if (err == 0) {
+        rq->rlen += n;
+        p[rq->rlen] = '\0';
+    }
+    return err;
+}
+
+static int s3_response(struct s3_conn *c, struct s3_req *rq, int *keep)
+{
+    char line[1024];
+    int chunked = 0, have_len = 0, err = s3_line(c, line, sizeof(line));
+
+    if (err)
+        return err;
+    if (sscanf(line, "HTTP/1.%*d %d", &rq->status) != 1)
+        return -EPROTO;
+    *keep = strncmp(line, "HTTP/1.1", 8) == 0;
+    rq->clen = 0;
+    rq->etag[0] = '\0';
+    rq->mtime = 0;
+    while ((err = s3_line(c, line, sizeof(line))) == 0 && line[0]) {
+        char *v = strchr(line, ':');
+        if (v == NULL)
+            continue;
+        *v++ = '\0';
+        while (*v == ' ')
+            v++;
+        if (strcasecmp(line, "Content-Length") == 0) {
+            rq->clen = strtoull(v, NULL, 10);
+            have_len = 1;
+        } else if (strcasecmp(line, "Transfer-Encoding") == 0) {
+            chunked = strcasestr(v, "chunked") != NULL;
+        } else if (strcasecmp(line, "Connection") == 0) {
+            if (strcasecmp(v, "close") == 0)
+                *keep = 0;
+            else if (strcasecmp(v, "keep-alive") == 0)
+                *keep = 1;
+        } else if (strcasecmp(line, "ETag") == 0) {
+            snprintf(rq->etag, sizeof(rq->etag), "%s", v);
+        } else if (strcasecmp(line, "Last-Modified") == 0) {
+            struct tm tm = { 0 };
+            if (strptime(v, "%a, %d %b %Y %H:%M:%S", &tm))
+                rq->mtime = timegm(&tm);
+        }
+    }
+    if (err)
+        return err;
+
+    int to_out = rq->out && rq->status / 100 == 2;
+    rq->rlen = 0;
+    if (strcmp(rq->method, "HEAD") == 0 || rq->status == 204 || rq->status == 304 ||
+        rq->status / 100 == 1)
+        return 0;
+    if (chunked) {
+        for (;;) {
+            if ((err = s3_line(c, line, sizeof(line))) != 0)
+                return err;
+            size_t n = strtoul(line, NULL, 16);
+            if (n == 0)
+                break;
+            if ((err = s3_body(c, rq, to_out, n)) != 0 ||
+                (err = s3_line(c, line, sizeof(line))) != 0)
+                return err;
+        }
+        /* trailer */
+        while ((err = s3_line(c, line, sizeof(line))) == 0 && line[0])
+            ;
+        return err;
+    }
+    if (have_len)
+        return rq->clen ? s3_body(c, rq, to_out, rq->clen) : 0;
+
+    /* 길이 없이 연결을 닫아 끝을 알리는 응답 */
+    *keep = 0;
+    while ((err = s3_body(c, rq, to_out, 1)) == 0)
+        ;
+    return err == -ECONNRESET ? 0 : err;
+}
+
+/*
+ * 요청 하나를 보내고 응답을 받음: HTTP 응답을 받았으면 0 (rq->status 확인),
+ * 연결 문제면 -errno. 재사용한 연결이 서버 쪽에서 닫혀 있었으면 새 연결로 한 번 더.
+ */
+static int s3_do(struct s3_req *rq)
+{
+    char key[3 * PATH_MAX], uri[3 * PATH_MAX + 300], src[3 * PATH_MAX + 300];
+    char hdr[4096 + 6 * PATH_MAX], date[17] = "", auth[512] = "", range[80] = "", clen[40] = "";
+    int err = 0;
+
+    if (rq->key && s3_uri_encode(rq->key, 1, key, sizeof(key)) != 0)
+        return -ENAMETOOLONG;
+    snprintf(uri, sizeof(uri), "/%s%s%s", s3.bucket, rq->key ? "/" : "", rq->key ? key : "");
+    if (rq->copy_src) {
+        if (s3_uri_encode(rq->copy_src, 1, key, sizeof(key)) != 0)
+            return -ENAMETOOLONG;
+        snprintf(src, sizeof(src), "/%s/%s", s3.bucket, key);
+    }
+    if (s3.key_id[0])
+        s3_sign(rq, uri, rq->copy_src ? src : NULL, date, auth, sizeof(auth));
+    if (rq->range_len)
+        snprintf(range, sizeof(range), "Range: bytes=%llu-%llu\r\n",
+                 (unsigned long long) rq->range_off,
+                 (unsigned long long) (rq->range_off + rq->range_len - 1));
+    if (rq->body || strcmp(rq->method, "PUT") == 0 || strcmp(rq->method, "POST") == 0)
+        snprintf(clen, sizeof(clen), "Content-Length: %zu\r\n", rq->blen);
+
+    int hlen = snprintf(hdr, sizeof(hdr),
+                        "%s %s%s%s HTTP/1.1\r\nHost: %s\r\n%s%s%s%s%s"
+                        "x-amz-content-sha256: UNSIGNED-PAYLOAD\r\n%s%s%s%s%s%s\r\n",
+                        rq->method, uri, rq->query ? "?" : "", rq->query ? rq->query : "",
+                        s3.host, clen, range,
+                        rq->copy_src ? "x-amz-copy-source: " : "", rq->copy_src ? src : "",
+                        rq->copy_src ? "\r\n" : "",
+                        date[0] ? "x-amz-date: " : "", date, date[0] ? "\r\n" : "",
+                        auth[0] ? "Authorization: " : "", auth, auth[0] ? "\r\n" : "");
+    if (hlen < 0 || (size_t) hlen >= sizeof(hdr))
+        return -ENAMETOOLONG;
+
+    __atomic_fetch_add(&s3.reqs[rq->kind], 1, __ATOMIC_RELAXED);
+    for (int attempt = 0; attempt < 2; attempt++) {
+        struct s3_conn *c = s3_conn_get(attempt > 0, &err);
+        if (c == NULL)
+            break;
+        int keep = 0;
+        free(rq->resp);
+        rq->resp = NULL;
+        rq->rlen = 0;
+        err = s3_send(c->fd, hdr, hlen, rq->body, rq->blen);
+        if (err == 0)
+            err = s3_response(c, rq, &keep);
+        s3_conn_put(c, err == 0 && keep);
+        if (err == 0 || attempt > 0 || (err != -ECONNRESET && err != -EPIPE))
+            break;
+    }
+    if (err)
+        __atomic_fetch_add(&s3.errors, 1, __ATOMIC_RELAXED);
+    return err;
+}
+
+static int s3_errno(const struct s3_req *rq)
+{
+    if (rq->status / 100 == 2)
+        return 0;
+    __atomic_fetch_add(&s3.errors, 1, __ATOMIC_RELAXED);
+    switch (rq->status) {
+    case 404: return -ENOENT;
+    case 403: return -EACCES;
+    case 409: return -EBUSY;
+    case 416: return -EINVAL;
+    case 503: return -EAGAIN;
+    default:  return -EIO;
+    }
+}
+
+/* 요청 하나로 끝나는 경우: 2xx면 0 */
+static int s3_call(struct s3_req *rq)
+{
+    int err = s3_do(rq);
+    return err ? err : s3_errno(rq);
+}
+
+/* 객체 [off, off+len)을 buf로 (ranged GET 하나) */
+static int s3_get_range(const char *key, char *buf, uint64_t off, size_t len)
+{
+    struct s3_req rq = {
+        .kind = S3_GET, .method = "GET", .key = key,
+        .range_off = off, .range_len = len, .out = buf, .outcap = len,
+    };
+    int err = s3_call(&rq);
+    if (err == 0 && rq.rlen != len)
+        err = -EIO;
+    s3_req_free(&rq);
+    return err;
+}
+
+struct s3_range {
+    const char *key;
+    char *buf;
+    uint64_t off;
+    size_t len;
+    int err;
+};
+
+static void s3_range_job(void *arg, unsigned int i)
+{
+    struct s3_range *r = (struct s3_range *) arg + i;
+    r->err = s3_get_range(r->key, r->buf, r->off, r->len);
+}
+
+/* [off, off+len)을 S3_RANGE 단위로 나눠 병렬로 */
+static int s3_get_parallel(const char *key, char *buf, uint64_t off, size_t len)
+{
+    unsigned int n = (len + S3_RANGE - 1) / S3_RANGE;
+    struct s3_range *r = calloc(n, sizeof(*r));
+    int err = 0;
+
+    if (r == NULL)
+        return -ENOMEM;
+    for (unsigned int i = 0; i < n; i++) {
+        size_t o = (size_t) i * S3_RANGE;
+        r[i] = (struct s3_range) { key, buf + o, off + o, len - o < S3_RANGE ? len - o : S3_RANGE, 0 };
+    }
+    hpool_run(s3_range_job, r, n);
+    for (unsigned int i = 0; i < n && err == 0; i++)
+        err = r[i].err;
+    free(r);
+    return err;
+}
+
+/* XML에서 [p, end) 안의 첫 <tag>...</tag> 내용을 out으로 (entity는 풂), 닫는 태그 뒤를 돌려줌 */
+static const char *xml_tag(const char *p, const char *end, const char *tag, char *out, size_t len)
+{
+    char open[64], close[64];
+    snprintf(open, sizeof(open), "<%s>", tag);
+    snprintf(close, sizeof(close), "</%s>", tag);
+
+    const char *a = memmem(p, end - p, open, strlen(open));
+    if (a == NULL)
+        return NULL;
+    a += strlen(open);
+    const char *b = memmem(a, end - a, close, strlen(close));
+    if (b == NULL)
+        return NULL;
+    if (out) {
+        static const struct { const char *ent; char ch; } ents[] = {
+            { "&amp;", '&' }, { "&lt;", '<' }, { "&gt;", '>' }, { "&quot;", '"' }, { "&apos;", '\'' },
+        };
+        size_t o = 0;
+        for (const char *q = a; q < b && o + 1 < len; q++) {
+            char ch = *q;
+            for (size_t e = 0; ch == '&' && e < sizeof(ents) / sizeof(ents[0]); e++)
+                if ((size_t) (b - q) >= strlen(ents[e].ent) &&
+                    strncmp(q, ents[e].ent, strlen(ents[e].ent)) == 0) {
+                    ch = ents[e].ch;
+                    q += strlen(ents[e].ent) - 1;
+                    break;
+                }
+            out[o++] = ch;
+        }
+        out[o] = '\0';
+    }
+    return b + strlen(close);
+}
+
+/* 속성 캐시: HEAD/LIST 결과 (없는 경로도), 쓰기로 열린 동안은 만료되지 않음 */
+struct s3_attr {
+    struct s3_attr *next;
+    uint64_t expires;
+    int exists;
+    mode_t mode;
+    uint64_t size;
+    time_t mtime;
+    unsigned int writers;
+    char path[];
+};
+
+static struct {
+    pthread_mutex_t lock;
+    struct s3_attr *table[S3_ATTR_BUCKETS];
+    unsigned int n;
+} s3_attrs = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static struct s3_attr **s3_attr_slot_locked(const char *path)
+{
+    struct s3_attr **pp = &s3_attrs.table[path_hash(path) % S3_ATTR_BUCKETS];
+    while (*pp && strcmp((*pp)->path, path) != 0)
+        pp = &(*pp)->next;
+    return pp;
+}
+
+static void s3_attr_trim_locked(void)
+{
+    for (int b = 0; b < S3_ATTR_BUCKETS; b++)
+        for (struct s3_attr **pp = &s3_attrs.table[b]; *pp;) {
+            struct s3_attr *a = *pp;
+            if (a->writers) {
+                pp = &a->next;
+                continue;
+            }
+            *pp = a->next;
+            free(a);
+            s3_attrs.n--;
+        }
+}
+
+static int s3_attr_get(const char *path, struct s3_attr *out)
+{
+    pthread_mutex_lock(&s3_attrs.lock);
+    struct s3_attr *a = *s3_attr_slot_locked(path);
+    int hit = a && (a->writers || a->expires > now_ns());
+    if (hit)
+        *out = *a;
+    pthread_mutex_unlock(&s3_attrs.lock);
+    __atomic_fetch_add(hit ? &s3.attr_hits : &s3.attr_misses, 1, __ATOMIC_RELAXED);
+    return hit;
+}
+
+/* writers는 hold(+1)/-1(놓음)/0(그대로) */
+static void s3_attr_set(const char *path, int exists, mode_t mode, uint64_t size, time_t mtime,
+                        int hold)
+{
+    pthread_mutex_lock(&s3_attrs.lock);
+    struct s3_attr **pp = s3_attr_slot_locked(path), *a = *pp;
+    if (a == NULL) {
+        if (s3_attrs.n >= S3_ATTR_MAX) {
+            s3_attr_trim_locked();
+            pp = s3_attr_slot_locked(path);
+        }
+        a = calloc(1, sizeof(*a) + strlen(path) + 1);
+        if (a == NULL) {
+            pthread_mutex_unlock(&s3_attrs.lock);
+            return;
+        }
+        strcpy(a->path, path);
+        *pp = a;
+        s3_attrs.n++;
+    }
+    a->exists = exists;
+    a->mode = mode;
+    a->size = size;
+    a->mtime = mtime;
+    a->expires = now_ns() + (uint64_t) options.s3_attr_ttl_ms * 1000000;
+    if (hold > 0)
+        a->writers++;
+    else if (hold < 0 && a->writers)
+        a->writers--;
+    pthread_mutex_unlock(&s3_attrs.lock);
+}
+
+static void s3_attr_forget(const char *path)
+{
+    pthread_mutex_lock(&s3_attrs.lock);
+    struct s3_attr **pp = s3_attr_slot_locked(path), *a = *pp;
+    if (a && a->writers == 0) {
+        *pp = a->next;
+        free(a);
+        s3_attrs.n--;
+    }
+    pthread_mutex_unlock(&s3_attrs.lock);
+}
+
+static void s3_attr_clear(void)
+{
+    pthread_mutex_lock(&s3_attrs.lock);
+    for (int b = 0; b < S3_ATTR_BUCKETS; b++)
+        while (s3_attrs.table[b]) {
+            struct s3_attr *a = s3_attrs.table[b];
+            s3_attrs.table[b] = a->next;
+            free(a);
+        }
+    s3_attrs.n = 0;
+    pthread_mutex_unlock(&s3_attrs.lock);
+}
+
+/* ListObjectsV2 한 페이지 (delimiter '/'), 응답 XML은 rq->resp */
+static int s3_list(const char *prefix, const char *token, unsigned int max, struct s3_req *rq)
+{
+    char p[3 * PATH_MAX], t[3 * 1024], query[sizeof(p) + sizeof(t) + 128];
+
+    if (s3_uri_encode(prefix, 0, p, sizeof(p)) || s3_uri_encode(token, 0, t, sizeof(t)))
+        return -ENAMETOOLONG;
+    snprintf(query, sizeof(query), "%s%s%sdelimiter=%%2F&list-type=2&max-keys=%u&prefix=%s",
+             token[0] ? "continuation-token=" : "", token[0] ? t : "", token[0] ? "&" : "",
+             max, p);
+    *rq = (struct s3_req) { .kind = S3_LIST, .method = "GET", .query = query };
+    int err = s3_call(rq);
+    rq->query = NULL;
+    if (err)
+        s3_req_free(rq);
+    return err;
+}
+
+/* prefix 아래에 (prefix 자체인 디렉토리 표시 객체 말고) 무엇이든 있는지 */
+static int s3_has_children(const char *prefix, int *dir_marker)
+{
+    struct s3_req rq;
+    int err = s3_list(prefix, "", 2, &rq);
+    if (err)
+        return err;
+
+    const char *p = rq.resp, *end = rq.resp + rq.rlen;
+    char key[PATH_MAX];
+    int children = 0;
+    *dir_marker = 0;
+    while ((p = xml_tag(p, end, "Key", key, sizeof(key))) != NULL) {
+        if (strcmp(key, prefix) == 0)
+            *dir_marker = 1;
+        else
+            children = 1;
+    }
+    if (xml_tag(rq.resp, end, "CommonPrefixes", NULL, 0))
+        children = 1;
+    s3_req_free(&rq);
+    return children;
+}
+
+static void s3_fill_stat(const struct s3_attr *a, struct stat *st)
+{
+    memset(st, 0, sizeof(*st));
+    st->st_mode = a->mode;
+    st->st_nlink = S_ISDIR(a->mode) ? 2 : 1;
+    st->st_size = a->size;
+    st->st_blksize = S3_RANGE;
+    st->st_blocks = (a->size + 511) / 512;
+    st->st_uid = getuid();
+    st->st_gid = getgid();
+    st->st_atime = st->st_mtime = st->st_ctime = a->mtime;
+}
+
+/* 경로의 속성: 캐시, 없으면 HEAD, 객체가 없으면 "key/" 아래를 LIST해 디렉토리인지 */
+static int s3_stat(const char *path, struct s3_attr *a)
+{
+    char key[PATH_MAX];
+    int err;
+
+    if (strcmp(path, "/") == 0) {
+        *a = (struct s3_attr) { .exists = 1, .mode = S_IFDIR | 0755 };
+        return 0;
+    }
+    if (s3_attr_get(path, a))
+        return a->exists ? 0 : -ENOENT;
+    if ((err = s3_key(path, 0, key, sizeof(key))) != 0)
+        return err;
+
+    struct s3_req rq = { .kind = S3_HEAD, .method = "HEAD", .key = key };
+    if ((err = s3_do(&rq)) != 0)
+        return err;
+    *a = (struct s3_attr) { .exists = 1, .mode = S_IFREG | 0644, .size = rq.clen, .mtime = rq.mtime };
+    if (rq.status == 404) {
+        int marker;
+        if ((err = s3_key(path, 1, key, sizeof(key))) != 0 ||
+            (err = s3_has_children(key, &marker)) < 0)
+            return err;
+        *a = (struct s3_attr) { .exists = err || marker, .mode = S_IFDIR | 0755 };
+    } else if ((err = s3_errno(&rq)) != 0) {
+        return err;
+    }
+    s3_attr_set(path, a->exists, a->mode, a->size, a->mtime, 0);
+    return a->exists ? 0 : -ENOENT;
+}
+
+/* 열린 파일: 읽기는 readahead 창, 쓰기는 아직 올리지 않은 부분의 버퍼 */
+struct s3_file {
+    pthread_mutex_t lock;
+    char key[PATH_MAX];
+    uint64_t size;
+    int writing;                /* 쓰기로 열림 */
+    int have;                   /* wbuf가 base 뒤의 내용을 담고 있음 (새 파일/O_TRUNC/첫 write) */
+    int dirty;
+    int err;                    /* 실패한 part upload (release에서 abort) */
+    char *wbuf;
+    size_t wlen, wcap;
+    uint64_t base;              /* 이미 part로 올린 바이트 */
+    char upload[256];           /* multipart upload id, 비어 있으면 아직 */
+    char (*etag)[80];
+    unsigned int nparts, partcap;
+    char *ra;                   /* readahead 버퍼: 객체 [ra_off, ra_off + ra_len) */
+    uint64_t ra_off;
+    size_t ra_len, ra_cap;
+    uint64_t ra_next;           /* 순차라면 다음 read가 시작할 위치 */
+    size_t window;
+};
+
+static void s3_file_free(struct s3_file *f)
+{
+    pthread_mutex_destroy(&f->lock);
+    free(f->wbuf);
+    free(f->etag);
+    free(f->ra);
+    free(f);
+}
+
+static int s3_wbuf_reserve(struct s3_file *f, size_t len)
+{
+    if (len <= f->wcap)
+        return 0;
+    size_t cap = f->wcap ? f->wcap : 64 * 1024;
+    while (cap < len)
+        cap *= 2;
+    char *p = realloc(f->wbuf, cap);
+    if (p == NULL)
+        return -ENOMEM;
+    f->wbuf = p;
+    f->wcap = cap;
+    return 0;
+}
+
+/* 고치려고 연 기존 객체의 내용을 버퍼로 (첫 write/truncate에서) */
+static int s3_load(struct s3_file *f)
+{
+    if (f->have)
+        return 0;
+    if (f->size > S3_REWRITE_MAX)
+        return -EFBIG;
+    int err = s3_wbuf_reserve(f, f->size);
+    if (err == 0 && f->size)
+        err = s3_get_parallel(f->key, f->wbuf, 0, f->size);
+    if (err)
+        return err;
+    f->wlen = f->size;
+    f->have = 1;
+    return 0;
+}
+
+struct s3_part_job {
+    struct s3_file *f;
+    const char *data;
+    size_t len;
+    unsigned int first;         /* 첫 part 번호 - 1 */
+    size_t part;
+    int err[];
+};
+
+static void s3_part_job(void *arg, unsigned int i)
+{
+    struct s3_part_job *j = arg;
+    struct s3_file *f = j->f;
+    size_t o = (size_t) i * j->part, n = j->len - o < j->part ? j->len - o : j->part;
+    char query[400];
+
+    snprintf(query, sizeof(query), "partNumber=%u&uploadId=%s", j->first + i + 1, f->upload);
+    struct s3_req rq = {
+        .kind = S3_PART, .method = "PUT", .key = f->key, .query = query,
+        .body = j->data + o, .blen = n,
+    };
+    j->err[i] = s3_call(&rq);
+    if (j->err[i] == 0 && rq.etag[0] == '\0')
+        j->err[i] = -EPROTO;
+    if (j->err[i] == 0)
+        snprintf(f->etag[j->first + i], sizeof(f->etag[0]), "%s", rq.etag);
+    s3_req_free(&rq);
+}
+
+/* 버퍼 앞 len바이트를 part들로 병렬 upload하고 버퍼에서 뺌 (마지막 part만 짧을 수 있음) */
+static int s3_upload_parts(struct s3_file *f, size_t len)
+{
+    size_t part = options.s3_part;
+    unsigned int n = (len + part - 1) / part;
+    int err = 0;
+
+    if (f->upload[0] == '\0') {
+        struct s3_req rq = { .kind = S3_PART, .method = "POST", .key = f->key, .query = "uploads=" };
+        err = s3_call(&rq);
+        if (err == 0 && (rq.resp == NULL ||
+                         !xml_tag(rq.resp, rq.resp + rq.rlen, "UploadId", f->upload, sizeof(f->upload))))
+            err = -EPROTO;
+        s3_req_free(&rq);
+        if (err)
+            return err;
+    }
+    if (f->nparts + n > S3_PARTS_MAX)
+        return -EFBIG;
+    if (f->nparts + n > f->partcap) {
+        unsigned int cap = f->partcap ? f->partcap : 16;
+        while (cap < f->nparts + n)
+            cap *= 2;
+        void *p = realloc(f->etag, cap * sizeof(f->etag[0]));
+        if (p == NULL)
+            return -ENOMEM;
+        f->etag = p;
+        f->partcap = cap;
+    }
+
+    struct s3_part_job *j = calloc(1, sizeof(*j) + n * sizeof(int));
+    if (j == NULL)
+        return -ENOMEM;
+    *j = (struct s3_part_job) { f, f->wbuf, len, f->nparts, part };
+    hpool_run(s3_part_job, j, n);
+    for (unsigned int i = 0; i < n && err == 0; i++)
+        err = j->err[i];
+    free(j);
+    if (err)
+        return err;
+
+    f->nparts += n;
+    f->base += len;
+    f->wlen -= len;
+    memmove(f->wbuf, f->wbuf + len, f->wlen);
+    return 0;
+}
+
+static void s3_abort(struct s3_file *f)
+{
+    if (f->upload[0] == '\0')
+        return;
+    char query[300];
+    snprintf(query, sizeof(query), "uploadId=%s", f->upload);
+    struct s3_req rq = { .kind = S3_PART, .method = "DELETE", .key = f->key, .query = query };
+    s3_call(&rq);
+    s3_req_free(&rq);
+    f->upload[0] = '\0';
+}
+
+/* release: 남은 버퍼를 PUT 한 번으로, 또는 마지막 part들을 올리고 upload를 완료 */
+static int s3_commit(struct s3_file *f)
+{
+    int err = f->err;
+
+    if (err == 0 && f->upload[0] == '\0' && f->wlen <= options.s3_part) {
+        struct s3_req rq = {
+            .kind = S3_PUT, .method = "PUT", .key = f->key, .body = f->wbuf, .blen = f->wlen,
+        };
+        err = s3_call(&rq);
+        s3_req_free(&rq);
+        return err;
+    }
+    if (err == 0 && f->wlen)
+        err = s3_upload_parts(f, f->wlen);
+    if (err == 0) {
+        size_t len = 128 + (size_t) f->nparts * 128;
+        char *xml = malloc(len), query[300];
+        size_t o = 0;
+        if (xml == NULL) {
+            err = -ENOMEM;
+        } else {
+            o += sprintf(xml, "<CompleteMultipartUpload>");
+            for (unsigned int i = 0; i < f->nparts; i++)
+                o += snprintf(xml + o, len - o, "<Part><PartNumber>%u</PartNumber><ETag>%s</ETag></Part>",
+                              i + 1, f->etag[i]);
+            o += snprintf(xml + o, len - o, "</CompleteMultipartUpload>");
+            snprintf(query, sizeof(query), "uploadId=%s", f->upload);
+            struct s3_req rq = {
+                .kind = S3_PART, .method = "POST", .key = f->key, .query = query,
+                .body = xml, .blen = o,
+            };
+            err = s3_call(&rq);
+            /* 200으로 답하고 본문에 오류를 담을 수 있음 */
+            if (err == 0 && rq.resp && strstr(rq.resp, "<Error>"))
+                err = -EIO;
+            s3_req_free(&rq);
+            free(xml);
+        }
+    }
+    if (err)
+        s3_abort(f);
+    else
+        __atomic_fetch_add(&s3.uploads, 1, __ATOMIC_RELAXED);
+    return err;
+}
+
+static int s3_getattr(int next, const char *path, struct stat *stbuf, struct fuse_file_info *fi)
+{
+    if (strcmp(path, STATS_PATH) == 0)
+        return next_getattr(next, path, stbuf, fi);
+
+    struct s3_attr a;
+    int err = s3_stat(path, &a);
+    if (err == 0)
+        s3_fill_stat(&a, stbuf);
+    return err;
+}
+
+static int s3_readdir(int next, const char *path, void *buf, fuse_fill_dir_t filler,
+                      off_t offset, struct fuse_file_info *fi, enum fuse_readdir_flags flags)
+{
+    (void) next;
+    (void) offset;
+    (void) fi;
+    (void) flags;
+
+    char prefix[PATH_MAX], token[1024] = "", key[PATH_MAX], child[PATH_MAX];
+    int err = s3_key(path, 1, prefix, sizeof(prefix)), full = 0;
+    size_t plen = strlen(prefix);
+    struct s3_attr a;
+    struct stat st;
+
+    if (err)
+        return err;
+    filler(buf, ".", NULL, 0, 0);
+    filler(buf, "..", NULL, 0, 0);
+    do {
+        struct s3_req rq;
+        if ((err = s3_list(prefix, token, 1000, &rq)) != 0)
+            return err;
+
+        const char *p = rq.resp, *end = rq.resp + rq.rlen, *q;
+        char num[32], date[40];
+        while (!full && (q = xml_tag(p, end, "Contents", NULL, 0)) != NULL) {
+            const char *c = memmem(p, q - p, "<Contents>", 10);
+            if (xml_tag(c, q, "Key", key, sizeof(key)) && strcmp(key, prefix) != 0 &&
+                strchr(key + plen, '/') == NULL) {
+                struct tm tm = { 0 };
+                xml_tag(c, q, "Size", num, sizeof(num));
+                a = (struct s3_attr) { .exists = 1, .mode = S_IFREG | 0644,
+                                       .size = strtoull(num, NULL, 10) };
+                if (xml_tag(c, q, "LastModified", date, sizeof(date)) &&
+                    strptime(date, "%Y-%m-%dT%H:%M:%S", &tm))
+                    a.mtime = timegm(&tm);
+                snprintf(child, sizeof(child), "%s/%s", strcmp(path, "/") ? path : "", key + plen);
+                s3_attr_set(child, 1, a.mode, a.size, a.mtime, 0);
+                s3_fill_stat(&a, &st);
+                full = filler(buf, key + plen, &st, 0, 0);
+            }
+            p = q;
+        }
+        p = rq.resp;
+        while (!full && (q = xml_tag(p, end, "CommonPrefixes", NULL, 0)) != NULL) {
+            const char *c = memmem(p, q - p, "<CommonPrefixes>", 16);
+            size_t n;
+            if (xml_tag(c, q, "Prefix", key, sizeof(key)) && (n = strlen(key)) > plen + 1) {
+                key[n - 1] = '\0';
+                a = (struct s3_attr) { .exists = 1, .mode = S_IFDIR | 0755 };
+                snprintf(child, sizeof(child), "%s/%s", strcmp(path, "/") ? path : "", key + plen);
+                s3_attr_set(child, 1, a.mode, 0, 0, 0);
+                s3_fill_stat(&a, &st);
+                full = filler(buf, key + plen, &st, 0, 0);
+            }
+            p = q;
+        }
+        char trunc[8] = "";
+        xml_tag(rq.resp, end, "IsTruncated", trunc, sizeof(trunc));
+        if (full || strcmp(trunc, "true") != 0 ||
+            !xml_tag(rq.resp, end, "NextContinuationToken", token, sizeof(token)))
+            token[0] = '\0';
+        s3_req_free(&rq);
+    } while (token[0]);
+    return 0;
+}
+
+static int s3_attach(const char *path, struct fuse_file_info *fi, const struct s3_attr *a,
+                     int fresh)
+{
+    struct s3_file *f = calloc(1, sizeof(*f));
+    struct basic_fh *fh = fh_new(-1);
+    int err = f && fh ? s3_key(path, 0, f->key, sizeof(f->key)) : -ENOMEM;
+
+    if (err) {
+        free(f);
+        free(fh);
+        return err;
+    }
+    pthread_mutex_init(&f->lock, NULL);
+    f->size = fresh ? 0 : a->size;
+    f->writing = (fi->flags & O_ACCMODE) != O_RDONLY;
+    f->have = f->dirty = fresh;
+    if (f->writing)
+        s3_attr_set(path, 1, S_IFREG | 0644, f->size, fresh ? time(NULL) : a->mtime, 1);
+    fh->s3 = f;
+    fi->fh = (uint64_t) (uintptr_t) fh;
+    return 0;
+}
+
+static int s3_create(int next, const char *path, mode_t mode, struct fuse_file_info *fi)
+{
+    (void) next;
+    (void) mode;
+    struct s3_attr a;
+
+    if (strcmp(path, STATS_PATH) == 0)
+        return -EEXIST;
+    int err = s3_stat(path, &a);
+    if (err == 0 && S_ISDIR(a.mode))
+        return -EISDIR;
+    if (err && err != -ENOENT)
+        return err;
+    /* 객체는 release에서 생김 (그 전에는 이 데몬의 속성 캐시에만) */
+    fi->flags = (fi->flags & ~O_ACCMODE) | O_WRONLY;
+    return s3_attach(path, fi, &a, 1);
+}
+
+static int s3_open(int next, const char *path, struct fuse_file_info *fi)
+{
+    struct s3_attr a;
+
+    if (strcmp(path, STATS_PATH) == 0)
+        return next_open(next, path, fi);
+    int err = s3_stat(path, &a);
+    if (err)
+        return err;
+    if (S_ISDIR(a.mode))
+        return -EISDIR;
+    return s3_attach(path, fi, &a, (fi->flags & O_TRUNC) && (fi->flags & O_ACCMODE) != O_RDONLY);
+}
+
+static int s3_read(int next, const char *path, char *buf, size_t size, off_t offset,
+                   struct fuse_file_info *fi)
+{
+    struct basic_fh *fh = get_fh(fi);
+    struct s3_file *f = fh ? fh->s3 : NULL;
+    if (f == NULL)
+        return next_read(next, path, buf, size, offset, fi);
+
+    pthread_mutex_lock(&f->lock);
+    uint64_t off = offset, end = off + size < f->size ? off + size : f->size;
+    int res = 0;
+
+    if (off >= end) {
+        res = 0;
+    } else if (f->have) {
+        /* 쓰는 중: 올린 part는 완료 전에는 읽을 수 없음 */
+        res = off < f->base ? -EIO : (int) (end - off);
+        if (res > 0)
+            memcpy(buf, f->wbuf + (off - f->base), end - off);
+    } else if (off >= f->ra_off && end <= f->ra_off + f->ra_len) {
+        memcpy(buf, f->ra + (off - f->ra_off), end - off);
+        __atomic_fetch_add(&s3.ra_hits, 1, __ATOMIC_RELAXED);
+        res = end - off;
+    } else {
+        /* 순차면 창을 두 배로, 아니면 처음 크기로 */
+        size_t w = off == f->ra_next && f->window ? f->window * 2 : S3_RANGE;
+        f->window = w < options.s3_readahead ? w : options.s3_readahead;
+        uint64_t fend = off + (end - off > f->window ? end - off : f->window);
+        if (fend > f->size)
+            fend = f->size;
+        if (fend - off > f->ra_cap) {
+            char *p = realloc(f->ra, fend - off);
+            if (p == NULL) {
+                res = -ENOMEM;
+                goto out;
+            }
+            f->ra = p;
+            f->ra_cap = fend - off;
+        }
+        f->ra_len = 0;
+        res = s3_get_parallel(f->key, f->ra, off, fend - off);
+        if (res == 0) {
+            f->ra_off = off;
+            f->ra_len = fend - off;
+            memcpy(buf, f->ra, end - off);
+            res = end - off;
+        }
+    }
+    if (res > 0)
+        f->ra_next = end;
+out:
+    pthread_mutex_unlock(&f->lock);
+    return res;
+}
+
+/* 버퍼를 off+size까지 늘리고 (빈 곳은 0) 크기를 속성 캐시에 */
+static int s3_extend(struct s3_file *f, const char *path, uint64_t end)
+{
+    if (end > f->base + f->wlen) {
+        int err = s3_wbuf_reserve(f, end - f->base);
+        if (err)
+            return err;
+        memset(f->wbuf + f->wlen, 0, end - f->base - f->wlen);
+        f->wlen = end - f->base;
+    }
+    f->size = f->base + f->wlen;
+    s3_attr_set(path, 1, S_IFREG | 0644, f->size, time(NULL), 0);
+    return 0;
+}
+
+static int s3_write(int next, const char *path, const char *buf, size_t size, off_t offset,
+                    struct fuse_file_info *fi)
+{
+    struct basic_fh *fh = get_fh(fi);
+    struct s3_file *f = fh ? fh->s3 : NULL;
+    if (f == NULL)
+        return next_write(next, path, buf, size, offset, fi);
+
+    pthread_mutex_lock(&f->lock);
+    int err = f->err ? f->err : s3_load(f);
+    if (err == 0 && (uint64_t) offset < f->base)
+        err = -EOPNOTSUPP;
+    if (err == 0)
+        err = s3_extend(f, path, offset + size);
+    if (err == 0) {
+        memcpy(f->wbuf + (offset - f->base), buf, size);
+        f->dirty = 1;
+        f->ra_len = 0;
+        /* s3_threads개의 part가 모이면 한꺼번에 (뒤의 짧은 부분은 남김) */
+        size_t part = options.s3_part, batch = (size_t) options.s3_threads * part;
+        if (f->wlen >= batch + part && (err = s3_upload_parts(f, batch)) != 0) {
+            f->err = err;
+            fprintf(stderr, "[WARN] s3: %s: part upload failed (%s)\n", path, strerror(-err));
+        }
+    }
+    pthread_mutex_unlock(&f->lock);
+    return err ? err : (int) size;
+}
+
+static int s3_release(int next, const char *path, struct fuse_file_info *fi)
+{
+    struct basic_fh *fh = get_fh(fi);
+    struct s3_file *f = fh ? fh->s3 : NULL;
+    if (f == NULL)
+        return next_release(next, path, fi);
+
+    int err = f->dirty ? s3_commit(f) : 0;
+    if (f->writing) {
+        /* 실패했으면 다음 stat에서 다시 HEAD */
+        s3_attr_set(path, 1, S_IFREG | 0644, f->size, time(NULL), -1);
+        if (err)
+            s3_attr_forget(path);
+    }
+    if (err)
+        fprintf(stderr, "[WARN] s3: %s: upload failed, changes lost (%s)\n", path, strerror(-err));
+    s3_file_free(f);
+    free(fh);
+    fi->fh = 0;
+    return err;
+}
+
+static int s3_put_empty(const char *key)
+{
+    struct s3_req rq = { .kind = S3_PUT, .method = "PUT", .key = key };
+    int err = s3_call(&rq);
+    s3_req_free(&rq);
+    return err;
+}
+
+static int s3_delete(const char *key)
+{
+    struct s3_req rq = { .kind = S3_DELETE, .method = "DELETE", .key = key };
+    int err = s3_call(&rq);
+    s3_req_free(&rq);
+    return err == -ENOENT ? 0 : err;
+}
+
+static int s3_truncate(int next, const char *path, off_t size, struct fuse_file_info *fi)
+{
+    struct basic_fh *fh = fi ? get_fh(fi) : NULL;
+    struct s3_file *f = fh ? fh->s3 : NULL;
+    struct s3_attr a;
+    int err;
+
+    if (strcmp(path, STATS_PATH) == 0)
+        return next_truncate(next, path, size, fi);
+    if (f && f->writing) {
+        pthread_mutex_lock(&f->lock);
+        err = f->err ? f->err : s3_load(f);
+        if (err == 0 && (uint64_t) size < f->base)
+            err = -EOPNOTSUPP;
+        if (err == 0) {
+            if ((uint64_t) size < f->base + f->wlen)
+                f->wlen = size - f->base;
+            err = s3_extend(f, path, size);
+            f->dirty = 1;
+        }
+        pthread_mutex_unlock(&f->lock);
+        return err;
+    }
+
+    /* 열려 있지 않은 파일은 새 내용으로 다시 올림 */
+    if ((err = s3_stat(path, &a)) != 0)
+        return err;
+    if (S_ISDIR(a.mode))
+        return -EISDIR;
+    if ((uint64_t) size == a.size)
+        return 0;
+
+    struct fuse_file_info wfi = { .flags = O_WRONLY };
+    if ((err = s3_attach(path, &wfi, &a, size == 0)) != 0)
+        return err;
+    f = get_fh(&wfi)->s3;
+    err = size > S3_REWRITE_MAX ? -EFBIG : s3_load(f);
+    if (err == 0) {
+        if ((uint64_t) size < f->wlen)
+            f->wlen = size;
+        err = s3_extend(f, path, size);
+        f->dirty = 1;
+    }
+    if (err)
+        f->dirty = 0;
+    int rerr = s3_release(next, path, &wfi);
+    return err ? err : rerr;
+}
+
+static int s3_unlink(int next, const char *path)
+{
+    (void) next;
+    struct s3_attr a;
+    char key[PATH_MAX];
+    int err = s3_stat(path, &a);
+
+    if (err)
+        return err;
+    if (S_ISDIR(a.mode))
+        return -EISDIR;
+    if ((err = s3_key(path, 0, key, sizeof(key))) != 0 || (err = s3_delete(key)) != 0)
+        return err;
+    s3_attr_set(path, 0, 0, 0, 0, 0);
+    return 0;
+}
+
+/* 파일만: 서버 쪽 COPY 후 DELETE (디렉토리는 -EXDEV로 mv가 하나씩 옮기게 함) */
+static int s3_rename(int next, const char *from, const char *to, unsigned int flags)
+{
+    (void) next;
+    struct s3_attr a, b;
+    char src[PATH_MAX], dst[PATH_MAX];
+    int err;
+
+    if (flags)
+        return -EINVAL;
+    if ((err = s3_stat(from, &a)) != 0)
+        return err;
+    if (S_ISDIR(a.mode))
+        return -EXDEV;
+    if (s3_stat(to, &b) == 0 && S_ISDIR(b.mode))
+        return -EISDIR;
+    if ((err = s3_key(from, 0, src, sizeof(src))) != 0 ||
+        (err = s3_key(to, 0, dst, sizeof(dst))) != 0)
+        return err;
+
+    struct s3_req rq = { .kind = S3_COPY, .method = "PUT", .key = dst, .copy_src = src };
+    err = s3_call(&rq);
+    if (err == 0 && rq.resp && strstr(rq.resp, "<Error>"))
+        err = -EIO;
+    s3_req_free(&rq);
+    if (err == 0)
+        err = s3_delete(src);
+    s3_attr_forget(to);
+    if (err == 0)
+        s3_attr_set(from, 0, 0, 0, 0, 0);
+    return err;
+}
+
+static int s3_mkdir(int next, const char *path, mode_t mode)
+{
+    (void) next;
+    (void) mode;
+    struct s3_attr a;
+    char key[PATH_MAX];
+    int err = s3_stat(path, &a);
+
+    if (err == 0)
+        return -EEXIST;
+    if (err != -ENOENT || (err = s3_key(path, 1, key, sizeof(key))) != 0 ||
+        (err = s3_put_empty(key)) != 0)
+        return err;
+    s3_attr_set(path, 1, S_IFDIR | 0755, 0, 0, 0);
+    return 0;
+}
+
+static int s3_rmdir(int next, const char *path)
+{
+    (void) next;
+    struct s3_attr a;
+    char key[PATH_MAX];
+    int marker, err = s3_stat(path, &a);
+
+    if (err)
+        return err;
+    if (!S_ISDIR(a.mode))
+        return -ENOTDIR;
+    if ((err = s3_key(path, 1, key, sizeof(key))) != 0 ||
+        (err = s3_has_children(key, &marker)) < 0)
+        return err;
+    if (err)
+        return -ENOTEMPTY;
+    if (marker && (err = s3_delete(key)) != 0)
+        return err;
+    s3_attr_set(path, 0, 0, 0, 0, 0);
+    return 0;
+}
+
+/* 객체에는 mode/시각을 둘 곳이 없음: 있는지만 확인 */
+static int s3_chmod(int next, const char *path, mode_t mode, struct fuse_file_info *fi)
+{
+    (void) next;
+    (void) mode;
+    (void) fi;
+    struct s3_attr a;
+    return s3_stat(path, &a);
+}
+
+static int s3_utimens(int next, const char *path, const struct timespec ts[2],
+                      struct fuse_file_info *fi)
+{
+    (void) next;
+    (void) ts;
+    (void) fi;
+    struct s3_attr a;
+    return s3_stat(path, &a);
+}
+
+static int s3_opendir(int next, const char *path, struct fuse_file_info *fi)
+{
+    (void) next;
+    (void) fi;
+    struct s3_attr a;
+    int err = s3_stat(path, &a);
+    return err ? err : S_ISDIR(a.mode) ? 0 : -ENOTDIR;
+}
+
+static const struct basic_layer s3_layer = {
+    .name       = "s3",
+    .getattr    = s3_getattr,
+    .readdir    = s3_readdir,
+    .create     = s3_create,
+    .open       = s3_open,
+    .read       = s3_read,
+    .write      = s3_write,
+    .unlink     = s3_unlink,
+    .rename     = s3_rename,
+    .release    = s3_release,
+    .mkdir      = s3_mkdir,
+    .rmdir      = s3_rmdir,
+    .chmod      = s3_chmod,
+    .truncate   = s3_truncate,
+    .utimens    = s3_utimens,
+    .opendir    = s3_opendir,
+};
+
+/* "http://host[:port]/bucket"와 키 파일("ID:SECRET" 한 줄) */
+static int s3_setup(const char *url, const char *keyfile)
+{
+    char host[256], port[8] = "80";
+    const char *p = url;
+
+    if (strncmp(p, "http://", 7) != 0)
+        return -EPROTONOSUPPORT;
+    p += 7;
+    size_t n = strcspn(p, "/");
+    if (n == 0 || n >= sizeof(host) || p[n] != '/' || p[n + 1] == '\0' ||
+        strlen(p + n + 1) >= sizeof(s3.bucket) || strchr(p + n + 1, '/'))
+        return -EINVAL;
+    memcpy(host, p, n);
+    host[n] = '\0';
+    snprintf(s3.host, sizeof(s3.host), "%s", host);
+    snprintf(s3.bucket, sizeof(s3.bucket), "%s", p + n + 1);
+    char *colon = strrchr(host, ':');
+    if (colon && !strchr(host, ']')) {
+        if (strlen(colon + 1) >= sizeof(port))
+            return -EINVAL;
+        strcpy(port, colon + 1);
+        *colon = '\0';
+    }
+
+    struct addrinfo hints = { .ai_socktype = SOCK_STREAM }, *ai;
+    if (getaddrinfo(host, port, &hints, &ai) != 0)
+        return -EHOSTUNREACH;
+    memcpy(&s3.addr, ai->ai_addr, ai->ai_addrlen);
+    s3.addrlen = ai->ai_addrlen;
+    freeaddrinfo(ai);
+
+    snprintf(s3.region, sizeof(s3.region), "%s", options.s3_region ? options.s3_region : "us-east-1");
+    if (keyfile) {
+        FILE *kf = fopen(keyfile, "r");
+        char line[512];
+        if (kf == NULL)
+            return -errno;
+        int ok = fgets(line, sizeof(line), kf) != NULL;
+        fclose(kf);
+        char *sep = ok ? strchr(line, ':') : NULL;
+        if (sep == NULL)
+            return -EINVAL;
+        *sep = '\0';
+        line[strcspn(sep + 1, "\r\n") + (sep + 1 - line)] = '\0';
+        if (strlen(line) >= sizeof(s3.key_id) || strlen(sep + 1) >= sizeof(s3.secret))
+            return -EINVAL;
+        strcpy(s3.key_id, line);
+        strcpy(s3.secret, sep + 1);
+    }
+    s3.on = 1;
+    return 0;
+}
+
+/*
+ * remote backend (-o remote=unix:/path 또는 tcp:host:port): 맨 아래 layer로, 백엔드
+ * 연산(lstat, open, pread, pwrite, rename, …)을 다른 데몬(-o remote_serve=ADDR로 띄운
+ * 이 프로그램, 자기 DIR_PATH를 제공)에 메시지로 보낸다. 통계 파일만 passthrough로.
+ *
+ * 프레임은 rpc_hdr(16바이트) + payload, 요청 payload는 숫자 인자 4개 뒤에 경로 문자열들
+ * (NUL로 끝남) 또는 write 데이터. 연결마다 응답을 기다리는 요청이 RPC_SLOTS개까지
+ * 있을 수 있고 응답은 id로 짝을 지어 순서와 무관하게 돌아온다 (서버는 worker
+ * 여러 개가 동시에 처리). 보내는 쪽은 누가 쓰고 있으면 큐에 프레임을 얹고 쓰는
+ * 스레드가 모인 것을 writev 한 번으로 보내므로, 혼자일 때는 바로 나가 RTT 한 번이고
+ * 몰릴 때는 저절로 묶인다. 받는 쪽도 한 번의 recv로 여러 프레임을 읽는다.
+ *
+ * 핸들은 연 연결의 세대를 기억해, 연결이 끊겨 다시 맺은 뒤에는 -ENOTCONN (서버는
+ * 끊긴 연결이 연 fd를 닫음). 경로 연산은 새 연결로 계속된다. 끊긴 연결에 걸린 요청은
+ * -ECONNRESET (둘 다 backend_down).
+ */
+#define RPC_MAGIC 0x50524642u       /* "BFRP" (바이트 순서가 다르면 맞지 않음) */
+#define RPC_VERSION 1
+#define RPC_SLOTS 256               /* 연결당 응답을 기다리는 요청 수 */
+#define RPC_MAX_PAYLOAD (16 * 1024 * 1024)
+#define RPC_DIR_CHUNK (256 * 1024)  /* readdir 응답 하나의 크기 (넘으면 RPC_MORE) */
+#define RPC_NOREPLY 1               /* flags: 응답을 보내지 않음 (close) */
+#define RPC_MORE 2                  /* readdir 응답: 이어서 더 있음 */
+#define REMOTE_CONNS_MAX 8
+#define RPC_PEER_GET 64             /* peer cache 블록 요청 (remote layer 연산이 아님) */
+
+struct rpc_hdr {
+    uint32_t len;                   /* 뒤따르는 payload 크기 */
+    uint32_t id;                    /* 응답은 요청과 같은 id */
+    uint16_t op;
+    uint16_t flags;
+    int32_t res;                    /* 응답: 0 이상은 결과, 음수는 -errno */
+};
+
+struct rpc_args {
+    int64_t v[4];                   /* op마다 뜻이 다름 (rs_exec 참고) */
+};
+
+/* lstat 결과 (양쪽 struct stat 배치와 무관하게) */
+struct rpc_stat {
+    uint64_t ino, size, blocks;
+    uint32_t mode, nlink, uid, gid, blksize, pad;
+    int64_t atime, atime_ns, mtime, mtime_ns, ctime, ctime_ns;
+};
+
+static void rpc_stat_pack(const struct stat *st, struct rpc_stat *r)
+{
+    *r = (struct rpc_stat) {
+        .ino = st->st_ino, .size = st->st_size, .blocks = st->st_blocks,
+        .mode = st->st_mode, .nlink = st->st_nlink, .uid = st->st_uid, .gid = st->st_gid,
+        .blksize = st->st_blksize,
+        .atime = st->st_atim.tv_sec, .atime_ns = st->st_atim.tv_nsec,
+        .mtime = st->st_mtim.tv_sec, .mtime_ns = st->st_mtim.tv_nsec,
+        .ctime = st->st_ctim.tv_sec, .ctime_ns = st->st_ctim.tv_nsec,
+    };
+}
+
+static void rpc_stat_unpack(const struct rpc_stat *r, struct stat *st)
+{
+    memset(st, 0, sizeof(*st));
+    st->st_ino = r->ino;
+    st->st_size = r->size;
+    st->st_blocks = r->blocks;
+    st->st_mode = r->mode;
+    st->st_nlink = r->nlink;
+    st->st_uid = r->uid;
+    st->st_gid = r->gid;
+    st->st_blksize = r->blksize;
+    st->st_atim = (struct timespec) { r->atime, r->atime_ns };
+    st->st_mtim = (struct timespec) { r->mtime, r->mtime_ns };
+    st->st_ctim = (struct timespec) { r->ctime, r->ctime_ns };
+}
+
+/* 한 연결의 보내기(여러 스레드가 같이)와 받기(한 스레드) */
+struct rpc_link {
+    pthread_mutex_t lock;
+    pthread_cond_t sent;            /* flushed가 늘었거나 연결이 깨짐 */
+    int fd;                         /* -1이면 끊김 */
+    int broken;                     /* 더 보내지 않음 (받는 쪽이 정리 중) */
+    struct iovec *q, *spare;        /* 보낼 조각들 (넣은 스레드의 메모리를 가리킴) */
+    unsigned int nq, qcap, qframes;
+    uint64_t queued, flushed;       /* 넣은/보낸 프레임 수 */
+    int sending;
+    unsigned int waiters;           /* 남이 보내주기를 기다리는 스레드 */
+    size_t rpos, rlen;
+    char rbuf[64 * 1024];
+};
+
+static void rpc_link_init(struct rpc_link *l, int fd)
+{
+    pthread_mutex_init(&l->lock, NULL);
+    pthread_cond_init(&l->sent, NULL);
+    l->fd = fd;
+}
+
+/*
+ * 프레임 하나(iov n개)를 보냄 (l->lock을 잡고 호출). 이미 보내는 스레드가 있으면
+ * 큐에 얹고 그 스레드가 보낼 때까지 기다리고, 없으면 직접 큐가 빌 때까지 보낸다.
+ * 돌아온 뒤에는 iov가 가리키는 메모리를 더 쓰지 않음.
+ */
+static int rpc_send_locked(struct rpc_link *l, const struct iovec *iov, unsigned int n)
+{
+    if (l->broken || l->fd < 0)
+        return -ECONNRESET;
+    if (l->nq + n > l->qcap) {
+        unsigned int cap = l->qcap ? l->qcap * 2 : 64;
+        while (cap < l->nq + n)
+            cap *= 2;
+        struct iovec *q = realloc(l->q, cap * sizeof(*q));
+        struct iovec *s = q ? realloc(l->spare, cap * sizeof(*s)) : NULL;
+        if (q)
+            l->q = q;
+        if (s)
+            l->spare = s;
+        if (q == NULL || s == NULL)
+            return -ENOMEM;
+        l->qcap = cap;
+    }
+    memcpy(l->q + l->nq, iov, n * sizeof(*iov));
+    l->nq += n;
+    l->qframes++;
+    uint64_t seq = ++l->queued;
+
+    /* 깨진 뒤에도 보내는 스레드가 이 메모리를 쓰고 있을 수 있으니 끝날 때까지 */
+    if (l->sending) {
+        l->waiters++;
+        while (l->flushed < seq && !(l->broken && !l->sending))
+            pthread_cond_wait(&l->sent, &l->lock);
+        if (--l->waiters == 0)
+            pthread_cond_broadcast(&l->sent);
+        return l->flushed >= seq ? 0 : -ECONNRESET;
+    }
+
+    int err = 0;
+    l->sending = 1;
+    while (l->nq && err == 0 && !l->broken) {
+        struct iovec *v = l->q;
+        unsigned int cnt = l->nq, frames = l->qframes;
+        l->q = l->spare;
+        l->spare = v;
+        l->nq = l->qframes = 0;
+        int fd = l->fd;
+        pthread_mutex_unlock(&l->lock);
+
+        while (cnt && err == 0) {
+            struct msghdr msg = { .msg_iov = v, .msg_iovlen = cnt < IOV_MAX ? cnt : IOV_MAX };
+            ssize_t w = BACKEND(sendmsg(fd, &msg, MSG_NOSIGNAL));
+            if (w < 0) {
+                err = -errno;
+                break;
+            }
+            while (cnt && (size_t) w >= v->iov_len) {
+                w -= v->iov_len;
+                v++;
+                cnt--;
+            }
+            if (cnt) {
+                v->iov_base = (char *) v->iov_base + w;
+                v->iov_len -= w;
+            }
+        }
+
+        pthread_mutex_lock(&l->lock);
+        l->flushed += frames;
+        __atomic_fetch_add(&remote.writes, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&remote.frames, frames, __ATOMIC_RELAXED);
+        pthread_cond_broadcast(&l->sent);
+    }
+    l->sending = 0;
+    if (err) {
+        /* 받는 쪽이 알아채고 정리하도록 */
+        l->broken = 1;
+        shutdown(l->fd, SHUT_RDWR);
+    }
+    pthread_cond_broadcast(&l->sent);
+    return l->flushed >= seq ? 0 : -ECONNRESET;
+}
+
+/* 정확히 n바이트 받기 (dst가 NULL이면 버림), 큰 본문은 버퍼를 거치지 않고 바로 */
+static int rpc_recv(struct rpc_link *l, void *dst, size_t n)
+{
+    char *d = dst;
+    while (n) {
+        if (l->rpos == l->rlen) {
+            if (d && n >= sizeof(l->rbuf)) {
+                ssize_t r = recv(l->fd, d, n, 0);
+                if (r <= 0)
+                    return r == 0 ? -ECONNRESET : -errno;
+                d += r;
+                n -= r;
+                continue;
+            }
+            ssize_t r = recv(l->fd, l->rbuf, sizeof(l->rbuf), 0);
+            if (r <= 0)
+                return r == 0 ? -ECONNRESET : -errno;
+            l->rpos = 0;
+            l->rlen = r;
+        }
+        size_t m = l->rlen - l->rpos < n ? l->rlen - l->rpos : n;
+        if (d) {
+            memcpy(d, l->rbuf + l->rpos, m);
+            d += m;
+        }
+        l->rpos += m;
+        n -= m;
+    }
+    return 0;
+}
+
+/* "unix:/path", "tcp:host:port" (또는 "host:port") */
+static int rpc_addr(const char *spec, struct sockaddr_storage *ss, socklen_t *len)
+{
+    memset(ss, 0, sizeof(*ss));
+    if (strncmp(spec, "unix:", 5) == 0) {
+        struct sockaddr_un *un = (struct sockaddr_un *) ss;
+        if (strlen(spec + 5) >= sizeof(un->sun_path))
+            return -ENAMETOOLONG;
+        un->sun_family = AF_UNIX;
+        strcpy(un->sun_path, spec + 5);
+        *len = sizeof(*un);
+        return 0;
+    }
+    if (strncmp(spec, "tcp:", 4) == 0)
+        spec += 4;
+
+    char host[256];
+    const char *colon = strrchr(spec, ':');
+    if (colon == NULL || (size_t) (colon - spec) >= sizeof(host))
+        return -EINVAL;
+    memcpy(host, spec, colon - spec);
+    host[colon - spec] = '\0';
+
+    struct addrinfo hints = { .ai_socktype = SOCK_STREAM, .ai_flags = AI_PASSIVE }, *ai;
+    if (getaddrinfo(host[0] ? host : NULL, colon + 1, &hints, &ai) != 0)
+        return -EHOSTUNREACH;
+    memcpy(ss, ai->ai_addr, ai->ai_addrlen);
+    *len = ai->ai_addrlen;
+    freeaddrinfo(ai);
+    return 0;
+}
+
+static void rpc_sock_opts(int fd)
+{
+    int one = 1;
+    if (fd >= 0)
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+/* 클라이언트: 응답을 기다리는 요청 */
+struct rpc_call {
+    pthread_cond_t cond;
+    uint32_t id;
+    int done;
+    int32_t res;
+    uint16_t flags;
+    char *out;
+    size_t outcap, outlen;
+};
+
+struct remote_conn {
+    struct rpc_link link;
+    const char *name;               /* 로그용 주소 문자열 */
+    struct sockaddr_storage addr;
+    socklen_t addrlen;
+    unsigned long long *reconnects;
+    unsigned int gen;               /* 다시 연결할 때마다 늘어남 (0은 쓰지 않음) */
+    struct rpc_call *slot[RPC_SLOTS];
+    pthread_cond_t slot_free;
+    uint32_t next_id;
+};
+
+struct rpc_req {
+    uint16_t op;
+    uint16_t flags;                 /* RPC_NOREPLY */
+    struct rpc_args a;
+    const char *path, *path2;
+    const void *data;
+    size_t dlen;
+    char *out;                      /* 응답 payload (outcap을 넘으면 연결 오류) */
+    size_t outcap;
+    size_t outlen;
+    uint16_t rflags;
+};
+
+/* 응답을 받아 기다리는 요청에 넘기는 스레드, 연결이 끊기면 모두 -ECONNRESET으로 깨우고 끝남 */
+static void *remote_reader(void *arg)
+{
+    struct remote_conn *c = arg;
+    struct rpc_link *l = &c->link;
+    struct rpc_hdr h;
+
+    while (rpc_recv(l, &h, sizeof(h)) == 0) {
+        pthread_mutex_lock(&l->lock);
+        struct rpc_call *call = c->slot[h.id % RPC_SLOTS];
+        pthread_mutex_unlock(&l->lock);
+        /* 기다리는 쪽은 done이 될 때까지 call을 놓지 않으므로 본문은 잠금 없이 */
+        if (call == NULL || call->id != h.id || h.len > call->outcap ||
+            rpc_recv(l, call->out, h.len) != 0)
+            break;
+        pthread_mutex_lock(&l->lock);
+        call->res = h.res;
+        call->flags = h.flags;
+        call->outlen = h.len;
+        call->done = 1;
+        c->slot[h.id % RPC_SLOTS] = NULL;
+        pthread_cond_signal(&call->cond);
+        pthread_cond_signal(&c->slot_free);
+        pthread_mutex_unlock(&l->lock);
+    }
+
+    pthread_mutex_lock(&l->lock);
+    l->broken = 1;
+    shutdown(l->fd, SHUT_RDWR);
+    l->nq = l->qframes = 0;
+    pthread_cond_broadcast(&l->sent);
+    while (l->sending || l->waiters)
+        pthread_cond_wait(&l->sent, &l->lock);
+    for (int i = 0; i < RPC_SLOTS; i++) {
+        struct rpc_call *call = c->slot[i];
+        if (call == NULL)
+            continue;
+        call->res = -ECONNRESET;
+        call->done = 1;
+        c->slot[i] = NULL;
+        pthread_cond_signal(&call->cond);
+    }
+    pthread_cond_broadcast(&c->slot_free);
+    close(l->fd);
+    l->fd = -1;
+    pthread_mutex_unlock(&l->lock);
+    fprintf(stderr, "[WARN] connection to %s lost\n", c->name);
+    return NULL;
+}
+
+/* 끊겨 있으면 다시 연결하고 HELLO 확인 (l->lock을 잡고 호출) */
+static int remote_connect_locked(struct remote_conn *c)
+{
+    struct rpc_link *l = &c->link;
+    if (l->fd >= 0)
+        return l->broken ? -ECONNRESET : 0;
+
+    int fd = socket(c->addr.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+        return -errno;
+    if (BACKEND(connect(fd, (struct sockaddr *) &c->addr, c->addrlen)) == -1) {
+        int err = errno;
+        close(fd);
+        /* unix socket 파일이 없음: 경로 연산의 -ENOENT로 보이면 안 됨 */
+        return err == ENOENT ? -ECONNREFUSED : -err;
+    }
+    rpc_sock_opts(fd);
+
+    struct rpc_hdr h = { .len = sizeof(struct rpc_args), .op = RPC_HELLO };
+    struct rpc_args a = { { RPC_MAGIC, RPC_VERSION } };
+    struct iovec iov[2] = { { &h, sizeof(h) }, { &a, sizeof(a) } };
+    struct msghdr msg = { .msg_iov = iov, .msg_iovlen = 2 };
+    struct rpc_hdr r;
+    l->rpos = l->rlen = 0;
+    l->fd = fd;
+    if (sendmsg(fd, &msg, MSG_NOSIGNAL) != (ssize_t) (sizeof(h) + sizeof(a)) ||
+        rpc_recv(l, &r, sizeof(r)) != 0 || r.res != 0 || r.len != 0) {
+        l->fd = -1;
+        close(fd);
+        fprintf(stderr, "[WARN] %s did not accept the handshake\n", c->name);
+        return -EPROTO;
+    }
+
+    pthread_t t;
+    if (pthread_create(&t, NULL, remote_reader, c) != 0) {
+        l->fd = -1;
+        close(fd);
+        return -EAGAIN;
+    }
+    pthread_detach(t);
+    l->broken = 0;
+    if (c->gen++)
+        __atomic_fetch_add(c->reconnects, 1, __ATOMIC_RELAXED);
+    else
+        c->gen = 1;
+    return 0;
+}
+
+/*
+ * 요청 하나: 결과(0 이상) 또는 -errno. *gen이 0이면 아무 세대나 쓰고 그 값을 채우며,
+ * 0이 아니면 그 세대의 연결일 때만 (핸들 연산).
+ */
+static int rpc_call(struct remote_conn *c, unsigned int *gen, struct rpc_req *rq)
+{
+    struct rpc_link *l = &c->link;
+    size_t p1 = rq->path ? strlen(rq->path) + 1 : 0, p2 = rq->path2 ? strlen(rq->path2) + 1 : 0;
+    struct rpc_hdr h = { .len = sizeof(rq->a) + p1 + p2 + rq->dlen, .op = rq->op, .flags = rq->flags };
+    struct iovec iov[5] = { { &h, sizeof(h) }, { &rq->a, sizeof(rq->a) } };
+    unsigned int n = 2;
+    struct rpc_call call = { .out = rq->out, .outcap = rq->outcap };
+    int err;
+
+    if (p1)
+        iov[n++] = (struct iovec) { (void *) rq->path, p1 };
+    if (p2)
+        iov[n++] = (struct iovec) { (void *) rq->path2, p2 };
+    if (rq->dlen)
+        iov[n++] = (struct iovec) { (void *) rq->data, rq->dlen };
+
+    pthread_mutex_lock(&l->lock);
+    if (*gen == 0 && (err = remote_connect_locked(c)) != 0)
+        goto out;
+    if (l->fd < 0 || l->broken || (*gen && *gen != c->gen)) {
+        err = l->fd < 0 || l->broken ? -ECONNRESET : -ENOTCONN;
+        goto out;
+    }
+    *gen = c->gen;
+    if (!(rq->flags & RPC_NOREPLY)) {
+        while ((h.id = ++c->next_id) == 0 || c->slot[h.id % RPC_SLOTS]) {
+            if (h.id && c->slot[h.id % RPC_SLOTS]) {
+                pthread_cond_wait(&c->slot_free, &l->lock);
+                if (l->broken || c->gen != *gen) {
+                    err = l->broken ? -ECONNRESET : -ENOTCONN;
+                    goto out;
+                }
+            }
+        }
+        pthread_cond_init(&call.cond, NULL);
+        call.id = h.id;
+        c->slot[h.id % RPC_SLOTS] = &call;
+    }
+    err = rpc_send_locked(l, iov, n);
+    if (!(rq->flags & RPC_NOREPLY)) {
+        if (err && c->slot[h.id % RPC_SLOTS] == &call)
+            c->slot[h.id % RPC_SLOTS] = NULL;
+        while (err == 0 && !call.done)
+            pthread_cond_wait(&call.cond, &l->lock);
+        pthread_cond_destroy(&call.cond);
+        if (err == 0) {
+            err = call.res;
+            rq->outlen = call.outlen;
+            rq->rflags = call.flags;
+        }
+    }
+out:
+    pthread_mutex_unlock(&l->lock);
+    return err;
+}
+
+static int remote_call(unsigned int ci, unsigned int *gen, struct rpc_req *rq)
+{
+    __atomic_fetch_add(&remote.calls[rq->op], 1, __ATOMIC_RELAXED);
+    int err = rpc_call(&remote.conns[ci], gen, rq);
+    if (err < 0)
+        __atomic_fetch_add(&remote.errors, 1, __ATOMIC_RELAXED);
+    return err;
+}
+
+static void rpc_conn_init(struct remote_conn *c, const char *name,
+                          const struct sockaddr_storage *ss, socklen_t len,
+                          unsigned long long *reconnects)
+{
+    rpc_link_init(&c->link, -1);
+    pthread_cond_init(&c->slot_free, NULL);
+    c->name = name;
+    c->addr = *ss;
+    c->addrlen = len;
+    c->reconnects = reconnects;
+}
+
+/* 경로 연산의 연결: 같은 경로는 같은 연결로 (순서가 섞이지 않게) */
+static unsigned int remote_pick(const char *path)
+{
+    return path_hash(path) % remote.n;
+}
+
+static int remote_path_call(const char *path, struct rpc_req *rq)
+{
+    unsigned int gen = 0;
+    return remote_call(remote_pick(path), &gen, rq);
+}
+
+static int remote_getattr(int next, const char *path, struct stat *stbuf,
+                          struct fuse_file_info *fi)
+{
+    if (strcmp(path, STATS_PATH) == 0)
+        return next_getattr(next, path, stbuf, fi);
+
+    struct rpc_stat rs;
+    struct rpc_req rq = { .op = RPC_LSTAT, .path = path, .out = (char *) &rs, .outcap = sizeof(rs) };
+    int res = remote_path_call(path, &rq);
+    if (res < 0)
+        return res;
+    if (rq.outlen != sizeof(rs))
+        return -EPROTO;
+    rpc_stat_unpack(&rs, stbuf);
+    return 0;
+}
+
+static int remote_readdir(int next, const char *path, void *buf, fuse_fill_dir_t filler,
+                          off_t offset, struct fuse_file_info *fi, enum fuse_readdir_flags flags)
+{
+    (void) next;
+    (void) offset;
+    (void) fi;
+    (void) flags;
+
+    char *out = malloc(RPC_DIR_CHUNK);
+    int64_t start = 0;
+    int res = 0, full = 0;
+
+    if (out == NULL)
+        return -ENOMEM;
+    do {
+        struct rpc_req rq = {
+            .op = RPC_READDIR, .a = { { start } }, .path = path, .out = out, .outcap = RPC_DIR_CHUNK,
+        };
+        if ((res = remote_path_call(path, &rq)) < 0)
+            break;
+        /* rpc_stat, uint16 이름 길이, 이름 순서로 res개 */
+        size_t o = 0;
+        for (int i = 0; i < res && !full; i++) {
+            struct rpc_stat rs;
+            uint16_t nl;
+            char name[NAME_MAX + 1];
+            if (o + sizeof(rs) + sizeof(nl) > rq.outlen)
+                break;
+            memcpy(&rs, out + o, sizeof(rs));
+            memcpy(&nl, out + o + sizeof(rs), sizeof(nl));
+            o += sizeof(rs) + sizeof(nl);
+            if (nl > NAME_MAX || o + nl > rq.outlen)
+                break;
+            memcpy(name, out + o, nl);
+            name[nl] = '\0';
+            o += nl;
+
+            struct stat st;
+            rpc_stat_unpack(&rs, &st);
+            full = filler(buf, name, &st, 0, 0);
+        }
+        start += res;
+        res = (rq.rflags & RPC_MORE) && !full ? 1 : 0;
+    } while (res == 1);
+    free(out);
+    return res < 0 ? res : 0;
+}
+
+static int remote_attach(const char *path, struct fuse_file_info *fi, int flags, mode_t mode)
+{
+    unsigned int ci = __atomic_fetch_add(&remote.rr, 1, __ATOMIC_RELAXED) % remote.n, gen = 0;
+    struct rpc_req rq = { .op = RPC_OPEN, .a = { { flags, mode } }, .path = path };
+    int fd = remote_call(ci, &gen, &rq);
+    if (fd < 0)
+        return fd;
+
+    struct basic_fh *fh = fh_new(fd);
+    if (fh == NULL) {
+        struct rpc_req cl = { .op = RPC_CLOSE, .flags = RPC_NOREPLY, .a = { { fd } } };
+        remote_call(ci, &gen, &cl);
+        return -ENOMEM;
+    }
+    fh->rconn = ci;
+    fh->rgen = gen;
+    fi->fh = (uint64_t) (uintptr_t) fh;
+    return 0;
+}
+
+static int remote_create(int next, const char *path, mode_t mode, struct fuse_file_info *fi)
+{
+    (void) next;
+    if (strcmp(path, STATS_PATH) == 0)
+        return -EEXIST;
+    /* passthrough의 create와 같은 플래그 */
+    return remote_attach(path, fi, O_CREAT | O_WRONLY | (fi->flags & O_APPEND), mode);
+}
+
+static int remote_open(int next, const char *path, struct fuse_file_info *fi)
+{
+    if (strcmp(path, STATS_PATH) == 0)
+        return next_open(next, path, fi);
+    return remote_attach(path, fi, fi->flags, 0);
+}
+
+static int remote_read(int next, const char *path, char *buf, size_t size, off_t offset,
+                       struct fuse_file_info *fi)
+{
+    struct basic_fh *fh = get_fh(fi);
+    if (fh == NULL || fh->rgen == 0)
+        return next_read(next, path, buf, size, offset, fi);
+
+    if (size > RPC_MAX_PAYLOAD)
+        size = RPC_MAX_PAYLOAD;
+    struct rpc_req rq = {
+        .op = RPC_PREAD, .a = { { fh->fd, offset, size } }, .out = buf, .outcap = size,
+    };
+    return remote_call(fh->rconn, &fh->rgen, &rq);
+}
+
+static int remote_write(int next, const char *path, const char *buf, size_t size,
+                        off_t offset, struct fuse_file_info *fi)
+{
+    struct basic_fh *fh = get_fh(fi);
+    if (fh == NULL || fh->rgen == 0)
+        return next_write(next, path, buf, size, offset, fi);
+
+    if (size > RPC_MAX_PAYLOAD)
+        size = RPC_MAX_PAYLOAD;
+    struct rpc_req rq = {
+        .op = RPC_PWRITE, .a = { { fh->fd, offset } }, .data = buf, .dlen = size,
+    };
+    return remote_call(fh->rconn, &fh->rgen, &rq);
+}
+
+/* close는 응답을 기다리지 않음 (release의 결과는 어차피 쓰이지 않음) */
+static int remote_release(int next, const char *path, struct fuse_file_info *fi)
+{
+    struct basic_fh *fh = get_fh(fi);
+    if (fh == NULL || fh->rgen == 0)
+        return next_release(next, path, fi);
+
+    struct rpc_req rq = { .op = RPC_CLOSE, .flags = RPC_NOREPLY, .a = { { fh->fd } } };
+    remote_call(fh->rconn, &fh->rgen, &rq);
+    free(fh);
+    fi->fh = 0;
+    return 0;
+}
+
+static int remote_unlink(int next, const char *path)
+{
+    (void) next;
+    struct rpc_req rq = { .op = RPC_UNLINK, .path = path };
+    return remote_path_call(path, &rq);
+}
+
+static int remote_rename(int next, const char *from, const char *to, unsigned int flags)
+{
+    (void) next;
+    if (flags)
+        return -EINVAL;
+    struct rpc_req rq = { .op = RPC_RENAME, .path = from, .path2 = to };
+    return remote_path_call(from, &rq);
+}
+
+static int remote_mkdir(int next, const char *path, mode_t mode)
+{
+    (void) next;
+    struct rpc_req rq = { .op = RPC_MKDIR, .a = { { mode } }, .path = path };
+    return remote_path_call(path, &rq);
+}
+
+static int remote_rmdir(int next, const char *path)
+{
+    (void) next;
+    struct rpc_req rq = { .op = RPC_RMDIR, .path = path };
+    return remote_path_call(path, &rq);
+}
+
+static int remote_chmod(int next, const char *path, mode_t mode, struct fuse_file_info *fi)
+{
+    (void) next;
+    (void) fi;
+    struct rpc_req rq = { .op = RPC_CHMOD, .a = { { mode } }, .path = path };
+    return remote_path_call(path, &rq);
+}
+
+static int remote_truncate(int next, const char *path, off_t size, struct fuse_file_info *fi)
+{
+    struct basic_fh *fh = fi ? get_fh(fi) : NULL;
+
+    if (strcmp(path, STATS_PATH) == 0)
+        return next_truncate(next, path, size, fi);
+    if (fh && fh->rgen) {
+        struct rpc_req rq = { .op = RPC_FTRUNCATE, .a = { { fh->fd, size } } };
+        return remote_call(fh->rconn, &fh->rgen, &rq);
+    }
+    struct rpc_req rq = { .op = RPC_TRUNCATE, .a = { { size } }, .path = path };
+    return remote_path_call(path, &rq);
+}
+
+static int remote_utimens(int next, const char *path, const struct timespec ts[2],
+                          struct fuse_file_info *fi)
+{
+    (void) next;
+    (void) fi;
+    struct rpc_req rq = {
+        .op = RPC_UTIMENS, .path = path,
+        .a = { { ts[0].tv_sec, ts[0].tv_nsec, ts[1].tv_sec, ts[1].tv_nsec } },
+    };
+    return remote_path_call(path, &rq);
+}
+
+static int remote_fsync(int next, const char *path, int datasync, struct fuse_file_info *fi)
+{
+    struct basic_fh *fh = get_fh(fi);
+    if (fh == NULL || fh->rgen == 0)
+        return next_fsync(next, path, datasync, fi);
+
+    struct rpc_req rq = { .op = RPC_FSYNC, .a = { { fh->fd, datasync } } };
+    return remote_call(fh->rconn, &fh->rgen, &rq);
+}
+
+static int remote_opendir(int next, const char *path, struct fuse_file_info *fi)
+{
+    struct stat st;
+    int res = remote_getattr(next, path, &st, fi);
+    return res ? res : S_ISDIR(st.st_mode) ? 0 : -ENOTDIR;
+}
+
+static const struct basic_layer remote_layer = {
+    .name       = "remote",
+    .getattr    = remote_getattr,
+    .readdir    = remote_readdir,
+    .create     = remote_create,
+    .open       = remote_open,
+    .read       = remote_read,
+    .write      = remote_write,
+    .unlink     = remote_unlink,
+    .rename     = remote_rename,
+    .release    = remote_release,
+    .mkdir      = remote_mkdir,
+    .rmdir      = remote_rmdir,
+    .chmod      = remote_chmod,
+    .truncate   = remote_truncate,
+    .utimens    = remote_utimens,
+    .opendir    = remote_opendir,
+    .fsync      = remote_fsync,
+};
+
+static int remote_setup(const char *spec, unsigned int nconns)
+{
+    struct sockaddr_storage ss;
+    socklen_t len;
+    int err = rpc_addr(spec, &ss, &len);
+    if (err)
+        return err;
+    remote.conns = calloc(nconns, sizeof(*remote.conns));
+    if (remote.conns == NULL)
+        return -ENOMEM;
+    for (unsigned int i = 0; i < nconns; i++)
+        rpc_conn_init(&remote.conns[i], spec, &ss, len, &remote.reconnects);
+    remote.n = nconns;
+    return 0;
+}
+
+/*
+ * 기준 서버 (-o remote_serve=ADDR): 마운트하지 않고 ADDR에서 기다리며 자기
+ * DIR_PATH에 대한 요청을 처리한다. 연결마다 받는 스레드가 프레임을 읽어 공용
+ * worker(remote_threads개)에 넘기고, 응답은 worker가 끝나는 순서대로 같은
+ * 묶어 보내기로 돌려준다. fd는 연 연결만 쓸 수 있고 연결이 끊기면 닫는다.
+ */
+struct rs_conn {
+    struct rpc_link link;
+    unsigned int refs;              /* 받는 스레드 + 처리 중인 요청 (rs.lock) */
+    uint8_t *owned;                 /* 이 연결이 연 fd (link.lock) */
+    int owned_cap;
+};
+
+struct rs_work {
+    struct rs_work *next;
+    struct rs_conn *c;
+    struct rpc_hdr h;
+    char *p;
+};
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct rs_work *head, *tail;
+    int peer_only;              /* 데몬 안의 peer cache 서버: 블록 요청만 받음 */
+} rs = { .lock = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER };
+
+static void rs_unref(struct rs_conn *c)
+{
+    pthread_mutex_lock(&rs.lock);
+    int last = --c->refs == 0;
+    pthread_mutex_unlock(&rs.lock);
+    if (!last)
+        return;
+    for (int fd = 0; fd < c->owned_cap; fd++)
+        if (c->owned[fd])
+            close(fd);
+    close(c->link.fd);
+    free(c->owned);
+    free(c->link.q);
+    free(c->link.spare);
+    free(c);
+}
+
+static int rs_own(struct rs_conn *c, int fd, int set)
+{
+    int ok = 1;
+    pthread_mutex_lock(&c->link.lock);
+    if (set > 0 && fd >= c->owned_cap) {
+        int cap = c->owned_cap ? c->owned_cap : 64;
+        while (cap <= fd)
+            cap *= 2;
+        uint8_t *p = realloc(c->owned, cap);
+        if (p) {
+            memset(p + c->owned_cap, 0, cap - c->owned_cap);
+            c->owned = p;
+            c->owned_cap = cap;
+        }
+    }
+    if (fd < 0 || fd >= c->owned_cap)
+        ok = 0;
+    else if (set > 0)
+        c->owned[fd] = 1;
+    else if ((ok = c->owned[fd]) && set < 0)
+        c->owned[fd] = 0;
+    pthread_mutex_unlock(&c->link.lock);
+    return ok;
+}
+
+/* payload의 i번째 경로 (인자 뒤), 루트 밖으로 나가는 경로는 거부 */
+static const char *rs_arg(const struct rpc_hdr *h, const char *p, int i, int *err)
+{
+    size_t o = sizeof(struct rpc_args);
+    for (;;) {
+        *err = -EINVAL;
+        if (o >= h->len)
+            return NULL;
+        const char *s = p + o, *end = memchr(s, '\0', h->len - o);
+        if (end == NULL)
+            return NULL;
+        if (i-- == 0) {
+            *err = -EPERM;
+            if (s[0] != '/' || strstr(s, "/../") || (end - s >= 3 && strcmp(end - 3, "/..") == 0))
+                return NULL;
+            *err = 0;
+            return s;
+        }
+        o += end - s + 1;
+    }
+}
+
+static int rs_path(const struct rpc_hdr *h, const char *p, int i, char *out, size_t len)
+{
+    int err;
+    const char *s = rs_arg(h, p, i, &err);
+    if (s)
+        get_full_path(s, out, len);
+    return err;
+}
+
+static int32_t pcache_serve(const struct rpc_args *a, const char *path, char **out, size_t *olen);
+
+/* 요청 하나를 처리: 결과 또는 -errno, 응답 본문은 *out (malloc) */
+static int32_t rs_exec(struct rs_conn *c, const struct rpc_hdr *h, const char *p,
+                       char **out, size_t *olen, uint16_t *oflags)
+{
+    struct rpc_args a;
+    char fp[PATH_MAX], fp2[PATH_MAX];
+    struct stat st;
+    int err;
+
+    if (h->len < sizeof(a))
+        return -EINVAL;
+    memcpy(&a, p, sizeof(a));
+    int fd = a.v[0];
+
+    if (h->op == RPC_PEER_GET) {
+        const char *path = rs_arg(h, p, 0, &err);
+        return path && rs.peer_only ? pcache_serve(&a, path, out, olen) : err ? err : -ENOSYS;
+    }
+    if (rs.peer_only)
+        return -EPERM;
+
+    switch (h->op) {
+    case RPC_LSTAT:
+        if ((err = rs_path(h, p, 0, fp, sizeof(fp))) != 0)
+            return err;
+        if (lstat(fp, &st) == -1)
+            return -errno;
+        if ((*out = malloc(sizeof(struct rpc_stat))) == NULL)
+            return -ENOMEM;
+        rpc_stat_pack(&st, (struct rpc_stat *) *out);
+        *olen = sizeof(struct rpc_stat);
+        return 0;
+    case RPC_OPEN:
+        if ((err = rs_path(h, p, 0, fp, sizeof(fp))) != 0)
+            return err;
+        if ((fd = open(fp, (int) a.v[0] | O_CLOEXEC, (mode_t) a.v[1])) == -1)
+            return -errno;
+        if (!rs_own(c, fd, 1)) {
+            close(fd);
+            return -ENOMEM;
+        }
+        return fd;
+    case RPC_CLOSE:
+        return rs_own(c, fd, -1) ? (close(fd) == -1 ? -errno : 0) : -EBADF;
+    case RPC_PREAD: {
+        if (!rs_own(c, fd, 0))
+            return -EBADF;
+        if (a.v[2] < 0)
+            return -EINVAL;
+        size_t n = a.v[2] < RPC_MAX_PAYLOAD ? a.v[2] : RPC_MAX_PAYLOAD;
+        if ((*out = malloc(n ? n : 1)) == NULL)
+            return -ENOMEM;
+        ssize_t r = pread(fd, *out, n, a.v[1]);
+        if (r < 0)
+            return -errno;
+        *olen = r;
+        return r;
+    }
+    case RPC_PWRITE: {
+        if (!rs_own(c, fd, 0))
+            return -EBADF;
+        ssize_t w = pwrite(fd, p + sizeof(a), h->len - sizeof(a), a.v[1]);
+        return w < 0 ? -errno : w;
+    }
+    case RPC_FTRUNCATE:
+        if (!rs_own(c, fd, 0))
+            return -EBADF;
+        return ftruncate(fd, a.v[1]) == -1 ? -errno : 0;
+    case RPC_FSYNC:
+        if (!rs_own(c, fd, 0))
+            return -EBADF;
+        return (a.v[1] ? fdatasync(fd) : fsync(fd)) == -1 ? -errno : 0;
+    case RPC_READDIR: {
+        if ((err = rs_path(h, p, 0, fp, sizeof(fp))) != 0)
+            return err;
+        DIR *dp = opendir(fp);
+        if (dp == NULL)
+            return -errno;
+        char *buf = malloc(RPC_DIR_CHUNK);
+        size_t o = 0;
+        int64_t idx = 0;
+        int32_t cnt = 0;
+        struct dirent *de;
+        if (buf == NULL) {
+            closedir(dp);
+            return -ENOMEM;
+        }
+        while ((de = readdir(dp)) != NULL) {
+            if (idx++ < a.v[0])
+                continue;
+            uint16_t nl = strlen(de->d_name);
+            if (o + sizeof(struct rpc_stat) + sizeof(nl) + nl > RPC_DIR_CHUNK) {
+                *oflags |= RPC_MORE;
+                break;
+            }
+            if (snprintf(fp2, sizeof(fp2), "%s/%s", fp, de->d_name) >= (int) sizeof(fp2) ||
+                lstat(fp2, &st) == -1)
+                memset(&st, 0, sizeof(st));
+            struct rpc_stat rs;
+            rpc_stat_pack(&st, &rs);
+            memcpy(buf + o, &rs, sizeof(rs));
+            memcpy(buf + o + sizeof(rs), &nl, sizeof(nl));
+            memcpy(buf + o + sizeof(rs) + sizeof(nl), de->d_name, nl);
+            o += sizeof(rs) + sizeof(nl) + nl;
+            cnt++;
+        }
+        closedir(dp);
+        *out = buf;
+        *olen = o;
+        return cnt;
+    }
+    case RPC_UNLINK:
+    case RPC_RMDIR:
+    case RPC_MKDIR:
+    case RPC_CHMOD:
+    case RPC_TRUNCATE:
+    case RPC_UTIMENS:
+    case RPC_RENAME:
+        if ((err = rs_path(h, p, 0, fp, sizeof(fp))) != 0)
+            return err;
+        switch (h->op) {
+        case RPC_UNLINK:   err = unlink(fp); break;
+        case RPC_RMDIR:    err = rmdir(fp); break;
+        case RPC_MKDIR:    err = mkdir(fp, a.v[0]); break;
+        case RPC_CHMOD:    err = chmod(fp, a.v[0]); break;
+        case RPC_TRUNCATE: err = truncate(fp, a.v[0]); break;
+        case RPC_UTIMENS: {
+            struct timespec ts[2] = { { a.v[0], a.v[1] }, { a.v[2], a.v[3] } };
+            err = utimensat(AT_FDCWD, fp, ts, AT_SYMLINK_NOFOLLOW);
+            break;
+        }
+        default:
+            if ((err = rs_path(h, p, 1, fp2, sizeof(fp2))) != 0)
+                return err;
+            err = rename(fp, fp2);
+            break;
+        }
+        return err == -1 ? -errno : 0;
+    default:
+        return -ENOSYS;
+    }
+}
+
+static void *rs_worker(void *arg)
+{
+    (void) arg;
+    for (;;) {
+        pthread_mutex_lock(&rs.lock);
+        while (rs.head == NULL)
+            pthread_cond_wait(&rs.cond, &rs.lock);
+        struct rs_work *w = rs.head;
+        if ((rs.head = w->next) == NULL)
+            rs.tail = NULL;
+        pthread_mutex_unlock(&rs.lock);
+
+        char *out = NULL;
+        size_t olen = 0;
+        uint16_t oflags = 0;
+        int32_t res = rs_exec(w->c, &w->h, w->p, &out, &olen, &oflags);
+        if (!(w->h.flags & RPC_NOREPLY)) {
+            struct rpc_hdr r = { .len = olen, .id = w->h.id, .op = w->h.op, .flags = oflags, .res = res };
+            struct iovec iov[2] = { { &r, sizeof(r) }, { out, olen } };
+            pthread_mutex_lock(&w->c->link.lock);
+            rpc_send_locked(&w->c->link, iov, olen ? 2 : 1);
+            pthread_mutex_unlock(&w->c->link.lock);
+        }
+        free(out);
+        free(w->p);
+        rs_unref(w->c);
+        free(w);
+    }
+    return NULL;
+}
+
+static void *rs_reader(void *arg)
+{
+    struct rs_conn *c = arg;
+    struct rpc_hdr h;
+    struct rpc_args a;
+
+    /* 첫 프레임은 HELLO여야 함 */
+    if (rpc_recv(&c->link, &h, sizeof(h)) != 0 || h.op != RPC_HELLO || h.len != sizeof(a) ||
+        rpc_recv(&c->link, &a, sizeof(a)) != 0 || a.v[0] != RPC_MAGIC || a.v[1] != RPC_VERSION)
+        goto out;
+    struct rpc_hdr r = { .id = h.id, .op = RPC_HELLO };
+    struct iovec iov = { &r, sizeof(r) };
+    pthread_mutex_lock(&c->link.lock);
+    int err = rpc_send_locked(&c->link, &iov, 1);
+    pthread_mutex_unlock(&c->link.lock);
+    if (err)
+        goto out;
+
+    while (rpc_recv(&c->link, &h, sizeof(h)) == 0 && h.len <= RPC_MAX_PAYLOAD + 4096) {
+        struct rs_work *w = malloc(sizeof(*w));
+        char *p = malloc(h.len ? h.len : 1);
+        if (w == NULL || p == NULL || rpc_recv(&c->link, p, h.len) != 0) {
+            free(w);
+            free(p);
+            break;
+        }
+        *w = (struct rs_work) { NULL, c, h, p };
+        pthread_mutex_lock(&rs.lock);
+        c->refs++;
+        if (rs.tail)
+            rs.tail->next = w;
+        else
+            rs.head = w;
+        rs.tail = w;
+        pthread_cond_signal(&rs.cond);
+        pthread_mutex_unlock(&rs.lock);
+    }
+out:
+    pthread_mutex_lock(&c->link.lock);
+    c->link.broken = 1;
+    shutdown(c->link.fd, SHUT_RDWR);
+    pthread_cond_broadcast(&c->link.sent);
+    pthread_mutex_unlock(&c->link.lock);
+    rs_unref(c);
+    return NULL;
+}
+
+/* spec에서 기다리는 socket을 열고 worker를 띄움: listen fd 또는 -errno */
+static int rs_listen(const char *spec)
+{
+    struct sockaddr_storage ss;
+    socklen_t len;
+    int err = rpc_addr(spec, &ss, &len);
+    if (err)
+        return err;
+    int lfd = socket(ss.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0), one = 1;
+    if (ss.ss_family == AF_UNIX)
+        unlink(((struct sockaddr_un *) &ss)->sun_path);
+    else if (lfd >= 0)
+        setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (lfd == -1 || bind(lfd, (struct sockaddr *) &ss, len) == -1 || listen(lfd, 64) == -1) {
+        err = -errno;
+        if (lfd >= 0)
+            close(lfd);
+        return err;
+    }
+
+    unsigned int nthreads = options.remote_threads ? options.remote_threads : 8;
+    for (unsigned int i = 0; i < nthreads; i++) {
+        pthread_t t;
+        if (pthread_create(&t, NULL, rs_worker, NULL) == 0)
+            pthread_detach(t);
+    }
+    return lfd;
+}
+
+/* 연결마다 받는 스레드를 붙임, accept가 실패하면 돌아옴 */
+static void *rs_accept_main(void *arg)
+{
+    int lfd = (int) (intptr_t) arg;
+
+    for (;;) {
+        int fd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd == -1) {
+            if (errno == EINTR || errno == ECONNABORTED || errno == EMFILE)
+                continue;
+            fprintf(stderr, "[WARN] accept: %s\n", strerror(errno));
+            return NULL;
+        }
+        rpc_sock_opts(fd);
+        struct rs_conn *c = calloc(1, sizeof(*c));
+        pthread_t t;
+        if (c == NULL) {
+            close(fd);
+            continue;
+        }
+        rpc_link_init(&c->link, fd);
+        c->refs = 1;
+        if (pthread_create(&t, NULL, rs_reader, c) != 0) {
+            close(fd);
+            free(c);
+            continue;
+        }
+        pthread_detach(t);
+    }
+}
+
+static int remote_serve(const char *spec)
+{
+    int lfd = rs_listen(spec);
+    if (lfd < 0) {
+        fprintf(stderr, "remote_serve: %s: %s\n", spec, strerror(-lfd));
+        return -1;
+    }
+    printf("[INFO] serving %s on %s (%u workers)\n", DIR_PATH, spec,
+           options.remote_threads ? options.remote_threads : 8);
+    fflush(stdout);
+    rs_accept_main((void *) (intptr_t) lfd);
+    return -1;
+}
+
+/*
+ * cache coherence (-o coherence=ADDR,coherence_peers=ADDR+ADDR): 같은 백엔드를 쓰는
+ * 데몬끼리 바뀐 경로를 알려 서로의 인라인 캐시, 목록 캐시, 커널 캐시를 비운다.
+ * 주소 형식은 remote와 같고, 각 데몬의 coherence 주소가 그 데몬의 이름이다.
+ *
+ * 피어마다 연결이 두 개다. 우리가 맺은 연결로 lease 요청과 무효화를 보내고 ack를
+ * 받으며, 피어가 맺은 연결에서는 그 반대로 답한다. 피어 p가 lease 요청에 답하면
+ * 요청을 보낸 시각 + coherence_lease_ms까지 p의 변경은 모두 통보된다고 믿는다.
+ * 모든 피어의 lease가 살아 있으면 캐시 항목을 coherence_ttl_ms 동안 다시 확인하지
+ * 않고, 하나라도 끊기면 inline_ttl_ms로 돌아간다. 끊겼다 이어지면 epoch가 늘어
+ * 그 전에 확인한 항목은 (놓친 무효화가 있을 수 있으니) 한 번씩 다시 확인한다.
+ *
+ * 변경한 쪽은 무효화를 보내고 각 피어가 ack하거나 그 피어에게 준 lease가 끝날
+ * 때까지 기다린다. 우리가 맺은 연결이 끊긴 피어, 또는 lease/2 넘게 ack하지 않은
+ * 무효화가 있는 피어에게는 lease를 새로 주지 않으므로 기다림에는 끝이 있다.
+ * 연결이 끊기면 그때 준 lease가 끝날 때까지 다시 주지 않아 피어가 끊김을 알게 한다.
+ * 핸들로 쓰는 파일은 첫 write 전에 알리고 close까지 피어가 캐시하지 않는다.
+ */
+#define COH_PEERS_MAX 16
+#define COH_WINDOW 1024             /* 피어당 ack를 기다리는 무효화 수 */
+
+enum { COH_HELLO = 1, COH_LEASE, COH_INVAL };
+
+struct coh_peer {
+    char addr[256];
+    struct sockaddr_storage ss;
+    socklen_t sslen;
+    struct rpc_link link;       /* 우리가 맺은 연결 (받기는 coh_peer_main만) */
+    pthread_cond_t acked;       /* acked_seq가 늘었거나 연결이 바뀜 */
+    uint32_t seq, acked_seq;    /* 보낸/ack받은 마지막 무효화 */
+    uint32_t lost_seq;          /* 연결이 끊길 때 ack를 못 받은 것까지 (이하는 lease로) */
+    uint64_t sent_ns[COH_WINDOW];   /* 무효화별 보낸 시각 (seq % COH_WINDOW) */
+    uint32_t hb_seq;
+    uint64_t hb_sent;
+    uint64_t lease_until;       /* 이 피어의 변경이 통보된다고 믿는 시각 */
+    uint64_t granted_until;     /* 이 피어가 우리 변경이 통보된다고 믿을 수 있는 시각 */
+    uint64_t blackout_until;    /* 연결이 끊겼음: 이때까지 lease를 주지 않음 */
+    pthread_t thread;
+};
+
+/* now_ns 기준 deadline까지 cond에서 기다림 (lock을 잡고) */
+static void coh_wait_until(pthread_cond_t *cond, pthread_mutex_t *lock, uint64_t deadline)
+{
+    uint64_t now = now_ns();
+    if (deadline <= now)
+        return;
+    uint64_t wait = deadline - now;
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    wait += ts.tv_nsec;
+    ts.tv_sec += wait / 1000000000ull;
+    ts.tv_nsec = wait % 1000000000ull;
+    pthread_cond_timedwait(cond, lock, &ts);
+}
+
+/* icache.trust_until = 모든 피어 lease 중 가장 이른 끝 */
+static void coh_trust_update(void)
+{
+    uint64_t until = UINT64_MAX;
+    for (unsigned int i = 0; i < coh.n; i++) {
+        uint64_t u = __atomic_load_n(&coh.peer[i].lease_until, __ATOMIC_ACQUIRE);
+        if (u < until)
+            until = u;
+    }
+    __atomic_store_n(&icache.trust_until, until, __ATOMIC_RELEASE);
+}
+
+/* 피어에게 lease를 줄 수 있는지 (p->link.lock을 잡고) */
+static int coh_may_grant(const struct coh_peer *p, uint64_t now)
+{
+    uint64_t lease = (uint64_t) options.coherence_lease_ms * 1000000;
+    if (p->link.fd < 0 || p->link.broken || now < p->blackout_until)
+        return 0;
+    /* 오래 ack되지 않은 무효화가 있으면 그 피어는 이미 놓쳤을 수 있음 */
+    return p->acked_seq == p->seq ||
+           now - p->sent_ns[(p->acked_seq + 1) % COH_WINDOW] < lease / 2;
+}
+
+/*
+ * 변경된 path를 모든 피어에 알리고, 피어마다 ack 또는 그 피어의 lease 끝을 기다림.
+ * 아래 layer의 결과와 무관하게 항상 돌아온다.
+ */
+static void coh_publish(const char *path, unsigned int flags)
+{
+    uint32_t want[COH_PEERS_MAX];
+    size_t plen = strlen(path) + 1;
+
+    if (coh.n == 0 || strcmp(path, STATS_PATH) == 0)
+        return;
+    __atomic_fetch_add(&coh.published, 1, __ATOMIC_RELAXED);
+    uint64_t t0 = now_ns();
+
+    for (unsigned int i = 0; i < coh.n; i++) {
+        struct coh_peer *p = &coh.peer[i];
+        struct rpc_hdr h = { .len = plen, .op = COH_INVAL, .flags = flags };
+        struct iovec iov[2] = { { &h, sizeof(h) }, { (void *) path, plen } };
+
+        pthread_mutex_lock(&p->link.lock);
+        while (p->link.fd >= 0 && !p->link.broken && p->seq - p->acked_seq >= COH_WINDOW - 1)
+            coh_wait_until(&p->acked, &p->link.lock, now_ns() + 100000000);
+        want[i] = 0;
+        if (p->link.fd >= 0 && !p->link.broken) {
+            h.id = p->seq + 1;
+            p->sent_ns[h.id % COH_WINDOW] = now_ns();
+            p->seq++;
+            if (rpc_send_locked(&p->link, iov, 2) == 0)
+                want[i] = h.id;
+        }
+        pthread_mutex_unlock(&p->link.lock);
+    }
+
+    for (unsigned int i = 0; i < coh.n; i++) {
+        struct coh_peer *p = &coh.peer[i];
+        int expired = 0;
+
+        pthread_mutex_lock(&p->link.lock);
+        for (;;) {
+            if (want[i] && (int32_t) (want[i] - p->lost_seq) > 0 &&
+                (int32_t) (p->acked_seq - want[i]) >= 0)
+                break;
+            /* 보내지 못했거나 끊겼으면 lease만 기다림 (끊긴 연결은 새로 주지 않음) */
+            uint64_t until = p->granted_until > p->blackout_until ?
+                             p->granted_until : p->blackout_until;
+            if (now_ns() >= until) {
+                expired = 1;
+                break;
+            }
+            coh_wait_until(&p->acked, &p->link.lock, until);
+        }
+        /* 답하지 않는 피어와는 연결을 끊어 lease가 끊겼음을 알게 함 */
+        if (expired && want[i] && p->link.fd >= 0) {
+            p->link.broken = 1;
+            shutdown(p->link.fd, SHUT_RDWR);
+        }
+        pthread_mutex_unlock(&p->link.lock);
+        if (expired)
+            __atomic_fetch_add(&coh.timeouts, 1, __ATOMIC_RELAXED);
+    }
+    __atomic_fetch_add(&coh.wait_ns, now_ns() - t0, __ATOMIC_RELAXED);
+}
+
+/* 피어의 무효화를 적용 (pins: 이 연결로 받은 pin, 끊기면 풂) */
+struct coh_pinned {
+    struct coh_pinned *next;
+    char path[];
+};
+
+static void coh_apply(const char *path, unsigned int flags, struct coh_pinned **pins)
+{
+    __atomic_fetch_add(&icache.gen, 1, __ATOMIC_ACQ_REL);
+    if (flags & COH_PIN) {
+        struct coh_pinned *pn = malloc(sizeof(*pn) + strlen(path) + 1);
+        if (pn) {
+            strcpy(pn->path, path);
+            pn->next = *pins;
+            *pins = pn;
+            inline_pin(path, 1);
+        }
+    }
+    if (flags & COH_UNPIN) {
+        for (struct coh_pinned **pp = pins; *pp; pp = &(*pp)->next) {
+            if (strcmp((*pp)->path, path) == 0) {
+                struct coh_pinned *pn = *pp;
+                *pp = pn->next;
+                free(pn);
+                inline_pin(path, -1);
+                break;
+            }
+        }
+    }
+    inline_invalidate(path, flags & COH_SUBTREE);
+    inval_queue(path);
+    dir_changed(path);
+    __atomic_fetch_add(&coh.received, 1, __ATOMIC_RELAXED);
+}
+
+/* 피어가 맺은 연결: lease 요청과 무효화에 답함 */
+static void *coh_conn_main(void *arg)
+{
+    struct rpc_link *l = arg;
+    struct coh_peer *p = NULL;
+    struct coh_pinned *pins = NULL;
+    char path[PATH_MAX];
+    struct rpc_hdr h;
+    uint64_t lease = (uint64_t) options.coherence_lease_ms * 1000000;
+
+    if (rpc_recv(l, &h, sizeof(h)) == 0 && h.op == COH_HELLO && h.len > 0 &&
+        h.len <= sizeof(path) && rpc_recv(l, path, h.len) == 0) {
+        path[h.len - 1] = '\0';
+        for (unsigned int i = 0; i < coh.n && p == NULL; i++)
+            if (strcmp(coh.peer[i].addr, path) == 0)
+                p = &coh.peer[i];
+        if (p == NULL)
+            fprintf(stderr, "[WARN] coherence: %s is not in coherence_peers\n", path);
+    }
+
+    while (p && rpc_recv(l, &h, sizeof(h)) == 0 && h.len <= sizeof(path)) {
+        if (h.len && rpc_recv(l, path, h.len) != 0)
+            break;
+        int reply = 1;
+        if (h.op == COH_INVAL && h.len > 0) {
+            path[h.len - 1] = '\0';
+            coh_apply(path, h.flags, &pins);
+        } else if (h.op == COH_LEASE) {
+            /* lease는 답하기 전에 기록 (피어는 요청을 보낸 시각부터 셈) */
+            uint64_t now = now_ns();
+            pthread_mutex_lock(&p->link.lock);
+            if ((reply = coh_may_grant(p, now)) && now + lease > p->granted_until)
+                p->granted_until = now + lease;
+            pthread_mutex_unlock(&p->link.lock);
+        } else {
+            break;
+        }
+        if (reply) {
+            struct rpc_hdr r = { .id = h.id, .op = h.op };
+            struct iovec iov = { &r, sizeof(r) };
+            pthread_mutex_lock(&l->lock);
+            int err = rpc_send_locked(l, &iov, 1);
+            pthread_mutex_unlock(&l->lock);
+            if (err)
+                break;
+        }
+    }
+
+    while (pins) {
+        struct coh_pinned *pn = pins;
+        pins = pn->next;
+        inline_pin(pn->path, -1);
+        free(pn);
+    }
+    close(l->fd);
+    free(l->q);
+    free(l->spare);
+    free(l);
+    return NULL;
+}
+
+static void *coh_listen_main(void *arg)
+{
+    (void) arg;
+    while (!coh.stop) {
+        int fd = accept4(coh.lfd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd == -1) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            break;
+        }
+        rpc_sock_opts(fd);
+        struct rpc_link *l = calloc(1, sizeof(*l));
+        pthread_t t;
+        if (l == NULL) {
+            close(fd);
+            continue;
+        }
+        rpc_link_init(l, fd);
+        if (pthread_create(&t, NULL, coh_conn_main, l) != 0) {
+            close(fd);
+            free(l);
+            continue;
+        }
+        pthread_detach(t);
+    }
+    return NULL;
+}
+
+/* 우리가 맺은 연결의 ack 하나 처리 */
+static void coh_peer_ack(struct coh_peer *p, const struct rpc_hdr *h)
+{
+    uint64_t now = now_ns();
+
+    pthread_mutex_lock(&p->link.lock);
+    if (h->op == COH_INVAL) {
+        p->acked_seq = h->id;
+        pthread_cond_broadcast(&p->acked);
+    } else if (h->op == COH_LEASE && h->id == p->hb_seq) {
+        /* 끊겼다 이어짐: 그 사이의 무효화를 놓쳤을 수 있음 */
+        if (p->lease_until < now) {
+            __atomic_fetch_add(&icache.epoch, 1, __ATOMIC_ACQ_REL);
+            __atomic_fetch_add(&coh.lapses, 1, __ATOMIC_RELAXED);
+        }
+        __atomic_store_n(&p->lease_until, p->hb_sent + (uint64_t) options.coherence_lease_ms * 1000000,
+                         __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&p->link.lock);
+    coh_trust_update();
+}
+
+/* 피어마다: 연결을 유지하며 lease를 lease/3마다 갱신하고 ack를 받음 */
+static void *coh_peer_main(void *arg)
+{
+    struct coh_peer *p = arg;
+    uint64_t lease = (uint64_t) options.coherence_lease_ms * 1000000;
+    size_t alen = strlen(options.coherence) + 1;
+
+    while (!coh.stop) {
+        int fd = socket(p->ss.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd != -1 && connect(fd, (struct sockaddr *) &p->ss, p->sslen) == -1) {
+            close(fd);
+            fd = -1;
+        }
+        if (fd == -1) {
+            pthread_mutex_lock(&p->link.lock);
+            coh_wait_until(&p->acked, &p->link.lock, now_ns() + lease / 4);
+            pthread_mutex_unlock(&p->link.lock);
+            continue;
+        }
+        rpc_sock_opts(fd);
+
+        struct rpc_hdr h = { .len = alen, .op = COH_HELLO };
+        struct iovec iov[2] = { { &h, sizeof(h) }, { (void *) options.coherence, alen } };
+        pthread_mutex_lock(&p->link.lock);
+        p->link.fd = fd;
+        p->link.broken = 0;
+        p->link.rpos = p->link.rlen = 0;
+        int err = rpc_send_locked(&p->link, iov, 2);
+        pthread_mutex_unlock(&p->link.lock);
+        __atomic_fetch_add(&coh.up, 1, __ATOMIC_RELAXED);
+
+        uint64_t last_hb = 0;
+        while (err == 0 && !coh.stop) {
+            uint64_t now = now_ns();
+            if (now - last_hb >= lease / 3) {
+                struct rpc_hdr hb = { .op = COH_LEASE };
+                struct iovec v = { &hb, sizeof(hb) };
+                pthread_mutex_lock(&p->link.lock);
+                hb.id = ++p->hb_seq;
+                p->hb_sent = now;
+                err = rpc_send_locked(&p->link, &v, 1);
+                pthread_mutex_unlock(&p->link.lock);
+                last_hb = now;
+                if (err)
+                    break;
+            }
+            if (p->link.rpos == p->link.rlen) {
+                struct pollfd pfd = { .fd = fd, .events = POLLIN };
+                int timeout = (int) ((last_hb + lease / 3 - now) / 1000000) + 1;
+                int r = poll(&pfd, 1, timeout);
+                if (r < 0 && errno != EINTR)
+                    err = -errno;
+                if (r <= 0)
+                    continue;
+            }
+            struct rpc_hdr a;
+            if ((err = rpc_recv(&p->link, &a, sizeof(a))) != 0 || a.len != 0)
+                break;
+            coh_peer_ack(p, &a);
+        }
+
+        /* 그때까지 준 lease가 끝나기 전에는 다시 주지 않음 */
+        pthread_mutex_lock(&p->link.lock);
+        p->link.broken = 1;
+        shutdown(fd, SHUT_RDWR);
+        p->link.nq = p->link.qframes = 0;
+        pthread_cond_broadcast(&p->link.sent);
+        while (p->link.sending || p->link.waiters)
+            pthread_cond_wait(&p->link.sent, &p->link.lock);
+        if (p->granted_until > p->blackout_until)
+            p->blackout_until = p->granted_until;
+        p->lost_seq = p->acked_seq = p->seq;
+        close(fd);
+        p->link.fd = -1;
+        pthread_cond_broadcast(&p->acked);
+        pthread_mutex_unlock(&p->link.lock);
+        __atomic_fetch_sub(&coh.up, 1, __ATOMIC_RELAXED);
+        if (!coh.stop)
+            fprintf(stderr, "[WARN] coherence: lost connection to %s\n", p->addr);
+    }
+    return NULL;
+}
+
+/* 주소 확인 (layers_setup에서), 스레드는 coh_start에서 */
+static int coh_setup(void)
+{
+    char *list = strdup(options.coherence_peers), *save = NULL;
+    int err = 0;
+
+    if (list == NULL)
+        return -ENOMEM;
+    coh.peer = calloc(COH_PEERS_MAX, sizeof(*coh.peer));
+    if (coh.peer == NULL) {
+        free(list);
+        return -ENOMEM;
+    }
+    for (char *a = strtok_r(list, "+", &save); a && err == 0; a = strtok_r(NULL, "+", &save)) {
+        struct coh_peer *p = &coh.peer[coh.n];
+        if (coh.n == COH_PEERS_MAX || strlen(a) >= sizeof(p->addr))
+            err = -E2BIG;
+        else if ((err = rpc_addr(a, &p->ss, &p->sslen)) == 0) {
+            strcpy(p->addr, a);
+            rpc_link_init(&p->link, -1);
+            pthread_cond_init(&p->acked, NULL);
+            coh.n++;
+        }
+    }
+    free(list);
+    if (err == 0 && coh.n == 0)
+        err = -EINVAL;
+    if (err) {
+        free(coh.peer);
+        coh.peer = NULL;
+        coh.n = 0;
+    }
+    return err;
+}
+
+static int coh_start(void)
+{
+    struct sockaddr_storage ss;
+    socklen_t len;
+    int one = 1, err = rpc_addr(options.coherence, &ss, &len);
+
+    if (err)
+        return err;
+    coh.lfd = socket(ss.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (coh.lfd == -1)
+        return -errno;
+    if (ss.ss_family == AF_UNIX)
+        unlink(((struct sockaddr_un *) &ss)->sun_path);
+    else
+        setsockopt(coh.lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(coh.lfd, (struct sockaddr *) &ss, len) == -1 || listen(coh.lfd, 16) == -1 ||
+        pthread_create(&coh.listener, NULL, coh_listen_main, NULL) != 0) {
+        err = -errno;
+        close(coh.lfd);
+        coh.lfd = -1;
+        return err;
+    }
+    for (unsigned int i = 0; i < coh.n; i++)
+        pthread_create(&coh.peer[i].thread, NULL, coh_peer_main, &coh.peer[i]);
+    return 0;
+}
+
+static void coh_stop(void)
+{
+    if (coh.lfd < 0)
+        return;
+    coh.stop = 1;
+    shutdown(coh.lfd, SHUT_RDWR);
+    pthread_join(coh.listener, NULL);
+    for (unsigned int i = 0; i < coh.n; i++) {
+        struct coh_peer *p = &coh.peer[i];
+        pthread_mutex_lock(&p->link.lock);
+        if (p->link.fd >= 0)
+            shutdown(p->link.fd, SHUT_RDWR);
+        pthread_cond_broadcast(&p->acked);
+        pthread_mutex_unlock(&p->link.lock);
+        pthread_join(p->thread, NULL);
+    }
+    close(coh.lfd);
+    coh.lfd = -1;
+}
+
+/*
+ * peer cache (-o peer_cache=ADDR,peer_cache_peers=ADDR+ADDR): 같은 백엔드를 읽는
+ * 데몬들이 읽은 블록(peer_cache_block 단위)을 메모리에 두고 서로 나눠 쓴다.
+ * 블록마다 주인을 consistent hashing(노드마다 가상 노드 PCACHE_VNODES개)으로 정해,
+ * 주인이 아닌 데몬은 자기 캐시에 없으면 주인에게 묻고, 주인은 자기 캐시나 아래
+ * layer에서 읽어 준다. 같은 블록을 여럿이 동시에 물어도 아래 layer read는 한 번이라
+ * N개 노드가 같은 데이터를 읽어도 공유 저장소에서는 대략 한 번만 읽힌다.
+ *
+ * 읽기 전용 핸들만 쓰며, 블록은 open 때 아래 layer에서 얻은 크기와 mtime으로
+ * 확인한다 (파일이 바뀌면 주인도 다시 읽고, 주인 쪽 파일이 요청과 다르면 -ESTALE
+ * 이라 직접 읽음). 즉 close-to-open 일관성. 주인이 응답하지 않으면
+ * peer_cache_retry_ms 동안 그 주인 몫은 직접 읽는다. 멤버 목록은 모든 노드가 같아야
+ * 하고 (순서는 무관) 각 노드의 peer_cache 주소가 그 노드의 이름이다.
+ */
+#define PCACHE_VNODES 64
+
+struct pblock {
+    struct pblock *hnext;
+    struct pblock *prev, *next;     /* LRU (head가 최근) */
+    char *path;
+    off_t off;                  /* 블록 시작 */
+    off_t fsize;                /* 검증값: 채울 때의 파일 크기와 mtime */
+    struct timespec mtime;
+    unsigned int refs;          /* 표 1 + 쓰는 중인 스레드 */
+    int state;                  /* 0 채우는 중, 1 사용 가능 */
+    int linked;
+    size_t len;                 /* 유효한 바이트 (파일 끝 블록은 짧음) */
+    char data[];
+};
+
+struct pcache_ring {
+    uint32_t point;
+    int node;                   /* -1이면 이 노드, 아니면 pcache.peer 번호 */
+};
+
+struct pcache_peer {
+    char addr[256];
+    struct remote_conn conn;
+    uint64_t down_until;        /* 응답하지 않음: 이때까지 그 주인 몫은 직접 읽음 */
+};
+
+static uint32_t pcache_mix(uint32_t h)
+{
+    h ^= h >> 16;               /* murmur3 finalizer */
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h;
+}
+
+static unsigned int pcache_bucket(const char *path, off_t off)
+{
+    return pcache_mix(path_hash(path) ^ (uint32_t) (off / options.peer_cache_block) * 0x9e3779b1u) %
+           PCACHE_BUCKETS;
+}
+
+/* 블록 주인: ring에서 키 이상인 첫 점 (없으면 처음으로) */
+static int pcache_owner(const char *path, off_t off)
+{
+    uint32_t key = pcache_mix(path_hash(path) ^ pcache_mix((uint32_t) (off / options.peer_cache_block)));
+    unsigned int lo = 0, hi = pcache.nring;
+    while (lo < hi) {
+        unsigned int mid = (lo + hi) / 2;
+        if (pcache.ring[mid].point < key)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return pcache.ring[lo == pcache.nring ? 0 : lo].node;
+}
+
+static void pcache_free(struct pblock *b)
+{
+    free(b->path);
+    free(b);
+}
+
+static void pcache_put(struct pblock *b)
+{
+    pthread_mutex_lock(&pcache.lock);
+    int last = --b->refs == 0;
+    pthread_mutex_unlock(&pcache.lock);
+    if (last)
+        pcache_free(b);
+}
+
+/* pcache.lock 보유 상태에서 호출 */
+static void pcache_unlink_locked(struct pblock *b)
+{
+    struct pblock **pp = &pcache.table[pcache_bucket(b->path, b->off)];
+    while (*pp != b)
+        pp = &(*pp)->hnext;
+    *pp = b->hnext;
+    if (b->prev)
+        b->prev->next = b->next;
+    else
+        pcache.head = b->next;
+    if (b->next)
+        b->next->prev = b->prev;
+    else
+        pcache.tail = b->prev;
+    pcache.bytes -= options.peer_cache_block;
+    pcache.blocks--;
+    b->linked = 0;
+    if (--b->refs == 0)
+        pcache_free(b);
+}
+
+/*
+ * (path, off) 블록을 참조를 잡아 반환. 검증값이 맞는 블록이 있으면 *fill = 0,
+ * 없으면 빈 블록을 표에 넣고 *fill = 1 (호출한 쪽이 채우고 pcache_done).
+ * 다른 스레드가 채우는 중이면 끝날 때까지 기다림.
+ */
+static struct pblock *pcache_acquire(const char *path, off_t off, off_t fsize,
+                                     const struct timespec *mtime, int *fill)
+{
+    unsigned int bk = pcache_bucket(path, off);
+    struct pblock *b;
+
+    pthread_mutex_lock(&pcache.lock);
+    for (;;) {
+        for (b = pcache.table[bk]; b; b = b->hnext)
+            if (b->off == off && strcmp(b->path, path) == 0)
+                break;
+        if (b == NULL)
+            break;
+        if (b->fsize != fsize || !ts_equal(&b->mtime, mtime)) {
+            /* 파일이 바뀜: 채우는 중이면 기다렸다가 버림 */
+            if (b->state == 0) {
+                pthread_cond_wait(&pcache.cond, &pcache.lock);
+                continue;
+            }
+            pcache_unlink_locked(b);
+            break;
+        }
+        if (b->state == 0) {
+            pthread_cond_wait(&pcache.cond, &pcache.lock);
+            continue;
+        }
+        b->refs++;
+        if (pcache.head != b) {
+            b->prev->next = b->next;
+            if (b->next)
+                b->next->prev = b->prev;
+            else
+                pcache.tail = b->prev;
+            b->prev = NULL;
+            b->next = pcache.head;
+            pcache.head->prev = b;
+            pcache.head = b;
+        }
+        pthread_mutex_unlock(&pcache.lock);
+        *fill = 0;
+        return b;
+    }
+
+    b = calloc(1, sizeof(*b) + options.peer_cache_block);
+    if (b == NULL || (b->path = strdup(path)) == NULL) {
+        pthread_mutex_unlock(&pcache.lock);
+        free(b);
+        return NULL;
+    }
+    b->off = off;
+    b->fsize = fsize;
+    b->mtime = *mtime;
+    b->refs = 2;
+    b->linked = 1;
+    b->hnext = pcache.table[bk];
+    pcache.table[bk] = b;
+    b->next = pcache.head;
+    if (pcache.head)
+        pcache.head->prev = b;
+    pcache.head = b;
+    if (pcache.tail == NULL)
+        pcache.tail = b;
+    pcache.bytes += options.peer_cache_block;
+    pcache.blocks++;
+    pthread_mutex_unlock(&pcache.lock);
+    *fill = 1;
+    return b;
+}
+
+/* 채우기 끝: len < 0이면 실패 (표에서 뺌). 예산을 넘으면 오래된 블록부터 버림 */
+static void pcache_done(struct pblock *b, ssize_t len)
+{
+    pthread_mutex_lock(&pcache.lock);
+    b->state = 1;
+    b->len = len > 0 ? len : 0;
+    if (len < 0 && b->linked)
+        pcache_unlink_locked(b);
+    struct pblock *t = pcache.tail;
+    while (pcache.bytes > options.peer_cache_budget && t) {
+        struct pblock *prev = t->prev;
+        if (t->state == 1 && t != b) {
+            pcache_unlink_locked(t);
+            pcache.evictions++;
+        }
+        t = prev;
+    }
+    pthread_cond_broadcast(&pcache.cond);
+    pthread_mutex_unlock(&pcache.lock);
+}
+
+/* 아래 layer에서 블록 하나를 읽음 (파일 끝이면 짧게) */
+static ssize_t pcache_load(int next, const char *path, off_t off, struct fuse_file_info *fi,
+                           char *data)
+{
+    size_t got = 0;
+    __atomic_fetch_add(&pcache.loads, 1, __ATOMIC_RELAXED);
+    while (got < options.peer_cache_block) {
+        int r = next_read(next, path, data + got, options.peer_cache_block - got, off + got, fi);
+        if (r < 0)
+            return r;
+        if (r == 0)
+            break;
+        got += r;
+    }
+    return got;
+}
+
+/* 주인에게 블록을 받아 옴: 길이 또는 -errno */
+static ssize_t pcache_fetch(struct pcache_peer *p, const char *path, off_t off, off_t fsize,
+                            const struct timespec *mtime, char *data)
+{
+    unsigned int gen = 0;
+    struct rpc_req rq = {
+        .op = RPC_PEER_GET, .path = path, .out = data, .outcap = options.peer_cache_block,
+        .a = { { off, fsize, mtime->tv_sec, mtime->tv_nsec } },
+    };
+    int res = rpc_call(&p->conn, &gen, &rq);
+    if (res >= 0 && (size_t) res != rq.outlen)
+        res = -EPROTO;
+    if (res >= 0)
+        __atomic_fetch_add(&pcache.peer_hits, 1, __ATOMIC_RELAXED);
+    else if (res == -ESTALE)
+        __atomic_fetch_add(&pcache.stale, 1, __ATOMIC_RELAXED);
+    else if (res != -ENOENT) {
+        /* 죽었거나 느린 주인: 잠시 그 몫은 직접 */
+        p->down_until = now_ns() + (uint64_t) options.peer_cache_retry_ms * 1000000;
+        __atomic_fetch_add(&pcache.peer_errors, 1, __ATOMIC_RELAXED);
+    }
+    return res;
+}
+
+/* 주인으로서 다른 노드의 요청에 답함 (remote 서버 worker에서) */
+static int32_t pcache_serve(const struct rpc_args *a, const char *path, char **out, size_t *olen)
+{
+    off_t off = a->v[0], fsize = a->v[1];
+    struct timespec mtime = { a->v[2], a->v[3] };
+    int fill;
+
+    if (off < 0 || off % options.peer_cache_block)
+        return -EINVAL;
+    __atomic_fetch_add(&pcache.served, 1, __ATOMIC_RELAXED);
+    struct pblock *b = pcache_acquire(path, off, fsize, &mtime, &fill);
+    if (b == NULL)
+        return -ENOMEM;
+    if (fill) {
+        struct fuse_file_info fi = { .flags = O_RDONLY };
+        struct stat st;
+        ssize_t res = next_open(pcache.next, path, &fi);
+        if (res == 0) {
+            res = next_getattr(pcache.next, path, &st, &fi);
+            /* 요청한 쪽이 본 파일과 다르면 섞지 않음 */
+            if (res == 0 && (st.st_size != fsize || !ts_equal(&st.st_mtim, &mtime)))
+                res = -ESTALE;
+            if (res == 0)
+                res = pcache_load(pcache.next, path, off, &fi, b->data);
+            next_release(pcache.next, path, &fi);
+        }
+        pcache_done(b, res);
+        if (res < 0) {
+            pcache_put(b);
+            return res;
+        }
+    } else {
+        __atomic_fetch_add(&pcache.hits, 1, __ATOMIC_RELAXED);
+    }
+    int32_t len = b->len;
+    *out = malloc(len ? len : 1);
+    if (*out)
+        memcpy(*out, b->data, len);
+    pcache_put(b);
+    if (*out == NULL)
+        return -ENOMEM;
+    *olen = len;
+    return len;
+}
+
+/* 읽기 핸들의 블록: 내 캐시 → 주인 → 아래 layer 순서. NULL이면 직접 읽을 것 */
+static struct pblock *pcache_get(int next, const char *path, off_t off,
+                                 const struct basic_fh *fh, struct fuse_file_info *fi)
+{
+    int fill;
+    struct pblock *b = pcache_acquire(path, off, fh->pc_size, &fh->pc_mtime, &fill);
+    if (b == NULL || !fill) {
+        if (b)
+            __atomic_fetch_add(&pcache.hits, 1, __ATOMIC_RELAXED);
+        return b;
+    }
+
+    ssize_t res = -EAGAIN;
+    int owner = pcache_owner(path, off);
+    if (owner >= 0 && now_ns() >= pcache.peer[owner].down_until)
+        res = pcache_fetch(&pcache.peer[owner], path, off, fh->pc_size, &fh->pc_mtime, b->data);
+    if (res < 0)
+        res = pcache_load(next, path, off, fi, b->data);
+    pcache_done(b, res);
+    if (res < 0) {
+        pcache_put(b);
+        return NULL;
+    }
+    return b;
+}
+
+static int peer_open(int next, const char *path, struct fuse_file_info *fi)
+{
+    int res = next_open(next, path, fi);
+    struct basic_fh *fh = res == 0 ? get_fh(fi) : NULL;
+    struct stat st;
+
+    /* 읽기 전용 핸들만, 연 시점의 크기와 mtime이 블록 검증값 */
+    if (fh && (fi->flags & O_ACCMODE) == O_RDONLY && strcmp(path, STATS_PATH) != 0 &&
+        next_getattr(next, path, &st, fi) == 0 && S_ISREG(st.st_mode)) {
+        fh->pc_size = st.st_size;
+        fh->pc_mtime = st.st_mtim;
+        fh->pc_ok = 1;
+    }
+    return res;
+}
+
+static int peer_read(int next, const char *path, char *buf, size_t size, off_t offset,
+                     struct fuse_file_info *fi)
+{
+    struct basic_fh *fh = get_fh(fi);
+    size_t done = 0, bs = options.peer_cache_block;
+
+    if (fh == NULL || !fh->pc_ok)
+        return next_read(next, path, buf, size, offset, fi);
+
+    while (done < size && offset + (off_t) done < fh->pc_size) {
+        off_t pos = offset + done, boff = pos - pos % bs;
+        struct pblock *b = pcache_get(next, path, boff, fh, fi);
+        if (b == NULL) {
+            int r = next_read(next, path, buf + done, size - done, pos, fi);
+            return r < 0 ? (done ? (int) done : r) : (int) (done + r);
+        }
+        size_t in = pos - boff, n = b->len > in ? b->len - in : 0;
+        if (n > size - done)
+            n = size - done;
+        memcpy(buf + done, b->data + in, n);
+        pcache_put(b);
+        done += n;
+        if (n == 0)
+            break;
+    }
+    return done;
+}
+
+static const struct basic_layer peer_layer = {
+    .name       = "peer",
+    .open       = peer_open,
+    .read       = peer_read,
+};
+
+static int pcache_ring_cmp(const void *a, const void *b)
+{
+    uint32_t x = ((const struct pcache_ring *) a)->point, y = ((const struct pcache_ring *) b)->point;
+    return x < y ? -1 : x > y;
+}
+
+/* 멤버 목록과 ring을 만듦 (서버는 pcache_start에서) */
+static int pcache_setup(void)
+{
+    char *list = strdup(options.peer_cache_peers ? options.peer_cache_peers : ""), *save = NULL;
+    int err = 0;
+
+    if (list == NULL)
+        return -ENOMEM;
+    pcache.peer = calloc(PCACHE_PEERS_MAX, sizeof(*pcache.peer));
+    pcache.ring = calloc((PCACHE_PEERS_MAX + 1) * PCACHE_VNODES, sizeof(*pcache.ring));
+    if (pcache.peer == NULL || pcache.ring == NULL)
+        err = -ENOMEM;
+    for (char *a = strtok_r(list, "+", &save); a && err == 0; a = strtok_r(NULL, "+", &save)) {
+        struct pcache_peer *p = &pcache.peer[pcache.npeers];
+        struct sockaddr_storage ss;
+        socklen_t len;
+        if (strcmp(a, options.peer_cache) == 0)
+            continue;
+        if (pcache.npeers == PCACHE_PEERS_MAX || strlen(a) >= sizeof(p->addr))
+            err = -E2BIG;
+        else if ((err = rpc_addr(a, &ss, &len)) == 0) {
+            strcpy(p->addr, a);
+            rpc_conn_init(&p->conn, p->addr, &ss, len, &pcache.reconnects);
+            pcache.npeers++;
+        }
+    }
+    free(list);
+    if (err)
+        return err;
+
+    /* 노드 이름#번호의 해시가 가상 노드 위치 */
+    for (int n = -1; n < (int) pcache.npeers; n++) {
+        for (int v = 0; v < PCACHE_VNODES; v++) {
+            char name[300];
+            snprintf(name, sizeof(name), "%s#%d", n < 0 ? options.peer_cache : pcache.peer[n].addr, v);
+            pcache.ring[pcache.nring++] = (struct pcache_ring) { pcache_mix(path_hash(name)), n };
+        }
+    }
+    qsort(pcache.ring, pcache.nring, sizeof(*pcache.ring), pcache_ring_cmp);
+    return 0;
+}
+
+static int pcache_start(void)
+{
+    int lfd = rs_listen(options.peer_cache);
+    pthread_t t;
+
+    if (lfd < 0)
+        return lfd;
+    rs.peer_only = 1;
+    if (pthread_create(&t, NULL, rs_accept_main, (void *) (intptr_t) lfd) != 0) {
+        close(lfd);
+        return -EAGAIN;
+    }
+    pthread_detach(t);
+    return 0;
+}
+
+static void pcache_clear(void)
+{
+    pthread_mutex_lock(&pcache.lock);
+    while (pcache.head)
+        pcache_unlink_locked(pcache.head);
+    pthread_mutex_unlock(&pcache.lock);
+}
+
+/*
+ * write-behind (-o write_behind=DIR): write는 DIR(빠른 로컬 장치)의 journal에 기록해
+ * 디스크에 내려간 뒤 바로 응답하고, 백엔드에는 uploader 스레드가 나중에 올린다.
+ * 파일마다 쌓인 write는 이어지는 것끼리 write_behind_batch 크기까지 합쳐 순서대로
+ * 쓰고, 파일을 fsync한 뒤에 journal에서 지운다. 여러 write가 한 번의 fdatasync를
+ * 같이 씀 (group commit).
+ *
+ * 올라가지 않은 write는 메모리 색인(파일별 목록)으로 찾아 read와 getattr에 반영하므로
+ * 이 데몬 안에서는 바로 보인다. 순서가 중요한 연산(truncate, rename, unlink, utimens,
+ * O_TRUNC open)은 그 파일의 write를 먼저 올리거나(unlink는 버림) journal에 DROP
+ * 기록을 남겨, 재시작 때 journal을 다시 읽어도 그 뒤의 상태를 덮지 않는다.
+ *
+ * fsync: write_behind_sync=local(기본)이면 journal에 있으면 끝, backend이면 그 파일의
+ * write가 백엔드에 올라가 sync될 때까지 기다림.
+ *
+ * journal은 write_behind_max / 4 크기 segment 파일(DIR/wb.<id>.log)로 나뉘고,
+ * segment의 write가 모두 올라가면 지운다. 가득 차면 write가 기다림 (백엔드가
+ * 실패 중이면 -ENOSPC).
+ */
+#define WB_MAGIC 0x6277626a         /* "jbwb" */
+#define WB_WRITE 0
+#define WB_DROP 1                   /* 이 경로의 앞선 write는 무효 */
+#define WB_DROP_TREE 2              /* 이 경로와 그 아래의 앞선 write는 무효 (rename) */
+#define WB_RETRY_MS 1000            /* 백엔드 실패 뒤 다시 올려 보기까지 */
+
+struct wb_rec {
+    uint32_t magic;
+    uint32_t crc;               /* crc를 0으로 둔 머리, 경로, 데이터의 crc32c */
+    uint64_t seq;
+    int64_t off;
+    uint32_t len;
+    uint16_t plen;              /* 뒤따르는 경로 길이 (NUL 없음) */
+    uint16_t kind;
+};
+
+struct wb_seg {
+    struct wb_seg *next;        /* 오래된 것부터 */
+    uint64_t id;
+    int fd;
+    off_t end;
+    off_t synced;               /* 여기까지 fdatasync 끝남 */
+    int syncing;
+    unsigned int live;          /* 아직 올리지 않은 write */
+    unsigned int refs;          /* sync를 기다리는 writer */
+};
+
+struct wb_ext {
+    struct wb_ext *next;
+    uint64_t seq;
+    off_t off;
+    size_t len;
+    struct wb_seg *seg;
+    off_t joff;                 /* segment 안에서 데이터 위치 */
+};
+
+struct wb_file {
+    struct wb_file *hnext;
+    struct wb_file *qnext;      /* uploader 대기열 */
+    char *path;
+    struct wb_ext *head, *tail; /* 기록 순서 */
+    unsigned int n;
+    size_t bytes;
+    off_t end;                  /* 올리지 않은 write의 끝 중 최대 */
+    struct timespec mtime;      /* 마지막 write 시각 */
+    uint64_t since;             /* 대기열에 들어간 시각 */
+    uint64_t last_seg;          /* 이 경로의 기록이 있는 마지막 segment */
+    unsigned int gen;           /* 올린 write를 목록에서 뺄 때마다 증가 */
+    unsigned int fails;
+    int err;                    /* 마지막 upload 오류 */
+    unsigned int refs;
+    int busy, queued, urgent;
+};
+
+static unsigned int wb_bucket(const char *path)
+{
+    return path_hash(path) % WB_BUCKETS;
+}
+
+static struct wb_file *wb_find_locked(const char *path)
+{
+    struct wb_file *f = wb.table[wb_bucket(path)];
+    while (f && strcmp(f->path, path) != 0)
+        f = f->hnext;
+    return f;
+}
+
+static struct wb_file *wb_get_locked(const char *path)
+{
+    struct wb_file *f = wb_find_locked(path);
+    if (f)
+        return f;
+    f = calloc(1, sizeof(*f));
+    if (f == NULL || (f->path = strdup(path)) == NULL) {
+        free(f);
+        return NULL;
+    }
+    unsigned int b = wb_bucket(path);
+    f->hnext = wb.table[b];
+    wb.table[b] = f;
+    wb.nfiles++;
+    return f;
+}
+
+static void wb_dequeue_locked(struct wb_file *f)
+{
+    struct wb_file **pp = &wb.qhead, *prev = NULL;
+    if (!f->queued)
+        return;
+    while (*pp != f) {
+        prev = *pp;
+        pp = &(*pp)->qnext;
+    }
+    *pp = f->qnext;
+    if (wb.qtail == f)
+        wb.qtail = prev;
+    f->queued = 0;
+}
+
+/* 대기열 끝에, front면 맨 앞에 (flush를 기다리는 파일) */
+static void wb_enqueue_locked(struct wb_file *f, int front)
+{
+    if (f->queued && (!front || wb.qhead == f))
+        return;
+    wb_dequeue_locked(f);
+    f->queued = 1;
+    f->since = now_ns();
+    if (front) {
+        f->qnext = wb.qhead;
+        wb.qhead = f;
+        if (wb.qtail == NULL)
+            wb.qtail = f;
+    } else {
+        f->qnext = NULL;
+        if (wb.qtail)
+            wb.qtail->qnext = f;
+        else
+            wb.qhead = f;
+        wb.qtail = f;
+    }
+    pthread_cond_signal(&wb.work);
+}
+
+/* 앞에서 n개의 write를 목록에서 뺌 (올렸거나 버림) */
+static void wb_trim_locked(struct wb_file *f, unsigned int n)
+{
+    while (n-- && f->head) {
+        struct wb_ext *e = f->head;
+        f->head = e->next;
+        e->seg->live--;
+        f->bytes -= e->len;
+        wb.pending -= e->len;
+        f->n--;
+        free(e);
+    }
+    if (f->head == NULL)
+        f->tail = NULL;
+    f->end = 0;
+    for (struct wb_ext *e = f->head; e; e = e->next)
+        if (e->off + (off_t) e->len > f->end)
+            f->end = e->off + e->len;
+    f->gen++;
+}
+
+static int wb_seg_open_locked(void)
+{
+    char p[PATH_MAX];
+    struct wb_seg *s = calloc(1, sizeof(*s));
+
+    if (s == NULL)
+        return -ENOMEM;
+    s->id = wb.seg_id++;
+    snprintf(p, sizeof(p), "%s/wb.%016llx.log", options.write_behind, (unsigned long long) s->id);
+    s->fd = open(p, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (s->fd < 0) {
+        int err = -errno;
+        free(s);
+        return err;
+    }
+    if (wb.cur)
+        wb.cur->next = s;
+    else
+        wb.segs = s;
+    wb.cur = s;
+    return 0;
+}
+
+/*
+ * 다 올라간 segment를 지움. 아무것도 남지 않았으면 현재 segment도 새로 시작해,
+ * 지운 segment에만 기록이 있던 파일 항목을 버릴 수 있게 함.
+ */
+static void wb_retire_locked(void)
+{
+    char p[PATH_MAX];
+
+    if (wb.pending == 0 && wb.cur && wb.cur->end > 0 && wb.cur->refs == 0 &&
+        wb_seg_open_locked() != 0)
+        return;
+    while (wb.segs != wb.cur && wb.segs->live == 0 && wb.segs->refs == 0) {
+        struct wb_seg *s = wb.segs;
+        wb.segs = s->next;
+        wb.disk -= s->end;
+        close(s->fd);
+        snprintf(p, sizeof(p), "%s/wb.%016llx.log", options.write_behind, (unsigned long long) s->id);
+        unlink(p);
+        free(s);
+    }
+    for (unsigned int b = 0; b < WB_BUCKETS; b++) {
+        struct wb_file **pp = &wb.table[b];
+        while (*pp) {
+            struct wb_file *f = *pp;
+            if (f->n == 0 && f->refs == 0 && !f->busy && !f->queued && f->last_seg < wb.segs->id) {
+                *pp = f->hnext;
+                wb.nfiles--;
+                free(f->path);
+                free(f);
+            } else {
+                pp = &f->hnext;
+            }
+        }
+    }
+}
+
+/* journal 끝에 기록 하나: 데이터 위치를 돌려줌 (sync는 wb_sync_locked) */
+static off_t wb_append_locked(int kind, const char *path, off_t off, const char *buf, size_t len)
+{
+    size_t plen = strlen(path);
+    struct wb_rec rec = {
+        .magic = WB_MAGIC, .seq = wb.seq, .off = off, .len = len, .plen = plen, .kind = kind,
+    };
+    size_t rsz = sizeof(rec) + plen + len;
+    int err;
+
+    if (wb.cur->end > 0 && wb.cur->end + (off_t) rsz > (off_t) (options.write_behind_max / 4) &&
+        (err = wb_seg_open_locked()) != 0)
+        return err;
+    rec.crc = crc32c(crc32c(crc32c(0, &rec, sizeof(rec)), path, plen), buf, len);
+    struct iovec v[3] = { { &rec, sizeof(rec) }, { (void *) path, plen }, { (void *) buf, len } };
+    ssize_t w = BACKEND(pwritev(wb.cur->fd, v, len ? 3 : 2, wb.cur->end));
+    if (w != (ssize_t) rsz)
+        return w < 0 ? -errno : -EIO;
+    wb.seq++;
+    wb.cur->end += rsz;
+    wb.disk += rsz;
+    return wb.cur->end - len;
+}
+
+/* s의 end까지 디스크에: 이미 다른 writer가 sync 중이면 그 결과를 같이 씀 */
+static int wb_sync_locked(struct wb_seg *s, off_t end)
+{
+    int err = 0;
+
+    s->refs++;
+    while (s->synced < end && err == 0) {
+        if (s->syncing) {
+            pthread_cond_wait(&wb.synced, &wb.lock);
+            continue;
+        }
+        off_t upto = s->end;
+        s->syncing = 1;
+        pthread_mutex_unlock(&wb.lock);
+        if (BACKEND(fdatasync(s->fd)) == -1)
+            err = -errno;
+        pthread_mutex_lock(&wb.lock);
+        s->syncing = 0;
+        if (err == 0 && upto > s->synced)
+            s->synced = upto;
+        wb.syncs++;
+        pthread_cond_broadcast(&wb.synced);
+    }
+    s->refs--;
+    return err;
+}
+
+/* path(tree면 그 아래도)의 기록이 journal에 있으면 DROP을 남김 */
+static int wb_mark_locked(const char *path, int tree)
+{
+    size_t len = strlen(path);
+    int found = wb_find_locked(path) != NULL;
+
+    for (unsigned int b = 0; tree && !found && b < WB_BUCKETS; b++)
+        for (struct wb_file *f = wb.table[b]; f && !found; f = f->hnext)
+            found = strncmp(f->path, path, len) == 0 && f->path[len] == '/';
+    if (!found)
+        return 0;
+    off_t end = wb_append_locked(tree ? WB_DROP_TREE : WB_DROP, path, 0, NULL, 0);
+    if (end < 0)
+        return end;
+    struct wb_file *f = wb_find_locked(path);
+    if (f)
+        f->last_seg = wb.cur->id;
+    return wb_sync_locked(wb.cur, end);
+}
+
+/* f의 upload가 끝나기를 기다림 (호출한 쪽이 refs를 잡고 있음) */
+static void wb_idle_locked(struct wb_file *f)
+{
+    while (f->busy)
+        pthread_cond_wait(&wb.done, &wb.lock);
+}
+
+/* path의 지금까지의 write를 백엔드에 올리고 sync될 때까지 기다림 */
+static int wb_flush_locked(struct wb_file *f)
+{
+    int err = 0;
+
+    if (f->n == 0)
+        return 0;
+    uint64_t target = f->tail->seq;
+    unsigned int fails = f->fails;
+    f->refs++;
+    f->urgent = 1;
+    if (!f->busy)
+        wb_enqueue_locked(f, 1);
+    __atomic_fetch_add(&wb.flushes, 1, __ATOMIC_RELAXED);
+    while (f->head && f->head->seq <= target) {
+        if (f->fails != fails) {
+            err = f->err;
+            break;
+        }
+        pthread_cond_wait(&wb.done, &wb.lock);
+    }
+    f->refs--;
+    return err;
+}
+
+static int wb_flush(const char *path, int tree)
+{
+    size_t len = strlen(path);
+    int err = 0;
+
+    pthread_mutex_lock(&wb.lock);
+    struct wb_file *f = wb_find_locked(path);
+    if (f)
+        err = wb_flush_locked(f);
+    /* 디렉터리 rename: 아래 파일들을 하나씩 (기다리는 동안 표가 바뀌므로 매번 처음부터) */
+    while (tree && err == 0) {
+        f = NULL;
+        for (unsigned int b = 0; f == NULL && b < WB_BUCKETS; b++)
+            for (f = wb.table[b]; f; f = f->hnext)
+                if (f->n && strncmp(f->path, path, len) == 0 && f->path[len] == '/')
+                    break;
+        if (f == NULL)
+            break;
+        err = wb_flush_locked(f);
+    }
+    pthread_mutex_unlock(&wb.lock);
+    return err;
+}
+
+/* 순서가 중요한 연산 앞: 올리고(또는 discard면 버리고) DROP을 남김 */
+static int wb_barrier(const char *path, int tree, int discard)
+{
+    int err = discard ? 0 : wb_flush(path, tree);
+
+    pthread_mutex_lock(&wb.lock);
+    struct wb_file *f = discard ? wb_find_locked(path) : NULL;
+    if (f && f->n) {
+        f->refs++;
+        wb_idle_locked(f);
+        wb_trim_locked(f, f->n);
+        wb_dequeue_locked(f);
+        f->refs--;
+        pthread_cond_broadcast(&wb.done);
+    }
+    if (err == 0)
+        err = wb_mark_locked(path, tree);
+    pthread_mutex_unlock(&wb.lock);
+    return err;
+}
+
+/* 모은 구간 하나를 백엔드에 (layer가 짧게 쓰면 나머지를 이어서) */
+static int wb_put(const char *path, const char *buf, size_t len, off_t off,
+                  struct fuse_file_info *fi)
+{
+    for (size_t w = 0; w < len;) {
+        int r = next_write(wb.next, path, buf + w, len - w, off + w, fi);
+        if (r <= 0)
+            return r < 0 ? r : -EIO;
+        w += r;
+    }
+    __atomic_fetch_add(&wb.batches, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&wb.uploaded, len, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/* uploader: f의 앞 n개 write를 기록 순서대로, 이어지는 것끼리 합쳐 올리고 fsync */
+static int wb_upload(struct wb_file *f, unsigned int n, char *buf)
+{
+    struct fuse_file_info fi = { .flags = O_WRONLY };
+    struct wb_ext *e = f->head;
+    size_t fill = 0, bs = options.write_behind_batch;
+    off_t start = 0;
+    int err = next_open(wb.next, f->path, &fi);
+
+    if (err)
+        return err == -ENOENT ? 0 : err;    /* 파일이 없어짐: 올릴 곳이 없음 */
+    for (unsigned int i = 0; i < n && err == 0; i++, e = i < n ? e->next : e) {
+        for (size_t done = 0; done < e->len && err == 0;) {
+            if (fill && (fill == bs || start + (off_t) fill != e->off + (off_t) done)) {
+                err = wb_put(f->path, buf, fill, start, &fi);
+                fill = 0;
+                continue;
+            }
+            if (fill == 0)
+                start = e->off + done;
+            size_t chunk = e->len - done < bs - fill ? e->len - done : bs - fill;
+            if (BACKEND(pread(e->seg->fd, buf + fill, chunk, e->joff + done)) != (ssize_t) chunk)
+                err = -EIO;
+            fill += chunk;
+            done += chunk;
+        }
+    }
+    if (err == 0 && fill)
+        err = wb_put(f->path, buf, fill, start, &fi);
+    if (err == 0)
+        err = next_fsync(wb.next, f->path, 1, &fi);
+    next_release(wb.next, f->path, &fi);
+    return err;
+}
+
+static void *wb_main(void *arg)
+{
+    (void) arg;
+    char *buf = malloc(options.write_behind_batch);
+    uint64_t delay = (uint64_t) options.write_behind_delay_ms * 1000000, retry_at = 0;
+    int failing = 0;
+
+    pthread_mutex_lock(&wb.lock);
+    while (buf) {
+        struct wb_file *f = wb.qhead;
+        uint64_t now = now_ns(), due;
+        if (f == NULL) {
+            if (wb.stop)
+                break;
+            pthread_cond_wait(&wb.work, &wb.lock);
+            continue;
+        }
+        /* 오래 기다렸거나, 한 batch가 찼거나, 누가 기다리거나, journal이 차 가면 올림 */
+        due = f->urgent || wb.stop || wb.waiting || f->bytes >= options.write_behind_batch ||
+              wb.disk * 2 > options.write_behind_max ? now : f->since + delay;
+        if (failing && retry_at > due && !wb.stop)
+            due = retry_at;
+        if (wb.stop && failing)
+            break;  /* 백엔드가 안 되면 나머지는 다음 시작 때 journal에서 */
+        if (now < due) {
+            struct timespec ts;
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            uint64_t at = (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec + (due - now);
+            ts.tv_sec = at / 1000000000;
+            ts.tv_nsec = at % 1000000000;
+            pthread_cond_timedwait(&wb.work, &wb.lock, &ts);
+            continue;
+        }
+        wb_dequeue_locked(f);
+        f->busy = 1;
+        f->urgent = 0;
+        unsigned int n = f->n;
+        pthread_mutex_unlock(&wb.lock);
+
+        int err = wb_upload(f, n, buf);
+
+        pthread_mutex_lock(&wb.lock);
+        f->busy = 0;
+        if (err == 0) {
+            wb_trim_locked(f, n);
+            if (failing)
+                fprintf(stderr, "[INFO] write-behind: backend is back, uploading\n");
+            failing = 0;
+        } else {
+            f->fails++;
+            f->err = err;
+            wb.errors++;
+            if (!failing)
+                fprintf(stderr, "[WARN] write-behind: upload of %s failed: %s (keeping it in %s)\n",
+                        f->path, strerror(-err), options.write_behind);
+            failing = 1;
+            retry_at = now_ns() + (uint64_t) WB_RETRY_MS * 1000000;
+        }
+        wb.failing = failing;
+        if (f->n && !f->queued)
+            wb_enqueue_locked(f, 0);
+        wb_retire_locked();
+        pthread_cond_broadcast(&wb.done);
+    }
+    pthread_mutex_unlock(&wb.lock);
+    free(buf);
+    return NULL;
+}
+
+static int wb_getattr(int next, const char *path, struct stat *stbuf, struct fuse_file_info *fi)
+{
+    int res = next_getattr(next, path, stbuf, fi);
+    if (res || !S_ISREG(stbuf->st_mode))
+        return res;
+
+    pthread_mutex_lock(&wb.lock);
+    struct wb_file *f = wb_find_locked(path);
+    if (f && f->n) {
+        if (f->end > stbuf->st_size) {
+            stbuf->st_size = f->end;
+            stbuf->st_blocks = (f->end + 511) / 512;
+        }
+        if (f->mtime.tv_sec > stbuf->st_mtim.tv_sec ||
+            (f->mtime.tv_sec == stbuf->st_mtim.tv_sec && f->mtime.tv_nsec > stbuf->st_mtim.tv_nsec))
+            stbuf->st_mtim = stbuf->st_ctim = f->mtime;
+    }
+    pthread_mutex_unlock(&wb.lock);
+    return 0;
+}
+
+static int wb_open(int next, const char *path, struct fuse_file_info *fi)
+{
+    if ((fi->flags & O_TRUNC) && strcmp(path, STATS_PATH) != 0) {
+        int err = wb_barrier(path, 0, 0);
+        if (err)
+            return err;
+    }
+    return next_open(next, path, fi);
+}
+
+/* 백엔드에서 읽은 뒤 아직 올리지 않은 write를 기록 순서대로 덮음 */
+static int wb_read(int next, const char *path, char *buf, size_t size, off_t offset,
+                   struct fuse_file_info *fi)
+{
+    pthread_mutex_lock(&wb.lock);
+    struct wb_file *f = wb_find_locked(path);
+    if (f == NULL || f->n == 0) {
+        pthread_mutex_unlock(&wb.lock);
+        return next_read(next, path, buf, size, offset, fi);
+    }
+    f->refs++;
+
+    int res;
+    for (;;) {
+        /* 읽는 사이에 upload가 끝나 목록에서 빠졌다면 다시 읽음 */
+        unsigned int gen = f->gen;
+        pthread_mutex_unlock(&wb.lock);
+        res = next_read(next, path, buf, size, offset, fi);
+        pthread_mutex_lock(&wb.lock);
+        if (f->gen == gen)
+            break;
+    }
+    if (res >= 0 && f->n) {
+        size_t len = res;
+        if (len < size && f->end > offset + (off_t) len) {
+            size_t upto = f->end - offset < (off_t) size ? (size_t) (f->end - offset) : size;
+            memset(buf + len, 0, upto - len);
+            len = upto;
+        }
+        for (struct wb_ext *e = f->head; e; e = e->next) {
+            off_t lo = e->off > offset ? e->off : offset;
+            off_t hi = e->off + (off_t) e->len < offset + (off_t) len ? e->off + (off_t) e->len :
+                       offset + (off_t) len;
+            if (lo < hi && pread(e->seg->fd, buf + (lo - offset), hi - lo,
+                                 e->joff + (lo - e->off)) != hi - lo) {
+                res = -EIO;
+                break;
+            }
+        }
+        if (res >= 0)
+            res = len;
+    }
+    f->refs--;
+    pthread_mutex_unlock(&wb.lock);
+    return res;
+}
+
+static int wb_write(int next, const char *path, const char *buf, size_t size, off_t offset,
+                    struct fuse_file_info *fi)
+{
+    size_t rsz = sizeof(struct wb_rec) + strlen(path) + size;
+    int err = 0;
+
+    if (strcmp(path, STATS_PATH) == 0)
+        return next_write(next, path, buf, size, offset, fi);
+
+    pthread_mutex_lock(&wb.lock);
+    /* journal이 가득: uploader가 비울 때까지 (백엔드가 실패 중이면 포기) */
+    while (wb.disk + rsz > options.write_behind_max && wb.disk > 0) {
+        if (wb.failing) {
+            err = -ENOSPC;
+            break;
+        }
+        wb.waiting++;
+        pthread_cond_signal(&wb.work);
+        pthread_cond_wait(&wb.done, &wb.lock);
+        wb.waiting--;
+    }
+    struct wb_file *f = err ? NULL : wb_get_locked(path);
+    struct wb_ext *e = f ? calloc(1, sizeof(*e)) : NULL;
+    if (e == NULL) {
+        pthread_mutex_unlock(&wb.lock);
+        free(e);
+        return err ? err : -ENOMEM;
+    }
+    e->seq = wb.seq;
+    off_t joff = wb_append_locked(WB_WRITE, path, offset, buf, size);
+    if (joff < 0) {
+        pthread_mutex_unlock(&wb.lock);
+        free(e);
+        return joff;
+    }
+    e->off = offset;
+    e->len = size;
+    e->seg = wb.cur;
+    e->joff = joff;
+    e->seg->live++;
+    if (f->tail)
+        f->tail->next = e;
+    else
+        f->head = e;
+    f->tail = e;
+    f->n++;
+    f->bytes += size;
+    f->last_seg = e->seg->id;
+    if (offset + (off_t) size > f->end)
+        f->end = offset + size;
+    clock_gettime(CLOCK_REALTIME, &f->mtime);
+    wb.pending += size;
+    wb.writes++;
+    if (!f->queued && !f->busy)
+        wb_enqueue_locked(f, 0);
+
+    err = wb_sync_locked(e->seg, joff + size);
+    pthread_mutex_unlock(&wb.lock);
+    return err ? err : (int) size;
+}
+
+static int wb_unlink(int next, const char *path)
+{
+    int err = wb_barrier(path, 0, 1);
+    return err ? err : next_unlink(next, path);
+}
+
+static int wb_rename(int next, const char *from, const char *to, unsigned int flags)
+{
+    int err = wb_barrier(from, 1, 0);
+    if (err == 0)
+        err = wb_barrier(to, 1, 1);
+    return err ? err : next_rename(next, from, to, flags);
+}
+
+static int wb_truncate(int next, const char *path, off_t size, struct fuse_file_info *fi)
+{
+    int err = strcmp(path, STATS_PATH) == 0 ? 0 : wb_barrier(path, 0, 0);
+    return err ? err : next_truncate(next, path, size, fi);
+}
+
+/* 나중에 올라가는 write가 mtime을 덮지 않도록 먼저 올림 */
+static int wb_utimens(int next, const char *path, const struct timespec ts[2],
+                      struct fuse_file_info *fi)
+{
+    int err = wb_flush(path, 0);
+    return err ? err : next_utimens(next, path, ts, fi);
+}
+
+static int wb_fsync(int next, const char *path, int datasync, struct fuse_file_info *fi)
+{
+    /* local: write가 응답할 때 이미 journal에 sync됨 */
+    if (!wb.backend_sync)
+        return 0;
+    int err = wb_flush(path, 0);
+    return err ? err : next_fsync(next, path, datasync, fi);
+}
+
+static const struct basic_layer wb_layer = {
+    .name       = "write-behind",
+    .getattr    = wb_getattr,
+    .open       = wb_open,
+    .read       = wb_read,
+    .write      = wb_write,
+    .unlink     = wb_unlink,
+    .rename     = wb_rename,
+    .truncate   = wb_truncate,
+    .utimens    = wb_utimens,
+    .fsync      = wb_fsync,
+};
+
+static int wb_seg_cmp(const void *a, const void *b)
+{
+    uint64_t x = (*(struct wb_seg *const *) a)->id, y = (*(struct wb_seg *const *) b)->id;
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * 시작할 때 남은 segment를 기록 순서대로 읽어 색인을 다시 만듦 (DROP까지 적용).
+ * 끝이 잘린 기록부터는 버리고, 남은 write는 평소처럼 uploader가 올린다.
+ */
+static int wb_recover(void)
+{
+    DIR *dp = opendir(options.write_behind);
+    struct wb_seg **segs = NULL;
+    size_t nsegs = 0, cap = 0;
+    struct dirent *de;
+    int err = 0;
+
+    if (dp == NULL)
+        return -errno;
+    while ((de = readdir(dp)) != NULL) {
+        unsigned long long id;
+        char tail;
+        if (sscanf(de->d_name, "wb.%16llx.lo%c", &id, &tail) != 2 || tail != 'g')
+            continue;
+        if (nsegs == cap) {
+            cap = cap ? cap * 2 : 16;
+            struct wb_seg **n = realloc(segs, cap * sizeof(*segs));
+            if (n == NULL) {
+                err = -ENOMEM;
+                break;
+            }
+            segs = n;
+        }
+        struct wb_seg *s = calloc(1, sizeof(*s));
+        char p[PATH_MAX];
+        snprintf(p, sizeof(p), "%s/%s", options.write_behind, de->d_name);
+        if (s == NULL || (s->fd = open(p, O_RDWR | O_CLOEXEC)) < 0) {
+            err = s ? -errno : -ENOMEM;
+            free(s);
+            break;
+        }
+        s->id = id;
+        segs[nsegs++] = s;
+    }
+    closedir(dp);
+    if (nsegs)
+        qsort(segs, nsegs, sizeof(*segs), wb_seg_cmp);
+
+    char path[PATH_MAX];
+    for (size_t i = 0; i < nsegs; i++) {
+        struct wb_seg *s = segs[i];
+        struct wb_rec rec;
+        if (wb.cur)
+            wb.cur->next = s;
+        else
+            wb.segs = s;
+        wb.cur = s;
+        wb.seg_id = s->id + 1;
+        while (err == 0 && pread(s->fd, &rec, sizeof(rec), s->end) == (ssize_t) sizeof(rec) &&
+               rec.magic == WB_MAGIC && rec.plen < sizeof(path) && rec.plen > 0 &&
+               rec.len <= options.write_behind_max) {
+            char *data = malloc(rec.len ? rec.len : 1);
+            uint32_t crc = rec.crc;
+            off_t doff = s->end + sizeof(rec) + rec.plen;
+            rec.crc = 0;
+            int good = data && pread(s->fd, path, rec.plen, s->end + sizeof(rec)) == rec.plen &&
+                       pread(s->fd, data, rec.len, doff) == (ssize_t) rec.len &&
+                       crc32c(crc32c(crc32c(0, &rec, sizeof(rec)), path, rec.plen),
+                              data, rec.len) == crc;
+            free(data);
+            if (!good)
+                break;
+            path[rec.plen] = '\0';
+            if (rec.kind == WB_WRITE) {
+                struct wb_file *f = wb_get_locked(path);
+                struct wb_ext *e = f ? calloc(1, sizeof(*e)) : NULL;
+                if (e == NULL) {
+                    err = -ENOMEM;
+                    break;
+                }
+                *e = (struct wb_ext) { NULL, rec.seq, rec.off, rec.len, s, doff };
+                if (f->tail)
+                    f->tail->next = e;
+                else
+                    f->head = e;
+                f->tail = e;
+                f->n++;
+                f->bytes += rec.len;
+                if (e->off + (off_t) e->len > f->end)
+                    f->end = e->off + e->len;
+                f->last_seg = s->id;
+                s->live++;
+                wb.pending += rec.len;
+                wb.recovered++;
+            } else {
+                size_t len = rec.plen;
+                for (unsigned int b = 0; b < WB_BUCKETS; b++)
+                    for (struct wb_file *f = wb.table[b]; f; f = f->hnext)
+                        if (f->n && strncmp(f->path, path, len) == 0 &&
+                            (f->path[len] == '\0' || (rec.kind == WB_DROP_TREE && f->path[len] == '/'))) {
+                            wb.recovered -= f->n;
+                            wb_trim_locked(f, f->n);
+                        }
+                struct wb_file *f = wb_get_locked(path);
+                if (f)
+                    f->last_seg = s->id;
+            }
+            if (rec.seq >= wb.seq)
+                wb.seq = rec.seq + 1;
+            s->end = doff + rec.len;
+        }
+        /* 잘린 꼬리는 다음 기록이 덮지 않도록 잘라 둠 */
+        if (ftruncate(s->fd, s->end) == -1 && err == 0)
+            err = -errno;
+        s->synced = s->end;
+        wb.disk += s->end;
+    }
+    free(segs);
+    if (err)
+        return err;
+    /* 새 기록은 새 segment에 */
+    if ((err = wb_seg_open_locked()) != 0)
+        return err;
+    for (unsigned int b = 0; b < WB_BUCKETS; b++)
+        for (struct wb_file *f = wb.table[b]; f; f = f->hnext)
+            if (f->n)
+                wb_enqueue_locked(f, 0);
+    if (wb.recovered)
+        fprintf(stderr, "[INFO] write-behind: %llu writes (%lu bytes) from %s still to upload\n",
+                wb.recovered, wb.pending, options.write_behind);
+    return 0;
+}
+
+static int wb_start(void)
+{
+    if (pthread_create(&wb.thread, NULL, wb_main, NULL) != 0)
+        return -EAGAIN;
+    wb.running = 1;
+    return 0;
+}
+
+/* 남은 write를 올리고 끝냄 (백엔드가 실패 중이면 journal에 둔 채로) */
+static void wb_stop(void)
+{
+    if (!wb.running)
+        return;
+    pthread_mutex_lock(&wb.lock);
+    wb.stop = 1;
+    pthread_cond_signal(&wb.work);
+    pthread_mutex_unlock(&wb.lock);
+    pthread_join(wb.thread, NULL);
+    wb.running = 0;
+    if (wb.pending)
+        fprintf(stderr, "[WARN] write-behind: %lu bytes left in %s for the next start\n",
+                wb.pending, options.write_behind);
+}
+
+/*
+ * offline (-o offline=DIR): 백엔드가 응답하지 않아도 마운트가 계속 동작하게 한다.
+ * 열린 일반 파일(offline_file_max 이하)은 백그라운드 스레드가 DIR/data 아래 같은
+ * 경로에 사본으로 받아 둔다 (크기와 mtime이 백엔드와 같으면 최신). 백엔드 호출이
+ * 연결 계열 오류(-ECONNREFUSED, -ETIMEDOUT, -EHOSTDOWN ...)로 실패하면 오프라인이 된다.
+ *
+ * 오프라인 동안 요청은 백엔드로 가지 않고 사본으로 처리한다: 사본이 있는 파일과
+ * 디렉터리만 보이고, 변경은 사본에 하면서 DIR/log에 기록한다 (sync한 뒤 응답).
+ * 백엔드는 백그라운드 스레드만 확인하며, 실패할 때마다 간격을 두 배로
+ * (offline_retry_ms부터 offline_retry_max_ms까지) 늘린다.
+ *
+ * 다시 연결되면 기록을 순서대로 재생하고 내용이 바뀐 파일은 사본 전체를 올린다.
+ * 그동안 변경은 기다린다 (읽기는 계속 사본에서). 충돌 검사: 파일을 오프라인에서
+ * 처음 바꿀 때 사본의 크기와 mtime(= 받을 때의 백엔드 파일)을 기록에 남겨, 백엔드
+ * 파일이 그사이 다른 곳에서 바뀌었으면 덮지 않고 우리 내용을
+ * "이름.conflict-시각-번호"로 올린다 (unlink와 rename은 하지 않음).
+ *
+ * 오프라인이 되기 전에 열린 백엔드 핸들도 실패하면 사본으로 옮겨 간다.
+ * 사본은 지우지 않으므로 DIR의 크기는 따로 관리해야 한다.
+ */
+#define OFF_MAGIC 0x6c66666f        /* "offl" */
+#define OFF_CHUNK (1024 * 1024)     /* 사본을 받고 올리는 단위 */
+#define OFF_AGAIN 1                 /* 기다리는 사이 온라인이 됨: 백엔드로 다시 */
+
+enum { OFF_CREATE, OFF_DIRTY, OFF_MKDIR, OFF_RMDIR, OFF_UNLINK, OFF_RENAME, OFF_CHMOD,
+       OFF_UTIMENS };
+
+/* 기록 하나: 디스크와 메모리에서 같은 모양, 뒤에 경로 (NUL 포함) */
+struct off_rec {
+    uint32_t magic;
+    uint32_t crc;               /* crc를 0으로 둔 전체의 crc32c */
+    uint16_t op;
+    uint16_t has_base;          /* 백엔드에 있던 파일: 바꾸기 전의 크기와 mtime */
+    uint32_t mode;
+    int64_t base_size;
+    int64_t base_sec, base_nsec;
+    int64_t ts[4];              /* utimens: atime, mtime (sec, nsec) */
+    uint16_t plen, plen2;       /* 경로 길이, plen2는 rename의 대상 */
+    uint32_t pad;
+    char path[];
+};
+
+/* 백엔드에 올릴 내용이 있는 파일 (이름이 바뀌면 따라감) */
+struct off_node {
+    struct off_node *hnext;
+    char *path;
+    int has_base;               /* 0이면 오프라인에서 만든 파일 */
+    off_t base_size;
+    struct timespec base_mtime;
+};
+
+/* DIR/data + path (너무 길면 빈 문자열: 사본 연산이 -ENOENT로 실패) */
+static void off_cpath(const char *path, char *out, size_t size)
+{
+    size_t d = strlen(options.offline), p = strlen(path);
+
+    out[0] = '\0';
+    if (d + 5 + p < size) {
+        memcpy(out, options.offline, d);
+        memcpy(out + d, "/data", 5);
+        memcpy(out + d + 5, path, p + 1);
+    }
+}
+
+static int off_online(void)
+{
+    return __atomic_load_n(&off.state, __ATOMIC_ACQUIRE) == OFF_ONLINE;
+}
+
+/* 오프라인에서 사본이 없는 파일: 백엔드가 준 오류 그대로 */
+static int off_err(void)
+{
+    int err = __atomic_load_n(&off.down_err, __ATOMIC_RELAXED);
+    return err ? err : -EIO;
+}
+
+static void off_set_locked(int state)
+{
+    __atomic_store_n(&off.state, state, __ATOMIC_RELEASE);
+}
+
+static void off_fail(int err)
+{
+    pthread_mutex_lock(&off.lock);
+    if (off.state == OFF_ONLINE) {
+        off_set_locked(OFF_OFFLINE);
+        off.down_err = err;
+        off.since = now_ns();
+        off.backoff_ms = options.offline_retry_ms;
+        off.next_probe = off.since + (uint64_t) off.backoff_ms * 1000000;
+        off.downs++;
+        fprintf(stderr, "[WARN] offline: backend failed (%s), serving from %s\n",
+                strerror(-err), options.offline);
+        pthread_cond_signal(&off.work);
+    }
+    pthread_mutex_unlock(&off.lock);
+}
+
+/* 핸들 연산의 실패는 그 핸들만의 문제일 수 있음 (재연결 전의 핸들): 백엔드를 확인 */
+static int off_confirm(int err)
+{
+    struct stat st;
+    int res = next_getattr(off.next, "/", &st, NULL);
+    if (!backend_down(res))
+        return 0;
+    off_fail(err);
+    return 1;
+}
+
+/*
+ * 사본을 바꾸기 전: 재생 중이면 끝날 때까지 기다리고 lock을 잡은 채 0.
+ * 그사이 온라인이 되었으면 OFF_AGAIN (local: 핸들이 이미 사본에 있어 그대로 진행).
+ */
+static int off_begin(int local)
+{
+    pthread_mutex_lock(&off.lock);
+    while (off.state == OFF_REPLAY)
+        pthread_cond_wait(&off.replayed, &off.lock);
+    if (off.state == OFF_ONLINE && !local) {
+        pthread_mutex_unlock(&off.lock);
+        return OFF_AGAIN;
+    }
+    __atomic_fetch_add(&off.local_ops, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+static unsigned int off_bucket(const char *path)
+{
+    return path_hash(path) % OFF_BUCKETS;
+}
+
+static struct off_node *off_find_locked(const char *path)
+{
+    struct off_node *n = off.table[off_bucket(path)];
+    while (n && strcmp(n->path, path) != 0)
+        n = n->hnext;
+    return n;
+}
+
+static struct off_node *off_get_locked(const char *path)
+{
+    struct off_node *n = off_find_locked(path);
+    if (n)
+        return n;
+    n = calloc(1, sizeof(*n));
+    if (n == NULL || (n->path = strdup(path)) == NULL) {
+        free(n);
+        return NULL;
+    }
+    unsigned int b = off_bucket(path);
+    n->hnext = off.table[b];
+    off.table[b] = n;
+    off.ndirty++;
+    return n;
+}
+
+static int off_under(const char *path, const char *dir, size_t len)
+{
+    return strncmp(path, dir, len) == 0 && (path[len] == '\0' || path[len] == '/');
+}
+
+/* path(tree면 그 아래도)의 항목을 빼서 목록으로 돌려줌 */
+static struct off_node *off_take_locked(const char *path, int tree)
+{
+    size_t len = strlen(path);
+    struct off_node *taken = NULL;
+
+    for (unsigned int b = tree ? 0 : off_bucket(path); b < OFF_BUCKETS; b++) {
+        struct off_node **pp = &off.table[b];
+        while (*pp) {
+            struct off_node *n = *pp;
+            if (tree ? off_under(n->path, path, len) : strcmp(n->path, path) == 0) {
+                *pp = n->hnext;
+                n->hnext = taken;
+                taken = n;
+                off.ndirty--;
+            } else {
+                pp = &n->hnext;
+            }
+        }
+        if (!tree)
+            break;
+    }
+    return taken;
+}
+
+static void off_drop_locked(const char *path, int tree)
+{
+    struct off_node *n = off_take_locked(path, tree);
+    while (n) {
+        struct off_node *next = n->hnext;
+        free(n->path);
+        free(n);
+        n = next;
+    }
+}
+
+/* rename: from과 그 아래 항목을 to 아래로 */
+static void off_move_locked(const char *from, const char *to)
+{
+    size_t len = strlen(from);
+    struct off_node *n = off_take_locked(from, 1);
+
+    off_drop_locked(to, 1);
+    while (n) {
+        struct off_node *next = n->hnext;
+        char *p = malloc(strlen(to) + strlen(n->path + len) + 1);
+        if (p) {
+            strcpy(p, to);
+            strcat(p, n->path + len);
+            free(n->path);
+            n->path = p;
+            unsigned int b = off_bucket(p);
+            n->hnext = off.table[b];
+            off.table[b] = n;
+            off.ndirty++;
+        } else {
+            fprintf(stderr, "[WARN] offline: out of memory, %s will not be uploaded\n", n->path);
+            free(n->path);
+            free(n);
+        }
+        n = next;
+    }
+}
+
+static struct off_rec *off_rec_new(int op, const char *path, const char *to)
+{
+    size_t p1 = strlen(path) + 1, p2 = to ? strlen(to) + 1 : 0;
+    struct off_rec *r = calloc(1, sizeof(*r) + p1 + p2);
+
+    if (r == NULL)
+        return NULL;
+    r->magic = OFF_MAGIC;
+    r->op = op;
+    r->plen = p1;
+    r->plen2 = p2;
+    memcpy(r->path, path, p1);
+    if (to)
+        memcpy(r->path + p1, to, p2);
+    return r;
+}
+
+/* 바꾸기 전의 path: 이미 올릴 항목이면 그 base, 아니면 지금 사본 (= 받을 때의 백엔드) */
+static void off_base_locked(const char *path, struct off_rec *r)
+{
+    char cp[PATH_MAX];
+    struct stat st;
+    struct off_node *n = off_find_locked(path);
+
+    if (n) {
+        r->has_base = n->has_base;
+        r->base_size = n->base_size;
+        r->base_sec = n->base_mtime.tv_sec;
+        r->base_nsec = n->base_mtime.tv_nsec;
+        r->mode = S_IFREG;
+        return;
+    }
+    off_cpath(path, cp, sizeof(cp));
+    if (lstat(cp, &st) == 0) {
+        r->has_base = 1;
+        r->base_size = st.st_size;
+        r->base_sec = st.st_mtim.tv_sec;
+        r->base_nsec = st.st_mtim.tv_nsec;
+        r->mode = st.st_mode;
+    }
+}
+
+/* 기록이 올릴 항목에 주는 영향 (기록할 때와 시작할 때 다시 읽을 때 같음) */
+static void off_apply_locked(const struct off_rec *r)
+{
+    struct off_node *n;
+
+    switch (r->op) {
+    case OFF_CREATE:
+        if ((n = off_get_locked(r->path)) != NULL)
+            n->has_base = 0;
+        break;
+    case OFF_DIRTY:
+        if (off_find_locked(r->path) == NULL && (n = off_get_locked(r->path)) != NULL) {
+            n->has_base = r->has_base;
+            n->base_size = r->base_size;
+            n->base_mtime = (struct timespec) { r->base_sec, r->base_nsec };
+        }
+        break;
+    case OFF_UNLINK:
+        off_drop_locked(r->path, 0);
+        break;
+    case OFF_RMDIR:
+        off_drop_locked(r->path, 1);
+        break;
+    case OFF_RENAME:
+        off_move_locked(r->path, r->path + r->plen);
+        break;
+    }
+}
+
+/* 기록 하나를 log 끝에 sync하고 적용 (r은 여기서 맡음) */
+static int off_log_locked(struct off_rec *r)
+{
+    size_t len = sizeof(*r) + r->plen + r->plen2;
+
+    if (off.nlog == off.logcap) {
+        unsigned int cap = off.logcap ? off.logcap * 2 : 64;
+        struct off_rec **n = realloc(off.log, cap * sizeof(*n));
+        if (n == NULL) {
+            free(r);
+            return -ENOMEM;
+        }
+        off.log = n;
+        off.logcap = cap;
+    }
+    r->crc = 0;
+    r->crc = crc32c(0, r, len);
+    ssize_t w = BACKEND(pwrite(off.logfd, r, len, off.logend));
+    if (w != (ssize_t) len || BACKEND(fdatasync(off.logfd)) == -1) {
+        int err = w < 0 || w == (ssize_t) len ? -errno : -ENOSPC;
+        free(r);
+        return err;
+    }
+    off.logend += len;
+    off.log[off.nlog++] = r;
+    off_apply_locked(r);
+    pthread_cond_signal(&off.work);
+    return 0;
+}
+
+/* 사본을 바꾼 결과 res가 성공이면 기록, 아니면 버림 */
+static int off_commit_locked(struct off_rec *r, int res)
+{
+    if (res == 0)
+        return off_log_locked(r);
+    free(r);
+    return res;
+}
+
+/* path의 내용이 바뀌기 직전: 처음이면 base와 함께 기록 */
+static int off_dirty_locked(const char *path)
+{
+    if (off_find_locked(path))
+        return 0;
+    struct off_rec *r = off_rec_new(OFF_DIRTY, path, NULL);
+    if (r == NULL)
+        return -ENOMEM;
+    off_base_locked(path, r);
+    return off_log_locked(r);
+}
+
+/* 온라인에서 성공한 변경을 사본에도 (사본이 없으면 그냥 둠) */
+static void off_follow(int op, const char *path, const char *to, mode_t mode)
+{
+    char cp[PATH_MAX], ct[PATH_MAX];
+
+    off_cpath(path, cp, sizeof(cp));
+    pthread_mutex_lock(&off.lock);
+    switch (op) {
+    case OFF_UNLINK:
+        unlink(cp);
+        off_drop_locked(path, 0);
+        break;
+    case OFF_RENAME:
+        off_cpath(to, ct, sizeof(ct));
+        if (rename(cp, ct) == -1 && errno == ENOENT)
+            unlink(ct);     /* 대상의 옛 사본이 남지 않게 */
+        off_move_locked(path, to);
+        break;
+    case OFF_MKDIR:
+        mkdir(cp, mode);
+        break;
+    case OFF_RMDIR:
+        rmdir(cp);
+        break;
+    case OFF_CHMOD:
+        chmod(cp, mode);
+        break;
+    }
+    pthread_mutex_unlock(&off.lock);
+}
+
+/* 이 파일의 사본이 최신인지 백그라운드에서 확인하게 함 */
+static void off_want(const char *path)
+{
+    unsigned int h = path_hash(path);
+
+    if (options.offline_file_max == 0)
+        return;
+    pthread_mutex_lock(&off.lock);
+    for (unsigned int i = 0; i < off.nfetch; i++)
+        if (off.fetch[i].hash == h && strcmp(off.fetch[i].path, path) == 0) {
+            pthread_mutex_unlock(&off.lock);
+            return;
+        }
+    if (off.nfetch < OFF_FETCH_MAX && (off.fetch[off.nfetch].path = strdup(path)) != NULL) {
+        off.fetch[off.nfetch++].hash = h;
+        pthread_cond_signal(&off.work);
+    }
+    pthread_mutex_unlock(&off.lock);
+}
+
+/* 사본 경로의 상위 디렉터리들을 백엔드와 같은 권한으로 */
+static int off_mkdirs(const char *path)
+{
+    char sub[PATH_MAX], cp[PATH_MAX];
+    struct stat st;
+    const char *s = path;
+
+    while ((s = strchr(s + 1, '/')) != NULL) {
+        snprintf(sub, sizeof(sub), "%.*s", (int) (s - path), path);
+        off_cpath(sub, cp, sizeof(cp));
+        if (lstat(cp, &st) == 0)
+            continue;
+        mode_t mode = next_getattr(off.next, sub, &st, NULL) == 0 ? st.st_mode & 07777 : 0755;
+        if (mkdir(cp, mode) == -1 && errno != EEXIST)
+            return -errno;
+    }
+    return 0;
+}
+
+/* 백그라운드: path의 사본이 백엔드와 다르면 새로 받음 */
+static void off_fetch(const char *path)
+{
+    static unsigned long long seq;
+    char cp[PATH_MAX], tmp[PATH_MAX], *buf;
+    struct stat st, cst;
+    struct fuse_file_info fi = { .flags = O_RDONLY };
+    off_t pos = 0;
+    int res = next_getattr(off.next, path, &st, NULL), fd;
+
+    if (res || !S_ISREG(st.st_mode) || (unsigned long) st.st_size > options.offline_file_max)
+        goto out;
+    off_cpath(path, cp, sizeof(cp));
+    if (lstat(cp, &cst) == 0 && cst.st_size == st.st_size && ts_equal(&cst.st_mtim, &st.st_mtim))
+        return;
+    if ((res = off_mkdirs(path)) != 0)
+        goto out;
+    snprintf(tmp, sizeof(tmp), "%s/tmp/%llu", options.offline, seq++);
+    if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)) == -1)
+        return;
+    res = (buf = malloc(OFF_CHUNK)) ? next_open(off.next, path, &fi) : -ENOMEM;
+    if (res == 0) {
+        int n;
+        while ((n = next_read(off.next, path, buf, OFF_CHUNK, pos, &fi)) > 0) {
+            if (pwrite(fd, buf, n, pos) != n) {
+                n = -EIO;
+                break;
+            }
+            pos += n;
+        }
+        res = n;
+        next_release(off.next, path, &fi);
+    }
+    free(buf);
+    /* 받는 사이에 바뀌었으면 다음 open 때 다시 */
+    struct timespec ts[2] = { st.st_atim, st.st_mtim };
+    if (res == 0 && (pos != st.st_size || fchmod(fd, st.st_mode & 07777) == -1 ||
+                     futimens(fd, ts) == -1))
+        res = -EAGAIN;
+    close(fd);
+    pthread_mutex_lock(&off.lock);
+    /* 그사이 오프라인이 되어 사본을 바꾸기 시작했으면 덮지 않음 */
+    if (res == 0 && off.state == OFF_ONLINE && off.writers == 0 &&
+        off_find_locked(path) == NULL && rename(tmp, cp) == 0) {
+        off.fetched++;
+        off.fetch_bytes += pos;
+        tmp[0] = '\0';
+    }
+    pthread_mutex_unlock(&off.lock);
+    if (tmp[0])
+        unlink(tmp);
+out:
+    if (backend_down(res))
+        off_fail(res);
+}
+
+static void off_conflict(const char *path, const char *what)
+{
+    __atomic_fetch_add(&off.conflicts, 1, __ATOMIC_RELAXED);
+    fprintf(stderr, "[WARN] offline: %s changed on the backend while offline, %s\n", path, what);
+}
+
+/* 백엔드 파일이 base 그대로인지 (다른 곳에서 바뀌지 않음) */
+static int off_same(const struct stat *st, int has_base, off_t size, int64_t sec, int64_t nsec)
+{
+    return has_base && S_ISREG(st->st_mode) && st->st_size == size &&
+           st->st_mtim.tv_sec == sec && st->st_mtim.tv_nsec == nsec;
+}
+
+/* 재생: 이름과 디렉터리 변경 하나. 내용은 off_upload, 백엔드가 안 되면 그 오류 */
+static int off_replay_rec(struct off_rec *r)
+{
+    const char *to = r->path + r->plen;
+    struct stat st;
+    int res = 0;
+
+    switch (r->op) {
+    case OFF_MKDIR:
+        res = next_mkdir(off.next, r->path, r->mode);
+        if (res == -EEXIST)
+            res = 0;
+        break;
+    case OFF_RMDIR:
+        res = next_rmdir(off.next, r->path);
+        if (res == -ENOTEMPTY || res == -EEXIST) {
+            off_conflict(r->path, "not removing it");
+            res = 0;
+        }
+        break;
+    case OFF_UNLINK:
+        if (!r->has_base)
+            break;      /* 오프라인에서 만든 파일 */
+        res = next_getattr(off.next, r->path, &st, NULL);
+        if (res == 0 && off_same(&st, 1, r->base_size, r->base_sec, r->base_nsec))
+            res = next_unlink(off.next, r->path);
+        else if (res == 0)
+            off_conflict(r->path, "not removing it");
+        break;
+    case OFF_RENAME:
+        if (!r->has_base)
+            break;      /* 내용과 함께 새 이름으로 올라감 */
+        res = next_getattr(off.next, r->path, &st, NULL);
+        if (res == 0 && (S_ISDIR(r->mode) ||
+                         off_same(&st, 1, r->base_size, r->base_sec, r->base_nsec))) {
+            res = next_rename(off.next, r->path, to, 0);
+        } else if ((res == 0 || res == -ENOENT) && S_ISREG(r->mode)) {
+            /* 원본은 그대로 두고 우리 사본을 새 이름으로 올림 */
+            off_conflict(r->path, res ? "uploading our copy under the new name" :
+                                        "not renaming it");
+            pthread_mutex_lock(&off.lock);
+            struct off_node *n = off_get_locked(to);
+            if (n)
+                n->has_base = 0;
+            pthread_mutex_unlock(&off.lock);
+            res = 0;
+        }
+        break;
+    case OFF_CHMOD:
+        res = next_chmod(off.next, r->path, r->mode, NULL);
+        break;
+    case OFF_UTIMENS: {
+        struct timespec ts[2] = { { r->ts[0], r->ts[1] }, { r->ts[2], r->ts[3] } };
+        res = next_utimens(off.next, r->path, ts, NULL);
+        break;
+    }
+    }
+    if (res == -ENOENT)
+        res = 0;
+    if (res && !backend_down(res)) {
+        fprintf(stderr, "[WARN] offline: replaying a change to %s: %s (skipped)\n",
+                r->path, strerror(-res));
+        res = 0;
+    }
+    return res;
+}
+
+/* 재생: 내용이 바뀐 파일 하나를 사본 전체로 올림 (백엔드가 그사이 바뀌었으면 다른 이름으로) */
+static int off_upload(struct off_node *n)
+{
+    char cp[PATH_MAX], dst[PATH_MAX], *buf = NULL;
+    struct stat st, bst;
+    struct fuse_file_info fi = { .flags = O_WRONLY | O_TRUNC };
+    int fd, res, create;
+
+    off_cpath(n->path, cp, sizeof(cp));
+    if ((fd = open(cp, O_RDONLY | O_CLOEXEC)) == -1)
+        return 0;   /* 사본이 없어짐 */
+    fstat(fd, &st);
+    snprintf(dst, sizeof(dst), "%s", n->path);
+    res = next_getattr(off.next, n->path, &bst, NULL);
+    create = res == -ENOENT;
+    if (res == 0 && !off_same(&bst, n->has_base, n->base_size, n->base_mtime.tv_sec,
+                              n->base_mtime.tv_nsec)) {
+        char what[PATH_MAX + 32];
+        snprintf(dst, sizeof(dst), "%s.conflict-%lld-%llu", n->path, (long long) time(NULL),
+                 __atomic_load_n(&off.conflicts, __ATOMIC_RELAXED));
+        snprintf(what, sizeof(what), "ours is uploaded as %s", dst);
+        off_conflict(n->path, what);
+        create = 1;
+    } else if (res && !create) {
+        goto out;
+    }
+    res = create ? next_create(off.next, dst, st.st_mode & 07777, &fi) :
+                   next_open(off.next, dst, &fi);
+    if (res == 0) {
+        off_t pos = 0;
+        ssize_t r = 0;
+        if ((buf = malloc(OFF_CHUNK)) == NULL)
+            res = -ENOMEM;
+        while (res == 0 && (r = pread(fd, buf, OFF_CHUNK, pos)) > 0) {
+            for (ssize_t w = 0; res == 0 && w < r;) {
+                int k = next_write(off.next, dst, buf + w, r - w, pos + w, &fi);
+                if (k <= 0)
+                    res = k < 0 ? k : -EIO;
+                w += k;
+            }
+            pos += r;
+        }
+        if (res == 0 && r < 0)
+            res = -EIO;
+        if (res == 0)
+            res = next_fsync(off.next, dst, 1, &fi);
+        next_release(off.next, dst, &fi);
+    }
+    if (res == 0) {
+        struct timespec ts[2] = { st.st_atim, st.st_mtim };
+        next_chmod(off.next, dst, st.st_mode & 07777, NULL);
+        next_utimens(off.next, dst, ts, NULL);
+        if (strcmp(dst, n->path) != 0) {
+            /* 이 경로의 사본은 백엔드 것을 다시 받음 */
+            char cd[PATH_MAX];
+            off_cpath(dst, cd, sizeof(cd));
+            rename(cp, cd);
+        } else if (next_getattr(off.next, dst, &bst, NULL) == 0 &&
+                   !ts_equal(&bst.st_mtim, &st.st_mtim)) {
+            ts[1] = bst.st_mtim;    /* mtime을 못 정하는 백엔드: 사본을 맞춤 */
+            futimens(fd, ts);
+        }
+        __atomic_fetch_add(&off.uploads, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&off.upload_bytes, st.st_size, __ATOMIC_RELAXED);
+    }
+out:
+    free(buf);
+    close(fd);
+    if (res && !backend_down(res)) {
+        fprintf(stderr, "[WARN] offline: could not upload %s: %s (left in %s)\n",
+                n->path, strerror(-res), cp);
+        res = 0;
+    }
+    return res;
+}
+
+/*
+ * 재생이 중간에 멈춤: 이미 재생한 기록을 빼고 남은 기록과 아직 올리지 않은 파일로
+ * log를 새로 씀 (실패하면 옛 log를 그대로 두고 다음에 처음부터).
+ */
+static void off_compact_locked(unsigned int done)
+{
+    char p[PATH_MAX], np[PATH_MAX];
+    unsigned int keep = 0;
+    off_t end = 0;
+    int fd, ok = 1;
+
+    snprintf(p, sizeof(p), "%s/log", options.offline);
+    snprintf(np, sizeof(np), "%s/log.new", options.offline);
+    if ((fd = open(np, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)) == -1)
+        return;
+    for (unsigned int i = done; i < off.nlog; i++) {
+        struct off_rec *r = off.log[i];
+        size_t len = sizeof(*r) + r->plen + r->plen2;
+        if (r->op == OFF_CREATE || r->op == OFF_DIRTY)
+            continue;
+        ok = ok && pwrite(fd, r, len, end) == (ssize_t) len;
+        end += len;
+    }
+    for (unsigned int b = 0; b < OFF_BUCKETS; b++)
+        for (struct off_node *n = off.table[b]; n; n = n->hnext) {
+            struct off_rec *r = off_rec_new(n->has_base ? OFF_DIRTY : OFF_CREATE, n->path, NULL);
+            if (r == NULL) {
+                ok = 0;
+                continue;
+            }
+            size_t len = sizeof(*r) + r->plen;
+            r->has_base = n->has_base;
+            r->base_size = n->base_size;
+            r->base_sec = n->base_mtime.tv_sec;
+            r->base_nsec = n->base_mtime.tv_nsec;
+            r->crc = crc32c(0, r, len);
+            ok = ok && pwrite(fd, r, len, end) == (ssize_t) len;
+            end += len;
+            free(r);
+        }
+    if (!ok || fdatasync(fd) == -1 || rename(np, p) == -1) {
+        close(fd);
+        unlink(np);
+        return;
+    }
+    close(off.logfd);
+    off.logfd = fd;
+    off.logend = end;
+    /* 메모리의 기록도 같게: 재생할 것만 (올릴 파일은 이미 표에 있음) */
+    for (unsigned int i = 0; i < off.nlog; i++) {
+        struct off_rec *r = off.log[i];
+        if (i >= done && r->op != OFF_CREATE && r->op != OFF_DIRTY)
+            off.log[keep++] = r;
+        else
+            free(r);
+    }
+    off.nlog = keep;
+}
+
+/* 백엔드가 돌아옴: 기록을 순서대로, 그다음 바뀐 파일을 올림 (변경은 기다리는 중) */
+static int off_replay(void)
+{
+    unsigned int i;
+    int err = 0;
+
+    for (i = 0; i < off.nlog; i++)
+        if ((err = off_replay_rec(off.log[i])) != 0)
+            break;
+    __atomic_fetch_add(&off.replayed_ops, i, __ATOMIC_RELAXED);
+
+    pthread_mutex_lock(&off.lock);
+    for (unsigned int b = 0; err == 0 && b < OFF_BUCKETS; b++)
+        while (err == 0 && off.table[b]) {
+            struct off_node *n = off.table[b];
+            pthread_mutex_unlock(&off.lock);
+            err = off_upload(n);
+            pthread_mutex_lock(&off.lock);
+            if (err == 0) {
+                off.table[b] = n->hnext;
+                off.ndirty--;
+                free(n->path);
+                free(n);
+            }
+        }
+    if (err) {
+        off_compact_locked(i);
+    } else {
+        for (i = 0; i < off.nlog; i++)
+            free(off.log[i]);
+        off.nlog = 0;
+        off.logend = 0;
+        if (ftruncate(off.logfd, 0) == -1)
+            fprintf(stderr, "[WARN] offline: %s/log: %s\n", options.offline, strerror(errno));
+    }
+    pthread_mutex_unlock(&off.lock);
+    return err;
+}
+
+/* 백그라운드: 오프라인이면 간격을 늘려 가며 확인, 돌아오면 재생, 평소에는 사본 받기 */
+static void *off_main(void *arg)
+{
+    (void) arg;
+
+    pthread_mutex_lock(&off.lock);
+    while (!off.stop) {
+        uint64_t now = now_ns();
+        if (off.state == OFF_OFFLINE) {
+            if (now < off.next_probe) {
+                struct timespec ts;
+                clock_gettime(CLOCK_MONOTONIC, &ts);
+                uint64_t at = (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec + (off.next_probe - now);
+                ts.tv_sec = at / 1000000000;
+                ts.tv_nsec = at % 1000000000;
+                pthread_cond_timedwait(&off.work, &off.lock, &ts);
+                continue;
+            }
+            pthread_mutex_unlock(&off.lock);
+            struct stat st;
+            int res = next_getattr(off.next, "/", &st, NULL);
+            pthread_mutex_lock(&off.lock);
+            off.probes++;
+            if (backend_down(res)) {
+                off.backoff_ms = off.backoff_ms * 2 < options.offline_retry_max_ms ?
+                                 off.backoff_ms * 2 : options.offline_retry_max_ms;
+                off.next_probe = now_ns() + (uint64_t) off.backoff_ms * 1000000;
+                continue;
+            }
+            fprintf(stderr, "[INFO] offline: backend is back after %.1f s, replaying %u changes"
+                            " and %u files\n", (now_ns() - off.since) / 1e9, off.nlog, off.ndirty);
+            off_set_locked(OFF_REPLAY);
+        } else if (off.state == OFF_ONLINE && (off.nlog || off.ndirty)) {
+            off_set_locked(OFF_REPLAY);     /* 사본으로 옮겨 간 핸들이 쓴 것 */
+        }
+        if (off.state == OFF_REPLAY) {
+            while (off.busy)
+                pthread_cond_wait(&off.work, &off.lock);
+            pthread_mutex_unlock(&off.lock);
+            int err = off_replay();
+            pthread_mutex_lock(&off.lock);
+            if (err) {
+                fprintf(stderr, "[WARN] offline: backend failed again while replaying (%s)\n",
+                        strerror(-err));
+                off.down_err = err;
+                off.since = now_ns();
+                off.backoff_ms = options.offline_retry_ms;
+                off.next_probe = off.since + (uint64_t) off.backoff_ms * 1000000;
+                off.downs++;
+                off_set_locked(OFF_OFFLINE);
+            } else {
+                off_set_locked(OFF_ONLINE);
+            }
+            pthread_cond_broadcast(&off.replayed);
+            continue;
+        }
+        if (off.nfetch && off.state == OFF_ONLINE) {
+            char *path = off.fetch[0].path;
+            memmove(off.fetch, off.fetch + 1, --off.nfetch * sizeof(off.fetch[0]));
+            pthread_mutex_unlock(&off.lock);
+            off_fetch(path);
+            free(path);
+            pthread_mutex_lock(&off.lock);
+            continue;
+        }
+        pthread_cond_wait(&off.work, &off.lock);
+    }
+    pthread_mutex_unlock(&off.lock);
+    return NULL;
+}
+
+/* 백엔드 핸들이 백엔드가 내려가 실패: 같은 파일의 사본으로 옮겨 감 */
+static int off_switch(const char *path, struct basic_fh *fh, int err)
+{
+    char cp[PATH_MAX];
+
+    if (off_online() && !off_confirm(err))
+        return 0;
+    off_cpath(path, cp, sizeof(cp));
+    int fd = open(cp, (fh->off_wr ? O_RDWR : O_RDONLY) | O_CLOEXEC);
+    if (fd == -1)
+        return 0;
+    pthread_mutex_lock(&off.lock);
+    if (fh->ofd >= 0) {
+        close(fd);
+    } else {
+        fh->ofd = fd;
+        if (fh->off_wr)
+            off.writers++;
+    }
+    pthread_mutex_unlock(&off.lock);
+    return 1;
+}
+
+static int off_getattr(int next, const char *path, struct stat *stbuf, struct fuse_file_info *fi)
+{
+    struct basic_fh *fh = fi ? get_fh(fi) : NULL;
+    char cp[PATH_MAX];
+
+    if (fh && fh->ofd >= 0)
+        return fstat(fh->ofd, stbuf) == -1 ? -errno : 0;
+    if (off_online() || strcmp(path, STATS_PATH) == 0) {
+        int res = next_getattr(next, path, stbuf, fi);
+        if (!backend_down(res))
+            return res;
+        off_fail(res);
+    }
+    off_cpath(path, cp, sizeof(cp));
+    return BACKEND(lstat(cp, stbuf)) == -1 ? -errno : 0;
+}
+
+static int off_readdir(int next, const char *path, void *buf, fuse_fill_dir_t filler,
+                       off_t offset, struct fuse_file_info *fi, enum fuse_readdir_flags flags)
+{
+    char cp[PATH_MAX], child[PATH_MAX];
+
+    if (off_online()) {
+        int res = next_readdir(next, path, buf, filler, offset, fi, flags);
+        if (!backend_down(res))
+            return res;
+        off_fail(res);
+    }
+    off_cpath(path, cp, sizeof(cp));
+    DIR *dp = BACKEND(opendir(cp));
+    if (dp == NULL)
+        return -errno;
+    struct dirent *de;
+    while ((de = readdir(dp)) != NULL) {
+        struct stat st;
+        if (snprintf(child, sizeof(child), "%s/%s", cp, de->d_name) >= (int) sizeof(child) ||
+            lstat(child, &st) == -1)
+            continue;
+        if (filler(buf, de->d_name, &st, 0, 0))
+            break;
+    }
+    closedir(dp);
+    return 0;
+}
+
+static int off_opendir(int next, const char *path, struct fuse_file_info *fi)
+{
+    char cp[PATH_MAX];
+    struct stat st;
+
+    if (off_online()) {
+        int res = next_opendir(next, path, fi);
+        if (!backend_down(res))
+            return res;
+        off_fail(res);
+    }
+    off_cpath(path, cp, sizeof(cp));
+    if (BACKEND(lstat(cp, &st)) == -1)
+        return -errno;
+    return S_ISDIR(st.st_mode) ? 0 : -ENOTDIR;
+}
+
+/* 사본으로 open/create: 사본이 없는 파일은 오프라인에서 열 수 없음 */
+static int off_open_local(const char *path, struct fuse_file_info *fi, int create, mode_t mode)
+{
+    char cp[PATH_MAX];
+    struct stat st;
+    int wr = (fi->flags & O_ACCMODE) != O_RDONLY || (fi->flags & O_TRUNC) || create;
+    int fd, res = 0;
+
+    off_cpath(path, cp, sizeof(cp));
+    if (!wr) {
+        if ((fd = BACKEND(open(cp, O_RDONLY | O_CLOEXEC))) == -1)
+            return errno == ENOENT ? off_err() : -errno;
+        __atomic_fetch_add(&off.local_ops, 1, __ATOMIC_RELAXED);
+    } else {
+        if (off_begin(0))
+            return OFF_AGAIN;
+        struct off_rec *r = NULL;
+        int exists = lstat(cp, &st) == 0;
+        if (!exists && !create)
+            res = off_err();
+        else if (exists && create && (fi->flags & O_EXCL))
+            res = -EEXIST;
+        else if (!exists && (r = off_rec_new(OFF_CREATE, path, NULL)) == NULL)
+            res = -ENOMEM;
+        else if (exists && (fi->flags & O_TRUNC))
+            res = off_dirty_locked(path);
+        fd = -1;
+        if (res == 0) {
+            int flags = O_RDWR | O_CLOEXEC | (fi->flags & (O_APPEND | O_TRUNC));
+            fd = BACKEND(open(cp, exists ? flags : flags | O_CREAT | O_EXCL, mode));
+            res = fd == -1 ? -errno : 0;
+        }
+        if (r)
+            res = off_commit_locked(r, res);
+        if (res == 0)
+            off.writers++;
+        pthread_mutex_unlock(&off.lock);
+        if (res) {
+            if (fd >= 0)
+                close(fd);
+            return res;
+        }
+    }
+    struct basic_fh *fh = fh_new(-1);
+    if (fh == NULL) {
+        close(fd);
+        if (wr) {
+            pthread_mutex_lock(&off.lock);
+            off.writers--;
+            pthread_mutex_unlock(&off.lock);
+        }
+        return -ENOMEM;
+    }
+    fh->ofd = fd;
+    fh->off_wr = wr;
+    fh->off_local = 1;
+    fi->fh = (uintptr_t) fh;
+    return 0;
+}
+
+static int off_create(int next, const char *path, mode_t mode, struct fuse_file_info *fi)
+{
+    int res;
+
+    do {
+        if (off_online()) {
+            res = next_create(next, path, mode, fi);
+            if (!backend_down(res)) {
+                if (res == 0)
+                    get_fh(fi)->off_wr = 1;
+                return res;
+            }
+            off_fail(res);
+        }
+        res = off_open_local(path, fi, 1, mode);
+    } while (res == OFF_AGAIN);
+    return res;
+}
+
+static int off_open(int next, const char *path, struct fuse_file_info *fi)
+{
+    int res;
+
+    if (strcmp(path, STATS_PATH) == 0)
+        return next_open(next, path, fi);
+    do {
+        if (off_online()) {
+            res = next_open(next, path, fi);
+            if (!backend_down(res)) {
+                /* 쓰기만 하는 핸들은 닫을 때 받음 */
+                if (res == 0) {
+                    get_fh(fi)->off_wr = (fi->flags & O_ACCMODE) != O_RDONLY;
+                    if ((fi->flags & O_ACCMODE) != O_WRONLY)
+                        off_want(path);
+                }
+                return res;
+            }
+            off_fail(res);
+        }
+        res = off_open_local(path, fi, 0, 0);
+    } while (res == OFF_AGAIN);
+    return res;
+}
+
+static int off_read(int next, const char *path, char *buf, size_t size, off_t offset,
+                    struct fuse_file_info *fi)
+{
+    struct basic_fh *fh = get_fh(fi);
+
+    if (fh->ofd < 0) {
+        int res = next_read(next, path, buf, size, offset, fi);
+        if (!backend_down(res) || !off_switch(path, fh, res))
+            return res;
+    }
+    ssize_t r = BACKEND(pread(fh->ofd, buf, size, offset));
+    return r == -1 ? -errno : (int) r;
+}
+
+static int off_write(int next, const char *path, const char *buf, size_t size, off_t offset,
+                     struct fuse_file_info *fi)
+{
+    struct basic_fh *fh = get_fh(fi);
+
+    if (fh->ofd < 0) {
+        int res = next_write(next, path, buf, size, offset, fi);
+        if (!backend_down(res) || !off_switch(path, fh, res))
+            return res;
+    }
+    /* 파일의 첫 변경이면 base를 기록하고, 재생이 이 write를 기다리게 함 */
+    off_begin(1);
+    int res = off_dirty_locked(path);
+    if (res == 0)
+        off.busy++;
+    pthread_mutex_unlock(&off.lock);
+    if (res)
+        return res;
+    ssize_t w = BACKEND(pwrite(fh->ofd, buf, size, offset));
+    pthread_mutex_lock(&off.lock);
+    if (--off.busy == 0)
+        pthread_cond_broadcast(&off.work);
+    pthread_mutex_unlock(&off.lock);
+    return w == -1 ? -errno : (int) w;
+}
+
+static int off_release(int next, const char *path, struct fuse_file_info *fi)
+{
+    struct basic_fh *fh = get_fh(fi);
+
+    if (fh && fh->ofd >= 0) {
+        close(fh->ofd);
+        fh->ofd = -1;
+        if (fh->off_wr) {
+            pthread_mutex_lock(&off.lock);
+            off.writers--;
+            pthread_mutex_unlock(&off.lock);
+        }
+        if (fh->off_local) {
+            free(fh);
+            fi->fh = 0;
+            return 0;
+        }
+    }
+    int wrote = fh && fh->off_wr && off_online();
+    int res = next_release(next, path, fi);
+    /* 백엔드에 쓴 내용으로 사본을 새로 (write-behind가 올린 것도) */
+    if (wrote)
+        off_want(path);
+    return res;
+}
+
+static int off_fsync(int next, const char *path, int datasync, struct fuse_file_info *fi)
+{
+    struct basic_fh *fh = get_fh(fi);
+
+    if (fh && fh->ofd < 0) {
+        int res = next_fsync(next, path, datasync, fi);
+        if (!backend_down(res) || !off_switch(path, fh, res))
+            return res;
+    }
+    if (fh && BACKEND(datasync ? fdatasync(fh->ofd) : fsync(fh->ofd)) == -1)
+        return -errno;
+    return 0;
+}
+
+static int off_unlink(int next, const char *path)
+{
+    char cp[PATH_MAX];
+    int res;
+
+    do {
+        if (off_online()) {
+            res = next_unlink(next, path);
+            if (!backend_down(res)) {
+                if (res == 0)
+                    off_follow(OFF_UNLINK, path, NULL, 0);
+                return res;
+            }
+            off_fail(res);
+        }
+    } while (off_begin(0));
+    off_cpath(path, cp, sizeof(cp));
+    struct off_rec *r = off_rec_new(OFF_UNLINK, path, NULL);
+    if (r == NULL) {
+        res = -ENOMEM;
+    } else {
+        off_base_locked(path, r);
+        res = off_commit_locked(r, BACKEND(unlink(cp)) == -1 ? -errno : 0);
+    }
+    pthread_mutex_unlock(&off.lock);
+    return res;
+}
+
+static int off_rename(int next, const char *from, const char *to, unsigned int flags)
+{
+    char cf[PATH_MAX], ct[PATH_MAX];
+    int res;
+
+    do {
+        if (off_online()) {
+            res = next_rename(next, from, to, flags);
+            if (!backend_down(res)) {
+                if (res == 0)
+                    off_follow(OFF_RENAME, from, to, 0);
+                return res;
+            }
+            off_fail(res);
+        }
+    } while (off_begin(0));
+    off_cpath(from, cf, sizeof(cf));
+    off_cpath(to, ct, sizeof(ct));
+    struct off_rec *r = flags ? NULL : off_rec_new(OFF_RENAME, from, to);
+    if (r == NULL) {
+        res = flags ? -EINVAL : -ENOMEM;
+    } else {
+        off_base_locked(from, r);
+        res = off_commit_locked(r, BACKEND(rename(cf, ct)) == -1 ? -errno : 0);
+    }
+    pthread_mutex_unlock(&off.lock);
+    return res;
+}
+
+static int off_mkdir(int next, const char *path, mode_t mode)
+{
+    char cp[PATH_MAX];
+    int res;
+
+    do {
+        if (off_online()) {
+            res = next_mkdir(next, path, mode);
+            if (!backend_down(res)) {
+                if (res == 0)
+                    off_follow(OFF_MKDIR, path, NULL, mode);
+                return res;
+            }
+            off_fail(res);
+        }
+    } while (off_begin(0));
+    off_cpath(path, cp, sizeof(cp));
+    struct off_rec *r = off_rec_new(OFF_MKDIR, path, NULL);
+    if (r == NULL) {
+        res = -ENOMEM;
+    } else {
+        r->mode = mode;
+        res = off_commit_locked(r, BACKEND(mkdir(cp, mode)) == -1 ? -errno : 0);
+    }
+    pthread_mutex_unlock(&off.lock);
+    return res;
+}
+
+static int off_rmdir(int next, const char *path)
+{
+    char cp[PATH_MAX];
+    int res;
+
+    do {
+        if (off_online()) {
+            res = next_rmdir(next, path);
+            if (!backend_down(res)) {
+                if (res == 0)
+                    off_follow(OFF_RMDIR, path, NULL, 0);
+                return res;
+            }
+            off_fail(res);
+        }
+    } while (off_begin(0));
+    off_cpath(path, cp, sizeof(cp));
+    struct off_rec *r = off_rec_new(OFF_RMDIR, path, NULL);
+    res = r ? off_commit_locked(r, BACKEND(rmdir(cp)) == -1 ? -errno : 0) : -ENOMEM;
+    pthread_mutex_unlock(&off.lock);
+    return res;
+}
+
+/*
+ * 사본의 속성 변경: 일반 파일은 내용과 함께 올라가므로 (mode, mtime 포함) 바뀐 파일로만
+ * 표시하고, 디렉터리는 그 변경을 기록한다.
+ */
+static int off_setattr_locked(const char *path, struct off_rec *r)
+{
+    char cp[PATH_MAX];
+    struct stat st;
+
+    off_cpath(path, cp, sizeof(cp));
+    if (BACKEND(lstat(cp, &st)) == -1) {
+        free(r);
+        return -errno;
+    }
+    if (!S_ISDIR(st.st_mode)) {
+        int res = off_dirty_locked(path);
+        if (res == 0 && r->op == OFF_CHMOD && BACKEND(chmod(cp, r->mode)) == -1)
+            res = -errno;
+        if (res == 0 && r->op == OFF_UTIMENS) {
+            struct timespec ts[2] = { { r->ts[0], r->ts[1] }, { r->ts[2], r->ts[3] } };
+            if (BACKEND(utimensat(AT_FDCWD, cp, ts, AT_SYMLINK_NOFOLLOW)) == -1)
+                res = -errno;
+        }
+        free(r);
+        return res;
+    }
+    if (r->op == OFF_CHMOD)
+        return off_commit_locked(r, BACKEND(chmod(cp, r->mode)) == -1 ? -errno : 0);
+    struct timespec ts[2] = { { r->ts[0], r->ts[1] }, { r->ts[2], r->ts[3] } };
+    return off_commit_locked(r, BACKEND(utimensat(AT_FDCWD, cp, ts, AT_SYMLINK_NOFOLLOW)) == -1 ?
+                                -errno : 0);
+}
+
+static int off_chmod(int next, const char *path, mode_t mode, struct fuse_file_info *fi)
+{
+    int res;
+
+    do {
+        if (off_online()) {
+            res = next_chmod(next, path, mode, fi);
+            if (!backend_down(res)) {
+                if (res == 0)
+                    off_follow(OFF_CHMOD, path, NULL, mode);
+                return res;
+            }
+            off_fail(res);
+        }
+    } while (off_begin(0));
+    struct off_rec *r = off_rec_new(OFF_CHMOD, path, NULL);
+    if (r) {
+        r->mode = mode;
+        res = off_setattr_locked(path, r);
+    } else {
+        res = -ENOMEM;
+    }
+    pthread_mutex_unlock(&off.lock);
+    return res;
+}
+
+static int off_utimens(int next, const char *path, const struct timespec ts[2],
+                       struct fuse_file_info *fi)
+{
+    int res;
+
+    do {
+        if (off_online()) {
+            res = next_utimens(next, path, ts, fi);
+            if (!backend_down(res))
+                return res;     /* 사본의 mtime이 달라져 다음 open 때 다시 받음 */
+            off_fail(res);
+        }
+    } while (off_begin(0));
+    struct off_rec *r = off_rec_new(OFF_UTIMENS, path, NULL);
+    if (r) {
+        struct timespec now[2] = { { 0, UTIME_NOW }, { 0, UTIME_NOW } };
+        const struct timespec *t = ts ? ts : now;
+        r->ts[0] = t[0].tv_sec;
+        r->ts[1] = t[0].tv_nsec;
+        r->ts[2] = t[1].tv_sec;
+        r->ts[3] = t[1].tv_nsec;
+        res = off_setattr_locked(path, r);
+    } else {
+        res = -ENOMEM;
+    }
+    pthread_mutex_unlock(&off.lock);
+    return res;
+}
+
+static int off_truncate(int next, const char *path, off_t size, struct fuse_file_info *fi)
+{
+    struct basic_fh *fh = fi ? get_fh(fi) : NULL;
+    int local = fh && fh->ofd >= 0, res;
+    char cp[PATH_MAX];
+
+    if (strcmp(path, STATS_PATH) == 0)
+        return next_truncate(next, path, size, fi);
+    do {
+        if (!local && off_online()) {
+            res = next_truncate(next, path, size, fi);
+            if (!backend_down(res))
+                return res;
+            off_fail(res);
+        }
+    } while (off_begin(local));
+    off_cpath(path, cp, sizeof(cp));
+    res = off_dirty_locked(path);
+    if (res == 0 && BACKEND(local ? ftruncate(fh->ofd, size) : truncate(cp, size)) == -1)
+        res = -errno;
+    pthread_mutex_unlock(&off.lock);
+    return res;
+}
+
+static const struct basic_layer off_layer = {
+    .name       = "offline",
+    .getattr    = off_getattr,
+    .readdir    = off_readdir,
+    .create     = off_create,
+    .open       = off_open,
+    .read       = off_read,
+    .write      = off_write,
+    .unlink     = off_unlink,
+    .rename     = off_rename,
+    .release    = off_release,
+    .mkdir      = off_mkdir,
+    .rmdir      = off_rmdir,
+    .chmod      = off_chmod,
+    .truncate   = off_truncate,
+    .utimens    = off_utimens,
+    .opendir    = off_opendir,
+    .fsync      = off_fsync,
+};
+
+/*
+ * 시작: DIR/data, DIR/tmp를 만들고 DIR/log를 다시 읽음. 재생하지 못한 기록이 있으면
+ * 오프라인으로 시작해 백엔드가 확인되는 대로 재생한다.
+ */
+static int off_recover(void)
+{
+    char p[PATH_MAX];
+    struct off_rec hdr;
+    DIR *dp;
+
+    snprintf(p, sizeof(p), "%s/data", options.offline);
+    if (mkdir(p, 0755) == -1 && errno != EEXIST)
+        return -errno;
+    snprintf(p, sizeof(p), "%s/tmp", options.offline);
+    if (mkdir(p, 0700) == -1 && errno != EEXIST)
+        return -errno;
+    if ((dp = opendir(p)) != NULL) {
+        struct dirent *de;
+        while ((de = readdir(dp)) != NULL)
+            if (de->d_name[0] != '.')
+                unlinkat(dirfd(dp), de->d_name, 0);
+        closedir(dp);
+    }
+    snprintf(p, sizeof(p), "%s/log", options.offline);
+    if ((off.logfd = open(p, O_RDWR | O_CREAT | O_CLOEXEC, 0600)) == -1)
+        return -errno;
+
+    while (pread(off.logfd, &hdr, sizeof(hdr), off.logend) == (ssize_t) sizeof(hdr) &&
+           hdr.magic == OFF_MAGIC && hdr.plen > 0 && hdr.plen <= PATH_MAX &&
+           hdr.plen2 <= PATH_MAX) {
+        size_t len = sizeof(hdr) + hdr.plen + hdr.plen2;
+        struct off_rec *r = malloc(len);
+        if (r == NULL)
+            return -ENOMEM;
+        uint32_t crc = hdr.crc;
+        int good = pread(off.logfd, r, len, off.logend) == (ssize_t) len;
+        r->crc = 0;
+        if (!good || crc32c(0, r, len) != crc || r->path[r->plen - 1] != '\0' ||
+            (r->plen2 && r->path[r->plen + r->plen2 - 1] != '\0')) {
+            free(r);
+            break;
+        }
+        r->crc = crc;
+        if (off.nlog == off.logcap) {
+            unsigned int cap = off.logcap ? off.logcap * 2 : 64;
+            struct off_rec **n = realloc(off.log, cap * sizeof(*n));
+            if (n == NULL) {
+                free(r);
+                return -ENOMEM;
+            }
+            off.log = n;
+            off.logcap = cap;
+        }
+        off.log[off.nlog++] = r;
+        off_apply_locked(r);
+        off.logend += len;
+    }
+    /* 잘린 꼬리는 다음 기록이 덮지 않도록 잘라 둠 */
+    if (ftruncate(off.logfd, off.logend) == -1)
+        return -errno;
+    if (off.nlog) {
+        off.state = OFF_OFFLINE;
+        off.down_err = -EIO;
+        off.since = now_ns();
+        off.backoff_ms = options.offline_retry_ms;
+        fprintf(stderr, "[INFO] offline: %u changes (%u files) in %s still to replay\n",
+                off.nlog, off.ndirty, options.offline);
+    }
+    return 0;
+}
+
+static int off_start(void)
+{
+    if (pthread_create(&off.thread, NULL, off_main, NULL) != 0)
+        return -EAGAIN;
+    off.running = 1;
+    return 0;
+}
+
+static void off_stop(void)
+{
+    if (!off.running)
+        return;
+    pthread_mutex_lock(&off.lock);
+    off.stop = 1;
+    pthread_cond_signal(&off.work);
+    pthread_mutex_unlock(&off.lock);
+    pthread_join(off.thread, NULL);
+    off.running = 0;
+    while (off.nfetch)
+        free(off.fetch[--off.nfetch].path);
+    if (off.nlog || off.ndirty)
+        fprintf(stderr, "[WARN] offline: %u changes (%u files) left in %s for the next start\n",
+                off.nlog, off.ndirty, options.offline);
+}
+
+/*
+ * breaker layer: 백엔드 바로 위에서 모든 호출을 backend_brk로 감싼다 (원리는 위
+ * brk_enter 설명). 통계 파일은 백엔드와 무관하니 그대로, release는 핸들을 닫아야
+ * 하므로 열려 있어도 보낸다.
+ */
+#define BRK_CALL(mode, call) ({                                         \
+        int brk_s_ = brk_enter(&backend_brk, (mode));                   \
+        brk_s_ < 0 ? brk_s_ : brk_leave(&backend_brk, brk_s_, (call));  \
+    })
+
+static int brk_getattr(int next, const char *path, struct stat *stbuf, struct fuse_file_info *fi)
+{
+    if (strcmp(path, STATS_PATH) == 0)
+        return next_getattr(next, path, stbuf, fi);
+    return BRK_CALL(BRK_WAIT, next_getattr(next, path, stbuf, fi));
+}
+
+static int brk_readdir(int next, const char *path, void *buf, fuse_fill_dir_t filler,
+                       off_t offset, struct fuse_file_info *fi, enum fuse_readdir_flags flags)
+{
+    return BRK_CALL(BRK_WAIT, next_readdir(next, path, buf, filler, offset, fi, flags));
+}
+
+static int brk_create(int next, const char *path, mode_t mode, struct fuse_file_info *fi)
+{
+    return BRK_CALL(BRK_WAIT, next_create(next, path, mode, fi));
+}
+
+static int brk_open(int next, const char *path, struct fuse_file_info *fi)
+{
+    if (strcmp(path, STATS_PATH) == 0)
+        return next_open(next, path, fi);
+    return BRK_CALL(BRK_WAIT, next_open(next, path, fi));
+}
+
+static int brk_read(int next, const char *path, char *buf, size_t size, off_t offset,
+                    struct fuse_file_info *fi)
+{
+    if (strcmp(path, STATS_PATH) == 0)
+        return next_read(next, path, buf, size, offset, fi);
+    return BRK_CALL(BRK_WAIT, next_read(next, path, buf, size, offset, fi));
+}
+
+static int brk_write(int next, const char *path, const char *buf, size_t size, off_t offset,
+                     struct fuse_file_info *fi)
+{
+    return BRK_CALL(BRK_WAIT, next_write(next, path, buf, size, offset, fi));
+}
+
+static int brk_unlink(int next, const char *path)
+{
+    return BRK_CALL(BRK_WAIT, next_unlink(next, path));
+}
+
+static int brk_rename(int next, const char *from, const char *to, unsigned int flags)
+{
+    return BRK_CALL(BRK_WAIT, next_rename(next, from, to, flags));
+}
+
+static int brk_release(int next, const char *path, struct fuse_file_info *fi)
+{
+    if (strcmp(path, STATS_PATH) == 0)
+        return next_release(next, path, fi);
+    return BRK_CALL(BRK_FORCE, next_release(next, path, fi));
+}
+
+static int brk_mkdir(int next, const char *path, mode_t mode)
+{
+    return BRK_CALL(BRK_WAIT, next_mkdir(next, path, mode));
+}
+
+static int brk_rmdir(int next, const char *path)
+{
+    return BRK_CALL(BRK_WAIT, next_rmdir(next, path));
+}
+
+static int brk_chmod(int next, const char *path, mode_t mode, struct fuse_file_info *fi)
+{
+    return BRK_CALL(BRK_WAIT, next_chmod(next, path, mode, fi));
+}
+
+static int brk_truncate(int next, const char *path, off_t size, struct fuse_file_info *fi)
+{
+    if (strcmp(path, STATS_PATH) == 0)
+        return next_truncate(next, path, size, fi);
+    return BRK_CALL(BRK_WAIT, next_truncate(next, path, size, fi));
+}
+
+static int brk_utimens(int next, const char *path, const struct timespec ts[2],
+                       struct fuse_file_info *fi)
+{
+    return BRK_CALL(BRK_WAIT, next_utimens(next, path, ts, fi));
+}
+
+static int brk_opendir(int next, const char *path, struct fuse_file_info *fi)
+{
+    return BRK_CALL(BRK_WAIT, next_opendir(next, path, fi));
+}
+
+static int brk_fsync(int next, const char *path, int datasync, struct fuse_file_info *fi)
+{
+    return BRK_CALL(BRK_WAIT, next_fsync(next, path, datasync, fi));
+}
+
+static const struct basic_layer brk_layer = {
+    .name       = "breaker",
+    .getattr    = brk_getattr,
+    .readdir    = brk_readdir,
+    .create     = brk_create,
+    .open       = brk_open,
+    .read       = brk_read,
+    .write      = brk_write,
+    .unlink     = brk_unlink,
+    .rename     = brk_rename,
+    .release    = brk_release,
+    .mkdir      = brk_mkdir,
+    .rmdir      = brk_rmdir,
+    .chmod      = brk_chmod,
+    .truncate   = brk_truncate,
+    .utimens    = brk_utimens,
+    .opendir    = brk_opendir,
+    .fsync      = brk_fsync,
+};
+
+/*
+ * integrity layer: 파일을 integrity_block 크기 블록으로 나눠 블록마다 keyed
+ * BLAKE3 태그를 두고, read 때 검증하고 write/truncate 때 갱신한다.
+ *
+ * 태그는 같은 디렉토리의 숨김 sidecar 파일(TAG_PREFIX + 이름)에 헤더 다음
+ * 블록 순서대로 저장하며, sidecar와 데이터는 모두 아래 layer를 통해 읽고 쓴다.
+ * 블록 i의 태그는 파일 전체 BLAKE3 트리에서 그 블록에 해당하는 부분 트리의
+ * chaining value라 chunk 번호로 위치가 묶이고, 키는 integrity_key로 헤더의
+ * 파일별 nonce를 해시한 파일 키라 다른 파일의 같은 위치 블록과도 태그가 다르다.
+ * 헤더의 root는 파일 크기와 모든 태그에 대한 keyed 해시로, 마지막 핸들이 닫힐
+ * 때 계산해 두고 open 때 검증한다. 비정상 종료로 dirty가 남은 파일은 root 대신
+ * 현재 크기의 모든 블록을 태그로 다시 검증한다.
+ *
+ * 헤더 자체는 integrity_key(키가 없는 마운트면 키 없는 BLAKE3)로 만든 mac으로
+ * 보호해 flags, 크기, 방식, 키 버전을 바꿔치기할 수 없다. 키가 없던 마운트에서
+ * 만든 태그는 나중에 키를 주면 헤더가 맞지 않으므로 sidecar를 지우고
+ * integrity_adopt로 다시 만들어야 한다.
+ */
+#define TAG_PREFIX ".bft."
+#define TAG_MAGIC "BFTAGS02"    /* 01: 헤더 mac과 nonce 이전 (읽지 않음) */
+#define TAG_HDR_SIZE 128
+#define TAG_MAX 32              /* 가장 긴 태그 (blake3) */
+#define TAG_DIRTY 1             /* root가 태그와 맞지 않을 수 있음 (열려서 수정 중) */
+#define TAG_INTERLEAVED 2       /* 헤더와 태그가 데이터 파일 안에 있음 */
+#define ILV_SLOT TAG_MAX        /* interleaved 태그 자리: 방식과 무관하게 고정해야
+                                   크기 계산이 파일마다 같음 */
+#define INTEG_SLAB (4 * 1024 * 1024)    /* 태그를 다시 계산할 때 한 번에 읽는 크기 */
+
+enum { TAG_ALG_BLAKE3 = 1, TAG_ALG_CRC32C = 2 };
+
+/* 헤더의 alg 값마다 이름과 태그 크기. 검증 경로는 모두 같고 태그 계산만 다름 */
+static const struct tag_alg {
+    const char *name;
+    uint32_t id;
+    uint32_t tag_size;
+} tag_algs[] = {
+    { "blake3", TAG_ALG_BLAKE3, 32 },   /* keyed: 변조 검출 */
+    { "crc32c", TAG_ALG_CRC32C, 4 },    /* 키 없음: bit-rot 검출만 */
+};
+
+static const struct tag_alg *tag_alg_find(const char *name, uint32_t id)
+{
+    for (size_t i = 0; i < sizeof(tag_algs) / sizeof(tag_algs[0]); i++)
+        if (name ? strcmp(tag_algs[i].name, name) == 0 : tag_algs[i].id == id)
+            return &tag_algs[i];
+    return NULL;
+}
+
+/*
+ * 경로별 정책 (integrity_paths=/logs=crc32c@sampled:/secure=blake3): 파일에 가장
+ * 길게 일치하는 접두 경로의 방식을 쓰고, 없으면 integrity 기본값. 헤더의 방식이
+ * 경로의 방식과 다른 파일은 열지 않는다 (blake3 자리에 crc32c 태그를 넣는 격하
+ * 방지). 정책이 다른 곳으로의 rename은 EXDEV라 mv가 복사해 태그를 새로 만든다.
+ * "@검증 방식"은 태그와 무관하게 열 때마다 경로로 정하며, 없으면 integrity_verify.
+ */
+#define INTEG_POLICY_MAX 16
+
+static struct {
+    char *prefix;
+    size_t len;
+    const struct tag_alg *alg;
+    int verify;                 /* -1이면 integ_verify */
+} integ_policy[INTEG_POLICY_MAX];
+static int integ_npolicy;
+static const struct tag_alg *integ_default;
+static int integ_verify;            /* integrity_verify */
+
+struct tag_hdr {
+    char magic[8];
+    uint32_t alg;
+    uint32_t block_size;
+    uint32_t tag_size;
+    uint32_t flags;
+    uint64_t file_size;         /* 태그가 덮는 논리 크기 (dirty 동안은 데이터 파일 크기) */
+    uint8_t root[32];
+    uint32_t group;             /* interleaved: 태그 묶음 하나가 따르는 데이터 블록 수 */
+    uint32_t key_version;       /* blake3 키 버전 */
+    uint64_t rekey_next;        /* 키 교체 중: 이 블록 앞은 새 키, 뒤는 이전 키 */
+    uint8_t nonce[16];          /* 파일 키를 만드는 값, 태그를 처음 만들 때 정함 */
+    uint8_t mac[32];            /* 앞의 모든 필드에 대한 해시 (hdr_mac) */
+};
+_Static_assert(sizeof(struct tag_hdr) == TAG_HDR_SIZE, "tag header layout");
+
+/* 열린 파일(inode)마다 하나, 같은 파일의 핸들들이 공유 */
+struct integ_file {
+    dev_t dev;
+    ino_t ino;
+    unsigned int refs;              /* itab.lock */
+    int busy;                       /* itab.lock: 읽어 들이거나 닫는 중 (다른 open은 대기) */
+    pthread_rwlock_t lock;          /* read는 공유, 태그를 바꾸는 연산은 배타 */
+    struct fuse_file_info tfi;      /* sidecar 핸들 (O_RDWR) */
+    struct fuse_file_info dfi;      /* 태그 재계산용 데이터 읽기 핸들 */
+    char *path, *tpath;             /* 연 시점의 경로 (핸들 기반이라 참고용) */
+    const struct tag_alg *alg;      /* hdr.alg에 해당 */
+    int ilv;                        /* interleaved 배치 (dfi가 O_RDWR, sidecar 없음) */
+    int verify;                     /* VERIFY_* */
+    uint64_t *seen;                 /* first-touch: 검증한 블록 (read는 원자적으로 set) */
+    size_t nseen;                   /* seen의 word 수, 크기를 바꾸는 쪽(wrlock)이 늘림 */
+    struct tag_hdr hdr;
+    struct b3_key key, old_key;     /* integ_key, integ_old_key에서 만든 파일 키 */
+    struct integ_file *next;
+};
+
+#define ITAB_SLOTS 256
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;            /* busy였던 항목이 끝남 */
+    struct integ_file *slot[ITAB_SLOTS];
+} itab = { .lock = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER };
+
+static struct b3_key integ_key;         /* 버전 integrity_key_version */
+static struct b3_key integ_old_key;     /* 버전 integrity_key_version - 1, 교체 중에만 */
+static int integ_interleaved;       /* integrity_layout=interleaved */
+
+/* path에 적용할 방식, verify가 있으면 검증 방식도 */
+static const struct tag_alg *integ_alg_for(const char *path, int *verify)
+{
+    const struct tag_alg *alg = integ_default;
+    int v = -1;
+    size_t best = 0;
+
+    for (int i = 0; i < integ_npolicy; i++) {
+        size_t len = integ_policy[i].len;
+        if (len >= best && strncmp(path, integ_policy[i].prefix, len) == 0 &&
+            (path[len] == '\0' || path[len] == '/' || len == 1)) {
+            alg = integ_policy[i].alg;
+            v = integ_policy[i].verify;
+            best = len;
+        }
+    }
+    if (verify)
+        *verify = v < 0 ? integ_verify : v;
+    return alg;
+}
+
+static int verify_find(const char *name)
+{
+    for (int m = 0; m < VERIFY_MODES; m++)
+        if (strcmp(verify_names[m], name) == 0)
+            return m;
+    return -1;
+}
+
+/* "/logs=crc32c@sampled:/secure=blake3" */
+static int integ_policy_parse(const char *spec)
+{
+    char *copy = strdup(spec), *save = NULL;
+    if (copy == NULL)
+        return -ENOMEM;
+
+    int err = 0;
+    for (char *ent = strtok_r(copy, ":", &save); ent && err == 0;
+         ent = strtok_r(NULL, ":", &save)) {
+        char *eq = strrchr(ent, '=');
+        size_t len;
+        if (eq == NULL || ent[0] != '/' || integ_npolicy == INTEG_POLICY_MAX) {
+            err = -EINVAL;
+            break;
+        }
+        *eq = '\0';
+        len = strlen(ent);
+        while (len > 1 && ent[len - 1] == '/')
+            ent[--len] = '\0';
+        char *at = strchr(eq + 1, '@');
+        if (at)
+            *at++ = '\0';
+        integ_policy[integ_npolicy].alg = tag_alg_find(eq + 1, 0);
+        integ_policy[integ_npolicy].verify = at ? verify_find(at) : -1;
+        integ_policy[integ_npolicy].prefix = strdup(ent);
+        integ_policy[integ_npolicy].len = len;
+        if (integ_policy[integ_npolicy].alg == NULL || (at && integ_policy[integ_npolicy].verify < 0) ||
+            integ_policy[integ_npolicy].prefix == NULL)
+            err = -EINVAL;
+        else
+            integ_npolicy++;
+    }
+    free(copy);
+    return err;
+}
+
+static int is_tag_name(const char *path)
+{
+    const char *base = strrchr(path, '/');
+    return strncmp(base ? base + 1 : path, TAG_PREFIX, strlen(TAG_PREFIX)) == 0;
+}
+
+/* "/dir/name" -> "/dir/.bft.name" */
+static int tag_path(const char *path, char *out, size_t len)
+{
+    const char *base = strrchr(path, '/') + 1;
+    int n = snprintf(out, len, "%.*s%s%s", (int) (base - path), path, TAG_PREFIX, base);
+    return n < 0 || (size_t) n >= len ? -ENAMETOOLONG : 0;
+}
+
+/* 짧은 read/write를 이어 붙여 len 전체를 처리, read는 EOF에서 멈춤 */
+static ssize_t io_full(int next, const char *path, void *buf, size_t len, off_t off,
+                       struct fuse_file_info *fi, int write)
+{
+    size_t done = 0;
+
+    while (done < len) {
+        size_t n = len - done > INT_MAX ? INT_MAX : len - done;
+        int r = write ? next_write(next, path, (const char *) buf + done, n, off + done, fi)
+                      : next_read(next, path, (char *) buf + done, n, off + done, fi);
+        if (r < 0)
+            return r;
+        if (r == 0)
+            break;
+        done += r;
+    }
+    return done;
+}
+
+static uint64_t integ_blocks(uint64_t size)
+{
+    return (size + options.integrity_block - 1) / options.integrity_block;
+}
+
+/* 블록 b의 태그를 만든 키: 교체 중인 파일은 rekey_next 앞만 새 키 */
+static const struct b3_key *integ_block_key(const struct integ_file *f, uint64_t b)
+{
+    if (f->hdr.key_version == options.integrity_key_version || b < f->hdr.rekey_next)
+        return &f->key;
+    return &f->old_key;
+}
+
+struct tag_work {
+    const struct integ_file *f;
+    const struct b3_key *key;   /* NULL이면 블록 위치로 정함 */
+    const uint8_t *data;
+    size_t len;
+    uint64_t first;     /* data[0]이 속한 블록 번호 */
+    uint8_t *tags;
+};
+
+static void tag_block(void *arg, unsigned int i)
+{
+    const struct tag_work *w = arg;
+    size_t bs = options.integrity_block;
+    size_t off = (size_t) i * bs;
+    size_t n = w->len - off < bs ? w->len - off : bs;
+    uint8_t *tag = w->tags + (size_t) i * w->f->alg->tag_size;
+    const struct b3_key *key = w->key ? w->key : integ_block_key(w->f, w->first + i);
+    uint32_t cv[8];
+
+    switch (w->f->alg->id) {
+    case TAG_ALG_BLAKE3:
+        b3_tree(key, w->data + off, n, (w->first + i) * (bs / B3_CHUNK), 0, cv);
+        for (int k = 0; k < 8; k++)
+            store32(tag + 4 * k, cv[k]);
+        break;
+    case TAG_ALG_CRC32C:
+        /* 블록 번호를 초기값으로 써서 다른 위치에 잘못 쓰인 블록도 걸러냄 */
+        store32(tag, crc32c((uint32_t) (w->first + i), w->data + off, n));
+        break;
+    }
+}
+
+/*
+ * 블록 경계에서 시작하는 len바이트의 블록별 태그. blake3는 블록이 여럿이면
+ * hash pool과 나누고, crc32c는 메모리 대역폭이 한계라 그대로 계산한다.
+ */
+static void tags_compute(const struct integ_file *f, const struct b3_key *key,
+                         const void *data, size_t len, uint64_t first, uint8_t *tags)
+{
+    uint64_t t0 = now_ns();
+    struct tag_work w = { f, key, data, len, first, tags };
+    unsigned int n = integ_blocks(len);
+
+    if (f->alg->id == TAG_ALG_BLAKE3) {
+        hpool_run(tag_block, &w, n);
+    } else {
+        for (unsigned int i = 0; i < n; i++)
+            tag_block(&w, i);
+    }
+    cur_req.hash_ns += now_ns() - t0;
+    __atomic_fetch_add(&istat.hashed, n, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&istat.hashed_bytes, len, __ATOMIC_RELAXED);
+}
+
+/* 비교 시간이 내용에 따라 달라지지 않도록 */
+static int tag_equal(const uint8_t *a, const uint8_t *b, size_t len)
+{
+    uint8_t d = 0;
+    for (size_t i = 0; i < len; i++)
+        d |= a[i] ^ b[i];
+    return d == 0;
+}
+
+static int tags_io(int next, struct integ_file *f, uint8_t *tags, uint64_t first,
+                   uint64_t n, int write)
+{
+    size_t ts = f->hdr.tag_size;
+    size_t len = n * ts;
+    ssize_t r = io_full(next, f->tpath, tags, len, TAG_HDR_SIZE + first * ts,
+                        &f->tfi, write);
+    if (r < 0)
+        return r;
+    return (size_t) r == len ? 0 : -EIO;
+}
+
+/* 헤더의 키 버전에 맞는 integrity_key, 키가 없는 마운트면 키 없는 해시 */
+static const struct b3_key *hdr_key(const struct integ_file *f)
+{
+    static const struct b3_key unkeyed = {     /* words = b3_iv */
+        { 0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+          0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19 }, 0
+    };
+
+    if (integ_key.flags == 0)
+        return &unkeyed;
+    if (f->hdr.key_version == options.integrity_key_version)
+        return &integ_key;
+    if (f->hdr.key_version + 1 == options.integrity_key_version && integ_old_key.flags)
+        return &integ_old_key;
+    return NULL;
+}
+
+static void hdr_mac(const struct integ_file *f, uint8_t mac[32])
+{
+    b3_hash(hdr_key(f), &f->hdr, offsetof(struct tag_hdr, mac), mac);
+}
+
+/* 파일 키 = 마스터 키로 nonce를 해시한 값 (마스터 키가 없으면 비워 둠) */
+static void integ_file_key(const struct b3_key *master, const uint8_t nonce[16],
+                           struct b3_key *out)
+{
+    uint8_t k[32];
+
+    memset(out, 0, sizeof(*out));
+    if (master->flags == 0)
+        return;
+    b3_hash(master, nonce, 16, k);
+    for (int i = 0; i < 8; i++)
+        out->words[i] = load32(k + 4 * i);
+    out->flags = B3_KEYED;
+    memset(k, 0, sizeof(k));
+}
+
+static void integ_file_keys(struct integ_file *f)
+{
+    integ_file_key(&integ_key, f->hdr.nonce, &f->key);
+    integ_file_key(&integ_old_key, f->hdr.nonce, &f->old_key);
+}
+
+static int hdr_write(int next, struct integ_file *f)
+{
+    hdr_mac(f, f->hdr.mac);
+    ssize_t r = f->ilv ? io_full(next, f->path, &f->hdr, TAG_HDR_SIZE, 0, &f->dfi, 1)
+                       : io_full(next, f->tpath, &f->hdr, TAG_HDR_SIZE, 0, &f->tfi, 1);
+    if (r < 0)
+        return r;
+    return r == TAG_HDR_SIZE ? 0 : -EIO;
+}
+
+static off_t ilv_tag_pos(uint64_t b, uint64_t size);
+
+/* 블록 0..n-1의 태그를 이어서 읽음 (interleaved면 묶음마다 태그 자리에서) */
+static int tags_read_all(int next, struct integ_file *f, uint8_t *tags, uint64_t n)
+{
+    if (!f->ilv)
+        return tags_io(next, f, tags, 0, n, 0);
+
+    uint64_t G = options.integrity_group, ts = f->hdr.tag_size;
+    uint8_t *slots = malloc(G * ILV_SLOT);
+    int err = slots ? 0 : -ENOMEM;
+
+    for (uint64_t b = 0; err == 0 && b < n; b += G) {
+        uint64_t m = n - b < G ? n - b : G;
+        if (io_full(next, f->path, slots, m * ILV_SLOT, ilv_tag_pos(b, f->hdr.file_size),
+                    &f->dfi, 0) != (ssize_t) (m * ILV_SLOT))
+            err = -EIO;
+        for (uint64_t i = 0; err == 0 && i < m; i++)
+            memcpy(tags + (b + i) * ts, slots + i * ILV_SLOT, ts);
+    }
+    free(slots);
+    return err;
+}
+
+/* root = 파일 방식의 해시(파일 크기 || 모든 블록 태그), crc32c면 앞 4바이트만 */
+static int root_compute(int next, struct integ_file *f, uint8_t root[32])
+{
+    uint64_t n = integ_blocks(f->hdr.file_size);
+    size_t len = 8 + n * f->hdr.tag_size;
+    uint8_t *buf = malloc(len);
+    if (buf == NULL)
+        return -ENOMEM;
+
+    for (int i = 0; i < 8; i++)
+        buf[i] = f->hdr.file_size >> (8 * i);
+    int err = tags_read_all(next, f, buf + 8, n);
+    if (err == 0) {
+        uint64_t t0 = now_ns();
+        memset(root, 0, 32);
+        /* 교체 중에는 이전 키, 끝나면 새 키 (끝낼 때 dirty라 다시 계산됨) */
+        if (f->hdr.alg == TAG_ALG_BLAKE3)
+            b3_hash(f->hdr.key_version == options.integrity_key_version ? &f->key : &f->old_key,
+                    buf, len, root);
+        else
+            store32(root, crc32c(0, buf, len));
+        cur_req.hash_ns += now_ns() - t0;
+    }
+    free(buf);
+    return err;
+}
+
+/* 처음 수정할 때 dirty를 기록해 두면 비정상 종료 후에도 알 수 있음 */
+static int integ_mark_dirty(int next, struct integ_file *f)
+{
+    if (f->hdr.flags & TAG_DIRTY)
+        return 0;
+    f->hdr.flags |= TAG_DIRTY;
+    return hdr_write(next, f);
+}
+
+/*
+ * 블록 경계 start부터 end까지의 태그를 다시 계산해 저장.
+ * [blo, bhi)는 방금 쓴 buf의 내용을 쓰고 나머지는 데이터 파일에서 읽는다.
+ */
+static int tags_rebuild(int next, struct integ_file *f, off_t start, off_t end,
+                        const char *buf, off_t blo, off_t bhi)
+{
+    size_t bs = options.integrity_block;
+    size_t slab = INTEG_SLAB / bs * bs;
+    char *data = malloc(end - start < (off_t) slab ? (size_t) (end - start) : slab);
+    uint8_t *tags = malloc(integ_blocks(slab) * TAG_MAX);
+    int err = 0;
+
+    if (end > start && (data == NULL || tags == NULL))
+        err = -ENOMEM;
+
+    for (off_t s = start; err == 0 && s < end; s += slab) {
+        off_t e = end - s < (off_t) slab ? end : s + (off_t) slab;
+        off_t clo = blo > s ? blo : s, chi = bhi < e ? bhi : e;
+
+        if (buf == NULL || clo >= chi)
+            clo = chi = e;
+        if (clo > s && io_full(next, f->path, data, clo - s, s, &f->dfi, 0) != clo - s)
+            err = -EIO;
+        if (chi < e && io_full(next, f->path, data + (chi - s), e - chi, chi,
+                               &f->dfi, 0) != e - chi)
+            err = -EIO;
+        if (err)
+            break;
+        if (clo < chi)
+            memcpy(data + (clo - s), buf + (clo - blo), chi - clo);
+
+        tags_compute(f, NULL, data, e - s, s / bs, tags);
+        err = tags_io(next, f, tags, s / bs, integ_blocks(e - s), 1);
+    }
+
+    free(data);
+    free(tags);
+    return err;
+}
+
+static struct integ_file **itab_find_locked(dev_t dev, ino_t ino)
+{
+    struct integ_file **pp = &itab.slot[(ino ^ dev) % ITAB_SLOTS];
+    while (*pp && ((*pp)->dev != dev || (*pp)->ino != ino))
+        pp = &(*pp)->next;
+    return pp;
+}
+
+static void integ_free(int next, struct integ_file *f)
+{
+    if (f->tfi.fh)
+        next_release(next, f->tpath, &f->tfi);
+    if (f->dfi.fh)
+        next_release(next, f->path, &f->dfi);
+    pthread_rwlock_destroy(&f->lock);
+    memset(&f->key, 0, sizeof(f->key));
+    memset(&f->old_key, 0, sizeof(f->old_key));
+    free(f->path);
+    free(f->tpath);
+    free(f->seen);
+    free(f);
+}
+
+static int hdr_init(struct integ_file *f, uint64_t size)
+{
+    if (getrandom(f->hdr.nonce, sizeof(f->hdr.nonce), 0) != (ssize_t) sizeof(f->hdr.nonce))
+        return -EIO;
+    integ_file_keys(f);
+    f->alg = integ_alg_for(f->path, NULL);
+    memcpy(f->hdr.magic, TAG_MAGIC, sizeof(f->hdr.magic));
+    f->hdr.alg = f->alg->id;
+    f->hdr.block_size = options.integrity_block;
+    f->hdr.tag_size = f->alg->tag_size;
+    f->hdr.flags = TAG_DIRTY | (f->ilv ? TAG_INTERLEAVED : 0);
+    f->hdr.group = f->ilv ? options.integrity_group : 0;
+    f->hdr.key_version = options.integrity_key_version;
+    f->hdr.file_size = size;
+    return 0;
+}
+
+static int hdr_check(struct integ_file *f)
+{
+    if (memcmp(f->hdr.magic, TAG_MAGIC, sizeof(f->hdr.magic)) != 0 ||
+        (f->alg = tag_alg_find(NULL, f->hdr.alg)) == NULL ||
+        f->hdr.tag_size != f->alg->tag_size ||
+        f->hdr.block_size != options.integrity_block ||
+        !(f->hdr.flags & TAG_INTERLEAVED) != !f->ilv ||
+        (f->ilv && f->hdr.group != options.integrity_group)) {
+        fprintf(stderr, "[WARN] integrity: %s: bad or incompatible tag header\n", f->path);
+        return -EIO;
+    }
+    if (f->alg != integ_alg_for(f->path, NULL)) {
+        fprintf(stderr, "[WARN] integrity: %s: %s tags where %s is required\n",
+                f->path, f->alg->name, integ_alg_for(f->path, NULL)->name);
+        __atomic_fetch_add(&istat.failures, 1, __ATOMIC_RELAXED);
+        return -EIO;
+    }
+    if (f->alg->id == TAG_ALG_BLAKE3 && integ_key.flags == 0) {
+        fprintf(stderr, "[WARN] integrity: %s: blake3 tags but no integrity_key\n", f->path);
+        return -EIO;
+    }
+    if (hdr_key(f) == NULL) {
+        fprintf(stderr, "[WARN] integrity: %s: tags use key version %u\n",
+                f->path, f->hdr.key_version);
+        return -EIO;
+    }
+
+    uint8_t mac[32];
+    hdr_mac(f, mac);
+    if (!tag_equal(mac, f->hdr.mac, sizeof(mac))) {
+        fprintf(stderr, "[WARN] integrity: %s: tag header mac mismatch\n", f->path);
+        __atomic_fetch_add(&istat.failures, 1, __ATOMIC_RELAXED);
+        return -EIO;
+    }
+    integ_file_keys(f);
+    return 0;
+}
+
+static int ilv_load(int next, struct integ_file *f, const struct stat *st);
+static int integ_fetch(int next, struct integ_file *f, const char *path,
+                       struct fuse_file_info *fi, off_t astart, size_t alen,
+                       char *data, uint8_t *tags);
+static int integ_check(struct integ_file *f, const char *data, size_t alen, uint64_t b0,
+                       const uint8_t *need, uint8_t *tags);
+
+/*
+ * 닫히지 않은 채 끝난 파일: root를 믿을 수 없으므로 현재 크기의 모든 블록을
+ * 저장된 태그로 검증한다. 태그가 모자라거나(늘어난 데이터) 맞지 않으면 EIO.
+ */
+static int integ_verify_all(int next, struct integ_file *f)
+{
+    size_t bs = options.integrity_block, ts = f->hdr.tag_size;
+    size_t slab = INTEG_SLAB / bs * bs;
+    uint64_t size = f->hdr.file_size;
+    char *data = malloc(slab);
+    uint8_t *tags = malloc(2 * integ_blocks(slab) * TAG_MAX);
+    int err = data && tags ? 0 : -ENOMEM;
+
+    for (uint64_t s = 0; err == 0 && s < size; s += slab) {
+        size_t len = size - s < slab ? size - s : slab;
+        uint64_t n = integ_blocks(len);
+
+        err = integ_fetch(next, f, f->path, &f->dfi, s, len, data, tags + n * ts);
+        if (err == 0 && integ_check(f, data, len, s / bs, NULL, tags) != 0)
+            err = -EIO;
+        if (err == -EIO) {
+            fprintf(stderr, "[WARN] integrity: %s: unclean file fails verification in %llu-%llu\n",
+                    f->path, (unsigned long long) s, (unsigned long long) (s + len));
+            __atomic_fetch_add(&istat.failures, 1, __ATOMIC_RELAXED);
+        }
+    }
+    free(data);
+    free(tags);
+    return err;
+}
+
+/* sidecar가 없는 파일: 현재 내용으로 태그를 만들어 새 sidecar에 저장 */
+static int integ_adopt(int next, struct integ_file *f, off_t size)
+{
+    struct fuse_file_info cfi = { .flags = O_WRONLY | O_CREAT };
+
+    int err = next_create(next, f->tpath, 0600, &cfi);
+    if (err)
+        return err;
+    next_release(next, f->tpath, &cfi);
+
+    f->tfi.flags = O_RDWR;
+    err = next_open(next, f->tpath, &f->tfi);
+    if (err)
+        return err;
+
+    err = hdr_init(f, size);
+    if (err == 0)
+        err = hdr_write(next, f);
+    if (err == 0)
+        err = tags_rebuild(next, f, 0, size, NULL, 0, 0);
+    return err;
+}
+
+static int integ_root_check(int next, struct integ_file *f)
+{
+    uint8_t root[32];
+    int err = root_compute(next, f, root);
+    if (err == 0 && !tag_equal(root, f->hdr.root, sizeof(root))) {
+        fprintf(stderr, "[WARN] integrity: %s: root mismatch\n", f->path);
+        __atomic_fetch_add(&istat.failures, 1, __ATOMIC_RELAXED);
+        err = -EIO;
+    }
+    return err;
+}
+
+/* 헤더와 root를 읽어 검증 */
+static int integ_load_tags(int next, struct integ_file *f, const struct stat *st)
+{
+    if (f->ilv)
+        return ilv_load(next, f, st);
+
+    if (io_full(next, f->tpath, &f->hdr, TAG_HDR_SIZE, 0, &f->tfi, 0) != TAG_HDR_SIZE)
+        return -EIO;
+    int err = hdr_check(f);
+    if (err)
+        return err;
+
+    if (f->hdr.flags & TAG_DIRTY) {
+        /* 닫히지 않은 채 끝난 파일: 크기는 데이터 파일을 따르고 블록을 모두 검증 */
+        __atomic_fetch_add(&istat.unclean, 1, __ATOMIC_RELAXED);
+        f->hdr.file_size = st->st_size;
+        return integ_verify_all(next, f);
+    }
+    return integ_root_check(next, f);
+}
+
+/* 헤더나 root가 맞지 않음: 맞는 복제본을 찾아 그 태그(ilv면 헤더)를 나머지에 복사 */
+static int integ_repair_tags(int next, struct integ_file *f, const struct stat *st)
+{
+    for (int good = 0; good < mirror.n; good++) {
+        if (mirror.failed[good])
+            continue;
+        mirror_pin = good;
+        int err = integ_load_tags(next, f, st);
+        mirror_pin = -1;
+        if (err)
+            continue;
+
+        for (int r = 0; r < mirror.n; r++) {
+            if (r == good || mirror.failed[r])
+                continue;
+            err = f->ilv ? mirror_copy(f->path, 0, TAG_HDR_SIZE, good, r)
+                         : mirror_copy(f->tpath, 0, SIZE_MAX, good, r);
+            if (err)
+                mirror_fail(r, f->path, err);
+        }
+        fprintf(stderr, "[WARN] integrity: %s: tags repaired from %s\n",
+                f->path, mirror.root[good]);
+        __atomic_fetch_add(&mirror.repairs, 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+    __atomic_fetch_add(&mirror.repair_failures, 1, __ATOMIC_RELAXED);
+    return -EIO;
+}
+
+static int integ_load(int next, struct integ_file *f, const struct stat *st, int adopt)
+{
+    f->ilv = integ_interleaved;
+    f->dfi.flags = f->ilv ? O_RDWR : O_RDONLY;
+    int err = next_open(next, f->path, &f->dfi);
+    if (err)
+        return err;
+    if (f->ilv) {
+        err = integ_load_tags(next, f, st);
+        goto out;
+    }
+
+    f->tfi.flags = O_RDWR;
+    err = next_open(next, f->tpath, &f->tfi);
+    if (err == -ENOENT) {
+        f->tfi.fh = 0;
+        /* 내용이 있는 파일을 태그 없이 받아들이는 것은 옵션으로만 */
+        if (!adopt && st->st_size > 0) {
+            fprintf(stderr, "[WARN] integrity: %s has no tags\n", f->path);
+            __atomic_fetch_add(&istat.failures, 1, __ATOMIC_RELAXED);
+            return -EIO;
+        }
+        if (st->st_size > 0)
+            __atomic_fetch_add(&istat.adopted, 1, __ATOMIC_RELAXED);
+        return integ_adopt(next, f, st->st_size);
+    }
+    if (err)
+        return err;
+    err = integ_load_tags(next, f, st);
+
+out:
+    if (err == -EIO && WITH_MIRROR && mirror.n > 1 && !ec.k && mirror_pin < 0)
+        err = integ_repair_tags(next, f, st);
+    return err;
+}
+
+/* first-touch 기록을 현재 크기에 맞게 늘림 (실패하면 넘친 블록은 매번 검증) */
+static void integ_seen_grow(struct integ_file *f)
+{
+    size_t words = (integ_blocks(f->hdr.file_size) + 63) / 64;
+    if (f->verify != VERIFY_FIRST || words <= f->nseen)
+        return;
+    uint64_t *seen = realloc(f->seen, words * sizeof(*seen));
+    if (seen == NULL)
+        return;
+    memset(seen + f->nseen, 0, (words - f->nseen) * sizeof(*seen));
+    f->seen = seen;
+    f->nseen = words;
+}
+
+/* path 파일의 공유 상태를 얻음 (처음이면 sidecar를 열어 검증) */
+static int integ_acquire(int next, const char *path, struct fuse_file_info *fi,
+                         int adopt, struct integ_file **out)
+{
+    struct stat st;
+    char tpath[PATH_MAX];
+
+    int err = tag_path(path, tpath, sizeof(tpath));
+    if (err == 0)
+        err = next_getattr(next, path, &st, fi);
+    if (err)
+        return err;
+    if (!S_ISREG(st.st_mode))
+        return -EINVAL;
+
+    /*
+     * sidecar 열기/검증(root, 전체 블록)은 lock 밖에서 한다. 그동안 항목은
+     * busy로 표에 두어 같은 파일을 여는 다른 요청은 두 번 읽지 않고 기다린다.
+     */
+    pthread_mutex_lock(&itab.lock);
+    struct integ_file **pp, *f;
+    while ((f = *(pp = itab_find_locked(st.st_dev, st.st_ino))) != NULL && f->busy)
+        pthread_cond_wait(&itab.cond, &itab.lock);
+    if (f) {
+        f->refs++;
+        pthread_mutex_unlock(&itab.lock);
+        *out = f;
+        return 0;
+    }
+    if ((f = calloc(1, sizeof(*f))) == NULL) {
+        pthread_mutex_unlock(&itab.lock);
+        return -ENOMEM;
+    }
+    f->dev = st.st_dev;
+    f->ino = st.st_ino;
+    f->refs = 1;
+    f->busy = 1;
+    *pp = f;
+    pthread_mutex_unlock(&itab.lock);
+
+    pthread_rwlock_init(&f->lock, NULL);
+    f->path = strdup(path);
+    f->tpath = strdup(tpath);
+    integ_alg_for(path, &f->verify);
+    err = f->path && f->tpath ? integ_load(next, f, &st, adopt) : -ENOMEM;
+    if (err == 0)
+        integ_seen_grow(f);
+
+    /* 실패하면 표에서 빼고, 기다리던 요청은 처음부터 다시 읽음 */
+    pthread_mutex_lock(&itab.lock);
+    f->busy = 0;
+    if (err)
+        *itab_find_locked(f->dev, f->ino) = f->next;
+    pthread_cond_broadcast(&itab.cond);
+    pthread_mutex_unlock(&itab.lock);
+
+    if (err)
+        integ_free(next, f);
+    *out = err ? NULL : f;
+    return err;
+}
+
+static void integ_put(int next, struct integ_file *f)
+{
+    pthread_mutex_lock(&itab.lock);
+    if (--f->refs > 0) {
+        pthread_mutex_unlock(&itab.lock);
+        return;
+    }
+    /* 닫는 중: 새 open은 헤더가 기록된 뒤 디스크에서 다시 읽음 */
+    f->busy = 1;
+    pthread_mutex_unlock(&itab.lock);
+
+    if (f->hdr.flags & TAG_DIRTY && root_compute(next, f, f->hdr.root) == 0) {
+        f->hdr.flags &= ~TAG_DIRTY;
+        hdr_write(next, f);
+    }
+
+    pthread_mutex_lock(&itab.lock);
+    *itab_find_locked(f->dev, f->ino) = f->next;
+    pthread_cond_broadcast(&itab.cond);
+    pthread_mutex_unlock(&itab.lock);
+    integ_free(next, f);
+}
+
+/*
+ * interleaved 배치 (integrity_layout=interleaved): 데이터 파일 맨 앞에 헤더를 두고,
+ * 데이터 블록 integrity_group개마다 바로 뒤에 그 블록들의 태그 자리(ILV_SLOT씩)를
+ * 둔다. 마지막 묶음의 태그는 마지막 데이터 바로 뒤에 오므로 물리 크기에서 논리
+ * 크기를 계산할 수 있고(getattr), 검증 read는 데이터와 태그를 한 번의 pread로 읽는다.
+ * root는 sidecar와 같이 닫을 때 계산하고 열 때 묶음마다 태그 자리를 읽어 검증하며,
+ * 헤더의 크기가 물리 크기로 계산한 크기와 다르면 (잘리거나 늘어난 파일) 열지 않는다.
+ */
+
+static uint64_t ilv_group_data(void)
+{
+    return (uint64_t) options.integrity_group * options.integrity_block;
+}
+
+static uint64_t ilv_group_size(void)
+{
+    return (uint64_t) options.integrity_group * (options.integrity_block + ILV_SLOT);
+}
+
+/* 논리 위치 x의 물리 위치 (파일 크기와 무관) */
+static off_t ilv_data_pos(uint64_t x)
+{
+    uint64_t gd = ilv_group_data();
+    return TAG_HDR_SIZE + x / gd * ilv_group_size() + x % gd;
+}
+
+/* 논리 크기가 size일 때 블록 b의 태그 위치 */
+static off_t ilv_tag_pos(uint64_t b, uint64_t size)
+{
+    uint64_t gd = ilv_group_data(), g = b / options.integrity_group;
+    uint64_t d = size - g * gd < gd ? size - g * gd : gd;
+    return TAG_HDR_SIZE + g * ilv_group_size() + d + (b % options.integrity_group) * ILV_SLOT;
+}
+
+static off_t ilv_phys_size(uint64_t size)
+{
+    uint64_t gd = ilv_group_data(), rem = size % gd;
+    return TAG_HDR_SIZE + size / gd * ilv_group_size() + rem + integ_blocks(rem) * ILV_SLOT;
+}
+
+static uint64_t ilv_logical_size(off_t phys)
+{
+    if (phys <= TAG_HDR_SIZE)
+        return 0;
+
+    uint64_t p = phys - TAG_HDR_SIZE, gs = ilv_group_size();
+    uint64_t bsz = options.integrity_block + ILV_SLOT;
+    uint64_t rem = p % gs, m = (rem + bsz - 1) / bsz;
+    return p / gs * ilv_group_data() + (rem > m * ILV_SLOT ? rem - m * ILV_SLOT : 0);
+}
+
+static int ilv_load(int next, struct integ_file *f, const struct stat *st)
+{
+    if (st->st_size == 0) {
+        int err = hdr_init(f, 0);
+        return err ? err : hdr_write(next, f);
+    }
+
+    if (io_full(next, f->path, &f->hdr, TAG_HDR_SIZE, 0, &f->dfi, 0) != TAG_HDR_SIZE ||
+        memcmp(f->hdr.magic, TAG_MAGIC, sizeof(f->hdr.magic)) != 0) {
+        /* 기존 내용을 이 배치로 옮기는 것은 하지 않음 */
+        fprintf(stderr, "[WARN] integrity: %s is not in interleaved layout\n", f->path);
+        __atomic_fetch_add(&istat.failures, 1, __ATOMIC_RELAXED);
+        return -EIO;
+    }
+    int err = hdr_check(f);
+    if (err)
+        return err;
+    if (f->hdr.flags & TAG_DIRTY) {
+        __atomic_fetch_add(&istat.unclean, 1, __ATOMIC_RELAXED);
+        f->hdr.file_size = ilv_logical_size(st->st_size);
+        return integ_verify_all(next, f);
+    }
+    if (f->hdr.file_size != ilv_logical_size(st->st_size)) {
+        fprintf(stderr, "[WARN] integrity: %s: size %llu does not match the tag header (%llu)\n",
+                f->path, (unsigned long long) ilv_logical_size(st->st_size),
+                (unsigned long long) f->hdr.file_size);
+        __atomic_fetch_add(&istat.failures, 1, __ATOMIC_RELAXED);
+        return -EIO;
+    }
+    return integ_root_check(next, f);
+}
+
+/*
+ * 블록 경계 astart부터 alen바이트의 데이터(data에 연속으로)와 태그(tags에
+ * 블록 순서로)를 한 번의 read로 가져옴. 마지막 블록이 속한 묶음의 태그까지 읽는다.
+ */
+/* 블록 경계 astart부터 alen바이트의 데이터와 그 태그를 모두 덮는 물리 구간 */
+static void ilv_span(const struct integ_file *f, off_t astart, size_t alen,
+                     off_t *base, size_t *len)
+{
+    uint64_t bs = options.integrity_block, G = options.integrity_group;
+    uint64_t size = f->hdr.file_size, nb = integ_blocks(size);
+    uint64_t b1 = (astart + alen - 1) / bs;
+    uint64_t glast = (b1 / G + 1) * G < nb ? (b1 / G + 1) * G - 1 : nb - 1;
+
+    *base = ilv_data_pos(astart);
+    *len = ilv_tag_pos(glast, size) + ILV_SLOT - *base;
+}
+
+static int ilv_fetch(int next, struct integ_file *f, const char *path,
+                     struct fuse_file_info *fi, off_t astart, size_t alen,
+                     char *data, uint8_t *tags)
+{
+    uint64_t bs = options.integrity_block;
+    uint64_t size = f->hdr.file_size, ts = f->hdr.tag_size;
+    uint64_t b0 = astart / bs, b1 = (astart + alen - 1) / bs;
+    off_t base;
+    size_t len;
+    ilv_span(f, astart, alen, &base, &len);
+
+    char *raw = malloc(len);
+    if (raw == NULL)
+        return -ENOMEM;
+
+    ssize_t got = io_full(next, path, raw, len, base, fi, 0);
+    int res = got < 0 ? (int) got : (size_t) got != len ? -EIO : 0;
+    for (uint64_t b = b0; res == 0 && b <= b1; b++) {
+        uint64_t off = b * bs, n = size - off < bs ? size - off : bs;
+        memcpy(data + (off - astart), raw + (ilv_data_pos(off) - base), n);
+        memcpy(tags + (b - b0) * ts, raw + (ilv_tag_pos(b, size) - base), ts);
+    }
+    free(raw);
+    return res;
+}
+
+/*
+ * 논리 [lo, hi)에 buf를 쓰고 바뀐 블록의 태그와 함께 한 번의 write로 저장.
+ * lo는 현재 크기 이하여야 함 (그 뒤에 쓰려면 ilv_extend로 먼저 채움).
+ * 같은 묶음의 다른 블록 태그는 크기가 바뀌면 자리가 옮겨지므로 읽어 와 다시 쓴다.
+ */
+static int ilv_store(int next, struct integ_file *f, const char *buf, off_t lo, off_t hi)
+{
+    uint64_t bs = options.integrity_block, G = options.integrity_group;
+    uint64_t ts = f->hdr.tag_size;
+    uint64_t old = f->hdr.file_size, size = (uint64_t) hi > old ? (uint64_t) hi : old;
+    uint64_t nb = integ_blocks(size), onb = integ_blocks(old);
+    uint64_t c0 = lo / bs, c1 = (hi - 1) / bs;
+    uint64_t first = c0 / G * G;
+    uint64_t last = (c1 / G + 1) * G < nb ? (c1 / G + 1) * G - 1 : nb - 1;
+    off_t dstart = c0 * bs;
+    off_t dend = (last + 1) * bs < size ? (off_t) ((last + 1) * bs) : (off_t) size;
+    off_t oend = dend < (off_t) old ? dend : (off_t) old;
+    off_t base = ilv_data_pos(dstart);
+    size_t rawlen = ilv_tag_pos(last, size) + ILV_SLOT - base;
+    int err = 0;
+
+    char *ldata = malloc(dend - dstart);
+    uint8_t *slots = calloc(last - first + 1, ILV_SLOT);
+    uint8_t *tags = malloc((c1 - c0 + 1) * ts);
+    char *raw = calloc(1, rawlen);
+    if (ldata == NULL || slots == NULL || tags == NULL || raw == NULL) {
+        err = -ENOMEM;
+        goto out;
+    }
+
+    /* 바뀌지 않는 앞/뒤 데이터와, 같은 묶음의 다른 블록 태그 */
+    if (lo > dstart &&
+        io_full(next, f->path, ldata, lo - dstart, ilv_data_pos(dstart), &f->dfi, 0) != lo - dstart)
+        err = -EIO;
+    if (err == 0 && oend > hi &&
+        io_full(next, f->path, ldata + (hi - dstart), oend - hi, ilv_data_pos(hi),
+                &f->dfi, 0) != oend - hi)
+        err = -EIO;
+    if (err == 0 && c0 > first &&
+        io_full(next, f->path, slots, (c0 - first) * ILV_SLOT, ilv_tag_pos(first, old),
+                &f->dfi, 0) != (ssize_t) ((c0 - first) * ILV_SLOT))
+        err = -EIO;
+    if (err == 0 && last > c1 && c1 + 1 < onb &&
+        io_full(next, f->path, slots + (c1 + 1 - first) * ILV_SLOT, (last - c1) * ILV_SLOT,
+                ilv_tag_pos(c1 + 1, old), &f->dfi, 0) != (ssize_t) ((last - c1) * ILV_SLOT))
+        err = -EIO;
+    if (err)
+        goto out;
+    memcpy(ldata + (lo - dstart), buf, hi - lo);
+
+    uint64_t cend = (c1 + 1) * bs < size ? (c1 + 1) * bs : size;
+    tags_compute(f, NULL, ldata, cend - dstart, c0, tags);
+    for (uint64_t b = c0; b <= c1; b++)
+        memcpy(slots + (b - first) * ILV_SLOT, tags + (b - c0) * ts, ts);
+
+    for (uint64_t b = c0; b <= last; b++) {
+        uint64_t off = b * bs, n = size - off < bs ? size - off : bs;
+        memcpy(raw + (ilv_data_pos(off) - base), ldata + (off - dstart), n);
+    }
+    for (uint64_t b = first; b <= last; b++)
+        memcpy(raw + (ilv_tag_pos(b, size) - base), slots + (b - first) * ILV_SLOT, ILV_SLOT);
+
+    ssize_t w = io_full(next, f->path, raw, rawlen, base, &f->dfi, 1);
+    err = w < 0 ? (int) w : (size_t) w != rawlen ? -EIO : 0;
+    if (err == 0)
+        f->hdr.file_size = size;
+
+out:
+    free(ldata);
+    free(slots);
+    free(tags);
+    free(raw);
+    return err;
+}
+
+/* 현재 크기에서 size까지 0으로 채움 (INTEG_SLAB씩) */
+static int ilv_extend(int next, struct integ_file *f, uint64_t size)
+{
+    char *zeros = NULL;
+    int err = 0;
+
+    while (err == 0 && f->hdr.file_size < size) {
+        uint64_t n = size - f->hdr.file_size < INTEG_SLAB ? size - f->hdr.file_size : INTEG_SLAB;
+        if (zeros == NULL && (zeros = calloc(1, INTEG_SLAB)) == NULL)
+            return -ENOMEM;
+        err = ilv_store(next, f, zeros, f->hdr.file_size, f->hdr.file_size + n);
+    }
+    free(zeros);
+    return err;
+}
+
+/* 논리 크기를 size로 줄이거나 늘림: 줄일 때는 마지막 묶음의 태그를 새 자리에 쓰고 자름 */
+static int ilv_resize(int next, struct integ_file *f, const char *path, uint64_t size)
+{
+    uint64_t bs = options.integrity_block, G = options.integrity_group;
+
+    if (size >= f->hdr.file_size)
+        return ilv_extend(next, f, size);
+
+    if (size > 0) {
+        uint64_t c = integ_blocks(size) - 1, first = c / G * G;
+        uint64_t ts = f->hdr.tag_size, n = size - c * bs;
+        uint8_t *slots = calloc(c - first + 1, ILV_SLOT);
+        char *data = malloc(n);
+        uint8_t tag[TAG_MAX];
+        int err = 0;
+
+        if (slots == NULL || data == NULL)
+            err = -ENOMEM;
+        if (err == 0 && c > first &&
+            io_full(next, f->path, slots, (c - first) * ILV_SLOT,
+                    ilv_tag_pos(first, f->hdr.file_size), &f->dfi, 0) != (ssize_t) ((c - first) * ILV_SLOT))
+            err = -EIO;
+        if (err == 0 &&
+            io_full(next, f->path, data, n, ilv_data_pos(c * bs), &f->dfi, 0) != (ssize_t) n)
+            err = -EIO;
+        if (err == 0) {
+            tags_compute(f, NULL, data, n, c, tag);
+            memcpy(slots + (c - first) * ILV_SLOT, tag, ts);
+            size_t len = (c - first + 1) * ILV_SLOT;
+            if (io_full(next, f->path, slots, len, ilv_tag_pos(first, size), &f->dfi, 1) != (ssize_t) len)
+                err = -EIO;
+        }
+        free(slots);
+        free(data);
+        if (err)
+            return err;
+    }
+
+    int err = next_truncate(next, path, ilv_phys_size(size), NULL);
+    if (err == 0)
+        f->hdr.file_size = size;
+    return err;
+}
+
+static int integ_getattr(int next, const char *path, struct stat *stbuf,
+                         struct fuse_file_info *fi)
+{
+    if (is_tag_name(path))
+        return -ENOENT;
+    int res = next_getattr(next, path, stbuf, fi);
+    /* interleaved: 헤더와 태그를 뺀 논리 크기를 보여 줌 */
+    if (res == 0 && integ_interleaved && S_ISREG(stbuf->st_mode) &&
+        strcmp(path, STATS_PATH) != 0)
+        stbuf->st_size = ilv_logical_size(stbuf->st_size);
+    return res;
+}
+
+/* 크기 변경 (wrlock을 쥔 상태): 아래 파일을 자르고 바뀐 블록의 태그를 맞춤 */
+static int integ_resize(int next, struct integ_file *f, const char *path, off_t size)
+{
+    size_t bs = options.integrity_block;
+
+    int res = integ_mark_dirty(next, f);
+    if (res)
+        return res;
+    if (f->ilv) {
+        res = ilv_resize(next, f, path, size);
+    } else if ((res = next_truncate(next, path, size, NULL)) == 0) {
+        off_t old = f->hdr.file_size;
+        /* 줄어든 경우 마지막 블록만, 늘어난 경우 늘어난 부분(0)의 태그를 계산.
+         * 크기 밖으로 밀려난 태그는 file_size 밖이라 무시된다. */
+        off_t start = (size < old ? size : old) / bs * bs;
+        f->hdr.file_size = size;
+        res = tags_rebuild(next, f, start, size, NULL, 0, 0);
+    }
+    integ_seen_grow(f);
+    return res;
+}
+
+struct integ_dir {
+    void *buf;
+    fuse_fill_dir_t filler;
+};
+
+static int integ_filler(void *buf, const char *name, const struct stat *stbuf,
+                        off_t off, enum fuse_fill_dir_flags flags)
+{
+    const struct integ_dir *d = buf;
+    if (strncmp(name, TAG_PREFIX, strlen(TAG_PREFIX)) == 0)
+        return 0;
+    return d->filler(d->buf, name, stbuf, off, flags);
+}
+
+static int integ_readdir(int next, const char *path, void *buf, fuse_fill_dir_t filler,
+                         off_t offset, struct fuse_file_info *fi,
+                         enum fuse_readdir_flags flags)
+{
+    struct integ_dir d = { buf, filler };
+    return next_readdir(next, path, &d, integ_filler, offset, fi, flags);
+}
+
+static int integ_attach(int next, const char *path, struct fuse_file_info *fi, int adopt)
+{
+    struct integ_file *f;
+    int err = integ_acquire(next, path, fi, adopt, &f);
+    if (err) {
+        next_release(next, path, fi);
+        return err;
+    }
+    get_fh(fi)->ig = f;
+    return 0;
+}
+
+static int integ_create(int next, const char *path, mode_t mode, struct fuse_file_info *fi)
+{
+    char tpath[PATH_MAX];
+
+    if (is_tag_name(path))
+        return -EPERM;
+    /* interleaved에서 O_APPEND면 pwrite가 위치를 무시해 배치가 깨짐 (커널이 끝 위치를 줌) */
+    if (integ_interleaved)
+        fi->flags &= ~O_APPEND;
+    int err = next_create(next, path, mode, fi);
+    if (err)
+        return err;
+    /* 같은 이름의 이전 파일이 남긴 태그는 버리고 새로 시작 */
+    if (tag_path(path, tpath, sizeof(tpath)) == 0)
+        next_unlink(next, tpath);
+    return integ_attach(next, path, fi, 1);
+}
+
+static int integ_open(int next, const char *path, struct fuse_file_info *fi)
+{
+    int trunc = fi->flags & O_TRUNC;
+
+    if (strcmp(path, STATS_PATH) == 0)
+        return next_open(next, path, fi);
+
+    /* O_TRUNC는 태그(interleaved면 헤더까지)와 함께 여기서 처리 */
+    fi->flags &= ~(O_TRUNC | (integ_interleaved ? O_APPEND : 0));
+    int err = next_open(next, path, fi);
+    fi->flags |= trunc;
+    if (err)
+        return err;
+    err = integ_attach(next, path, fi, options.integrity_adopt);
+
+    if (err == 0 && trunc) {
+        struct integ_file *f = get_fh(fi)->ig;
+        pthread_rwlock_wrlock(&f->lock);
+        err = integ_resize(next, f, path, 0);
+        pthread_rwlock_unlock(&f->lock);
+        if (err) {
+            integ_put(next, f);
+            get_fh(fi)->ig = NULL;
+            next_release(next, path, fi);
+        }
+    }
+    return err;
+}
+
+/*
+ * 교체 중인 파일에서 위치로 정한 키와 맞지 않으면 다른 키로도 확인.
+ * 태그는 새 키로 썼지만 헤더(rekey_next)를 쓰기 전에 끝난 구간이 이렇게 보인다.
+ * data는 블록 b의 시작, len은 data에서 읽을 수 있는 최대 길이.
+ */
+static int integ_other_key(struct integ_file *f, const char *data, size_t len,
+                           uint64_t b, const uint8_t *want)
+{
+    if (f->alg->id != TAG_ALG_BLAKE3 || f->hdr.key_version == options.integrity_key_version)
+        return 0;
+
+    const struct b3_key *key = integ_block_key(f, b) == &f->key ? &f->old_key : &f->key;
+    size_t bs = options.integrity_block;
+    uint8_t tag[TAG_MAX];
+    tags_compute(f, key, data, len < bs ? len : bs, b, tag);
+    return tag_equal(tag, want, f->hdr.tag_size);
+}
+
+/* 블록 경계 astart부터 alen바이트의 데이터와 저장된 태그(블록 순서)를 읽음 */
+static int integ_fetch(int next, struct integ_file *f, const char *path,
+                       struct fuse_file_info *fi, off_t astart, size_t alen,
+                       char *data, uint8_t *tags)
+{
+    if (f->ilv)
+        return ilv_fetch(next, f, path, fi, astart, alen, data, tags);
+
+    ssize_t got = io_full(next, path, data, alen, astart, fi, 0);
+    /* 태그가 덮는 크기보다 데이터가 짧으면 EIO */
+    return got < 0 ? (int) got : (size_t) got != alen ? -EIO
+         : tags_io(next, f, tags, astart / options.integrity_block, integ_blocks(alen), 0);
+}
+
+/*
+ * need[i]인 블록(need가 NULL이면 전부)의 태그를 계산해 tags 뒤쪽 절반의 저장된
+ * 태그와 비교. 고른 블록이 이어진 구간마다 한 번에 계산한다 (blake3는 pool과 나눔).
+ */
+static int integ_check(struct integ_file *f, const char *data, size_t alen, uint64_t b0,
+                       const uint8_t *need, uint8_t *tags)
+{
+    size_t bs = options.integrity_block, ts = f->hdr.tag_size;
+    uint64_t n = integ_blocks(alen);
+
+    for (uint64_t i = 0; i < n;) {
+        uint64_t j = i;
+        while (j < n && (need == NULL || need[j]))
+            j++;
+        if (j == i) {
+            i++;
+            continue;
+        }
+        size_t hi = j * bs < alen ? j * bs : alen;
+        tags_compute(f, NULL, data + i * bs, hi - i * bs, b0 + i, tags + i * ts);
+        for (; i < j; i++)
+            if (!tag_equal(tags + i * ts, tags + (n + i) * ts, ts) &&
+                !integ_other_key(f, data + i * bs, alen - i * bs, b0 + i, tags + (n + i) * ts))
+                return -EIO;
+    }
+    return 0;
+}
+
+/*
+ * read-repair: 검증되는 사본이 있는 복제본을 찾아 data/tags를 채우고, 그 구간
+ * (데이터와 태그)을 다른 복제본들에 그대로 복사한다.
+ */
+static int integ_repair(int next, struct integ_file *f, const char *path,
+                        struct fuse_file_info *fi, off_t astart, size_t alen,
+                        char *data, uint8_t *tags)
+{
+    size_t ts = f->hdr.tag_size;
+    uint64_t n = integ_blocks(alen), b0 = astart / options.integrity_block;
+
+    for (int good = 0; good < mirror.n; good++) {
+        if (mirror.failed[good])
+            continue;
+        mirror_pin = good;
+        int res = integ_fetch(next, f, path, fi, astart, alen, data, tags + n * ts);
+        mirror_pin = -1;
+        if (res || integ_check(f, data, alen, b0, NULL, tags) != 0)
+            continue;
+
+        off_t doff = astart, toff = TAG_HDR_SIZE + b0 * ts;
+        size_t dlen = alen;
+        if (f->ilv)
+            ilv_span(f, astart, alen, &doff, &dlen);
+        for (int r = 0; r < mirror.n; r++) {
+            if (r == good || mirror.failed[r])
+                continue;
+            int err = mirror_copy(path, doff, dlen, good, r);
+            if (err == 0 && !f->ilv)
+                err = mirror_copy(f->tpath, toff, n * ts, good, r);
+            if (err)
+                mirror_fail(r, path, err);
+        }
+        fprintf(stderr, "[WARN] integrity: %s: verification failed at %lld, repaired from %s\n",
+                path, (long long) astart, mirror.root[good]);
+        __atomic_fetch_add(&mirror.repairs, 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+    __atomic_fetch_add(&mirror.repair_failures, 1, __ATOMIC_RELAXED);
+    return -EIO;
+}
+
+static __thread uint64_t sample_tick;
+
+/* 블록 b를 이번 read에서 검증할지 (scrub이면 항상) */
+static int integ_need(struct integ_file *f, uint64_t b, int scrub)
+{
+    if (scrub)
+        return 1;
+    switch (f->verify) {
+    case VERIFY_FIRST:
+        return b / 64 >= f->nseen ||
+               !(__atomic_load_n(&f->seen[b / 64], __ATOMIC_RELAXED) & (1ull << (b % 64)));
+    case VERIFY_SAMPLED:
+        return mix64(++sample_tick ^ (uintptr_t) &sample_tick) % options.integrity_sample == 0;
+    case VERIFY_BACKGROUND:
+        return 0;
+    }
+    return 1;
+}
+
+/*
+ * [offset, offset+size)를 읽고 방식에 따라 고른 블록만 태그와 비교.
+ * 고른 블록이 없으면(sidecar 배치) 아래 read를 그대로 부른다.
+ */
+static int integ_read_range(int next, struct integ_file *f, const char *path, char *buf,
+                            size_t size, off_t offset, struct fuse_file_info *fi, int scrub)
+{
+    size_t bs = options.integrity_block;
+    int res;
+
+    pthread_rwlock_rdlock(&f->lock);
+    off_t fsize = f->hdr.file_size;
+    if (offset >= fsize || size == 0) {
+        pthread_rwlock_unlock(&f->lock);
+        return 0;
+    }
+    off_t end = fsize - offset < (off_t) size ? fsize : offset + (off_t) size;
+    off_t astart = offset / bs * bs;
+    off_t aend = (end + bs - 1) / bs * bs;
+    if (aend > fsize)
+        aend = fsize;
+    size_t alen = aend - astart;
+    uint64_t n = integ_blocks(alen), b0 = astart / bs, nneed = 0;
+
+    uint8_t *need = malloc(n);
+    if (need == NULL) {
+        pthread_rwlock_unlock(&f->lock);
+        return -ENOMEM;
+    }
+    for (uint64_t i = 0; i < n; i++)
+        nneed += need[i] = integ_need(f, b0 + i, scrub);
+    if (!scrub)
+        __atomic_fetch_add(&istat.skipped[f->verify], n - nneed, __ATOMIC_RELAXED);
+    if (nneed == 0 && !f->ilv) {
+        res = next_read(next, path, buf, end - offset, offset, fi);
+        pthread_rwlock_unlock(&f->lock);
+        free(need);
+        return res;
+    }
+
+    /* 블록 경계에 맞고 buf에 다 들어가면 바로 읽음 */
+    char *data = astart == offset && alen <= size ? buf : malloc(alen);
+    size_t ts = f->hdr.tag_size;
+    uint8_t *tags = malloc(2 * n * ts);
+    if (data == NULL || tags == NULL) {
+        res = -ENOMEM;
+        goto out;
+    }
+
+    res = integ_fetch(next, f, path, fi, astart, alen, data, tags + n * ts);
+    if (res == 0)
+        res = integ_check(f, data, alen, b0, need, tags);
+    if (res == -EIO && WITH_MIRROR && mirror.n > 1 && !ec.k && mirror_pin < 0)
+        res = integ_repair(next, f, path, fi, astart, alen, data, tags);
+    if (res == -EIO) {
+        fprintf(stderr, "[WARN] integrity: %s: verification failed at %lld\n",
+                path, (long long) astart);
+        __atomic_fetch_add(&istat.failures, 1, __ATOMIC_RELAXED);
+    }
+    if (res)
+        goto out;
+    __atomic_fetch_add(&istat.verified, nneed, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&istat.checked[f->verify], nneed, __ATOMIC_RELAXED);
+    for (uint64_t i = 0; i < n; i++)
+        if (need[i] && (b0 + i) / 64 < f->nseen)
+            __atomic_fetch_or(&f->seen[(b0 + i) / 64], 1ull << ((b0 + i) % 64),
+                              __ATOMIC_RELAXED);
+
+    if (data != buf)
+        memcpy(buf, data + (offset - astart), end - offset);
+    res = end - offset;
+
+out:
+    pthread_rwlock_unlock(&f->lock);
+    if (data != buf)
+        free(data);
+    free(tags);
+    free(need);
+    return res;
+}
+
+static int integ_read(int next, const char *path, char *buf, size_t size,
+                      off_t offset, struct fuse_file_info *fi)
+{
+    struct integ_file *f = get_fh(fi)->ig;
+    if (f == NULL)
+        return next_read(next, path, buf, size, offset, fi);
+    return integ_read_range(next, f, path, buf, size, offset, fi, 0);
+}
+
+static int integ_write(int next, const char *path, const char *buf, size_t size,
+                       off_t offset, struct fuse_file_info *fi)
+{
+    struct integ_file *f = get_fh(fi)->ig;
+    if (f == NULL)
+        return next_write(next, path, buf, size, offset, fi);
+
+    size_t bs = options.integrity_block;
+
+    pthread_rwlock_wrlock(&f->lock);
+    int res = integ_mark_dirty(next, f);
+    if (res == 0 && f->ilv) {
+        /* 데이터와 태그를 같이 쓰므로 아래 write를 직접 부르지 않음 */
+        if ((uint64_t) offset > f->hdr.file_size)
+            res = ilv_extend(next, f, offset);
+        if (res == 0 && size > 0)
+            res = ilv_store(next, f, buf, offset, offset + size);
+        if (res == 0)
+            res = size;
+    } else if (res == 0) {
+        res = next_write(next, path, buf, size, offset, fi);
+    }
+    if (res > 0 && !f->ilv) {
+        off_t old = f->hdr.file_size, hi = offset + res;
+        off_t newsize = hi > old ? hi : old;
+        /* 파일 끝 뒤에 쓰면 그 사이(구멍)의 블록 태그도 바뀜 */
+        off_t start = (offset < old ? offset : old) / bs * bs;
+        off_t end = (hi + bs - 1) / bs * bs;
+        if (end > newsize)
+            end = newsize;
+
+        f->hdr.file_size = newsize;
+        int err = tags_rebuild(next, f, start, end, buf, offset, hi);
+        if (err)
+            res = err;
+    }
+    integ_seen_grow(f);
+    pthread_rwlock_unlock(&f->lock);
+    return res;
+}
+
+static int integ_truncate(int next, const char *path, off_t size, struct fuse_file_info *fi)
+{
+    struct integ_file *f;
+    int res = integ_acquire(next, path, fi, options.integrity_adopt, &f);
+    if (res)
+        return res;
+
+    pthread_rwlock_wrlock(&f->lock);
+    res = integ_resize(next, f, path, size);
+    pthread_rwlock_unlock(&f->lock);
+    integ_put(next, f);
+    return res;
+}
+
+static int integ_release(int next, const char *path, struct fuse_file_info *fi)
+{
+    struct basic_fh *fh = get_fh(fi);
+
+    if (fh && fh->ig) {
+        integ_put(next, fh->ig);
+        fh->ig = NULL;
+    }
+    return next_release(next, path, fi);
+}
+
+static int integ_unlink(int next, const char *path)
+{
+    char tpath[PATH_MAX];
+
+    int res = next_unlink(next, path);
+    if (res == 0 && !integ_interleaved && tag_path(path, tpath, sizeof(tpath)) == 0)
+        next_unlink(next, tpath);
+    return res;
+}
+
+/* path나 그 아래에 적용될 방식이 하나뿐이 아닌지 (아래에 따로 정한 접두 경로가 있음) */
+static int integ_policy_below(const char *path)
+{
+    size_t len = strlen(path);
+    for (int i = 0; i < integ_npolicy; i++)
+        if (integ_policy[i].len > len && strncmp(integ_policy[i].prefix, path, len) == 0 &&
+            (len == 1 || integ_policy[i].prefix[len] == '/'))
+            return 1;
+    return 0;
+}
+
+static int integ_rename(int next, const char *from, const char *to, unsigned int flags)
+{
+    char tfrom[PATH_MAX], tto[PATH_MAX];
+
+    if (is_tag_name(from) || is_tag_name(to))
+        return -EPERM;
+    /* 옮긴 뒤 경로의 방식이 헤더와 달라지면 열 수 없게 되므로 복사하게 함 */
+    if (integ_alg_for(from, NULL) != integ_alg_for(to, NULL) ||
+        integ_policy_below(from) || integ_policy_below(to))
+        return -EXDEV;
+    int res = next_rename(next, from, to, flags);
+    /* 디렉토리는 안의 sidecar가 함께 옮겨지므로 파일만 처리 */
+    if (res == 0 && !integ_interleaved && tag_path(from, tfrom, sizeof(tfrom)) == 0 &&
+        tag_path(to, tto, sizeof(tto)) == 0 &&
+        next_rename(next, tfrom, tto, 0) == -ENOENT)
+        next_unlink(next, tto);
+    return res;
+}
+
+static int integ_mkdir(int next, const char *path, mode_t mode)
+{
+    if (is_tag_name(path))
+        return -EPERM;
+    return next_mkdir(next, path, mode);
+}
+
+static const struct basic_layer integrity_layer = {
+    .name       = "integrity",
+    .getattr    = integ_getattr,
+    .readdir    = integ_readdir,
+    .create     = integ_create,
+    .open       = integ_open,
+    .read       = integ_read,
+    .write      = integ_write,
+    .unlink     = integ_unlink,
+    .rename     = integ_rename,
+    .release    = integ_release,
+    .mkdir      = integ_mkdir,
+    .truncate   = integ_truncate,
+};
+
+/*
+ * scrubber: background 방식 파일을 integrity_scrub_bw 안에서 주기적으로 끝까지
+ * 읽어 검증. integrity layer 바로 아래(integ_next)로 열고 읽으므로 위 layer나
+ * 요청 통계에는 잡히지 않는다.
+ */
+static int integ_next;      /* integrity layer가 받는 next */
+
+static struct {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int running;
+    int stop;
+    uint64_t t0;            /* 이번 바퀴 시작 (now_ns) */
+    uint64_t bytes;         /* 이번 바퀴에 읽은 양 */
+} scrub = { .lock = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER };
+
+/* ns만큼 쉼, 중간에 멈추라고 하면 1 */
+static int scrub_sleep(uint64_t ns)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ns += ts.tv_nsec;
+    ts.tv_sec += ns / 1000000000ull;
+    ts.tv_nsec = ns % 1000000000ull;
+
+    pthread_mutex_lock(&scrub.lock);
+    while (!scrub.stop && pthread_cond_timedwait(&scrub.cond, &scrub.lock, &ts) == 0)
+        ;
+    int stop = scrub.stop;
+    pthread_mutex_unlock(&scrub.lock);
+    return stop;
+}
+
+/* 파일 하나를 INTEG_SLAB씩 검증, 멈추라고 하면 1 */
+static int scrub_file(const char *path, char *buf)
+{
+    struct fuse_file_info fi = { .flags = O_RDONLY };
+    const double rate = (double) options.integrity_scrub_bw * 1024 * 1024;
+
+    if (next_open(integ_next, path, &fi) != 0 ||
+        integ_attach(integ_next, path, &fi, options.integrity_adopt) != 0)
+        return 0;   /* 없어졌거나 태그 문제 (integ_load가 이미 보고함) */
+
+    struct integ_file *f = get_fh(&fi)->ig;
+    int stop = 0;
+    for (off_t off = 0; !stop; off += INTEG_SLAB) {
+        int r = integ_read_range(integ_next, f, path, buf, INTEG_SLAB, off, &fi, 1);
+        if (r <= 0 && r != -EIO)
+            break;
+        /* 예산보다 앞서 있으면 그만큼 쉼 */
+        if (r == -EIO)      /* 실패한 구간도 읽은 것으로 침 */
+            r = f->hdr.file_size - off < INTEG_SLAB ? f->hdr.file_size - off : INTEG_SLAB;
+        scrub.bytes += r;
+        uint64_t due = scrub.t0 + (uint64_t) (scrub.bytes / rate * 1e9), now = now_ns();
+        stop = due > now ? scrub_sleep(due - now) : __atomic_load_n(&scrub.stop, __ATOMIC_RELAXED);
+    }
+    integ_release(integ_next, path, &fi);
+    __atomic_fetch_add(&istat.scrub_files, 1, __ATOMIC_RELAXED);
+    return stop;
+}
+
+/*
+ * 키 교체: 이전 키 버전의 파일을 REKEY_STEP씩, 그 구간만 wrlock을 쥐고 검증한
+ * 뒤 새 키로 태그를 다시 쓰고 헤더에 진행 위치(rekey_next)를 남긴다.
+ * 태그를 먼저 쓰므로 헤더가 뒤처질 수는 있어도 앞설 수는 없다 (integ_other_key).
+ */
+#define REKEY_STEP (1024 * 1024)
+
+static int rekey_active;    /* integrity_old_key가 있고 아직 남은 파일이 있을 수 있음 */
+static unsigned long rekey_left;    /* 이번 바퀴에 끝내지 못한 파일 */
+
+/* 다음 구간 하나, 파일을 다 끝냈으면 1 */
+static int rekey_step(struct integ_file *f, size_t *done)
+{
+    size_t bs = options.integrity_block, ts = f->hdr.tag_size;
+    size_t step = REKEY_STEP < bs ? bs : REKEY_STEP;
+    int next = integ_next;
+    char *data = NULL;
+    uint8_t *tags = NULL;
+
+    pthread_rwlock_wrlock(&f->lock);
+    int res = integ_mark_dirty(next, f);
+    uint64_t b0 = f->hdr.rekey_next, size = f->hdr.file_size;
+    if (res == 0 && b0 * bs >= size) {
+        /* root는 dirty라 마지막 close에서 새 키로 계산된다 */
+        f->hdr.key_version = options.integrity_key_version;
+        f->hdr.rekey_next = 0;
+        res = hdr_write(next, f);
+        pthread_rwlock_unlock(&f->lock);
+        return res ? res : 1;
+    }
+
+    size_t len = size - b0 * bs < step ? size - b0 * bs : step;
+    uint64_t n = integ_blocks(len);
+    data = malloc(len);
+    tags = malloc(2 * n * ts);
+    if (res == 0 && (data == NULL || tags == NULL))
+        res = -ENOMEM;
+    if (res == 0 && f->ilv) {
+        res = ilv_fetch(next, f, f->path, &f->dfi, b0 * bs, len, data, tags + n * ts);
+    } else if (res == 0) {
+        ssize_t got = io_full(next, f->path, data, len, b0 * bs, &f->dfi, 0);
+        res = got < 0 ? (int) got : (size_t) got != len ? -EIO
+                                  : tags_io(next, f, tags + n * ts, b0, n, 0);
+    }
+    /* 이전 키로 검증한 내용만 새 키로 옮김 (손상을 새 태그로 덮지 않도록) */
+    if (res == 0)
+        tags_compute(f, &f->old_key, data, len, b0, tags);
+    for (uint64_t i = 0; i < n && res == 0; i++)
+        if (!tag_equal(tags + i * ts, tags + (n + i) * ts, ts) &&
+            !integ_other_key(f, data + i * bs, len - i * bs, b0 + i, tags + (n + i) * ts))
+            res = -EIO;
+    if (res == -EIO) {
+        fprintf(stderr, "[WARN] integrity: %s: verification failed at %lld, key rotation stopped\n",
+                f->path, (long long) (b0 * bs));
+        __atomic_fetch_add(&istat.failures, 1, __ATOMIC_RELAXED);
+    }
+    if (res == 0) {
+        tags_compute(f, &f->key, data, len, b0, tags);
+        if (!f->ilv) {
+            res = tags_io(next, f, tags, b0, n, 1);
+        } else {
+            /* blake3 태그는 ILV_SLOT과 크기가 같아 묶음 안에서는 이어져 있음 */
+            for (uint64_t b = b0, e; res == 0 && b < b0 + n; b = e) {
+                e = (b / options.integrity_group + 1) * options.integrity_group;
+                if (e > b0 + n)
+                    e = b0 + n;
+                size_t l = (e - b) * ts;
+                if (io_full(next, f->path, tags + (b - b0) * ts, l, ilv_tag_pos(b, size),
+                            &f->dfi, 1) != (ssize_t) l)
+                    res = -EIO;
+            }
+        }
+    }
+    if (res == 0) {
+        f->hdr.rekey_next = b0 + n;
+        res = hdr_write(next, f);
+    }
+    pthread_rwlock_unlock(&f->lock);
+    free(data);
+    free(tags);
+    *done = len;
+    return res;
+}
+
+/* 이전 키 버전인 파일이면 새 키로 옮김, 멈추라고 하면 1 */
+static int rekey_file(const char *path)
+{
+    struct fuse_file_info fi = { .flags = O_RDONLY };
+    const double rate = (double) options.integrity_scrub_bw * 1024 * 1024;
+
+    if (next_open(integ_next, path, &fi) != 0)
+        return 0;
+    if (integ_attach(integ_next, path, &fi, options.integrity_adopt) != 0) {
+        rekey_left++;
+        return 0;
+    }
+
+    struct integ_file *f = get_fh(&fi)->ig;
+    int stop = 0, res = 0;
+    while (f->alg->id == TAG_ALG_BLAKE3 &&
+           f->hdr.key_version != options.integrity_key_version && !stop) {
+        size_t done = 0;
+        res = rekey_step(f, &done);
+        if (res) {
+            if (res < 0)
+                rekey_left++;
+            else
+                __atomic_fetch_add(&istat.rekeyed, 1, __ATOMIC_RELAXED);
+            break;
+        }
+        scrub.bytes += done;
+        uint64_t due = scrub.t0 + (uint64_t) (scrub.bytes / rate * 1e9), now = now_ns();
+        stop = due > now ? scrub_sleep(due - now) : __atomic_load_n(&scrub.stop, __ATOMIC_RELAXED);
+    }
+    if (stop)
+        rekey_left++;
+    integ_release(integ_next, path, &fi);
+    return stop;
+}
+
+/* 백엔드 디렉토리 path(마운트 기준) 아래를 훑음, 멈추라고 하면 1 */
+static int scrub_dir(const char *path, char *buf)
+{
+    char fpath[PATH_MAX], child[PATH_MAX];
+    get_full_path(path, fpath, sizeof(fpath));
+    DIR *dp = opendir(fpath);
+    if (dp == NULL)
+        return 0;
+
+    int stop = 0;
+    struct dirent *de;
+    while (!stop && (de = readdir(dp)) != NULL) {
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0 ||
+            strncmp(de->d_name, TAG_PREFIX, strlen(TAG_PREFIX)) == 0)
+            continue;
+        int n = snprintf(child, sizeof(child), "%s/%s",
+                         strcmp(path, "/") == 0 ? "" : path, de->d_name);
+        if (n < 0 || (size_t) n >= sizeof(child))
+            continue;
+        int verify;
+        if (de->d_type == DT_DIR) {
+            stop = scrub_dir(child, buf);
+        } else if (de->d_type == DT_REG && strcmp(child, STATS_PATH) != 0) {
+            integ_alg_for(child, &verify);
+            if (rekey_active)
+                stop = rekey_file(child);
+            if (!stop && verify == VERIFY_BACKGROUND)
+                stop = scrub_file(child, buf);
+        }
+    }
+    closedir(dp);
+    return stop;
+}
+
+static int scrub_needed(void)
+{
+    int need = integ_verify == VERIFY_BACKGROUND;
+    for (int i = 0; i < integ_npolicy; i++)
+        need |= integ_policy[i].verify == VERIFY_BACKGROUND;
+    return need;
+}
+
+static void *scrub_main(void *arg)
+{
+    (void) arg;
+    char *buf = malloc(INTEG_SLAB);
+    if (buf == NULL)
+        return NULL;
+
+    do {
+        scrub.t0 = now_ns();
+        scrub.bytes = 0;
+        rekey_left = 0;
+        if (scrub_dir("/", buf))
+            break;
+        __atomic_fetch_add(&istat.scrub_passes, 1, __ATOMIC_RELAXED);
+        if (rekey_active && rekey_left == 0) {
+            printf("[INFO] integrity: all files use key version %u\n",
+                   options.integrity_key_version);
+            rekey_active = 0;
+        } else if (rekey_active) {
+            fprintf(stderr, "[WARN] integrity: %lu files still on the previous key\n", rekey_left);
+        }
+    } while ((rekey_active || scrub_needed()) &&
+             !scrub_sleep((uint64_t) options.integrity_scrub_interval * 1000000000ull));
+    free(buf);
+    return NULL;
+}
+
+/* 키 교체 중이거나 background 방식을 쓰는 곳이 있을 때만 */
+static void scrub_start(void)
+{
+    rekey_active = integ_old_key.flags != 0;
+    if ((!rekey_active && !scrub_needed()) || options.integrity_scrub_bw == 0)
+        return;
+    if (pthread_create(&scrub.thread, NULL, scrub_main, NULL) == 0)
+        scrub.running = 1;
+}
+
+static void scrub_stop(void)
+{
+    if (!scrub.running)
+        return;
+    pthread_mutex_lock(&scrub.lock);
+    scrub.stop = 1;
+    pthread_cond_signal(&scrub.cond);
+    pthread_mutex_unlock(&scrub.lock);
+    pthread_join(scrub.thread, NULL);
+    scrub.running = 0;
+}
+
+/* integrity_key 파일에서 32바이트 키를 읽음 */
+static int integ_key_load(const char *file, struct b3_key *out)
+{
+    uint8_t key[32];
+    int fd = open(file, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return -errno;
+    ssize_t n = read(fd, key, sizeof(key));
+    close(fd);
+    if (n != (ssize_t) sizeof(key))
+        return -EINVAL;
+
+    for (int i = 0; i < 8; i++)
+        out->words[i] = load32(key + 4 * i);
+    out->flags = B3_KEYED;
+    memset(key, 0, sizeof(key));
+    return 0;
+}
+
+static void layer_push(const struct basic_layer *l)
+{
+    assert(nlayers < MAX_LAYERS);
+    layers[nlayers++] = l;
+}
+
+/* 마운트 옵션으로 켜진 기능들로 스택을 구성 (위에서 아래 순서가 고정) */
+static int layers_setup(void)
+{
+    /*
+     * prefetch는 DIR_PATH의 파일을 readahead(2)하므로 맨 아래가 로컬 트리이고
+     * 파일 offset이 그대로 데이터 offset일 때만 의미가 있다
+     */
+    if (WITH_PREFETCH && options.prefetch_bw &&
+        (options.s3 || options.remote || (options.mirror && options.mirror_ec) ||
+         (options.integrity && options.integrity_layout &&
+          strcmp(options.integrity_layout, "interleaved") == 0))) {
+        fprintf(stderr, "[INFO] prefetch: off (backend is not the local tree under %s)\n",
+                DIR_PATH);
+        options.prefetch_bw = 0;
+    }
+
+    /* heat/prefetch가 모두 꺼져 있으면 기록 분기가 없는 read/write 사용 */
+    if (options.heat_sample == 0 && (!WITH_PREFETCH || options.prefetch_bw == 0)) {
+        passthrough.read = basic_read_plain;
+        passthrough.write = basic_write_plain;
+        plain_io = 1;
+    } else if (options.heat_sample == 0) {
+        passthrough.write = basic_write_plain;
+    }
+
+    /* coherence는 cache layer가 변경을 알림 (인라인 캐시가 꺼져 있어도) */
+    if (WITH_COHERENCE && options.coherence) {
+        int err = WITH_CACHE && options.coherence_peers && options.coherence_lease_ms >= 30 ?
+                  coh_setup() : -EINVAL;
+        if (err) {
+            fprintf(stderr, "coherence: need coherence_peers=ADDR[+ADDR...] (at most %d),"
+                            " coherence_lease_ms >= 30 and the cache layer\n", COH_PEERS_MAX);
+            return -1;
+        }
+    }
+    if (WITH_CACHE && (options.inline_budget || coh.n))
+        layer_push(&cache_layer);
+
+    if (WITH_PEER_CACHE && options.peer_cache) {
+        unsigned int bs = options.peer_cache_block;
+        int err = options.peer_cache_peers && bs >= 4096 && bs <= 64 * 1024 * 1024 &&
+                  options.peer_cache_budget >= bs ? pcache_setup() : -EINVAL;
+        if (err) {
+            fprintf(stderr, "peer_cache: need peer_cache_peers=ADDR[+ADDR...] (at most %d),"
+                            " peer_cache_block in [4 KiB, 64 MiB] and a budget of at least"
+                            " one block\n", PCACHE_PEERS_MAX);
+            return -1;
+        }
+        layer_push(&peer_layer);
+        pcache.next = nlayers;
+        pcache.on = 1;
+    }
+
+    if (WITH_INTEGRITY && options.integrity) {
+        unsigned int bs = options.integrity_block;
+        integ_default = tag_alg_find(options.integrity, 0);
+        if (integ_default == NULL) {
+            fprintf(stderr, "unknown integrity mode: %s\n", options.integrity);
+            return -1;
+        }
+        if (options.integrity_layout) {
+            integ_interleaved = strcmp(options.integrity_layout, "interleaved") == 0;
+            if (!integ_interleaved && strcmp(options.integrity_layout, "sidecar") != 0) {
+                fprintf(stderr, "integrity_layout must be sidecar or interleaved\n");
+                return -1;
+            }
+        }
+        if (options.integrity_group == 0) {
+            fprintf(stderr, "integrity_group must be at least 1\n");
+            return -1;
+        }
+        if (options.integrity_verify &&
+            (integ_verify = verify_find(options.integrity_verify)) < 0) {
+            fprintf(stderr, "integrity_verify must be strict, first-touch, sampled or background\n");
+            return -1;
+        }
+        if (options.integrity_sample == 0) {
+            fprintf(stderr, "integrity_sample must be at least 1\n");
+            return -1;
+        }
+        if (options.integrity_paths && integ_policy_parse(options.integrity_paths) != 0) {
+            fprintf(stderr, "integrity_paths: expected /prefix=mode[@verify][:/prefix=mode...]\n");
+            return -1;
+        }
+        if (bs < B3_CHUNK || bs > INTEG_SLAB || (bs & (bs - 1))) {
+            fprintf(stderr, "integrity_block must be a power of two in [1 KiB, 4 MiB]\n");
+            return -1;
+        }
+        /* 키는 blake3를 쓰는 곳이 있을 때만 필요 */
+        int need_key = integ_default->id == TAG_ALG_BLAKE3;
+        for (int i = 0; i < integ_npolicy; i++)
+            need_key |= integ_policy[i].alg->id == TAG_ALG_BLAKE3;
+        int err = options.integrity_key ? integ_key_load(options.integrity_key, &integ_key)
+                                        : need_key ? -EINVAL : 0;
+        if (err) {
+            fprintf(stderr, "integrity_key: %s\n",
+                    options.integrity_key ? strerror(-err) : "required for blake3");
+            return -1;
+        }
+        if (options.integrity_key_version == 0 ||
+            (options.integrity_old_key && options.integrity_key_version < 2)) {
+            fprintf(stderr, "integrity_key_version must be at least 1 (2 with integrity_old_key)\n");
+            return -1;
+        }
+        if (options.integrity_old_key &&
+            (err = integ_key_load(options.integrity_old_key, &integ_old_key)) != 0) {
+            fprintf(stderr, "integrity_old_key: %s\n", strerror(-err));
+            return -1;
+        }
+        crc32c_init();
+        layer_push(&integrity_layer);
+        integ_next = nlayers;
+    }
+
+    /* 백엔드 종류와 무관하게 그 바로 위: uploader는 아래 layer로 씀 */
+    if (WITH_WRITE_BEHIND && options.write_behind) {
+        struct stat st;
+        unsigned int bs = options.write_behind_batch;
+        if (stat(options.write_behind, &st) == -1 || !S_ISDIR(st.st_mode)) {
+            fprintf(stderr, "write_behind: %s is not a directory\n", options.write_behind);
+            return -1;
+        }
+        if (options.write_behind_sync &&
+            strcmp(options.write_behind_sync, "local") != 0 &&
+            strcmp(options.write_behind_sync, "backend") != 0) {
+            fprintf(stderr, "write_behind_sync must be local or backend\n");
+            return -1;
+        }
+        if (bs < FUSE_MAX_REQ_SIZE || options.write_behind_max < 4UL * bs) {
+            fprintf(stderr, "write_behind: need write_behind_batch >= 1 MiB and"
+                            " write_behind_max >= 4 batches\n");
+            return -1;
+        }
+        wb.backend_sync = options.write_behind_sync &&
+                          strcmp(options.write_behind_sync, "backend") == 0;
+        crc32c_init();
+        layer_push(&wb_layer);
+        wb.next = nlayers;
+        wb.on = 1;
+    }
+
+    /* 백엔드(와 breaker) 바로 위: 백엔드의 실패만 보고, write-behind는 오프라인이면 사본에 올림 */
+    if (WITH_OFFLINE && options.offline) {
+        struct stat st;
+        if (stat(options.offline, &st) == -1 || !S_ISDIR(st.st_mode)) {
+            fprintf(stderr, "offline: %s is not a directory\n", options.offline);
+            return -1;
+        }
+        if (options.offline_retry_ms == 0 ||
+            options.offline_retry_max_ms < options.offline_retry_ms) {
+            fprintf(stderr, "offline: need 0 < offline_retry_ms <= offline_retry_max_ms\n");
+            return -1;
+        }
+        crc32c_init();
+        layer_push(&off_layer);
+        off.next = nlayers;
+        off.on = 1;
+    }
+
+    /* 백엔드 바로 위, offline 아래: 빠른 실패를 offline이 내려간 것으로 봄 */
+    if (WITH_BREAKER && options.breaker_ms) {
+        if (options.breaker_open_ms == 0 || options.breaker_inflight == 0 ||
+            options.breaker_inflight > BRK_SLOTS) {
+            fprintf(stderr, "breaker: need breaker_open_ms >= 1 and breaker_inflight in [1, %d]\n",
+                    BRK_SLOTS);
+            return -1;
+        }
+        brk_on = 1;
+        /* mirror/ec는 복제본마다 breaker를 둠: 전체를 막으면 남은 복제본도 못 씀 */
+        if (!brk_per_replica()) {
+            brk_init(&backend_brk, options.remote ? options.remote
+                                   : options.s3 ? options.s3 : DIR_PATH);
+            layer_push(&brk_layer);
+        }
+    }
+
+    if (WITH_MIRROR && options.mirror) {
+        int err = mirror_parse(options.mirror);
+        if (err) {
+            fprintf(stderr, "mirror: %s (1 to %d roots besides %s)\n", strerror(-err),
+                    MIRROR_MAX - 1, DIR_PATH);
+            return -1;
+        }
+        if (options.mirror_ec) {
+            if (options.mirror_ec >= (unsigned int) mirror.n || options.mirror_ec_cell < 512 ||
+                options.mirror_ec_cell > 16 * 1024 * 1024) {
+                fprintf(stderr, "mirror_ec: need 1 <= k < %d roots, cell 512 B .. 16 MiB\n",
+                        mirror.n);
+                return -1;
+            }
+            ec.k = options.mirror_ec;
+            ec.cell = options.mirror_ec_cell;
+            ec_setup();
+        }
+        if (mirror_gen_check() != 0)
+            return -1;
+        for (int r = 0; r < mirror.n; r++)
+            brk_init(&mirror.brk[r], mirror.root[r]);
+        if (options.mirror_hedge && !ec.k) {
+            char *end;
+            hedge.pct = strtod(options.mirror_hedge, &end);
+            if (*end || !(hedge.pct >= 0 && hedge.pct < 100)) {
+                fprintf(stderr, "mirror_hedge: percentile must be in [0, 100)\n");
+                return -1;
+            }
+        }
+        layer_push(ec.k ? &ec_layer : &mirror_layer);
+    }
+
+    if (WITH_S3 && options.s3) {
+        if (options.mirror) {
+            fprintf(stderr, "s3: cannot be combined with mirror\n");
+            return -1;
+        }
+        if (options.s3_threads == 0 || options.s3_part < S3_PART_MIN ||
+            options.s3_readahead < S3_RANGE) {
+            fprintf(stderr, "s3: need s3_threads >= 1, s3_part >= 5 MiB, s3_readahead >= 1 MiB\n");
+            return -1;
+        }
+        int err = s3_setup(options.s3, options.s3_key);
+        if (err) {
+            fprintf(stderr, "s3: %s: %s (expected http://host[:port]/bucket)\n",
+                    options.s3, strerror(-err));
+            return -1;
+        }
+        layer_push(&s3_layer);
+    }
+
+    if (WITH_REMOTE && options.remote) {
+        if (options.mirror || options.s3) {
+            fprintf(stderr, "remote: cannot be combined with mirror or s3\n");
+            return -1;
+        }
+        if (options.remote_conns == 0 || options.remote_conns > REMOTE_CONNS_MAX) {
+            fprintf(stderr, "remote_conns: must be between 1 and %d\n", REMOTE_CONNS_MAX);
+            return -1;
+        }
+        int err = remote_setup(options.remote, options.remote_conns);
+        if (err) {
+            fprintf(stderr, "remote: %s: %s (expected unix:/path or tcp:host:port)\n",
+                    options.remote, strerror(-err));
+            return -1;
+        }
+        layer_push(&remote_layer);
+    }
+
+    if (wb.on) {
+        int err = wb_recover();
+        if (err) {
+            fprintf(stderr, "write_behind: journal %s: %s\n", options.write_behind, strerror(-err));
+            return -1;
+        }
+    }
+    if (off.on) {
+        int err = off_recover();
+        if (err) {
+            fprintf(stderr, "offline: %s: %s\n", options.offline, strerror(-err));
+            return -1;
+        }
+    }
+
+    impl = passthrough;
+    if (nlayers == 0)
+        return 0;
+
+    impl.getattr  = stack_getattr;
+    impl.readdir  = stack_readdir;
+    impl.create   = stack_create;
+    impl.open     = stack_open;
+    impl.read     = stack_read;
+    impl.write    = stack_write;
+    impl.unlink   = stack_unlink;
+    impl.rename   = stack_rename;
+    impl.release  = stack_release;
+    impl.mkdir    = stack_mkdir;
+    impl.rmdir    = stack_rmdir;
+    impl.chmod    = stack_chmod;
+    impl.truncate = stack_truncate;
+    impl.utimens  = stack_utimens;
+    impl.opendir  = stack_opendir;
+    impl.fsync    = stack_fsync;
+    return 0;
+}
+
+/* init */
+static void *basic_init(struct fuse_conn_info *conn, struct fuse_config *cfg)
+{
+    (void) cfg;
+
+    /* 기본 키로드 등 초기화시 필요한 데이터 구조를 여기에 할당 가능 */
+    printf("[INFO] Basic FS Initialized. Backend: %s\n", DIR_PATH);
+
+    io_size_setup(conn);
+
+    /* init을 처리하는 워커가 이후 워커들을 만들므로 여기서 고정하면 물려받음 */
+    if (options.numa) {
+        numa_setup();
+        numa_bind_thread();
+    }
+
+    inval_start(fuse_get_context()->fuse);
+    pf_start();
+
+    /* hash pool: integrity 해시, mirror의 복제본별 작업, s3의 병렬 요청이 같이 씀 */
+    unsigned int nthreads = mirror.n - 1;
+    if (s3.on && options.s3_threads - 1 > nthreads)
+        nthreads = options.s3_threads - 1;
+    if (WITH_INTEGRITY && options.integrity) {
+        long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        unsigned int n = options.integrity_threads;
+        if (n == 0)
+            n = ncpu > 1 ? (ncpu - 1 < 8 ? ncpu - 1 : 8) : 0;
+        if (n > nthreads)
+            nthreads = n;
+    }
+    if (nthreads)
+        hpool_start(nthreads);
+    /* scrubber는 DIR_PATH를 직접 훑으므로 s3/remote에서는 켜지 않음 */
+    if (WITH_INTEGRITY && options.integrity && !s3.on && !remote.n)
+        scrub_start();
+    if (WITH_MIRROR)
+        hedge_start();
+    if (off.on) {
+        int err = off_start();
+        if (err)
+            fprintf(stderr, "[WARN] offline: %s (no copies, no replay)\n", strerror(-err));
+    }
+    if (wb.on) {
+        int err = wb_start();
+        if (err)
+            fprintf(stderr, "[WARN] write-behind: %s (writes stay in %s)\n",
+                    strerror(-err), options.write_behind);
+    }
+    if (pcache.on) {
+        int err = pcache_start();
+        if (err)
+            fprintf(stderr, "[WARN] peer cache %s: %s (peers will read for themselves)\n",
+                    options.peer_cache, strerror(-err));
+    }
+    if (coh.n) {
+        int err = coh_start();
+        if (err)
+            fprintf(stderr, "[WARN] coherence %s: %s (peers will wait out leases)\n",
+                    options.coherence, strerror(-err));
+    }
+
+    /* 데몬화 이후에 호출되므로 스레드는 여기서 시작해야 살아남음 */
+    if (options.metrics_sock) {
+        int err = metrics_start(options.metrics_sock);
+        if (err)
+            fprintf(stderr, "[WARN] metrics socket %s: %s\n",
+                    options.metrics_sock, strerror(-err));
+    }
+
+    return NULL;
+}
+
+/* destroy */
+static void basic_destroy(void *private_data)
+{
+    (void) private_data;
+
+    metrics_stop();
+    wb_stop();
+    off_stop();
+    coh_stop();
+    inval_stop();
+    pf_stop();
+    scrub_stop();
+    hedge_stop();
+    hpool_stop();
+    s3_conn_drain();
+    s3_attr_clear();
+    pcache_clear();
+}
+
+/* 요청 추적 래퍼: 각 처리 함수(impl)를 req_begin/req_end로 감쌈 */
+static int traced_getattr(const char *path, struct stat *stbuf,
+                          struct fuse_file_info *fi)
+{
+    req_begin(OP_GETATTR, path, 0, 0);
+    return req_end(impl.getattr(path, stbuf, fi));
+}
+
+static int traced_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
+                          off_t offset, struct fuse_file_info *fi,
+                          enum fuse_readdir_flags flags)
+{
+    req_begin(OP_READDIR, path, offset, 0);
+    return req_end(impl.readdir(path, buf, filler, offset, fi, flags));
+}
+
+static int traced_create(const char *path, mode_t mode, struct fuse_file_info *fi)
+{
+    req_begin(OP_CREATE, path, 0, 0);
+    return req_end(impl.create(path, mode, fi));
+}
+
+static int traced_open(const char *path, struct fuse_file_info *fi)
+{
+    req_begin(OP_OPEN, path, 0, 0);
+    return req_end(impl.open(path, fi));
+}
+
+static int traced_read(const char *path, char *buf, size_t size, off_t offset,
+                       struct fuse_file_info *fi)
+{
+    req_begin(OP_READ, path, offset, size);
+    return req_end(impl.read(path, buf, size, offset, fi));
+}
+
+static int traced_write(const char *path, const char *buf, size_t size,
+                        off_t offset, struct fuse_file_info *fi)
+{
+    req_begin(OP_WRITE, path, offset, size);
+    return req_end(impl.write(path, buf, size, offset, fi));
+}
+
+static int traced_unlink(const char *path)
+{
+    req_begin(OP_UNLINK, path, 0, 0);
+    return req_end(impl.unlink(path));
+}
+
+static int traced_rename(const char *from, const char *to, unsigned int flags)
+{
+    req_begin(OP_RENAME, from, 0, 0);
+    return req_end(impl.rename(from, to, flags));
+}
+
+static int traced_release(const char *path, struct fuse_file_info *fi)
+{
+    req_begin(OP_RELEASE, path, 0, 0);
+    return req_end(impl.release(path, fi));
+}
+
+static int traced_mkdir(const char *path, mode_t mode)
+{
+    req_begin(OP_MKDIR, path, 0, 0);
+    return req_end(impl.mkdir(path, mode));
+}
+
+static int traced_rmdir(const char *path)
+{
+    req_begin(OP_RMDIR, path, 0, 0);
+    return req_end(impl.rmdir(path));
+}
+
+static int traced_chmod(const char *path, mode_t mode, struct fuse_file_info *fi)
+{
+    req_begin(OP_CHMOD, path, 0, 0);
+    return req_end(impl.chmod(path, mode, fi));
+}
+
+static int traced_truncate(const char *path, off_t size, struct fuse_file_info *fi)
+{
+    req_begin(OP_TRUNCATE, path, size, 0);
+    return req_end(impl.truncate(path, size, fi));
+}
+
+static int traced_utimens(const char *path, const struct timespec ts[2],
+                          struct fuse_file_info *fi)
+{
+    req_begin(OP_UTIMENS, path, 0, 0);
+    return req_end(impl.utimens(path, ts, fi));
+}
+
+static int traced_opendir(const char *path, struct fuse_file_info *fi)
+{
+    req_begin(OP_OPENDIR, path, 0, 0);
+    return req_end(impl.opendir(path, fi));
+}
+
+static int traced_fsync(const char *path, int datasync, struct fuse_file_info *fi)
+{
+    req_begin(OP_FSYNC, path, 0, 0);
+    return req_end(impl.fsync(path, datasync, fi));
+}
+
+/* FUSE operations 매핑 */
+static struct fuse_operations basic_oper = {
+    .init       = basic_init,
+    .destroy    = basic_destroy,
+    .getattr    = traced_getattr,
+    .readdir    = traced_readdir,
+    .create     = traced_create,
+    .open       = traced_open,
+    .read       = traced_read,
+    .write      = traced_write,
+    .unlink     = traced_unlink,
+    .rename     = traced_rename,
+    .release    = traced_release,
+    .mkdir      = traced_mkdir,
+    .rmdir      = traced_rmdir,
+    .chmod      = traced_chmod,
+    .truncate   = traced_truncate,
+    .utimens    = traced_utimens,
+    .opendir    = traced_opendir,
+    .fsync      = traced_fsync,
 };
 
+/* 옵션 외 인자 중 첫 번째가 마운트 지점 (libfuse에도 그대로 넘김) */
+static int basic_opt_proc(void *data, const char *arg, int key,
+                          struct fuse_args *outargs)
+{
+    (void) data;
+    (void) outargs;
+
+    if (key == FUSE_OPT_KEY_NONOPT && options.mountpoint == NULL)
+        options.mountpoint = realpath(arg, NULL);
+    return 1;
+}
+
+static void show_help(const char *progname)
+{
+    printf("usage: %s [options] <mountpoint>\n\n", progname);
+    printf("File-system specific options:\n"
+           "    -o slow_us=<us>        slow log threshold in microseconds (0 = off)\n"
+           "    -o metrics_sock=<path> serve OpenMetrics text on a unix socket\n"
+           "    -o heat_sample=<n>     sample 1 in n reads/writes for the heat map (0 = off)\n"
+           "    -o heat_block=<bytes>  heat map range size (default 1 MiB)\n"
+           "    -o heat_halflife=<s>   heat counters are halved every s seconds\n"
+           "    -o inline_max=<bytes>  keep contents of files up to this size in memory\n"
+           "    -o inline_budget=<bytes> total memory for inline file contents (0 = off)\n"
+           "    -o inline_ttl_ms=<ms>  revalidate inline entries against the backend after ms\n"
+           "    -o prefetch_bw=<MiB/s> read ahead of sequential readers, within this budget (0 = off;\n"
+           "                           only with the local tree as backend)\n"
+           "    -o prefetch_max=<KiB>  largest prefetch window\n"
+           "    -o max_write=<bytes>   largest WRITE request (default and kernel limit: 1 MiB)\n"
+           "    -o read_ahead_kb=<kb>  kernel readahead for the mount, sets READ request size\n"
+           "    -o numa                bind workers and their memory to the backend's NUMA node\n"
+           "    -o numa_node=<n>       use node n instead of the detected one\n"
+           "    -o mirror=<dir:dir>    keep the same tree in these roots as well; writes go to\n"
+           "                           all of them, reads to the least busy one; a root that\n"
+           "                           failed stays out across restarts until it is resynced\n"
+           "                           and given a current root's .bfmirror\n"
+           "    -o mirror_hedge=<pct>  re-issue a read to another replica once it runs past\n"
+           "                           this latency percentile (e.g. 95; 0 = off)\n"
+           "    -o mirror_ec=<k>       erasure-code across the roots instead of copying:\n"
+           "                           k data fragments plus one parity per remaining root\n"
+           "    -o mirror_ec_cell=<bytes> bytes per fragment in each stripe (default 64 KiB)\n"
+           "    -o s3=<url>            serve an S3-compatible bucket (http://host[:port]/bucket)\n"
+           "                           instead of the backend directory\n"
+           "    -o s3_key=<file>       \"ACCESS_KEY_ID:SECRET\" for SigV4 signing (default: unsigned)\n"
+           "    -o s3_region=<r>       signing region (default us-east-1)\n"
+           "    -o s3_threads=<n>      parallel range GETs / part uploads (default 8)\n"
+           "    -o s3_part=<bytes>     multipart upload part size (default 8 MiB, at least 5 MiB)\n"
+           "    -o s3_readahead=<bytes> largest sequential read-ahead window (default 16 MiB)\n"
+           "    -o s3_attr_ttl_ms=<ms> reuse HEAD/LIST results for ms (default 1000)\n"
+           "    -o remote=<addr>       use the tree served by another instance (unix:/path or\n"
+           "                           tcp:host:port) instead of the backend directory\n"
+           "    -o remote_conns=<n>    connections to it, each with many requests in flight\n"
+           "                           (default 1, at most 8)\n"
+           "    -o remote_serve=<addr> do not mount; serve the backend directory on addr\n"
+           "    -o remote_threads=<n>  remote_serve: request worker threads (default 8)\n"
+           "    -o coherence=<addr>    receive cache invalidations from other instances sharing\n"
+           "                           the backend on addr (unix:/path or tcp:host:port)\n"
+           "    -o coherence_peers=<addr+addr> the other instances' coherence addresses\n"
+           "    -o coherence_ttl_ms=<ms> while every peer is reachable, revalidate cached\n"
+           "                           entries only this often (default 60000)\n"
+           "    -o coherence_lease_ms=<ms> how long a silent peer is waited for (default 2000)\n"
+           "    -o peer_cache=<addr>   share read blocks with other instances reading the same\n"
+           "                           backend; each block has one owner that reads it\n"
+           "    -o peer_cache_peers=<addr+addr> every instance's peer_cache address (same list\n"
+           "                           on all of them)\n"
+           "    -o peer_cache_budget=<bytes> memory for shared blocks (default 256 MiB)\n"
+           "    -o peer_cache_block=<bytes> block size, the unit of ownership (default 1 MiB)\n"
+           "    -o peer_cache_retry_ms=<ms> read directly for this long after an owner fails\n"
+           "                           (default 1000)\n"
+           "    -o write_behind=<dir>  acknowledge writes once synced to a journal in dir (a\n"
+           "                           fast local disk) and upload them to the backend later\n"
+           "    -o write_behind_sync=<s> what fsync waits for: local (the journal, default)\n"
+           "                           or backend\n"
+           "    -o write_behind_max=<bytes> journal size limit (default 1 GiB)\n"
+           "    -o write_behind_batch=<bytes> largest backend write (default 8 MiB)\n"
+           "    -o write_behind_delay_ms=<ms> collect writes this long before uploading\n"
+           "                           (default 200)\n"
+           "    -o offline=<dir>       keep local copies of opened files in dir; while the\n"
+           "                           backend is unreachable serve them and record changes,\n"
+           "                           replayed (with conflict checks) when it is back\n"
+           "    -o offline_file_max=<bytes> largest file kept as a copy (default 64 MiB)\n"
+           "    -o offline_retry_ms=<ms> first recheck of a failed backend (default 1000),\n"
+           "                           doubling up to offline_retry_max_ms (default 60000)\n"
+           "    -o breaker_ms=<ms>     backend calls slower than ms (or still running) count\n"
+           "                           as failures; when half of the recent ones fail, fail\n"
+           "                           fast (or serve cached data) for a while (0 = off)\n"
+           "    -o breaker_open_ms=<ms> how long to fail fast before a trial call\n"
+           "                           (default 5000)\n"
+           "    -o breaker_inflight=<n> backend calls running at once, keep below the\n"
+           "                           libfuse max_threads (default 8)\n"
+           "    -o integrity=<mode>    verify every block: blake3 (keyed, tamper-evident)\n"
+           "                           or crc32c (bit-rot only, no key)\n"
+           "    -o integrity_key=<file> 32-byte key for blake3 tags\n"
+           "    -o integrity_key_version=<v> version of integrity_key (default 1)\n"
+           "    -o integrity_old_key=<file> key v-1: still accepted, files are re-tagged\n"
+           "                           with the new key in the background\n"
+           "    -o integrity_paths=</prefix=mode:...> mode required for files under a prefix\n"
+           "    -o integrity_layout=<l> sidecar (default) or interleaved: tags inside the file,\n"
+           "                           read with the data in one request\n"
+           "    -o integrity_group=<n> interleaved: data blocks per tag group (default 1)\n"
+           "    -o integrity_block=<bytes> bytes covered by one tag (default 64 KiB)\n"
+           "    -o integrity_threads=<n> hashing threads (default: CPUs - 1, at most 8)\n"
+           "    -o integrity_adopt     tag existing untagged files instead of failing them\n"
+           "    -o integrity_verify=<v> when reads verify: strict (default), first-touch,\n"
+           "                           sampled or background (scrubber only);\n"
+           "                           per prefix with integrity_paths=/prefix=mode@verify\n"
+           "    -o integrity_sample=<n> sampled: verify one block in n (default 16)\n"
+           "    -o integrity_scrub_bw=<MiB/s> scrubber read budget (default 8)\n"
+           "    -o integrity_scrub_interval=<s> pause between scrub passes (default 1 day)\n"
+           "\n");
+}
+
 int main(int argc, char *argv[])
 {
+    struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+
     /* 백엔드 디렉토리 존재 여부 확인 권장(없으면 생성하거나 에러 처리) */
     /* 예: mkdir(DIR_PATH, 0755); // 주의: race condition 가능 */
 
+    if (fuse_opt_parse(&args, &options, option_spec, basic_opt_proc) == -1)
+        return 1;
+
+    if (options.show_help) {
+        show_help(argv[0]);
+        if (fuse_opt_add_arg(&args, "--help") != 0) {
+            fuse_opt_free_args(&args);
+            return 1;
+        }
+        args.argv[0][0] = '\0';
+    }
+
+    if (WITH_REMOTE && options.remote_serve) {
+        fuse_opt_free_args(&args);
+        return remote_serve(options.remote_serve) == 0 ? 0 : 1;
+    }
+
+    if (layers_setup() != 0) {
+        fuse_opt_free_args(&args);
+        return 1;
+    }
+
     printf("Mounting Basic FUSE FS...\n");
     printf("Target Storage: %s\n", DIR_PATH);
 
-    return fuse_main(argc, argv, &basic_oper, NULL);
+    int ret = fuse_main(args.argc, args.argv, &basic_oper, NULL);
+    fuse_opt_free_args(&args);
+    return ret;
 }
\ No newline at end of file
@@ -0,0 +1,75 @@
+/**
+ * bench_io_size.c - 요청 크기별 순차 read/write 처리량
+ *
+ * 같은 파일을 4 KiB부터 FUSE_MAX_REQ_SIZE(1 MiB, max_pages 협상 상한)까지의
+ * 요청 크기로 traced_write/traced_read 해서 MiB/s와 요청당 시간을 출력한다.
+ * 커널 왕복은 빠지므로 데몬 쪽 요청당 비용(추적, 레이어 스택, 시스템 호출)이
+ * 큰 요청으로 얼마나 분산되는지를 본다. 백엔드 파일은 page cache에 있는 상태.
+ *
+ *   ./run_tests.sh bench_io_size      (BENCH_MB 로 파일 크기 변경, 기본 256)
+ */
+#include "test_util.h"
+
+#define FILE_PATH "/t_bench_io/data"
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* 파일 전체를 size 단위 요청으로 한 번 (write면 쓰고 아니면 읽음), 걸린 초 */
+static double pass(char *buf, size_t size, off_t total, int write)
+{
+    struct fuse_file_info fi = { .flags = write ? O_WRONLY : O_RDONLY };
+    double t0;
+
+    if (traced_open(FILE_PATH, &fi) != 0)
+        return -1;
+    t0 = now_s();
+    for (off_t off = 0; off < total; off += size) {
+        int res = write ? traced_write(FILE_PATH, buf, size, off, &fi)
+                        : traced_read(FILE_PATH, buf, size, off, &fi);
+        if (res != (int) size) {
+            printf("%s at %lld: %d\n", write ? "write" : "read", (long long) off, res);
+            traced_release(FILE_PATH, &fi);
+            return -1;
+        }
+    }
+    t0 = now_s() - t0;
+    traced_release(FILE_PATH, &fi);
+    return t0;
+}
+
+int main(void)
+{
+    const char *mb = getenv("BENCH_MB");
+    off_t total = (off_t) (mb ? atoi(mb) : 256) << 20;
+    char *buf = malloc(FUSE_MAX_REQ_SIZE);
+
+    test_init();
+    test_fresh("t_bench_io");
+    if (buf == NULL || layers_setup() != 0)
+        return 1;
+    memset(buf, 'x', FUSE_MAX_REQ_SIZE);
+    CHECK(test_write(FILE_PATH, buf, 1) == 1);
+
+    /* 첫 write pass가 블록 할당을 치르지 않도록 미리 채움 */
+    CHECK(pass(buf, FUSE_MAX_REQ_SIZE, total, 1) >= 0);
+
+    printf("%10s %12s %12s %12s %12s\n", "req size", "write MiB/s", "us/write",
+           "read MiB/s", "us/read");
+    for (size_t size = 4096; size <= FUSE_MAX_REQ_SIZE && !test_failures; size *= 2) {
+        double w = pass(buf, size, total, 1), r = pass(buf, size, total, 0);
+        double reqs = (double) total / size;
+
+        CHECK(w > 0 && r > 0);
+        if (w <= 0 || r <= 0)
+            break;
+        printf("%9zuK %12.0f %12.2f %12.0f %12.2f\n", size / 1024,
+               (total >> 20) / w, w * 1e6 / reqs, (total >> 20) / r, r * 1e6 / reqs);
+    }
+    free(buf);
+    return test_done("bench_io_size");
+}
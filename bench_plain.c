@@ -0,0 +1,132 @@
+/**
+ * bench_plain.c - plain passthrough fast path와 기본 설정의 요청당 비용 비교
+ *
+ * 4 KiB read/write를 세 가지로 재서 ns/op를 출력한다:
+ *   raw      백엔드 파일에 pread/pwrite 직접 (하한)
+ *   default  기본 마운트 옵션 (heat 기록 분기가 있는 read/write)
+ *   plain    heat/prefetch를 끈 설정 (layers_setup이 *_plain 특수화를 고름)
+ * 각 측정은 fork한 자식에서 해서 옵션과 레이어 스택이 서로 섞이지 않는다.
+ * 잡음을 줄이려고 세 가지를 번갈아 TRIALS번 재서 가장 빠른 값을 쓴다. plain이
+ * default * PLAIN_SLACK + PLAIN_SLACK_NS보다 느리거나 raw * RAW_SLACK보다 느리면
+ * 실패 (ns 여유는 write의 writeback 잡음 몫).
+ *
+ * run_tests.sh는 아래 variant 줄의 플래그로 한 번 더 빌드해 돌린다 (기능을
+ * 컴파일 시 모두 뺀 빌드의 plain이 위 plain과 같은 수준이어야 함).
+ *
+ * variant: -DWITH_CACHE=0 -DWITH_HEAT=0 -DWITH_PREFETCH=0 -DWITH_INTEGRITY=0 -DWITH_MIRROR=0 -DWITH_S3=0 -DWITH_REMOTE=0 -DWITH_COHERENCE=0 -DWITH_PEER_CACHE=0 -DWITH_WRITE_BEHIND=0 -DWITH_OFFLINE=0 -DWITH_BREAKER=0
+ */
+#include "test_util.h"
+
+#define FILE_PATH "/t_bench_plain/data"
+#define FILE_SIZE (16 << 20)
+#define IO_SIZE 4096
+#define ROUNDS 8
+#define TRIALS 9
+#define PLAIN_SLACK 1.10
+#define PLAIN_SLACK_NS 100
+#define RAW_SLACK 2.0
+
+enum { RAW, DEFAULT, PLAIN };
+static const char *const mode_name[] = { "raw", "default", "plain" };
+
+/* 파일을 IO_SIZE 단위로 ROUNDS번 훑은 요청당 ns (write면 덮어씀) */
+static double measure(int mode, int write)
+{
+    struct fuse_file_info fi = { .flags = O_RDWR };
+    char buf[IO_SIZE], fpath[PATH_MAX];
+    int fd = -1;
+    uint64_t t0;
+    double ns;
+
+    memset(buf, 'p', sizeof(buf));
+    if (mode == RAW) {
+        snprintf(fpath, sizeof(fpath), "%s%s", DIR_PATH, FILE_PATH);
+        if ((fd = open(fpath, O_RDWR)) == -1)
+            return -1;
+    } else if (traced_open(FILE_PATH, &fi) != 0) {
+        return -1;
+    }
+    t0 = now_ns();
+    for (int r = 0; r < ROUNDS; r++) {
+        for (off_t off = 0; off < FILE_SIZE; off += IO_SIZE) {
+            ssize_t res;
+            if (mode == RAW)
+                res = write ? pwrite(fd, buf, IO_SIZE, off) : pread(fd, buf, IO_SIZE, off);
+            else
+                res = write ? traced_write(FILE_PATH, buf, IO_SIZE, off, &fi)
+                            : traced_read(FILE_PATH, buf, IO_SIZE, off, &fi);
+            if (res != IO_SIZE)
+                return -1;
+        }
+    }
+    ns = (now_ns() - t0) / ((double) ROUNDS * (FILE_SIZE / IO_SIZE));
+    if (mode == RAW)
+        close(fd);
+    else
+        traced_release(FILE_PATH, &fi);
+    return ns;
+}
+
+/* 자식에서 mode 설정으로 read와 write를 재고 파이프로 돌려줌 */
+static int run(int mode, double out[2])
+{
+    int p[2], status;
+    pid_t pid;
+
+    if (pipe(p) == -1 || (pid = fork()) == -1)
+        return -1;
+    if (pid == 0) {
+        double r[2] = { -1, -1 };
+        close(p[0]);
+        if (mode == PLAIN) {
+            options.heat_sample = 0;
+            options.prefetch_bw = 0;
+        }
+        if (layers_setup() == 0 && (mode != PLAIN || plain_io)) {
+            r[0] = measure(mode, 0);
+            r[1] = measure(mode, 1);
+        }
+        _exit(write(p[1], r, sizeof(r)) == sizeof(r) ? 0 : 1);
+    }
+    close(p[1]);
+    ssize_t n = read(p[0], out, 2 * sizeof(double));
+    close(p[0]);
+    waitpid(pid, &status, 0);
+    return n == 2 * sizeof(double) && WIFEXITED(status) && WEXITSTATUS(status) == 0 &&
+           out[0] > 0 && out[1] > 0 ? 0 : -1;
+}
+
+int main(void)
+{
+    static char data[FILE_SIZE];
+    double res[3][2], best[3][2];
+
+    test_init();
+    test_fresh("t_bench_plain");
+    if (layers_setup() != 0)
+        return 1;
+    CHECK(test_write(FILE_PATH, data, sizeof(data)) == (int) sizeof(data));
+
+    for (int t = 0; t < TRIALS && !test_failures; t++) {
+        for (int m = RAW; m <= PLAIN && !test_failures; m++) {
+            CHECK(run(m, res[m]) == 0);
+            for (int w = 0; w < 2; w++)
+                if (t == 0 || res[m][w] < best[m][w])
+                    best[m][w] = res[m][w];
+        }
+    }
+    if (test_failures)
+        return test_done("bench_plain");
+
+    printf("%-8s %12s %12s   (%zu-byte requests, best of %d, heat_sample %u by default)\n",
+           "mode", "read ns/op", "write ns/op", (size_t) IO_SIZE, TRIALS, options.heat_sample);
+    for (int m = RAW; m <= PLAIN; m++)
+        printf("%-8s %12.0f %12.0f\n", mode_name[m], best[m][0], best[m][1]);
+    printf("plain over raw: read +%.0f ns, write +%.0f ns\n",
+           best[PLAIN][0] - best[RAW][0], best[PLAIN][1] - best[RAW][1]);
+    for (int w = 0; w < 2; w++) {
+        CHECK(best[PLAIN][w] <= best[DEFAULT][w] * PLAIN_SLACK + PLAIN_SLACK_NS);
+        CHECK(best[PLAIN][w] <= best[RAW][w] * RAW_SLACK);
+    }
+    return test_done("bench_plain");
+}
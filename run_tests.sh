@@ -0,0 +1,64 @@
+#!/bin/sh
+# basic_fuse.c 테스트/벤치마크 드라이버를 빌드하고 실행
+#
+#   ./run_tests.sh                 test_*.c 모두
+#   ./run_tests.sh test_remote     지정한 것만
+#   ./run_tests.sh bench           bench_*.c 모두 (결과는 표로 출력)
+#
+# 드라이버 소스 주석에 " * variant: -DWITH_X=0 ..." 줄이 있으면 그 플래그로도
+# 빌드해서 한 번 더 돌림 (컴파일 시 기능을 뺀 빌드 확인용).
+#
+# libfuse3 개발 패키지가 필요 (pkg-config fuse3). 다른 위치면
+# FUSE_CFLAGS / FUSE_LIBS 로 지정. 백엔드로 /tmp/fuse_data 아래를 씀.
+# test_s3는 python3으로 로컬 S3 서버(s3_standin.py)를 띄움 (없으면 건너뜀).
+
+cd "$(dirname "$0")" || exit 1
+
+CC=${CC:-gcc}
+CFLAGS=${CFLAGS:--O2 -g -Wall}
+FUSE_CFLAGS=${FUSE_CFLAGS-$(pkg-config fuse3 --cflags)}
+FUSE_LIBS=${FUSE_LIBS-$(pkg-config fuse3 --libs)}
+OUT=${TMPDIR:-/tmp}/basic_fuse_tests
+mkdir -p "$OUT" || exit 1
+
+if [ $# -eq 0 ]; then
+    set -- test_*.c
+elif [ "$1" = bench ]; then
+    set -- bench_*.c
+fi
+
+# build_run NAME BIN [EXTRA_CFLAGS]: 실패하면 failed 증가
+build_run() {
+    # shellcheck disable=SC2086
+    if ! $CC $CFLAGS $3 $FUSE_CFLAGS "$1.c" -o "$OUT/$2" $FUSE_LIBS -lpthread; then
+        echo "$2: build failed"
+        failed=$((failed + 1))
+    elif ! timeout 600 "$OUT/$2"; then
+        failed=$((failed + 1))
+    fi
+}
+
+nl='
+'
+failed=0
+for src in "$@"; do
+    name=$(basename "$src" .c)
+    echo "== $name"
+    build_run "$name" "$name"
+    # 소스 주석의 " * variant: <CFLAGS>" 줄마다 그 플래그로 한 번 더
+    i=0
+    IFS=$nl
+    for extra in $(sed -n 's/^ \* variant: //p' "$name.c"); do
+        unset IFS
+        i=$((i + 1))
+        echo "== $name ($extra)"
+        build_run "$name" "$name.v$i" "$extra"
+    done
+    unset IFS
+done
+
+if [ $failed -ne 0 ]; then
+    echo "$failed failed"
+    exit 1
+fi
+echo "all passed"
@@ -0,0 +1,230 @@
+#!/usr/bin/env python3
+# test_s3.c가 쓰는 S3 호환 서버 (메모리에만 보관, 127.0.0.1)
+#
+#   python3 s3_standin.py [PORT [ID:SECRET]]
+#
+# basic_fuse의 s3 layer가 보내는 요청만 다룬다: HEAD, GET (Range), ListObjectsV2
+# (prefix/delimiter/max-keys/continuation-token), PUT (copy 포함), multipart
+# upload, DELETE. ID:SECRET을 주면 SigV4 서명을 검사하고 맞지 않으면 403.
+# PORT가 0(기본)이면 빈 포트를 골라 시작할 때 "port N" 한 줄을 출력한다.
+
+import email.utils
+import hashlib
+import hmac
+import re
+import sys
+import threading
+import time
+import urllib.parse
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+PART_MIN = 5 * 1024 * 1024
+
+objs = {}       # key -> (data, mtime)
+uploads = {}    # upload id -> {part number: data}
+lock = threading.Lock()
+next_upload = [0]
+key = None
+
+
+def esc(s):
+    return s.replace('&', '&amp;').replace('<', '&lt;').replace('>', '&gt;')
+
+
+def etag(data):
+    return '"%s"' % hashlib.md5(data).hexdigest()
+
+
+class Handler(BaseHTTPRequestHandler):
+    protocol_version = 'HTTP/1.1'
+
+    def log_message(self, *args):
+        pass
+
+    def parse(self):
+        u = urllib.parse.urlsplit(self.path)
+        parts = u.path.split('/', 2)
+        self.key = urllib.parse.unquote(parts[2]) if len(parts) > 2 else ''
+        self.q = dict(urllib.parse.parse_qsl(u.query, keep_blank_values=True))
+        self.rawpath, self.rawq = u.path, u.query
+        n = int(self.headers.get('Content-Length') or 0)
+        self.body = self.rfile.read(n) if n else b''
+        return self.verify() if key else True
+
+    def verify(self):
+        m = re.match(r'AWS4-HMAC-SHA256 Credential=([^/]+)/(\d+)/([^/]+)/s3/aws4_request, '
+                     r'SignedHeaders=([^,]+), Signature=(\w+)',
+                     self.headers.get('Authorization', ''))
+        kid, secret = key.split(':', 1)
+        if not m or m.group(1) != kid:
+            self.send(403, b'<Error><Code>InvalidAccessKeyId</Code></Error>')
+            return False
+        signed = m.group(4).split(';')
+        canon = '\n'.join([self.command, self.rawpath, self.rawq] +
+                          [h + ':' + self.headers.get(h, '').strip() for h in signed] +
+                          ['', m.group(4), self.headers.get('x-amz-content-sha256', '')])
+        scope = '%s/%s/s3/aws4_request' % (m.group(2), m.group(3))
+        sts = 'AWS4-HMAC-SHA256\n%s\n%s\n%s' % (self.headers.get('x-amz-date'), scope,
+                                                 hashlib.sha256(canon.encode()).hexdigest())
+        k = ('AWS4' + secret).encode()
+        for part in (m.group(2), m.group(3), 's3', 'aws4_request'):
+            k = hmac.new(k, part.encode(), hashlib.sha256).digest()
+        if not hmac.compare_digest(hmac.new(k, sts.encode(), hashlib.sha256).hexdigest(),
+                                   m.group(5)):
+            self.send(403, b'<Error><Code>SignatureDoesNotMatch</Code></Error>')
+            return False
+        return True
+
+    def send(self, code, body=b'', headers=(), length=None):
+        self.send_response(code)
+        for name, value in headers:
+            self.send_header(name, value)
+        self.send_header('Content-Length', str(len(body) if length is None else length))
+        self.end_headers()
+        if self.command != 'HEAD' and body:
+            self.wfile.write(body)
+
+    def do_HEAD(self):
+        if not self.parse():
+            return
+        with lock:
+            o = objs.get(self.key)
+        if o is None:
+            return self.send(404, length=0)
+        self.send(200, headers=[('ETag', etag(o[0])),
+                                ('Last-Modified', email.utils.formatdate(o[1], usegmt=True))],
+                  length=len(o[0]))
+
+    def do_GET(self):
+        if not self.parse():
+            return
+        if self.key == '':
+            return self.list()
+        with lock:
+            o = objs.get(self.key)
+        if o is None:
+            return self.send(404, b'<Error><Code>NoSuchKey</Code></Error>')
+        data, rng = o[0], self.headers.get('Range')
+        if not rng:
+            return self.send(200, data)
+        first, last = rng[len('bytes='):].split('-')
+        first, last = int(first), min(int(last), len(data) - 1)
+        if first >= len(data):
+            return self.send(416, b'<Error><Code>InvalidRange</Code></Error>')
+        self.send(206, data[first:last + 1],
+                  [('Content-Range', 'bytes %d-%d/%d' % (first, last, len(data)))])
+
+    def list(self):
+        prefix = self.q.get('prefix', '')
+        delim = self.q.get('delimiter')
+        max_keys = int(self.q.get('max-keys', 1000))
+        token = self.q.get('continuation-token', '')
+        with lock:
+            keys = sorted(k for k in objs if k.startswith(prefix))
+        ents, seen = [], set()
+        for k in keys:
+            rest = k[len(prefix):]
+            if delim and delim in rest:
+                p = prefix + rest.split(delim)[0] + delim
+                if p not in seen:
+                    seen.add(p)
+                    ents.append((p, True))
+            else:
+                ents.append((k, False))
+        ents = [e for e in ents if e[0] > token]
+        page, more = ents[:max_keys], len(ents) > max_keys
+        out = ['<?xml version="1.0"?><ListBucketResult><Prefix>%s</Prefix>'
+               '<KeyCount>%d</KeyCount><IsTruncated>%s</IsTruncated>'
+               % (esc(prefix), len(page), 'true' if more else 'false')]
+        if more:
+            out.append('<NextContinuationToken>%s</NextContinuationToken>' % esc(page[-1][0]))
+        for k, is_prefix in page:
+            if is_prefix:
+                out.append('<CommonPrefixes><Prefix>%s</Prefix></CommonPrefixes>' % esc(k))
+                continue
+            with lock:
+                o = objs.get(k)
+            if o:
+                out.append('<Contents><Key>%s</Key><LastModified>%s</LastModified>'
+                           '<Size>%d</Size></Contents>'
+                           % (esc(k), time.strftime('%Y-%m-%dT%H:%M:%S.000Z', time.gmtime(o[1])),
+                              len(o[0])))
+        out.append('</ListBucketResult>')
+        self.send(200, ''.join(out).encode(), [('Content-Type', 'application/xml')])
+
+    def do_PUT(self):
+        if not self.parse():
+            return
+        if 'uploadId' in self.q:
+            with lock:
+                parts = uploads.get(self.q['uploadId'])
+                if parts is not None:
+                    parts[int(self.q['partNumber'])] = self.body
+            if parts is None:
+                return self.send(404, b'<Error><Code>NoSuchUpload</Code></Error>')
+            return self.send(200, headers=[('ETag', etag(self.body))])
+        src = self.headers.get('x-amz-copy-source')
+        with lock:
+            if src:
+                o = objs.get(urllib.parse.unquote(src.split('/', 2)[2]))
+                if o is not None:
+                    objs[self.key] = (o[0], time.time())
+            else:
+                o = objs[self.key] = (self.body, time.time())
+        if o is None:
+            return self.send(404, b'<Error><Code>NoSuchKey</Code></Error>')
+        if src:
+            return self.send(200, b'<CopyObjectResult></CopyObjectResult>')
+        self.send(200, headers=[('ETag', etag(self.body))])
+
+    def do_POST(self):
+        if not self.parse():
+            return
+        if 'uploads' in self.q:
+            with lock:
+                next_upload[0] += 1
+                uid = 'up%d' % next_upload[0]
+                uploads[uid] = {}
+            return self.send(200, ('<InitiateMultipartUploadResult><UploadId>%s</UploadId>'
+                                   '</InitiateMultipartUploadResult>' % uid).encode())
+        with lock:
+            parts = uploads.pop(self.q.get('uploadId'), None)
+        if parts is None:
+            return self.send(404, b'<Error><Code>NoSuchUpload</Code></Error>')
+        nums = [int(n) for n in re.findall(rb'<PartNumber>(\d+)</PartNumber>', self.body)]
+        # S3처럼 오류도 200 본문으로
+        if nums != list(range(1, len(nums) + 1)):
+            return self.send(200, b'<Error><Code>InvalidPartOrder</Code></Error>')
+        if any(len(parts[n]) < PART_MIN for n in nums[:-1]):
+            return self.send(200, b'<Error><Code>EntityTooSmall</Code></Error>')
+        with lock:
+            objs[self.key] = (b''.join(parts[n] for n in nums), time.time())
+        self.send(200, b'<CompleteMultipartUploadResult/>')
+
+    def do_DELETE(self):
+        if not self.parse():
+            return
+        with lock:
+            if 'uploadId' in self.q:
+                uploads.pop(self.q['uploadId'], None)
+            else:
+                objs.pop(self.key, None)
+        self.send(204)
+
+
+class Server(ThreadingHTTPServer):
+    daemon_threads = True
+    request_queue_size = 128
+
+
+def main():
+    global key
+    port = int(sys.argv[1]) if len(sys.argv) > 1 else 0
+    key = sys.argv[2] if len(sys.argv) > 2 else None
+    srv = Server(('127.0.0.1', port), Handler)
+    print('port %d' % srv.server_address[1], flush=True)
+    srv.serve_forever()
+
+
+if __name__ == '__main__':
+    main()
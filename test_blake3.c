@@ -0,0 +1,128 @@
+/**
+ * test_blake3.c - BLAKE3 known-answer 테스트 (integrity 태그 계산)
+ *
+ * 입력은 공식 test_vectors.json과 같은 i % 251 패턴, 길이는 chunk(1 KiB) 경계와
+ * 벡터 레인(8 chunk) 경계 앞뒤. 기대값은 참조 구현(Python blake3 패키지)의
+ * 32바이트 출력으로, 키 없는 해시와 키 0x00..0x1f의 keyed 해시 두 가지.
+ * keyed 키는 integ_key_load로 파일에서 읽어 쓰고, 같은 계산을 hash pool
+ * 스레드로 나눠 돌려도 결과가 같은지 본다.
+ */
+#include "test_util.h"
+
+#define KEY_FILE "/tmp/basic_fuse_test_blake3.key"
+
+static const struct {
+    size_t len;
+    const char *hash, *keyed;
+} vectors[] = {
+    {      0, "af1349b9f5f9a1a6a0404dea36dcc9499bcb25c9adc112b7cc9a93cae41f3262",
+              "73492b19995d71cdb1e9d74decc09809eb732f1b00bc95c27cb15f9dd4d6478f" },
+    {      1, "2d3adedff11b61f14c886e35afa036736dcd87a74d27b5c1510225d0f592e213",
+              "d08b45c6b127ee94f3f8527a0b82a5f80be1695a0eaec6022e772c0eb95a7e8b" },
+    {   1023, "10108970eeda3eb932baac1428c7a2163b0e924c9a9e25b35bba72b28f70bd11",
+              "da1f18069871512af22af9f13dc005800dfd52c55f42753b5ae718086fe2ee44" },
+    {   1024, "42214739f095a406f3fc83deb889744ac00df831c10daa55189b5d121c855af7",
+              "f45a9249a627fdf1fcf13c0e6376f6a9a9b2056d6e1b5693a4b119a3453665f9" },
+    {   1025, "d00278ae47eb27b34faecf67b4fe263f82d5412916c1ffd97c8cb7fb814b8444",
+              "82223147a9b804a0c3f9a921b8d8aee250d1a51bb76be72152e6d5e8f27349b3" },
+    {   2048, "e776b6028c7cd22a4d0ba182a8bf62205d2ef576467e838ed6f2529b85fba24a",
+              "636bfa717d4f9fc3e59da9b2e5cce6a2b78eb70469c0fce49da38b5419892423" },
+    {   2049, "5f4d72f40d7a5f82b15ca2b2e44b1de3c2ef86c426c95c1af0b6879522563030",
+              "5442eec85e3fd173dcff07c39cd8cff9689f17224471e655618ed728cf03b056" },
+    {   3072, "b98cb0ff3623be03326b373de6b9095218513e64f1ee2edd2525c7ad1e5cffd2",
+              "66315151ac08f5cdf077f76e1b5f584a4da7b48a75036de5729be38dac835fb7" },
+    {   3073, "7124b49501012f81cc7f11ca069ec9226cecb8a2c850cfe644e327d22d3e1cd3",
+              "66eabf3a0a1a262221ee9eed633621a5065e4e73d098277c7de4162559edb9b4" },
+    {   4096, "015094013f57a5277b59d8475c0501042c0b642e531b0a1c8f58d2163229e969",
+              "e8c6e859e0480c4b062457defd04d2f4303b6cc280a0fe080ec5c4346a171937" },
+    {   4097, "9b4052b38f1c5fc8b1f9ff7ac7b27cd242487b3d890d15c96a1c25b8aa0fb995",
+              "a3b7fe277011b5efcde8a33d90b0edb88c29e73831f34d9b02aebab51c98e2a6" },
+    {   5120, "9cadc15fed8b5d854562b26a9536d9707cadeda9b143978f319ab34230535833",
+              "8bb4f2ab4db1d207713b4240105ec14d57452bc53073c480f8377279fa959a95" },
+    {   5121, "628bd2cb2004694adaab7bbd778a25df25c47b9d4155a55f8fbd79f2fe154cff",
+              "f5e92bc50eb02296aad75a7fb1faf6bf95c0f3eccfaaed506e2448df16b45c0b" },
+    {   6144, "3e2e5b74e048f3add6d21faab3f83aa44d3b2278afb83b80b3c35164ebeca205",
+              "40b1e813ec046e44a9818020f1e04cdc0e849d86636492191229f3f7257a636a" },
+    {   6145, "f1323a8631446cc50536a9f705ee5cb619424d46887f3c376c695b70e0f0507f",
+              "cc71dac5c78b3343de37fb4da9813f21a5b5ad63d9a2b1ca21a49a54373f9426" },
+    {   7168, "61da957ec2499a95d6b8023e2b0e604ec7f6b50e80a9678b89d2628e99ada77a",
+              "fabe20ee334b76c0b7fe08a7592829f8493c150393c8532f9505d27a22574fab" },
+    {   7169, "a003fc7a51754a9b3c7fae0367ab3d782dccf28855a03d435f8cfe74605e7817",
+              "accec9095f0b3bed3223a28fa90c84f8c7b4cd5570331664b4ecc52041468ade" },
+    {   8192, "aae792484c8efe4f19e2ca7d371d8c467ffb10748d8a5a1ae579948f718a2a63",
+              "c659141d9d7e6efafd2f274d4307b9ab3369f058c6d03cd5ba17d4518d77bd49" },
+    {   8193, "bab6c09cb8ce8cf459261398d2e7aef35700bf488116ceb94a36d0f5f1b7bc3b",
+              "c666ccf5fa240c07a9d0a6b8ae92c67668b482e7c2751fb5e1d9d7078fa9637e" },
+    {  16384, "f875d6646de28985646f34ee13be9a576fd515f76b5b0a26bb324735041ddde4",
+              "8880ce020ab0459420eee7e95f173d8a0d55c9b499d857880b0c661eb4162bae" },
+    {  31744, "62b6960e1a44bcc1eb1a611a8d6235b6b4b78f32e7abc4fb4c6cdcce94895c47",
+              "55253f057bce59e7811fea47ac0e72751ca12c40c4a5b8f3c42e54daa5073272" },
+    { 102400, "bc3e3d41a1146b069abffad3c0d44860cf664390afce4d9661f7902e7943e085",
+              "ab2ecf0478e816065ba6039d8ec583cbce8a2335efe903e2d7313c04ba5330d2" },
+};
+
+#define NVEC (sizeof(vectors) / sizeof(vectors[0]))
+
+static uint8_t input[102400];
+static struct b3_key plain_key, mac_key;
+static uint8_t pool_out[NVEC][32];
+
+static void hex(const uint8_t out[32], char buf[65])
+{
+    for (int i = 0; i < 32; i++)
+        sprintf(buf + 2 * i, "%02x", out[i]);
+}
+
+static void pool_fn(void *arg, unsigned int i)
+{
+    (void) arg;
+    b3_hash(&mac_key, input, vectors[i].len, pool_out[i]);
+}
+
+int main(void)
+{
+    uint8_t key[32], out[32];
+    char got[65];
+    int fd;
+
+    test_init();
+    for (size_t i = 0; i < sizeof(input); i++)
+        input[i] = i % 251;
+    for (int i = 0; i < 32; i++)
+        key[i] = i;
+
+    memcpy(plain_key.words, b3_iv, sizeof(b3_iv));
+    fd = open(KEY_FILE, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    CHECK(fd != -1 && write(fd, key, sizeof(key)) == (ssize_t) sizeof(key));
+    if (fd != -1)
+        close(fd);
+    CHECK(integ_key_load(KEY_FILE, &mac_key) == 0);
+    unlink(KEY_FILE);
+
+    for (size_t i = 0; i < NVEC; i++) {
+        b3_hash(&plain_key, input, vectors[i].len, out);
+        hex(out, got);
+        if (strcmp(got, vectors[i].hash) != 0)
+            printf("len %zu: hash %s\n", vectors[i].len, got);
+        CHECK(strcmp(got, vectors[i].hash) == 0);
+
+        b3_hash(&mac_key, input, vectors[i].len, out);
+        hex(out, got);
+        if (strcmp(got, vectors[i].keyed) != 0)
+            printf("len %zu: keyed %s\n", vectors[i].len, got);
+        CHECK(strcmp(got, vectors[i].keyed) == 0);
+    }
+
+    /* hash pool: 호출 스레드와 pool 스레드가 번호를 나눠 가짐 */
+    hpool_start(4);
+    for (int round = 0; round < 50; round++) {
+        memset(pool_out, 0, sizeof(pool_out));
+        hpool_run(pool_fn, NULL, NVEC);
+        for (size_t i = 0; i < NVEC; i++) {
+            hex(pool_out[i], got);
+            CHECK(strcmp(got, vectors[i].keyed) == 0);
+        }
+    }
+    hpool_stop();
+    return test_done("test_blake3");
+}
@@ -0,0 +1,218 @@
+/**
+ * test_breaker.c - 백엔드와 mirror 복제본의 circuit breaker
+ *
+ * remote_serve 자식을 SIGSTOP으로 멈춰 호출이 돌아오지 않게 하면 breaker가 열려
+ * 캐시된 파일은 그대로, 나머지는 -EHOSTDOWN으로 바로 돌아오는지, 그동안 통계
+ * 파일도 바로 읽히는지, SIGCONT 뒤 시험 호출 하나로 닫히는지 본다. mirror에서는
+ * 복제본 하나에 실패하는 호출을 넣어 그 breaker만 열리고 read가 다른 복제본으로
+ * 가다가 다시 돌아오는지, 전체 breaker가 없는지 본다. 레이어 스택은 한 번만
+ * 만들 수 있어 마운트마다 fork한 자식에서 돌린다.
+ */
+#include "test_util.h"
+
+#define SOCK "/tmp/basic_fuse_test_breaker.sock"
+#define ADDR "unix:" SOCK
+#define M1 "/tmp/fuse_data_brk1"
+#define HUNG 6
+
+static pid_t srv;
+
+/* 서버 자식을 띄우고 socket이 연결을 받을 때까지 기다림 */
+static pid_t serve(void)
+{
+    struct sockaddr_un sa = { .sun_family = AF_UNIX };
+    unlink(SOCK);
+    pid_t pid = fork();
+    if (pid == 0) {
+        options.remote_threads = 4;
+        remote_serve(ADDR);
+        _exit(1);
+    }
+    strcpy(sa.sun_path, SOCK);
+    for (int i = 0; pid > 0 && i < 200; i++) {
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        int ok = connect(fd, (struct sockaddr *) &sa, sizeof(sa)) == 0;
+        close(fd);
+        if (ok)
+            return pid;
+        usleep(10000);
+    }
+    return -1;
+}
+
+/* 마운트마다 자식 하나: fn의 실패 수를 종료 코드로 */
+static int mounted(int (*fn)(void))
+{
+    int status = -1;
+    pid_t pid = fork();
+    if (pid == 0)
+        _exit(fn());
+    return pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status)
+           ? WEXITSTATUS(status) : -1;
+}
+
+static double ms_since(uint64_t t0)
+{
+    return (now_ns() - t0) / 1e6;
+}
+
+static void *hang(void *arg)
+{
+    char path[32];
+    struct stat st;
+    snprintf(path, sizeof(path), "/t_brk/none%ld", (long) arg);
+    return (void *) (long) traced_getattr(path, &st, NULL);
+}
+
+/* 통계 파일에서 line으로 시작하는 줄이 있으면 그 줄의 want 포함 여부 */
+static int stats_has(const char *line, const char *want)
+{
+    struct fuse_file_info fi = { .flags = O_RDONLY };
+    static char buf[65536];
+    int n = 0;
+
+    if (traced_open(STATS_PATH, &fi) == 0) {
+        n = traced_read(STATS_PATH, buf, sizeof(buf) - 1, 0, &fi);
+        traced_release(STATS_PATH, &fi);
+    }
+    buf[n > 0 ? n : 0] = '\0';
+    char *s = strstr(buf, line), *e = s ? strchr(s, '\n') : NULL;
+    if (e)
+        *e = '\0';
+    return s && strstr(s, want);
+}
+
+static int backend(void)
+{
+    struct stat st;
+    char buf[16];
+
+    options.remote = ADDR;
+    options.inline_ttl_ms = 100;
+    options.breaker_ms = 200;
+    options.breaker_open_ms = 500;
+    options.breaker_inflight = 4;
+    if (layers_setup() != 0)
+        return 1;
+    CHECK(test_write("/t_brk/cached", "cached", 6) == 6);
+    CHECK(test_write("/t_brk/other", "other file", 10) == 10);
+    CHECK(test_read("/t_brk/cached", buf, sizeof(buf)) == 6);
+    CHECK(test_read("/t_brk/cached", buf, sizeof(buf)) == 6);  /* 두 번째 open에 캐시됨 */
+    CHECK(backend_brk.state == BRK_CLOSED && backend_brk.calls > 0);
+
+    /* 백엔드가 멈춤: 자리 넷이 멈춘 호출로 차면 열림 */
+    kill(srv, SIGSTOP);
+    pthread_t th[HUNG];
+    for (long i = 0; i < HUNG; i++)
+        pthread_create(&th[i], NULL, hang, (void *) i);
+    usleep(400000);
+    CHECK(backend_brk.state == BRK_OPEN && backend_brk.opened == 1);
+    CHECK(backend_brk.inflight == 4 && backend_brk.stuck_calls >= 4);
+
+    uint64_t t0 = now_ns();
+    CHECK(traced_getattr("/t_brk/cached", &st, NULL) == 0 && st.st_size == 6);
+    CHECK(test_read("/t_brk/cached", buf, sizeof(buf)) == 6 && memcmp(buf, "cached", 6) == 0);
+    CHECK(test_read("/t_brk/other", buf, sizeof(buf)) == -EHOSTDOWN);
+    CHECK(stats_has("# breaker backend", ": OPEN for"));
+    CHECK(ms_since(t0) < 100);
+
+    /* 돌아오면 멈췄던 호출이 끝나고, open_ms 뒤 시험 호출 하나로 닫힘 */
+    kill(srv, SIGCONT);
+    for (int i = 0; i < HUNG; i++) {
+        void *res;
+        pthread_join(th[i], &res);
+        long r = (long) res;
+        CHECK(r == -ENOENT || r == -ETIMEDOUT || r == -EHOSTDOWN);
+    }
+    usleep(600000);
+    CHECK(traced_getattr("/t_brk/none", &st, NULL) == -ENOENT);
+    CHECK(backend_brk.state == BRK_CLOSED && backend_brk.opened == 1);
+    CHECK(test_write("/t_brk/other", "changed", 7) == 7);
+    CHECK(test_read("/t_brk/other", buf, sizeof(buf)) == 7 && memcmp(buf, "changed", 7) == 0);
+    CHECK(stats_has("# breaker backend", ": closed,"));
+    return test_failures;
+}
+
+static int replicas(void)
+{
+    char buf[16];
+
+    options.mirror = M1;
+    options.breaker_ms = 100;
+    options.breaker_open_ms = 300;
+    options.inline_budget = 0;
+    if (layers_setup() != 0)
+        return 1;
+    hpool_start(1);
+    for (int l = 0; l < nlayers; l++)
+        CHECK(layers[l] != &brk_layer);
+    CHECK(test_write("/t_brk/f", "replicated", 10) == 10);
+    for (int i = 0; i < 20; i++)
+        CHECK(test_read("/t_brk/f", buf, sizeof(buf)) == 10);
+    CHECK(mirror.reads[1] > 0);
+
+    /* 복제본 1의 호출이 시간 초과로 끝남: 그 breaker만 열림 */
+    for (int i = 0; i < BRK_WINDOW && mirror.brk[1].state == BRK_CLOSED; i++) {
+        int slot = brk_enter(&mirror.brk[1], BRK_NOWAIT);
+        CHECK(slot >= 0);
+        brk_leave(&mirror.brk[1], slot, -ETIMEDOUT);
+    }
+    CHECK(mirror.brk[1].state == BRK_OPEN && mirror.brk[0].state == BRK_CLOSED);
+    CHECK(brk_enter(&mirror.brk[1], BRK_WAIT) == -EHOSTDOWN);
+
+    unsigned long long r0 = mirror.reads[0], r1 = mirror.reads[1];
+    for (int i = 0; i < 20; i++)
+        CHECK(test_read("/t_brk/f", buf, sizeof(buf)) == 10 && memcmp(buf, "replicated", 10) == 0);
+    CHECK(mirror.reads[0] > r0 && mirror.reads[1] == r1);
+    CHECK(stats_has("# breaker replica " M1, ": OPEN for"));
+
+    /* open_ms 뒤 read 하나가 시험 호출이 되어 닫고, 다시 나눠 읽음 */
+    usleep(350000);
+    for (int i = 0; i < 20; i++)
+        CHECK(test_read("/t_brk/f", buf, sizeof(buf)) == 10);
+    CHECK(mirror.brk[1].state == BRK_CLOSED && mirror.reads[1] > r1);
+    CHECK(!mirror.failed[1] && mirror.brk[1].opened == 1);
+    hpool_stop();
+    return test_failures;
+}
+
+/* 추가 루트가 없는 mirror 목록은 거부 */
+static int no_replica(void)
+{
+    options.mirror = "";
+    options.breaker_ms = 100;
+    return layers_setup() == 0;
+}
+
+/* 이전 실행이 DIR_PATH에 남긴 mirror 세대 파일 */
+static void drop_state(void)
+{
+    char p[PATH_MAX];
+    snprintf(p, sizeof(p), "%s/%s", DIR_PATH, MIRROR_STATE);
+    unlink(p);
+}
+
+int main(void)
+{
+    test_init();
+    test_fresh("t_brk");
+    drop_state();
+    CHECK(system("rm -rf " M1 " && mkdir -p " M1 "/t_brk") == 0);
+
+    srv = serve();
+    CHECK(srv > 0);
+    if (srv > 0) {
+        CHECK(mounted(backend) == 0);
+        kill(srv, SIGKILL);
+        waitpid(srv, NULL, 0);
+    }
+    unlink(SOCK);
+
+    test_fresh("t_brk");
+    CHECK(mounted(replicas) == 0);
+    CHECK(mounted(no_replica) == 0);
+
+    drop_state();
+    CHECK(system("rm -rf " M1) == 0);
+    return test_done("test_breaker");
+}
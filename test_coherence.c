@@ -0,0 +1,169 @@
+/**
+ * test_coherence.c - 같은 백엔드를 쓰는 두 데몬 사이의 캐시 일관성
+ *
+ * 이 프로세스(A)와 fork한 자식(B)이 각자 coherence 주소로 서로를 peer로 두고
+ * inline 캐시 ttl을 1분으로 길게 잡는다. B가 쓰거나 rename하면 A가 곧바로 새
+ * 내용을 보는지, B가 쓰려고 열어 둔 파일은 A가 닫힐 때까지 캐시하지 않는지,
+ * B가 죽으면 A의 publish가 lease 안에 끝나는지, B가 다시 뜨면 다시 믿는지
+ * (epoch 증가) 본다. B는 파이프로 받은 명령 한 글자를 처리하고 답한다.
+ */
+#include "test_util.h"
+
+#define SOCK_A "unix:/tmp/basic_fuse_test_coh_a.sock"
+#define SOCK_B "unix:/tmp/basic_fuse_test_coh_b.sock"
+#define LEASE_MS 300
+
+static int cmd_fd[2], ack_fd[2];
+
+static void setup(const char *self, const char *peer)
+{
+    options.coherence = self;
+    options.coherence_peers = peer;
+    options.inline_ttl_ms = 60000;      /* 알림이 없으면 1분 동안 옛 내용 */
+    options.coherence_ttl_ms = 60000;
+    options.coherence_lease_ms = LEASE_MS;
+    options.heat_sample = 0;
+    if (layers_setup() != 0 || coh_start() != 0) {
+        printf("coherence setup failed\n");
+        exit(1);
+    }
+}
+
+/* 잘라서 data로 덮어씀. fo가 있으면 닫지 않고 넘김 */
+static int put(const char *path, const char *data, struct fuse_file_info *fo)
+{
+    struct fuse_file_info fi = { .flags = O_WRONLY | O_TRUNC };
+    int res = traced_open(path, &fi);
+    if (res == -ENOENT) {
+        fi.flags = O_WRONLY;
+        res = traced_create(path, 0644, &fi);
+    }
+    if (res == 0)
+        res = traced_truncate(path, 0, &fi);
+    if (res == 0)
+        res = traced_write(path, data, strlen(data), 0, &fi);
+    if (fo)
+        *fo = fi;
+    else
+        traced_release(path, &fi);
+    return res;
+}
+
+static int get(const char *path, char *buf, size_t len)
+{
+    int n = test_read(path, buf, len - 1);
+    buf[n > 0 ? n : 0] = '\0';
+    return n;
+}
+
+static void peer_b(void)
+{
+    struct fuse_file_info held;
+    char c, buf[64];
+
+    setup(SOCK_B, SOCK_A);
+    while (read(cmd_fd[0], &c, 1) == 1) {
+        if (c == 'w')
+            put("/t_coh/x", "from B v2", NULL);
+        else if (c == 'o')
+            put("/t_coh/y", "B writing", &held);
+        else if (c == 'c')
+            traced_release("/t_coh/y", &held);
+        else if (c == 'r')
+            get("/t_coh/x", buf, sizeof(buf));
+        else if (c == 'n')
+            traced_rename("/t_coh/x", "/t_coh/z", 0);
+        if (write(ack_fd[1], "k", 1) != 1)
+            break;
+    }
+    _exit(0);
+}
+
+static pid_t start_b(void)
+{
+    if (pipe(cmd_fd) == -1 || pipe(ack_fd) == -1)
+        return -1;
+    pid_t pid = fork();
+    if (pid == 0)
+        peer_b();
+    return pid;
+}
+
+static void tell_b(char c)
+{
+    char ack;
+    CHECK(write(cmd_fd[1], &c, 1) == 1 && read(ack_fd[0], &ack, 1) == 1);
+}
+
+static int trusted(void)
+{
+    for (int i = 0; i < 200 && !(now_ns() < icache.trust_until); i++)
+        usleep(10000);
+    return now_ns() < icache.trust_until;
+}
+
+int main(void)
+{
+    struct stat st;
+    char buf[64];
+
+    test_init();
+    test_fresh("t_coh");
+    pid_t b = start_b();
+    CHECK(b > 0);
+    setup(SOCK_A, SOCK_B);
+    CHECK(trusted());
+
+    /* 믿는 동안은 캐시에서 */
+    CHECK(put("/t_coh/x", "from A v1", NULL) == 9);
+    tell_b('r');
+    CHECK(get("/t_coh/x", buf, sizeof(buf)) == 9 && strcmp(buf, "from A v1") == 0);
+    uint64_t attr_hits = icache.attr_hits, hits = icache.hits;
+    CHECK(traced_getattr("/t_coh/x", &st, NULL) == 0 && st.st_size == 9);
+    CHECK(get("/t_coh/x", buf, sizeof(buf)) == 9);
+    CHECK(icache.attr_hits == attr_hits + 1 && icache.hits == hits + 1);
+
+    /* B가 쓰면 A는 곧바로 새 내용 */
+    uint64_t received = coh.received;
+    tell_b('w');
+    CHECK(coh.received > received);
+    CHECK(get("/t_coh/x", buf, sizeof(buf)) == 9 && strcmp(buf, "from B v2") == 0);
+
+    /* B가 쓰려고 열어 둔 동안은 캐시하지 않음 */
+    tell_b('o');
+    CHECK(icache.npins == 1);
+    unsigned long entries = icache.entries;
+    CHECK(get("/t_coh/y", buf, sizeof(buf)) == 9 && strcmp(buf, "B writing") == 0);
+    CHECK(icache.entries == entries);
+    tell_b('c');
+    CHECK(icache.npins == 0);
+    CHECK(get("/t_coh/y", buf, sizeof(buf)) == 9 && icache.entries == entries + 1);
+
+    /* B의 rename */
+    CHECK(put("/t_coh/x", "A again!!", NULL) == 9);
+    CHECK(get("/t_coh/x", buf, sizeof(buf)) == 9);
+    tell_b('n');
+    CHECK(traced_getattr("/t_coh/x", &st, NULL) == -ENOENT);
+    CHECK(get("/t_coh/z", buf, sizeof(buf)) == 9 && strcmp(buf, "A again!!") == 0);
+
+    /* B가 죽으면 믿음이 끊기고 publish는 lease 안에 끝남 */
+    kill(b, SIGKILL);
+    waitpid(b, NULL, 0);
+    usleep((LEASE_MS + 100) * 1000);
+    CHECK(!(now_ns() < icache.trust_until));
+    uint64_t t0 = now_ns();
+    CHECK(put("/t_coh/z", "alone", NULL) == 5);
+    CHECK(now_ns() - t0 < (LEASE_MS + 100) * 1000000ULL);
+
+    /* 다시 뜬 B: epoch가 올라가고 다시 믿음 */
+    unsigned int epoch = icache.epoch;
+    b = start_b();
+    CHECK(b > 0 && trusted() && icache.epoch > epoch);
+    tell_b('w');
+    CHECK(get("/t_coh/x", buf, sizeof(buf)) == 9 && strcmp(buf, "from B v2") == 0);
+
+    kill(b, SIGKILL);
+    waitpid(b, NULL, 0);
+    coh_stop();
+    return test_done("test_coherence");
+}
@@ -0,0 +1,113 @@
+/**
+ * test_ec.c - erasure coding (mirror_ec)의 조각 복원과 잃은 조각 기록
+ *
+ * 보통 디렉토리 다섯 개(DIR_PATH와 복제본 루트 넷)에 데이터 3 + parity 2로
+ * 나눠 쓰고, 데이터 조각 파일을 지운 뒤에도 parity로 같은 내용을 읽는지 본다.
+ * 조각을 잃은 루트는 세대가 뒤처져 재시작 뒤에도 쓰지 않고 그 자리를 계속
+ * 복원으로 메우는지, 복원할 수 없을 만큼 뒤처진 루트가 많으면 마운트를
+ * 거부하는지도 본다. 마운트마다 fork한 자식에서 돌린다.
+ */
+#include "test_util.h"
+
+#define ROOT "/tmp/fuse_data_ec"
+#define ROOTS ROOT "1:" ROOT "2:" ROOT "3:" ROOT "4"
+#define CELL 4096
+#define FSIZE (10 * 3 * CELL + 1234)    /* stripe 10개와 부분 stripe */
+
+static char data[FSIZE], got[FSIZE + 1];
+
+static void sh(const char *cmd)
+{
+    CHECK(system(cmd) == 0);
+}
+
+static void drop_state(void)
+{
+    char p[PATH_MAX];
+    snprintf(p, sizeof(p), "%s/%s", DIR_PATH, MIRROR_STATE);
+    unlink(p);
+}
+
+static int mounted(int (*fn)(void))
+{
+    int status = -1;
+    pid_t pid = fork();
+    if (pid == 0) {
+        options.mirror = ROOTS;
+        options.mirror_ec = 3;
+        options.mirror_ec_cell = CELL;
+        _exit(fn());
+    }
+    return pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status)
+           ? WEXITSTATUS(status) : -1;
+}
+
+static int same(void)
+{
+    return test_read("/t_ec/f", got, sizeof(got)) == FSIZE && memcmp(got, data, FSIZE) == 0;
+}
+
+/* 쓰고, 데이터 조각 하나를 지워도 읽고, 그 루트를 잃은 것으로 기록 */
+static int first(void)
+{
+    if (layers_setup() != 0)
+        return 1;
+    CHECK(test_write("/t_ec/f", data, FSIZE) == FSIZE);
+    CHECK(same());
+    CHECK(ec.degraded == 0);
+    struct stat st;
+    CHECK(traced_getattr("/" MIRROR_STATE, &st, NULL) == -ENOENT);
+    CHECK(test_write("/t_ec/" MIRROR_STATE, "x", 1) == -EPERM);
+
+    sh("rm " ROOT "1/t_ec/f");
+    CHECK(same());
+    CHECK(ec.degraded > 0);
+
+    /* 조각 파일이 없어진 루트에 쓰면 실패로 표시되고 세대가 올라감 */
+    memset(data, 'w', 3 * CELL);
+    CHECK(test_write("/t_ec/f", data, FSIZE) == FSIZE);
+    CHECK(mirror.failed[1]);
+    CHECK(mirror_gen_read(0) == 2 && mirror_gen_read(1) == 1);
+    CHECK(same());
+    return test_failures;
+}
+
+/* 재시작: 루트 1은 뒤처져 쓰지 않고 그 조각은 계속 복원 */
+static int restarted(void)
+{
+    if (layers_setup() != 0)
+        return 1;
+    CHECK(mirror.failed[1] && !mirror.failed[2]);
+    CHECK(same());
+    CHECK(ec.degraded > 0);
+    return test_failures;
+}
+
+static int refused(void)
+{
+    return layers_setup() == 0;
+}
+
+int main(void)
+{
+    test_init();
+    test_fresh("t_ec");
+    drop_state();
+    sh("rm -rf " ROOT "1 " ROOT "2 " ROOT "3 " ROOT "4");
+    sh("mkdir -p " ROOT "1/t_ec " ROOT "2/t_ec " ROOT "3/t_ec " ROOT "4/t_ec");
+    for (int i = 0; i < FSIZE; i++)
+        data[i] = i * 31 + i / 4096;
+
+    CHECK(mounted(first) == 0);
+    memset(data, 'w', 3 * CELL);
+    CHECK(mounted(restarted) == 0);
+
+    /* 루트 셋이 뒤처지면 남은 조각 둘로는 복원할 수 없음 */
+    sh("echo 'generation 1' > " ROOT "2/" MIRROR_STATE);
+    sh("echo 'generation 1' > " ROOT "3/" MIRROR_STATE);
+    CHECK(mounted(refused) == 0);
+
+    drop_state();
+    sh("rm -rf " ROOT "1 " ROOT "2 " ROOT "3 " ROOT "4");
+    return test_done("test_ec");
+}
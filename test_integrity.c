@@ -0,0 +1,206 @@
+/**
+ * test_integrity.c - integrity layer의 태그 헤더 보호 테스트
+ *
+ * sidecar 배치에서 백엔드 파일을 직접 고쳐 헤더 필드 변조, 다른 파일의
+ * 같은 위치 블록 끼워 넣기, 비정상 종료로 dirty가 남은 파일의 변조,
+ * blake3 경로에 crc32c 태그 파일을 넣는 격하가 모두 EIO로 걸리는지 본다.
+ * interleaved 배치는 fork한 자식에서 이전 내용 되돌리기와 잘라 내기를 본다. 끝으로 여러 스레드가 같은 파일을 열고 닫기를
+ * 반복해 공유 상태를 읽어 들이는 중/닫는 중인 항목을 기다리는 경로를 돌린다.
+ */
+#include "test_util.h"
+
+#define KEY_FILE "/tmp/basic_fuse_test_integrity.key"
+#define BS 4096
+#define FSIZE (8 * BS)
+
+static char data[FSIZE], got[FSIZE];
+
+static void backend(const char *name, char *out, size_t len)
+{
+    snprintf(out, len, "%s/t_integ/%s", DIR_PATH, name);
+}
+
+static int peek(const char *name, void *buf, size_t len, off_t off)
+{
+    char p[PATH_MAX];
+    backend(name, p, sizeof(p));
+    int fd = open(p, O_RDONLY), n = fd == -1 ? -1 : (int) pread(fd, buf, len, off);
+    if (fd != -1)
+        close(fd);
+    return n;
+}
+
+static int poke(const char *name, const void *buf, size_t len, off_t off)
+{
+    char p[PATH_MAX];
+    backend(name, p, sizeof(p));
+    int fd = open(p, O_WRONLY), n = fd == -1 ? -1 : (int) pwrite(fd, buf, len, off);
+    if (fd != -1)
+        close(fd);
+    return n;
+}
+
+static void copy(const char *from, const char *to)
+{
+    char a[PATH_MAX], b[PATH_MAX], cmd[3 * PATH_MAX];
+    backend(from, a, sizeof(a));
+    backend(to, b, sizeof(b));
+    snprintf(cmd, sizeof(cmd), "cp '%s' '%s'", a, b);
+    CHECK(system(cmd) == 0);
+}
+
+/* interleaved: 한 묶음(데이터 2블록 + 태그)을 이전 내용으로 되돌리거나 묶음을 잘라 냄 */
+static int interleaved(void)
+{
+    char old[PATH_MAX], cur[PATH_MAX], cmd[3 * PATH_MAX];
+    size_t group = 2 * (BS + ILV_SLOT);
+    char *raw = malloc(group);
+    struct stat st;
+
+    options.integrity_layout = "interleaved";
+    options.integrity_group = 2;
+    if (raw == NULL || layers_setup() != 0)
+        return 1;
+    CHECK(test_write("/t_integ/i", data, FSIZE - 100) == FSIZE - 100);
+    CHECK(test_read("/t_integ/i", got, FSIZE) == FSIZE - 100);
+
+    backend("i", cur, sizeof(cur));
+    backend("i.old", old, sizeof(old));
+    snprintf(cmd, sizeof(cmd), "cp '%s' '%s'", cur, old);
+    CHECK(system(cmd) == 0);
+    memset(data, 'N', BS);
+    CHECK(test_write("/t_integ/i", data, FSIZE - 100) == FSIZE - 100);
+    CHECK(test_read("/t_integ/i", got, FSIZE) == FSIZE - 100 && memcmp(got, data, BS) == 0);
+
+    CHECK(peek("i", raw, group, TAG_HDR_SIZE) == (int) group);
+    CHECK(peek("i.old", got, group, TAG_HDR_SIZE) == (int) group);
+    CHECK(poke("i", got, group, TAG_HDR_SIZE) == (int) group);
+    CHECK(test_read("/t_integ/i", got, FSIZE) == -EIO);
+    CHECK(poke("i", raw, group, TAG_HDR_SIZE) == (int) group);
+    CHECK(test_read("/t_integ/i", got, FSIZE) == FSIZE - 100);
+
+    CHECK(stat(cur, &st) == 0 && truncate(cur, st.st_size - 100 - ILV_SLOT) == 0);
+    CHECK(test_read("/t_integ/i", got, FSIZE) == -EIO);
+    free(raw);
+    return test_failures;
+}
+
+#define THREADS 8
+#define ROUNDS 200
+
+static void *opener(void *arg)
+{
+    char *buf = malloc(FSIZE);
+    long bad = 0;
+    (void) arg;
+    for (int i = 0; i < ROUNDS && buf; i++)
+        if (test_read("/t_integ/b", buf, FSIZE) != FSIZE || memcmp(buf, data, FSIZE) != 0)
+            bad++;
+    free(buf);
+    return (void *) bad;
+}
+
+int main(void)
+{
+    struct tag_hdr hdr, saved;
+    uint8_t ta[TAG_MAX], tb[TAG_MAX];
+    int fd;
+
+    test_init();
+    test_fresh("t_integ");
+    fd = open(KEY_FILE, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    for (int i = 0; i < 32; i++)
+        CHECK(write(fd, "k", 1) == 1);
+    close(fd);
+    options.integrity = "blake3";
+    options.integrity_key = KEY_FILE;
+    options.integrity_block = BS;
+    options.inline_budget = 0;
+    for (int i = 0; i < FSIZE; i++)
+        data[i] = i * 7;
+
+    /* 레이어 스택은 한 번만 만들 수 있어 interleaved는 자식에서 */
+    pid_t pid = fork();
+    if (pid == 0)
+        _exit(interleaved() ? 1 : 0);
+    int status = -1;
+    CHECK(pid > 0 && waitpid(pid, &status, 0) == pid);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    options.integrity_paths = "/t_integ/weak=crc32c";
+    if (layers_setup() != 0)
+        return 1;
+    CHECK(test_write("/t_integ/a", data, FSIZE) == FSIZE);
+    CHECK(test_write("/t_integ/b", data, FSIZE) == FSIZE);
+    CHECK(test_read("/t_integ/a", got, FSIZE) == FSIZE && memcmp(got, data, FSIZE) == 0);
+
+    /* 같은 내용, 같은 위치라도 파일 키가 달라 태그가 다름 */
+    CHECK(peek(".bft.a", ta, 32, TAG_HDR_SIZE + 32) == 32);
+    CHECK(peek(".bft.b", tb, 32, TAG_HDR_SIZE + 32) == 32);
+    CHECK(memcmp(ta, tb, 32) != 0);
+
+    /* b의 블록 1을 바꾸고 그 데이터와 태그를 a의 같은 자리에 끼워 넣음 */
+    memset(data + BS, 'B', BS);
+    CHECK(test_write("/t_integ/b", data, FSIZE) == FSIZE);
+    CHECK(peek("b", got, BS, BS) == BS && poke("a", got, BS, BS) == BS);
+    CHECK(peek(".bft.b", tb, 32, TAG_HDR_SIZE + 32) == 32);
+    CHECK(poke(".bft.a", tb, 32, TAG_HDR_SIZE + 32) == 32);
+    CHECK(test_read("/t_integ/a", got, FSIZE) == -EIO);
+
+    /* 헤더 필드 변조: dirty 표시(root 검증 건너뛰기), 크기 */
+    CHECK(peek(".bft.b", &saved, sizeof(saved), 0) == (int) sizeof(saved));
+    hdr = saved;
+    hdr.flags |= TAG_DIRTY;
+    CHECK(poke(".bft.b", &hdr, sizeof(hdr), 0) == (int) sizeof(hdr));
+    CHECK(test_read("/t_integ/b", got, FSIZE) == -EIO);
+    hdr = saved;
+    hdr.file_size -= BS;
+    CHECK(poke(".bft.b", &hdr, sizeof(hdr), 0) == (int) sizeof(hdr));
+    CHECK(test_read("/t_integ/b", got, FSIZE) == -EIO);
+    CHECK(poke(".bft.b", &saved, sizeof(saved), 0) == (int) sizeof(saved));
+    CHECK(test_read("/t_integ/b", got, FSIZE) == FSIZE && memcmp(got, data, FSIZE) == 0);
+
+    /* 열어서 쓰는 중(dirty)인 상태를 복사해 비정상 종료를 흉내 냄 */
+    struct fuse_file_info fi = { .flags = O_WRONLY };
+    CHECK(traced_open("/t_integ/b", &fi) == 0);
+    CHECK(traced_write("/t_integ/b", "x", 1, 10, &fi) == 1);
+    data[10] = 'x';
+    copy("b", "c");
+    copy(".bft.b", ".bft.c");
+    copy("b", "d");
+    copy(".bft.b", ".bft.d");
+    traced_release("/t_integ/b", &fi);
+    CHECK(peek(".bft.c", &hdr, sizeof(hdr), 0) == (int) sizeof(hdr) && (hdr.flags & TAG_DIRTY));
+
+    unsigned long long unclean = istat.unclean;
+    CHECK(test_read("/t_integ/c", got, FSIZE) == FSIZE && memcmp(got, data, FSIZE) == 0);
+    CHECK(poke("d", "?", 1, 5 * BS + 3) == 1);
+    CHECK(test_read("/t_integ/d", got, FSIZE) == -EIO);
+    CHECK(istat.unclean == unclean + 2);
+
+    /* 방식 격하: crc32c 경로의 파일과 태그를 blake3 경로로 옮겨 놓음 */
+    CHECK(traced_mkdir("/t_integ/weak", 0755) == 0);
+    CHECK(test_write("/t_integ/weak/w", data, FSIZE) == FSIZE);
+    CHECK(peek("weak/.bft.w", &hdr, sizeof(hdr), 0) == (int) sizeof(hdr) &&
+          hdr.alg == TAG_ALG_CRC32C);
+    copy("weak/w", "w");
+    copy("weak/.bft.w", ".bft.w");
+    CHECK(test_read("/t_integ/w", got, FSIZE) == -EIO);
+    CHECK(test_read("/t_integ/weak/w", got, FSIZE) == FSIZE);
+    CHECK(traced_rename("/t_integ/weak/w", "/t_integ/w2", 0) == -EXDEV);
+    CHECK(traced_rename("/t_integ/weak", "/t_integ/strong", 0) == -EXDEV);
+    CHECK(traced_rename("/t_integ/weak/w", "/t_integ/weak/w2", 0) == 0);
+
+    pthread_t th[THREADS];
+    for (int i = 0; i < THREADS; i++)
+        pthread_create(&th[i], NULL, opener, NULL);
+    for (int i = 0; i < THREADS; i++) {
+        void *bad;
+        pthread_join(th[i], &bad);
+        CHECK(bad == NULL);
+    }
+    CHECK(istat.unclean == unclean + 2);
+
+    unlink(KEY_FILE);
+    return test_done("test_integrity");
+}
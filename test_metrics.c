@@ -0,0 +1,127 @@
+/**
+ * test_metrics.c - OpenMetrics exporter (-o metrics_sock=PATH) scrape 테스트
+ *
+ * 여러 스레드에서 요청을 처리한 뒤 unix socket으로 HTTP GET과 맨 연결(본문만)
+ * 두 가지로 긁어, 형식(TYPE 다음 샘플, # EOF)과 요청 수가 맞는지 본다.
+ */
+#include "test_util.h"
+
+#define SOCK "/tmp/basic_fuse_test_metrics.sock"
+#define THREADS 4
+#define CALLS 500
+
+static void *worker(void *arg)
+{
+    struct stat st;
+    (void) arg;
+    for (int i = 0; i < CALLS; i++)
+        traced_getattr("/t_metrics", &st, NULL);
+    return NULL;
+}
+
+/* 연결해서 (get이면 HTTP 요청을 보내고) 닫힐 때까지 받은 것 */
+static char *scrape(int get)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    char *buf = NULL;
+    size_t len = 0, cap = 0;
+
+    strcpy(addr.sun_path, SOCK);
+    if (fd == -1 || connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1) {
+        if (fd != -1)
+            close(fd);
+        return NULL;
+    }
+    if (get) {
+        static const char req[] = "GET /metrics HTTP/1.1\r\nHost: localhost\r\n\r\n";
+        if (write(fd, req, sizeof(req) - 1) != (ssize_t) sizeof(req) - 1) {
+            close(fd);
+            return NULL;
+        }
+    } else {
+        shutdown(fd, SHUT_WR);
+    }
+    for (;;) {
+        if (cap - len < 65536 && (buf = realloc(buf, cap += 65536)) == NULL)
+            break;
+        ssize_t n = read(fd, buf + len, cap - len - 1);
+        if (n <= 0)
+            break;
+        len += n;
+    }
+    close(fd);
+    if (buf)
+        buf[len] = '\0';
+    return buf;
+}
+
+static unsigned long long sample(const char *text, const char *name)
+{
+    const char *p = strstr(text, name);
+    return p ? strtoull(p + strlen(name), NULL, 10) : 0;
+}
+
+/* 모든 샘플 줄의 metric family에 앞선 # TYPE 줄이 있는지 */
+static int typed(const char *text)
+{
+    char family[128] = "";
+    for (const char *line = text; *line; ) {
+        const char *end = strchr(line, '\n');
+        if (end == NULL)
+            return 0;
+        if (strncmp(line, "# TYPE ", 7) == 0) {
+            sscanf(line + 7, "%127s", family);
+        } else if (line[0] != '#') {
+            if (family[0] == '\0' || strncmp(line, family, strlen(family)) != 0) {
+                printf("untyped sample: %.*s\n", (int) (end - line), line);
+                return 0;
+            }
+        }
+        line = end + 1;
+    }
+    return 1;
+}
+
+int main(void)
+{
+    test_init();
+    test_fresh("t_metrics");
+    if (layers_setup() != 0)
+        return 1;
+    options.metrics_sock = SOCK;
+    CHECK(metrics_start(SOCK) == 0);
+
+    pthread_t th[THREADS];
+    for (int i = 0; i < THREADS; i++)
+        pthread_create(&th[i], NULL, worker, NULL);
+    for (int i = 0; i < THREADS; i++)
+        pthread_join(th[i], NULL);
+
+    char *http = scrape(1), *raw = scrape(0);
+    CHECK(http != NULL && raw != NULL);
+    if (http && raw) {
+        CHECK(strncmp(http, "HTTP/1.0 200 OK\r\n", 17) == 0);
+        CHECK(strstr(http, "Content-Type: application/openmetrics-text") != NULL);
+        char *body = strstr(http, "\r\n\r\n");
+        CHECK(body != NULL);
+        CHECK(raw[0] == '#');   /* 요청이 없으면 헤더 없이 본문만 */
+        if (body) {
+            body += 4;
+            size_t n = strlen(body);
+            CHECK(n > 6 && strcmp(body + n - 6, "# EOF\n") == 0);
+            CHECK(typed(body));
+            unsigned long long got = sample(body, "basic_fuse_requests_total{op=\"getattr\"} ");
+            printf("getattr requests: %llu (expected >= %d)\n", got, THREADS * CALLS);
+            CHECK(got >= THREADS * CALLS);
+            CHECK(sample(body, "basic_fuse_requests_in_flight{op=\"getattr\"} ") == 0);
+            CHECK(strstr(body, "basic_fuse_request_duration_seconds_bucket{op=\"getattr\",le=\"+Inf\"}") != NULL);
+        }
+    }
+    free(http);
+    free(raw);
+
+    metrics_stop();
+    CHECK(access(SOCK, F_OK) == -1);
+    return test_done("test_metrics");
+}
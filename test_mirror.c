@@ -0,0 +1,135 @@
+/**
+ * test_mirror.c - mirror layer의 실패 복제본 기록과 create
+ *
+ * 복제본 하나가 실패하면 세대 번호(.bfmirror)가 올라가 재시작 뒤에도 그 루트를
+ * 쓰지 않는지, 다시 맞추고 세대 파일을 복사하면 다시 쓰는지, DIR_PATH가
+ * 뒤처졌으면 마운트를 거부하는지 본다. create가 다른 복제본에 남아 있던 같은
+ * 이름의 파일을 비우는지, 세대 파일이 보이지 않고 만들 수 없는지도 본다.
+ * 레이어 스택은 한 번만 만들 수 있어 마운트마다 fork한 자식에서 돌린다.
+ */
+#include "test_util.h"
+
+#define M1 "/tmp/fuse_data_mirror1"
+#define M2 "/tmp/fuse_data_mirror2"
+
+static void sh(const char *cmd)
+{
+    CHECK(system(cmd) == 0);
+}
+
+static int exists(const char *path)
+{
+    struct stat st;
+    return stat(path, &st) == 0;
+}
+
+/* 이전 실행이 DIR_PATH에 남긴 세대 파일 */
+static void drop_state(void)
+{
+    char p[PATH_MAX];
+    snprintf(p, sizeof(p), "%s/%s", DIR_PATH, MIRROR_STATE);
+    unlink(p);
+}
+
+static int seen;
+
+static int find_state(void *buf, const char *name, const struct stat *st, off_t off,
+                      enum fuse_fill_dir_flags flags)
+{
+    (void) buf, (void) st, (void) off, (void) flags;
+    if (strncmp(name, MIRROR_STATE, strlen(MIRROR_STATE)) == 0)
+        seen++;
+    return 0;
+}
+
+/* 마운트마다 자식 하나: fn의 실패 수를 종료 코드로 */
+static int mounted(int (*fn)(void))
+{
+    int status = -1;
+    pid_t pid = fork();
+    if (pid == 0) {
+        options.mirror = M1 ":" M2;
+        _exit(fn());
+    }
+    return pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status)
+           ? WEXITSTATUS(status) : -1;
+}
+
+/* 처음: 세대 1, 복제본 2를 잃으면 남은 루트가 세대 2 */
+static int first(void)
+{
+    struct fuse_file_info fi = { .flags = O_RDONLY };
+    struct stat st;
+
+    if (layers_setup() != 0)
+        return 1;
+    CHECK(mirror.gen == 1 && mirror_gen_read(2) == 1);
+    CHECK(test_write("/t_mirror/a", "aaaa", 4) == 4);
+    CHECK(exists(M2 "/t_mirror/a"));
+
+    CHECK(traced_getattr("/" MIRROR_STATE, &st, NULL) == -ENOENT);
+    CHECK(traced_getattr("/t_mirror/" MIRROR_STATE, &st, NULL) == -ENOENT);
+    CHECK(test_write("/t_mirror/" MIRROR_STATE, "x", 1) == -EPERM);
+    CHECK(traced_rename("/t_mirror/a", "/" MIRROR_STATE, 0) == -EPERM);
+    CHECK(traced_readdir("/", NULL, find_state, 0, &fi, 0) == 0 && seen == 0);
+
+    sh("rm -rf " M2 "/t_mirror");
+    CHECK(test_write("/t_mirror/b", "bbbb", 4) == 4);
+    CHECK(mirror.failed[2] && !mirror.failed[1]);
+    CHECK(mirror_gen_read(0) == 2 && mirror_gen_read(1) == 2 && mirror_gen_read(2) == 1);
+    return test_failures;
+}
+
+/* 재시작: 복제본 2는 뒤처져 쓰지 않음 */
+static int restarted(void)
+{
+    if (layers_setup() != 0)
+        return 1;
+    CHECK(mirror.gen == 2 && mirror.failed[2] && !mirror.failed[1]);
+    CHECK(test_write("/t_mirror/c", "cccc", 4) == 4);
+    CHECK(exists(M1 "/t_mirror/c") && !exists(M2 "/t_mirror/c"));
+    return test_failures;
+}
+
+/* 다시 맞춘 뒤: 모두 쓰고, create는 복제본에 남은 파일을 비움 */
+static int resynced(void)
+{
+    char buf[64];
+    struct stat st;
+
+    if (layers_setup() != 0)
+        return 1;
+    CHECK(!mirror.failed[1] && !mirror.failed[2]);
+    sh("echo leftover-from-an-earlier-life > " M1 "/t_mirror/d");
+    CHECK(test_write("/t_mirror/d", "dd", 2) == 2);
+    CHECK(!mirror.failed[1]);
+    CHECK(stat(M1 "/t_mirror/d", &st) == 0 && st.st_size == 2);
+    CHECK(test_read("/t_mirror/d", buf, sizeof(buf)) == 2 && memcmp(buf, "dd", 2) == 0);
+    return test_failures;
+}
+
+static int refused(void)
+{
+    return layers_setup() == 0;
+}
+
+int main(void)
+{
+    test_init();
+    test_fresh("t_mirror");
+    drop_state();
+    sh("rm -rf " M1 " " M2 " && mkdir -p " M1 "/t_mirror " M2 "/t_mirror");
+
+    CHECK(mounted(first) == 0);
+    CHECK(mounted(restarted) == 0);
+    sh("rm -rf " M2 " && cp -a " M1 " " M2);
+    CHECK(mounted(resynced) == 0);
+
+    /* DIR_PATH가 뒤처짐 */
+    sh("echo 'generation 9' > " M1 "/" MIRROR_STATE);
+    CHECK(mounted(refused) == 0);
+
+    drop_state();
+    sh("rm -rf " M1 " " M2);
+    return test_done("test_mirror");
+}
@@ -0,0 +1,169 @@
+/**
+ * test_offline.c - 백엔드가 내려간 동안의 사본 처리와 다시 연결된 뒤의 재생
+ *
+ * remote_serve 자식을 SIGKILL로 없애면 사본이 있는 파일은 계속 읽히고, 변경은
+ * 사본과 기록에 남는지 본다. 서버를 다시 띄우면 write, unlink, rename, mkdir가
+ * 그대로 재생되는지, 그사이 백엔드에서 바뀐 파일은 덮지 않고 우리 내용을
+ * .conflict- 파일로 올리는지 본다. 레이어 스택은 한 번만 만들 수 있어 fork한
+ * 자식에서 돌린다.
+ */
+#include "test_util.h"
+#include <glob.h>
+
+#define SOCK "/tmp/basic_fuse_test_offline.sock"
+#define ADDR "unix:" SOCK
+#define COPIES "/tmp/basic_fuse_test_offline"
+
+/* 서버 자식을 띄우고 socket이 연결을 받을 때까지 기다림 */
+static pid_t serve(void)
+{
+    struct sockaddr_un sa = { .sun_family = AF_UNIX };
+    unlink(SOCK);
+    pid_t pid = fork();
+    if (pid == 0) {
+        options.remote_threads = 4;
+        remote_serve(ADDR);
+        _exit(1);
+    }
+    strcpy(sa.sun_path, SOCK);
+    for (int i = 0; pid > 0 && i < 200; i++) {
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        int ok = connect(fd, (struct sockaddr *) &sa, sizeof(sa)) == 0;
+        close(fd);
+        if (ok)
+            return pid;
+        usleep(10000);
+    }
+    return -1;
+}
+
+static void stop(pid_t pid)
+{
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+}
+
+/* 백엔드 파일을 직접 읽음 (없으면 -ENOENT) */
+static int backend_read(const char *path, char *buf, size_t len)
+{
+    char fpath[PATH_MAX];
+    snprintf(fpath, sizeof(fpath), "%s%s", DIR_PATH, path);
+    int fd = open(fpath, O_RDONLY);
+    if (fd == -1)
+        return -errno;
+    int n = read(fd, buf, len);
+    close(fd);
+    return n;
+}
+
+static int backend_write(const char *path, const char *data)
+{
+    char fpath[PATH_MAX];
+    snprintf(fpath, sizeof(fpath), "%s%s", DIR_PATH, path);
+    int fd = open(fpath, O_WRONLY | O_TRUNC);
+    int n = fd == -1 ? -errno : write(fd, data, strlen(data));
+    if (fd != -1)
+        close(fd);
+    return n;
+}
+
+static void wait_state(int state)
+{
+    for (int i = 0; i < 500 && __atomic_load_n(&off.state, __ATOMIC_RELAXED) != state; i++)
+        usleep(10000);
+}
+
+static int offline(void)
+{
+    char buf[32], pat[PATH_MAX];
+    struct stat st;
+    glob_t g;
+
+    options.remote = ADDR;
+    options.offline = COPIES;
+    options.offline_retry_ms = 100;
+    options.offline_retry_max_ms = 400;
+    options.breaker_ms = 1000;
+    options.inline_budget = 0;
+    pid_t srv = serve();
+    if (srv <= 0 || layers_setup() != 0 || off_start() != 0)
+        return 1;
+
+    CHECK(test_write("/t_off/a", "alpha", 5) == 5);
+    CHECK(test_write("/t_off/b", "bravo", 5) == 5);
+    CHECK(test_write("/t_off/c", "charlie", 7) == 7);
+    CHECK(test_write("/t_off/e", "echo", 4) == 4);
+    /* 읽으려고 열면 사본을 백그라운드로 받음 */
+    CHECK(test_read("/t_off/a", buf, sizeof(buf)) == 5);
+    CHECK(test_read("/t_off/b", buf, sizeof(buf)) == 5);
+    CHECK(test_read("/t_off/c", buf, sizeof(buf)) == 7);
+    CHECK(test_read("/t_off/e", buf, sizeof(buf)) == 4);
+    for (int i = 0; i < 200 && off.fetched < 4; i++)
+        usleep(10000);
+    CHECK(off.fetched == 4);
+
+    /* 백엔드가 내려감: 사본으로 */
+    stop(srv);
+    CHECK(traced_getattr("/t_off/a", &st, NULL) == 0 && st.st_size == 5);
+    CHECK(off.state == OFF_OFFLINE && off.downs == 1);
+    CHECK(test_read("/t_off/a", buf, sizeof(buf)) == 5 && memcmp(buf, "alpha", 5) == 0);
+
+    CHECK(test_write("/t_off/a", "alpha-offline", 13) == 13);
+    CHECK(test_write("/t_off/e", "echo-ours", 9) == 9);
+    CHECK(test_write("/t_off/new", "new file", 8) == 8);
+    CHECK(traced_unlink("/t_off/b") == 0 && traced_getattr("/t_off/b", &st, NULL) == -ENOENT);
+    CHECK(traced_rename("/t_off/c", "/t_off/c2", 0) == 0);
+    CHECK(traced_mkdir("/t_off/d", 0755) == 0);
+    CHECK(test_write("/t_off/d/x", "in d", 4) == 4);
+    CHECK(test_read("/t_off/a", buf, sizeof(buf)) == 13 && memcmp(buf, "alpha-offline", 13) == 0);
+    CHECK(off.nlog > 0 && off.ndirty == 4);
+    CHECK(backend_read("/t_off/a", buf, sizeof(buf)) == 5);
+
+    /* 그사이 다른 곳에서 e를 바꿈 */
+    CHECK(backend_write("/t_off/e", "echo-theirs") == 11);
+
+    /* 다시 연결: 기록을 재생 */
+    srv = serve();
+    CHECK(srv > 0);
+    wait_state(OFF_ONLINE);
+    CHECK(off.state == OFF_ONLINE && off.nlog == 0 && off.ndirty == 0);
+    CHECK(backend_read("/t_off/a", buf, sizeof(buf)) == 13 && memcmp(buf, "alpha-offline", 13) == 0);
+    CHECK(backend_read("/t_off/new", buf, sizeof(buf)) == 8);
+    CHECK(backend_read("/t_off/b", buf, sizeof(buf)) == -ENOENT);
+    CHECK(backend_read("/t_off/c", buf, sizeof(buf)) == -ENOENT);
+    CHECK(backend_read("/t_off/c2", buf, sizeof(buf)) == 7 && memcmp(buf, "charlie", 7) == 0);
+    CHECK(backend_read("/t_off/d/x", buf, sizeof(buf)) == 4);
+
+    /* 충돌: 백엔드 쪽은 그대로, 우리 내용은 옆에 */
+    CHECK(off.conflicts == 1);
+    CHECK(backend_read("/t_off/e", buf, sizeof(buf)) == 11 && memcmp(buf, "echo-theirs", 11) == 0);
+    snprintf(pat, sizeof(pat), "%s/t_off/e.conflict-*", DIR_PATH);
+    CHECK(glob(pat, 0, NULL, &g) == 0 && g.gl_pathc == 1);
+    if (g.gl_pathc == 1)
+        CHECK(backend_read(g.gl_pathv[0] + strlen(DIR_PATH), buf, sizeof(buf)) == 9 &&
+              memcmp(buf, "echo-ours", 9) == 0);
+    globfree(&g);
+    CHECK(test_read("/t_off/e", buf, sizeof(buf)) == 11 && memcmp(buf, "echo-theirs", 11) == 0);
+
+    off_stop();
+    stop(srv);
+    return test_failures;
+}
+
+int main(void)
+{
+    test_init();
+    test_fresh("t_off");
+    CHECK(system("rm -rf " COPIES " && mkdir -p " COPIES) == 0);
+
+    int status = -1;
+    pid_t pid = fork();
+    if (pid == 0)
+        _exit(offline());
+    CHECK(pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status) &&
+          WEXITSTATUS(status) == 0);
+
+    unlink(SOCK);
+    CHECK(system("rm -rf " COPIES) == 0);
+    return test_done("test_offline");
+}
@@ -0,0 +1,174 @@
+/**
+ * test_peer_cache.c - 세 데몬이 블록 캐시를 나눠 갖는 peer_cache
+ *
+ * 이 프로세스와 fork한 자식 둘이 같은 peer 목록으로 뜨고 동시에 같은 파일을
+ * 읽어, 백엔드에서 읽은 블록이 셋을 합쳐 파일의 블록 수와 같은지(블록마다
+ * 주인 한 곳만 읽음) 본다. 파일을 다시 쓰면 모두 새 내용을 읽는지, peer 하나가
+ * 죽으면 그 몫을 오류 없이 직접 읽는지, peer 요청으로 DIR_PATH 밖 경로나 다른
+ * RPC를 부를 수 없는지도 본다.
+ */
+#include "test_util.h"
+
+#define NODES 3
+#define FSIZE (8 << 20)
+#define FILE_PATH "/t_pcache/big"
+
+static const char *const addrs[NODES] = {
+    "unix:/tmp/basic_fuse_test_pc0.sock",
+    "unix:/tmp/basic_fuse_test_pc1.sock",
+    "unix:/tmp/basic_fuse_test_pc2.sock",
+};
+static char ref[FSIZE];
+static int cmd_fd[NODES][2], res_fd[NODES][2];
+
+static void setup(int node)
+{
+    options.peer_cache = addrs[node];
+    options.peer_cache_peers = "unix:/tmp/basic_fuse_test_pc0.sock+"
+                               "unix:/tmp/basic_fuse_test_pc1.sock+"
+                               "unix:/tmp/basic_fuse_test_pc2.sock";
+    options.inline_budget = 0;
+    options.heat_sample = 0;
+    options.peer_cache_retry_ms = 300;
+    if (layers_setup() != 0 || pcache_start() != 0) {
+        printf("peer_cache setup failed\n");
+        exit(1);
+    }
+}
+
+/* 백엔드 파일을 ref로 직접 씀 (어느 노드의 캐시도 거치지 않음) */
+static void rewrite(void)
+{
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s%s", DIR_PATH, FILE_PATH);
+    FILE *f = fopen(path, "w");
+    CHECK(f && fwrite(ref, 1, FSIZE, f) == FSIZE);
+    if (f)
+        fclose(f);
+}
+
+/* 파일 전체를 무작위 크기 read로 읽어 ref와 비교, 틀린 read 수 */
+static void *read_all(void *arg)
+{
+    struct fuse_file_info fi = { .flags = O_RDONLY };
+    char *buf = malloc(200000);
+    long bad = 0;
+
+    (void) arg;
+    if (buf == NULL || traced_open(FILE_PATH, &fi) != 0) {
+        free(buf);
+        return (void *) 1;
+    }
+    for (off_t off = 0; off < FSIZE && !bad;) {
+        int len = rand() % 200000 + 1, want = off + len > FSIZE ? FSIZE - off : len;
+        int res = traced_read(FILE_PATH, buf, len, off, &fi);
+        bad += res != want || memcmp(buf, ref + off, want) != 0;
+        off += res > 0 ? res : 1;
+    }
+    bad += traced_read(FILE_PATH, buf, 10, FSIZE, &fi) != 0;
+    traced_release(FILE_PATH, &fi);
+    free(buf);
+    return (void *) bad;
+}
+
+static long read_parallel(void)
+{
+    pthread_t th[4];
+    long bad = 0;
+    for (int i = 0; i < 4; i++)
+        pthread_create(&th[i], NULL, read_all, NULL);
+    for (int i = 0; i < 4; i++) {
+        void *res;
+        pthread_join(th[i], &res);
+        bad += (long) res;
+    }
+    return bad;
+}
+
+/* 자식 노드: 'r'이면 백엔드 파일을 ref로 다시 읽고 모두 읽음. 답은 {loads, bad} */
+static void node(int i)
+{
+    char c;
+    setup(i);
+    while (read(cmd_fd[i][0], &c, 1) == 1) {
+        unsigned long long out[2] = { 0, 0 };
+        if (c == 'r') {
+            char path[PATH_MAX];
+            snprintf(path, sizeof(path), "%s%s", DIR_PATH, FILE_PATH);
+            FILE *f = fopen(path, "r");
+            out[1] = f == NULL || fread(ref, 1, FSIZE, f) != FSIZE;
+            if (f)
+                fclose(f);
+            out[1] += read_parallel();
+        }
+        out[0] = pcache.loads;
+        if (write(res_fd[i][1], out, sizeof(out)) != sizeof(out))
+            break;
+    }
+    _exit(0);
+}
+
+int main(void)
+{
+    unsigned long long out[2];
+    pid_t pid[NODES];
+
+    test_init();
+    test_fresh("t_pcache");
+    srand(1);
+    for (int i = 0; i < FSIZE; i++)
+        ref[i] = rand();
+    rewrite();
+    for (int i = 1; i < NODES; i++) {
+        CHECK(pipe(cmd_fd[i]) == 0 && pipe(res_fd[i]) == 0);
+        if ((pid[i] = fork()) == 0)
+            node(i);
+    }
+    setup(0);
+    usleep(200000);
+
+    /* 셋이 동시에 읽어도 블록마다 백엔드 read는 한 번 */
+    for (int i = 1; i < NODES; i++)
+        CHECK(write(cmd_fd[i][1], "r", 1) == 1);
+    CHECK(read_parallel() == 0);
+    unsigned long long loads = pcache.loads;
+    for (int i = 1; i < NODES; i++) {
+        CHECK(read(res_fd[i][0], out, sizeof(out)) == sizeof(out) && out[1] == 0);
+        loads += out[0];
+    }
+    CHECK(loads == FSIZE / options.peer_cache_block);
+
+    /* 다시 쓰면 validator가 바뀌어 새 내용 */
+    for (int i = 0; i < FSIZE; i += 4096)
+        ref[i] ^= 0x5a;
+    usleep(20000);
+    rewrite();
+    CHECK(read_parallel() == 0);
+    CHECK(write(cmd_fd[1][1], "r", 1) == 1);
+    CHECK(read(res_fd[1][0], out, sizeof(out)) == sizeof(out) && out[1] == 0);
+
+    /* 죽은 peer의 몫은 직접 읽음 */
+    kill(pid[2], SIGKILL);
+    waitpid(pid[2], NULL, 0);
+    for (int i = 0; i < FSIZE; i += 4096)
+        ref[i] ^= 0x33;
+    usleep(20000);
+    rewrite();
+    CHECK(read_parallel() == 0);
+    CHECK(pcache.peer_errors > 0);
+
+    /* peer 요청으로는 DIR_PATH 밖 경로도, peer RPC가 아닌 연산도 안 됨 */
+    char d[16];
+    unsigned int gen = 0;
+    struct rpc_req escape = { .op = RPC_PEER_GET, .path = "/../etc/passwd", .out = d,
+                              .outcap = sizeof(d) };
+    CHECK(rpc_call(&pcache.peer[0].conn, &gen, &escape) == -EPERM);
+    struct rpc_req other = { .op = RPC_LSTAT, .path = FILE_PATH, .out = d, .outcap = sizeof(d) };
+    gen = 0;
+    CHECK(rpc_call(&pcache.peer[0].conn, &gen, &other) == -EPERM);
+
+    kill(pid[1], SIGKILL);
+    waitpid(pid[1], NULL, 0);
+    pcache_clear();
+    return test_done("test_peer_cache");
+}
@@ -0,0 +1,173 @@
+/**
+ * test_remote.c - remote layer와 remote_serve 데몬을 unix socket으로 연결해 확인
+ *
+ * fork한 자식이 remote_serve로 DIR_PATH를 제공하고, 이쪽은 remote=unix:...로
+ * 붙어 여러 스레드가 동시에 쓰고 읽어 요청이 연결 하나에 몰려 나가는지
+ * (메시지보다 write 호출이 적은지), 여러 메시지로 나뉘는 큰 readdir, 그 밖의
+ * 연산과 DIR_PATH 밖 경로 거부를 본다. 끝으로 서버를 죽였다 다시 띄워 그 전에
+ * 열린 핸들은 오류(끊긴 동안 ECONNRESET, 다시 연결된 뒤 ENOTCONN), 새 연산은 다시
+ * 연결해 성공하는지 본다.
+ */
+#include "test_util.h"
+
+#define SOCK "/tmp/basic_fuse_test_remote.sock"
+#define ADDR "unix:" SOCK
+#define THREADS 16
+#define FSIZE (4 << 20)
+#define MANY 3000
+
+static char ref[FSIZE];
+static int names;
+
+static int count(void *buf, const char *name, const struct stat *st, off_t off,
+                 enum fuse_fill_dir_flags flags)
+{
+    (void) buf, (void) off, (void) flags;
+    if (name[0] != '.' && st->st_mode)
+        names++;
+    return 0;
+}
+
+/* 서버 자식을 띄우고 socket이 연결을 받을 때까지 기다림 */
+static pid_t serve(void)
+{
+    struct sockaddr_un sa = { .sun_family = AF_UNIX };
+    unlink(SOCK);
+    pid_t pid = fork();
+    if (pid == 0) {
+        options.remote_threads = 8;
+        remote_serve(ADDR);
+        _exit(1);
+    }
+    strcpy(sa.sun_path, SOCK);
+    for (int i = 0; pid > 0 && i < 200; i++) {
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        int ok = connect(fd, (struct sockaddr *) &sa, sizeof(sa)) == 0;
+        close(fd);
+        if (ok)
+            return pid;
+        usleep(10000);
+    }
+    return -1;
+}
+
+static void stop(pid_t pid)
+{
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+}
+
+static void *worker(void *arg)
+{
+    struct fuse_file_info fi = { .flags = O_WRONLY };
+    char path[32], buf[65536];
+    long bad = 0;
+
+    snprintf(path, sizeof(path), "/t_remote/t%ld", (long) arg);
+    if (traced_create(path, 0644, &fi) != 0)
+        return (void *) 1;
+    for (int off = 0; off < FSIZE && !bad; off += sizeof(buf))
+        bad += traced_write(path, ref + off, sizeof(buf), off, &fi) != sizeof(buf);
+    traced_release(path, &fi);
+
+    fi.flags = O_RDONLY;
+    if (bad || traced_open(path, &fi) != 0)
+        return (void *) 1;
+    for (int i = 0; i < 300 && !bad; i++) {
+        int off = rand() % FSIZE, len = rand() % sizeof(buf) + 1;
+        int want = off + len > FSIZE ? FSIZE - off : len;
+        struct stat st;
+        bad += traced_read(path, buf, len, off, &fi) != want || memcmp(buf, ref + off, want) != 0;
+        bad += traced_getattr(path, &st, NULL) != 0 || st.st_size != FSIZE;
+    }
+    traced_release(path, &fi);
+    return (void *) bad;
+}
+
+int main(void)
+{
+    struct fuse_file_info fi = { .flags = O_RDONLY };
+    struct stat st;
+    char buf[16];
+
+    test_init();
+    test_fresh("t_remote");
+    pid_t srv = serve();
+    CHECK(srv > 0);
+    options.remote = ADDR;
+    options.remote_conns = 2;
+    options.inline_budget = 0;
+    if (srv < 0 || layers_setup() != 0)
+        return 1;
+    for (int i = 0; i < FSIZE; i++)
+        ref[i] = rand();
+
+    CHECK(traced_getattr("/t_remote/d", &st, NULL) == -ENOENT);
+    CHECK(traced_mkdir("/t_remote/d", 0755) == 0);
+    CHECK(traced_getattr("/t_remote/d", &st, NULL) == 0 && S_ISDIR(st.st_mode));
+    CHECK(traced_getattr("/../etc/passwd", &st, NULL) == -EPERM);
+    CHECK(traced_rename("/t_remote/d", "/../x", 0) == -EPERM);
+
+    /* 동시 요청은 연결마다 모아서 씀 */
+    pthread_t th[THREADS];
+    for (long i = 0; i < THREADS; i++)
+        pthread_create(&th[i], NULL, worker, (void *) i);
+    for (int i = 0; i < THREADS; i++) {
+        void *bad;
+        pthread_join(th[i], &bad);
+        CHECK(bad == NULL);
+    }
+    CHECK(remote.frames > remote.writes);
+
+    /* 여러 메시지로 나뉘는 목록 */
+    for (int i = 0; i < MANY; i++) {
+        char path[96];
+        snprintf(path, sizeof(path), "/t_remote/d/a_rather_long_file_name_%05d", i);
+        fi.flags = O_WRONLY;
+        CHECK(traced_create(path, 0600, &fi) == 0);
+        traced_release(path, &fi);
+    }
+    unsigned long long msgs = remote.calls[RPC_READDIR];
+    names = 0;
+    CHECK(traced_readdir("/t_remote/d", NULL, count, 0, NULL, 0) == 0 && names == MANY);
+    CHECK(remote.calls[RPC_READDIR] - msgs > 1);
+
+    CHECK(traced_chmod("/t_remote/t0", 0600, NULL) == 0);
+    CHECK(traced_getattr("/t_remote/t0", &st, NULL) == 0 && (st.st_mode & 0777) == 0600);
+    CHECK(traced_truncate("/t_remote/t0", 100, NULL) == 0);
+    CHECK(traced_getattr("/t_remote/t0", &st, NULL) == 0 && st.st_size == 100);
+    struct timespec ts[2] = { { 1000, 5 }, { 2000, 7 } };
+    CHECK(traced_utimens("/t_remote/t0", ts, NULL) == 0);
+    CHECK(traced_getattr("/t_remote/t0", &st, NULL) == 0 && st.st_mtim.tv_sec == 2000 &&
+          st.st_mtim.tv_nsec == 7);
+    CHECK(traced_rename("/t_remote/t0", "/t_remote/u0", 0) == 0);
+    CHECK(traced_getattr("/t_remote/t0", &st, NULL) == -ENOENT);
+    CHECK(traced_unlink("/t_remote/u0") == 0 && traced_unlink("/t_remote/u0") == -ENOENT);
+    CHECK(traced_rmdir("/t_remote/d") == -ENOTEMPTY);
+    CHECK(traced_opendir("/t_remote/t1", &fi) == -ENOTDIR);
+
+    /* 서버 재시작: 열려 있던 핸들은 오류, 새 연산은 다시 연결 */
+    fi.flags = O_RDONLY;
+    CHECK(traced_open("/t_remote/t3", &fi) == 0);
+    stop(srv);
+    CHECK(traced_read("/t_remote/t3", buf, sizeof(buf), 0, &fi) == -ECONNRESET);
+    srv = serve();
+    CHECK(srv > 0);
+    /* 경로 연산으로 두 연결을 다시 맺은 뒤에도 옛 핸들은 안 됨 */
+    for (int i = 1; i < THREADS; i++) {
+        char path[32];
+        snprintf(path, sizeof(path), "/t_remote/t%d", i);
+        CHECK(traced_getattr(path, &st, NULL) == 0 && st.st_size == FSIZE);
+    }
+    CHECK(traced_read("/t_remote/t3", buf, sizeof(buf), 0, &fi) == -ENOTCONN);
+    traced_release("/t_remote/t3", &fi);
+    CHECK(traced_open("/t_remote/t3", &fi) == 0);
+    CHECK(traced_read("/t_remote/t3", buf, sizeof(buf), 0, &fi) == sizeof(buf) &&
+          memcmp(buf, ref, sizeof(buf)) == 0);
+    traced_release("/t_remote/t3", &fi);
+
+    if (srv > 0)
+        stop(srv);
+    unlink(SOCK);
+    return test_done("test_remote");
+}
@@ -0,0 +1,214 @@
+/**
+ * test_s3.c - s3 layer를 로컬 S3 호환 서버(s3_standin.py)에 붙여 확인
+ *
+ * 서버를 빈 포트로 띄우고 SigV4 키로 마운트해서 multipart upload(part 5 MiB)로
+ * 쓴 큰 파일의 순차/무작위 read, 작은 파일의 제자리 수정과 truncate, LIST
+ * 페이지를 넘는 readdir, 명시하지 않은 디렉토리, rename/unlink/rmdir을 본다.
+ * 틀린 키로 마운트하면 EACCES인지도 본다. python3이 없으면 건너뛴다.
+ */
+#include "test_util.h"
+
+#define KEY "AKIDTEST:test-secret"
+#define KEY_FILE "/tmp/basic_fuse_test_s3.key"
+#define BAD_KEY_FILE "/tmp/basic_fuse_test_s3.badkey"
+#define BIG (12 << 20)
+#define LISTED 1001             /* LIST 한 페이지(1000)를 넘김 */
+
+static char url[64];
+static char ref[BIG], got[BIG];
+static int names;
+
+static int count(void *buf, const char *name, const struct stat *st, off_t off,
+                 enum fuse_fill_dir_flags flags)
+{
+    (void) buf, (void) st, (void) off, (void) flags;
+    if (name[0] != '.')
+        names++;
+    return 0;
+}
+
+static void key_file(const char *path, const char *key)
+{
+    FILE *f = fopen(path, "w");
+    CHECK(f && fputs(key, f) >= 0);
+    if (f)
+        fclose(f);
+}
+
+/* s3_standin.py를 빈 포트로 띄우고 "port N" 줄에서 포트를 얻음 */
+static pid_t serve(void)
+{
+    int p[2], port = 0;
+    char line[32] = "";
+
+    if (pipe(p) == -1)
+        return -1;
+    pid_t pid = fork();
+    if (pid == 0) {
+        dup2(p[1], STDOUT_FILENO);
+        close(p[0]);
+        execlp("python3", "python3", "s3_standin.py", "0", KEY, (char *) NULL);
+        _exit(127);
+    }
+    close(p[1]);
+    size_t len = 0;
+    for (ssize_t n; pid > 0 && len < sizeof(line) - 1 && !strchr(line, '\n'); len += n)
+        if ((n = read(p[0], line + len, sizeof(line) - 1 - len)) <= 0)
+            break;
+    close(p[0]);
+    if (sscanf(line, "port %d", &port) != 1) {
+        if (pid > 0)
+            waitpid(pid, NULL, 0);
+        return -1;
+    }
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d/bucket", port);
+    return pid;
+}
+
+static int mounted(int (*fn)(void), const char *key)
+{
+    int status = -1;
+    pid_t pid = fork();
+    if (pid == 0) {
+        options.s3 = url;
+        options.s3_key = key;
+        options.s3_threads = 4;
+        options.s3_part = 5 << 20;
+        options.inline_budget = 0;
+        _exit(fn());
+    }
+    return pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status)
+           ? WEXITSTATUS(status) : -1;
+}
+
+static int write_at(const char *path, const char *buf, size_t len, off_t off)
+{
+    struct fuse_file_info fi = { .flags = O_RDWR };
+    int res = traced_open(path, &fi);
+    if (res)
+        return res;
+    res = traced_write(path, buf, len, off, &fi);
+    traced_release(path, &fi);
+    return res;
+}
+
+/* 한 바이트짜리 객체를 layer를 거치지 않고 PUT */
+static int put(const char *key)
+{
+    struct s3_req rq = { .kind = S3_PUT, .method = "PUT", .key = key, .body = "z", .blen = 1 };
+    int err = s3_call(&rq);
+    s3_req_free(&rq);
+    return err;
+}
+
+static int bucket(void)
+{
+    struct fuse_file_info fi = { .flags = O_RDONLY };
+    struct stat st;
+    char buf[32];
+
+    if (layers_setup() != 0)
+        return 1;
+    hpool_start(options.s3_threads - 1);
+
+    CHECK(traced_getattr("/d", &st, NULL) == -ENOENT);
+    CHECK(traced_mkdir("/d", 0755) == 0);
+    CHECK(traced_getattr("/d", &st, NULL) == 0 && S_ISDIR(st.st_mode));
+
+    /* 큰 파일: part 셋의 multipart upload */
+    CHECK(test_write("/d/big", ref, BIG) == BIG);
+    CHECK(s3.uploads == 1 && s3.reqs[S3_PART] == 5);     /* 시작, part 셋, 완료 */
+    s3_attr_clear();
+    CHECK(traced_getattr("/d/big", &st, NULL) == 0 && st.st_size == BIG);
+    CHECK(test_read("/d/big", got, BIG) == BIG && memcmp(got, ref, BIG) == 0);
+    CHECK(traced_open("/d/big", &fi) == 0);
+    for (int i = 0; i < 100; i++) {
+        size_t off = rand() % BIG, len = rand() % 300000 + 1;
+        int want = off + len > BIG ? BIG - off : len;
+        int res = traced_read("/d/big", got, len, off, &fi);
+        CHECK(res == want && memcmp(got, ref + off, want) == 0);
+        if (res != want)
+            break;
+    }
+    traced_release("/d/big", &fi);
+
+    /* 작은 파일: 제자리 수정, 늘이기, 줄이기 */
+    CHECK(test_write("/d/s", "hello world", 11) == 11);
+    CHECK(write_at("/d/s", "W", 1, 6) == 1);
+    CHECK(write_at("/d/s", "!!", 2, 11) == 2);
+    s3_attr_clear();
+    CHECK(test_read("/d/s", buf, sizeof(buf)) == 13 && memcmp(buf, "hello World!!", 13) == 0);
+    CHECK(traced_truncate("/d/s", 5, NULL) == 0);
+    CHECK(traced_truncate("/d/s", 8, NULL) == 0);
+    s3_attr_clear();
+    CHECK(test_read("/d/s", buf, sizeof(buf)) == 8 && memcmp(buf, "hello\0\0\0", 8) == 0);
+
+    /* LIST 페이지를 넘는 디렉토리 (객체는 바로 PUT) */
+    CHECK(traced_mkdir("/m", 0755) == 0);
+    for (int i = 0; i < LISTED; i++) {
+        char key[32];
+        snprintf(key, sizeof(key), "m/f%04d", i);
+        CHECK(put(key) == 0);
+    }
+    CHECK(traced_mkdir("/m/sub", 0755) == 0);
+    CHECK(test_write("/m/sub/deep", "y", 1) == 1);
+    unsigned long long lists = s3.reqs[S3_LIST];
+    names = 0;
+    CHECK(traced_readdir("/m", NULL, count, 0, NULL, 0) == 0 && names == LISTED + 1);
+    CHECK(s3.reqs[S3_LIST] - lists >= 2);
+
+    /* 디렉토리 객체 없이 키만 있는 경로 */
+    CHECK(put("imp/x/y") == 0);
+    CHECK(traced_getattr("/imp/x", &st, NULL) == 0 && S_ISDIR(st.st_mode));
+    CHECK(traced_getattr("/imp/x/y", &st, NULL) == 0 && st.st_size == 1);
+
+    CHECK(traced_rename("/d/s", "/d/t", 0) == 0);
+    CHECK(traced_getattr("/d/s", &st, NULL) == -ENOENT);
+    CHECK(traced_getattr("/d/t", &st, NULL) == 0 && st.st_size == 8);
+    CHECK(traced_rename("/m", "/n", 0) == -EXDEV);
+    CHECK(traced_rmdir("/d") == -ENOTEMPTY);
+    CHECK(traced_unlink("/d/t") == 0 && traced_unlink("/d/big") == 0);
+    CHECK(traced_unlink("/d/big") == -ENOENT);
+    CHECK(traced_rmdir("/d") == 0);
+    s3_attr_clear();
+    CHECK(traced_getattr("/d", &st, NULL) == -ENOENT);
+
+    hpool_stop();
+    s3_conn_drain();
+    s3_attr_clear();
+    return test_failures;
+}
+
+static int bad_key(void)
+{
+    struct stat st;
+    if (layers_setup() != 0)
+        return 1;
+    CHECK(traced_getattr("/imp/x/y", &st, NULL) == -EACCES);
+    s3_conn_drain();
+    return test_failures;
+}
+
+int main(void)
+{
+    test_init();
+    pid_t srv = serve();
+    if (srv < 0) {
+        printf("test_s3: skipped (cannot start python3 s3_standin.py)\n");
+        return 0;
+    }
+    key_file(KEY_FILE, KEY);
+    key_file(BAD_KEY_FILE, "AKIDTEST:wrong-secret");
+    srand(7);
+    for (int i = 0; i < BIG; i++)
+        ref[i] = rand();
+
+    CHECK(mounted(bucket, KEY_FILE) == 0);
+    CHECK(mounted(bad_key, BAD_KEY_FILE) == 0);
+
+    kill(srv, SIGTERM);
+    waitpid(srv, NULL, 0);
+    unlink(KEY_FILE);
+    unlink(BAD_KEY_FILE);
+    return test_done("test_s3");
+}
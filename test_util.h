@@ -0,0 +1,105 @@
+/**
+ * test_util.h - basic_fuse.c 테스트/벤치마크 드라이버 공용
+ *
+ * 드라이버는 basic_fuse.c를 그대로 포함해 마운트 없이 traced_* 핸들러를 직접
+ * 호출한다 (FUSE 커널 모듈이나 root 권한 불필요). 백엔드는 DIR_PATH
+ * (/tmp/fuse_data) 아래 드라이버마다 다른 하위 디렉토리를 쓴다.
+ * 빌드와 실행은 run_tests.sh 참고.
+ */
+#ifndef BASIC_FUSE_TEST_UTIL_H
+#define BASIC_FUSE_TEST_UTIL_H
+
+#define main basic_main
+#include "basic_fuse.c"
+#undef main
+
+#include <signal.h>
+#include <sys/wait.h>
+
+static int test_failures;
+
+#define CHECK(c) do {                                                   \
+        if (!(c)) {                                                     \
+            printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #c);         \
+            test_failures++;                                            \
+        }                                                               \
+    } while (0)
+
+/* 요청 밖에서 호출하므로 fuse_get_context()를 부르는 경로(slow log)는 끔 */
+static void test_init(void)
+{
+    setvbuf(stdout, NULL, _IONBF, 0);
+    options.slow_us = 0;
+    mkdir(DIR_PATH, 0755);
+}
+
+static int test_done(const char *name)
+{
+    printf("%s: %s (%d failures)\n", name, test_failures ? "FAILED" : "ok", test_failures);
+    return test_failures ? 1 : 0;
+}
+
+/* 백엔드 디렉토리 DIR_PATH/sub를 비워서 다시 만듦 */
+static inline void test_fresh(const char *sub)
+{
+    char cmd[PATH_MAX + 64];
+    snprintf(cmd, sizeof(cmd), "rm -rf '%s/%s' && mkdir -p '%s/%s'", DIR_PATH, sub, DIR_PATH, sub);
+    if (system(cmd) != 0)
+        printf("warning: %s failed\n", cmd);
+}
+
+/* 커널처럼 lookup 후 open, 없으면 create */
+static inline int test_write(const char *path, const void *data, size_t len)
+{
+    struct fuse_file_info fi = { .flags = O_WRONLY | O_TRUNC };
+    struct stat st;
+    int res = traced_getattr(path, &st, NULL) == -ENOENT ? -ENOENT : traced_open(path, &fi);
+
+    if (res == -ENOENT) {
+        fi.flags = O_WRONLY;
+        res = traced_create(path, 0644, &fi);
+    }
+    if (res)
+        return res;
+    for (size_t off = 0; off < len; ) {
+        size_t n = len - off < 128 * 1024 ? len - off : 128 * 1024;
+        res = traced_write(path, (const char *) data + off, n, off, &fi);
+        if (res <= 0) {
+            traced_release(path, &fi);
+            return res < 0 ? res : -EIO;
+        }
+        off += res;
+    }
+    traced_release(path, &fi);
+    return (int) len;
+}
+
+/* 최대 len바이트를 읽어 읽은 크기를 돌려줌 */
+static inline int test_read(const char *path, void *buf, size_t len)
+{
+    struct fuse_file_info fi = { .flags = O_RDONLY };
+    int res = traced_open(path, &fi);
+    size_t off = 0;
+
+    if (res)
+        return res;
+    while (off < len) {
+        size_t n = len - off < 128 * 1024 ? len - off : 128 * 1024;
+        res = traced_read(path, (char *) buf + off, n, off, &fi);
+        if (res <= 0)
+            break;
+        off += res;
+    }
+    traced_release(path, &fi);
+    return res < 0 ? res : (int) off;
+}
+
+/* 통계 파일 전체를 buf에 (NUL로 끝남) */
+static inline int test_stats(char *buf, size_t len)
+{
+    int n = test_read(STATS_PATH, buf, len - 1);
+    buf[n > 0 ? n : 0] = '\0';
+    return n;
+}
+
+#endif
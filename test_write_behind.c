@@ -0,0 +1,150 @@
+/**
+ * test_write_behind.c - write-behind journal의 응답, 재시작 복구, fsync
+ *
+ * uploader가 오래 기다리게 해 두고 쓰면 write가 journal에만 있는 채로 응답하고
+ * 이 데몬의 read/getattr에는 바로 보이는지, unlink한 파일의 write는 버려지고
+ * truncate 앞의 write는 먼저 올라가는지 본다. 그 자식을 올리기 전에 끝내고(끝이
+ * 잘린 기록도 하나 붙여) 다시 띄우면 journal을 읽어 남은 write만 올리는지,
+ * fsync가 write_behind_sync=local이면 journal만으로, backend면 백엔드에 올라간
+ * 뒤에 끝나는지 본다. 레이어 스택은 한 번만 만들 수 있어 마운트마다 fork한
+ * 자식에서 돌린다.
+ */
+#include "test_util.h"
+
+#define JOURNAL "/tmp/basic_fuse_test_wb"
+
+/* 백엔드 파일을 직접 읽음 (없으면 -ENOENT) */
+static int backend_read(const char *path, char *buf, size_t len)
+{
+    char fpath[PATH_MAX];
+    snprintf(fpath, sizeof(fpath), "%s%s", DIR_PATH, path);
+    int fd = open(fpath, O_RDONLY);
+    if (fd == -1)
+        return -errno;
+    int n = read(fd, buf, len);
+    close(fd);
+    return n;
+}
+
+/* 마운트마다 자식 하나: fn의 실패 수를 종료 코드로 */
+static int mounted(int (*fn)(void), const char *sync, unsigned int delay_ms)
+{
+    int status = -1;
+    pid_t pid = fork();
+    if (pid == 0) {
+        options.write_behind = JOURNAL;
+        options.write_behind_sync = sync;
+        options.write_behind_delay_ms = delay_ms;
+        options.inline_budget = 0;
+        options.heat_sample = 0;
+        if (layers_setup() != 0)
+            _exit(1);
+        _exit(fn());
+    }
+    return pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status)
+           ? WEXITSTATUS(status) : -1;
+}
+
+/* 올리기 전: journal에만 있어도 보임. 끝나면 올리지 않고 나감 (crash) */
+static int before_crash(void)
+{
+    struct stat st;
+    char buf[32];
+
+    CHECK(wb_start() == 0);
+    CHECK(test_write("/t_wb/a", "journaled", 9) == 9);
+    CHECK(backend_read("/t_wb/a", buf, sizeof(buf)) == 0);
+    CHECK(wb.pending == 9 && wb.writes == 1 && wb.syncs >= 1);
+    CHECK(traced_getattr("/t_wb/a", &st, NULL) == 0 && st.st_size == 9);
+    CHECK(test_read("/t_wb/a", buf, sizeof(buf)) == 9 && memcmp(buf, "journaled", 9) == 0);
+
+    /* unlink: 그 write는 버리고 DROP을 남김 */
+    CHECK(test_write("/t_wb/gone", "gone", 4) == 4);
+    CHECK(traced_unlink("/t_wb/gone") == 0);
+    CHECK(wb.pending == 9);
+
+    /* truncate 앞에서는 먼저 올림 */
+    CHECK(test_write("/t_wb/t", "truncated", 9) == 9);
+    CHECK(traced_truncate("/t_wb/t", 5, NULL) == 0);
+    CHECK(backend_read("/t_wb/t", buf, sizeof(buf)) == 5 && memcmp(buf, "trunc", 5) == 0);
+    CHECK(wb.pending == 9 && wb.flushes >= 1);
+
+    /* 같은 경로가 다시 생김: 앞의 DROP이 이것까지 지우면 안 됨 */
+    CHECK(test_write("/t_wb/gone", "back", 4) == 4);
+    return test_failures;
+}
+
+/* 재시작: journal의 write가 다시 보이고 uploader가 올림 */
+static int after_crash(void)
+{
+    char buf[32];
+
+    CHECK(wb.recovered == 2 && wb.pending == 13);
+    CHECK(test_read("/t_wb/a", buf, sizeof(buf)) == 9 && memcmp(buf, "journaled", 9) == 0);
+    CHECK(test_read("/t_wb/gone", buf, sizeof(buf)) == 4 && memcmp(buf, "back", 4) == 0);
+    CHECK(wb_start() == 0);
+    for (int i = 0; i < 500 && __atomic_load_n(&wb.pending, __ATOMIC_RELAXED); i++)
+        usleep(10000);
+    CHECK(wb.pending == 0);
+    CHECK(backend_read("/t_wb/a", buf, sizeof(buf)) == 9 && memcmp(buf, "journaled", 9) == 0);
+    CHECK(backend_read("/t_wb/gone", buf, sizeof(buf)) == 4 && memcmp(buf, "back", 4) == 0);
+    CHECK(backend_read("/t_wb/t", buf, sizeof(buf)) == 5);
+    wb_stop();
+    return test_failures;
+}
+
+/* fsync한 파일이 백엔드에 있는지를 돌려줌 */
+static int fsync_uploads(void)
+{
+    struct fuse_file_info fi = { .flags = O_WRONLY };
+    char buf[32];
+
+    if (wb_start() != 0 || traced_create("/t_wb/f", 0644, &fi) != 0)
+        return -1;
+    int ok = traced_write("/t_wb/f", "synced", 6, 0, &fi) == 6 &&
+             traced_fsync("/t_wb/f", 1, &fi) == 0;
+    int up = backend_read("/t_wb/f", buf, sizeof(buf)) == 6 && memcmp(buf, "synced", 6) == 0;
+    traced_release("/t_wb/f", &fi);
+    wb_stop();
+    return ok ? up : -1;
+}
+
+static int fsync_local(void)
+{
+    CHECK(fsync_uploads() == 0);
+    CHECK(wb.pending == 0);     /* wb_stop이 올림 */
+    return test_failures;
+}
+
+static int fsync_backend(void)
+{
+    CHECK(wb.backend_sync && fsync_uploads() == 1);
+    return test_failures;
+}
+
+/* 가장 새 segment 끝에 잘린 기록을 붙임 */
+static void torn_tail(void)
+{
+    char cmd[256];
+    snprintf(cmd, sizeof(cmd), "f=$(ls %s/wb.*.log | tail -n 1) && printf 'jbwb' >> \"$f\"",
+             JOURNAL);
+    CHECK(system(cmd) == 0);
+}
+
+int main(void)
+{
+    test_init();
+    test_fresh("t_wb");
+    CHECK(system("rm -rf " JOURNAL " && mkdir -p " JOURNAL) == 0);
+
+    CHECK(mounted(before_crash, NULL, 60000) == 0);
+    torn_tail();
+    CHECK(mounted(after_crash, NULL, 50) == 0);
+
+    /* uploader가 기다리는 동안의 fsync */
+    CHECK(mounted(fsync_local, "local", 60000) == 0);
+    CHECK(mounted(fsync_backend, "backend", 60000) == 0);
+
+    CHECK(system("rm -rf " JOURNAL) == 0);
+    return test_done("test_write_behind");
+}